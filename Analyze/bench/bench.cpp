@@ -0,0 +1,293 @@
+// Analyze benchmarks
+//
+//   make bench
+//   ../Relay/bin/bench generate bench.pcap
+//   ./bin/bench bench.pcap [--seconds S] [-o results.json]
+//
+// Measures the ingest path of readPcapFileToDataManager stage by stage (readSingleMsg, parseCanId,
+// extractUdpMsg) plus DataManager::AddDatapoint, Channel::PrepareData and line protocol formatting,
+// on the UDP payloads of a capture made by the Relay bench generator. The decoded channels are then
+// uploaded with writeToInfluxDBPacked to an in-process MockInfluxDB (see mock_influxdb.hpp), whose
+// request size and latency histograms go into the context. Results are printed as JSON, use -o
+// since parts of the ingest path still print to stdout.
+//
+//   ./bin/bench check-gather
+//
+// Compares the AVX2 column gathers of BatchDecoder against the scalar copies for every row stride and
+// row count a port batch can have, exits with 1 on a mismatch (make check).
+
+#include "ExtractUdpMsg.hpp"
+#include "DataManager.hpp"
+#include "Deserialization.hpp"
+#include "BatchDecoder.hpp"
+#include "IngestStats.hpp"
+#include "InfluxDBClient.hpp"
+#include "bench_util.hpp"
+#include "mock_influxdb.hpp"
+
+#include "pcapplusplus/PcapFileDevice.h"
+#include "pcapplusplus/Packet.h"
+#include "pcapplusplus/UdpLayer.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* const kLogId = "CAN_2024-11-20(142000)";
+
+struct Capture {
+    std::vector<std::vector<uint8_t>>   datagrams;
+    std::vector<CanOverUdpMsg>          frames;         // every record of every datagram, in order
+    uint64_t                            bytes = 0;
+};
+
+bool loadCapture(const std::string& pcap_file_path, Capture& capture) {
+    std::unique_ptr<pcpp::IFileReaderDevice> reader(pcpp::IFileReaderDevice::getReader(pcap_file_path.c_str()));
+    if (!reader || !reader->open()) {
+        std::cerr << "Error opening the pcap file: " << pcap_file_path << std::endl;
+        return false;
+    }
+    pcpp::RawPacket raw_packet;
+    while (reader->getNextPacket(raw_packet)) {
+        pcpp::Packet parsed_packet(&raw_packet, false, pcpp::UDP);
+        pcpp::UdpLayer* udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
+        if (udp_layer == nullptr)
+            continue;
+        const uint8_t* payload = udp_layer->getLayerPayload();
+        std::vector<uint8_t> datagram(payload, payload + udp_layer->getLayerPayloadSize());
+        size_t offset = 0;
+        CanOverUdpMsg msg;
+        while (readSingleMsg(datagram.data(), datagram.size(), offset, msg))
+            capture.frames.push_back(msg);
+        capture.bytes += datagram.size();
+        capture.datagrams.push_back(std::move(datagram));
+    }
+    reader->close();
+    return !capture.frames.empty();
+}
+
+// name of the first reflected field of every port, what AddDatapoint is called with below
+const std::array<const char*, CANARD_SUBJECT_ID_MAX + 1U>& firstFieldNames() {
+    static const auto table = dsdlMakePortTable<const char*>(VcuDsdlTypes{}, [](auto tag) -> const char* {
+        using T = typename decltype(tag)::type;
+        if constexpr (dsdlFieldCount<T>() == 0) {
+            return nullptr;
+        } else {
+            return std::get<0>(DsdlType<T>::fields).name;
+        }
+    });
+    return table;
+}
+
+// Every stride/row count/byte offset combination, on rows of random bytes. Comparing bit patterns,
+// not values, so NaN payloads count too.
+int checkGather() {
+    if (!gatherRowsUseAvx2()) {
+        std::cout << "check-gather: the CPU has no AVX2, only the scalar gather is used" << std::endl;
+        return 0;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    std::vector<uint8_t> rows;
+    std::vector<float> f32_scalar, f32_avx2;
+    std::vector<double> f64_scalar, f64_avx2;
+    size_t failures = 0;
+    size_t cases = 0;
+    for (size_t stride = 8; stride <= 64; stride += 8) {
+        rows.resize(BatchDecoder::kBatchRows * stride + 8);
+        for (uint8_t& byte : rows) {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            byte = static_cast<uint8_t>(state);
+        }
+        for (size_t count = 0; count <= BatchDecoder::kBatchRows; count += (count < 32) ? 1 : 61) {
+            for (size_t offset = 0; offset + sizeof(double) <= stride; ++offset) {
+                const uint8_t* base = rows.data() + offset;
+                f32_scalar.assign(count, 0.0f); f32_avx2.assign(count, 0.0f);
+                f64_scalar.assign(count, 0.0);  f64_avx2.assign(count, 0.0);
+                gatherRowsF32Scalar(base, stride, count, f32_scalar.data());
+                gatherRowsF32Avx2(base, stride, count, f32_avx2.data());
+                gatherRowsF64Scalar(base, stride, count, f64_scalar.data());
+                gatherRowsF64Avx2(base, stride, count, f64_avx2.data());
+                ++cases;
+                if (std::memcmp(f32_scalar.data(), f32_avx2.data(), count * sizeof(float)) != 0 ||
+                    std::memcmp(f64_scalar.data(), f64_avx2.data(), count * sizeof(double)) != 0) {
+                    if (++failures <= 10)
+                        std::cerr << "check-gather: mismatch at stride " << stride << ", " << count << " rows, offset " << offset << std::endl;
+                }
+            }
+        }
+    }
+    std::cout << "check-gather: " << cases - failures << "/" << cases << " cases match" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && std::string(argv[1]) == "check-gather")
+        return checkGather();
+    if (argc < 2) {
+        std::cerr << "usage: bench <in.pcap> [--seconds S] [-o results.json] | bench check-gather\n";
+        return 1;
+    }
+    const std::string pcap_file_path = argv[1];
+    double min_seconds = 1.0;
+    std::string output_path;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--seconds") {
+            min_seconds = std::stod(argv[i + 1]);
+        } else if (option == "-o") {
+            output_path = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    Capture capture;
+    if (!loadCapture(pcap_file_path, capture))
+        return 1;
+    const uint64_t frame_count = capture.frames.size();
+
+    std::vector<BenchResult> results;
+
+    results.push_back(benchRun("analyze.readSingleMsg", frame_count, capture.bytes, min_seconds, [&]() {
+        CanOverUdpMsg msg;
+        for (const auto& datagram : capture.datagrams) {
+            size_t offset = 0;
+            while (readSingleMsg(datagram.data(), datagram.size(), offset, msg))
+                benchDoNotOptimize(msg);
+        }
+    }));
+
+    results.push_back(benchRun("analyze.parseCanId", frame_count, frame_count * sizeof(uint32_t), min_seconds, [&]() {
+        for (const CanOverUdpMsg& msg : capture.frames) {
+            CanIdFields fields = parseCanId(msg.can_id);
+            benchDoNotOptimize(fields);
+        }
+    }));
+
+    // A fresh reader state per iteration, libcanard would otherwise drop the repeated transfer ids
+    DeserializationMap deserialization_map = createDeserializationMap();
+    std::unique_ptr<CanardRxContext> rx_context;
+    std::unique_ptr<DataManager> data_manager;
+    std::unique_ptr<DataManagerSink> sink;
+    std::unique_ptr<BatchDecoder> batch_decoder;
+    std::unique_ptr<IngestCounters> counters;
+    results.push_back(benchRunWithSetup("analyze.extractUdpMsg", frame_count, capture.bytes, min_seconds,
+        [&]() {
+            batch_decoder.reset();
+            sink.reset();
+            rx_context.reset();
+            data_manager = std::make_unique<DataManager>();
+            rx_context = std::make_unique<CanardRxContext>(deserialization_map);
+            sink = std::make_unique<DataManagerSink>(*data_manager, kLogId);
+            batch_decoder = std::make_unique<BatchDecoder>(*data_manager, kLogId);
+            counters = std::make_unique<IngestCounters>();
+        },
+        [&]() {
+            for (const auto& datagram : capture.datagrams) {
+                size_t offset = 0;
+                while (offset < datagram.size()) {
+                    if (!extractUdpMsg(datagram.data(), datagram.size(), offset, *rx_context, *batch_decoder, *sink, *counters))
+                        break;
+                }
+            }
+            batch_decoder->Flush();
+        }));
+    const IngestStats ingest_stats = counters->Snapshot();
+    batch_decoder.reset();
+    sink.reset();
+    rx_context.reset();
+
+    // The string lookup path, one datapoint per frame into the channel of its first field
+    results.push_back(benchRunWithSetup("analyze.AddDatapoint", frame_count, frame_count * (sizeof(double) + sizeof(float)), min_seconds,
+        [&]() {
+            data_manager = std::make_unique<DataManager>();
+        },
+        [&]() {
+            for (const CanOverUdpMsg& msg : capture.frames) {
+                const char* field = firstFieldNames()[parseCanId(msg.can_id).port_id];
+                if (field == nullptr)
+                    continue;
+                data_manager->AddDatapoint<float>(kLogId, "vcu", field, static_cast<double>(msg.timestamp), 1.f);
+            }
+        }));
+
+    // Two sorted runs back to back, what operator+= leaves after merging two files of one log
+    Channel<float> channel(kLogId, "vcu", "INS.vx");
+    results.push_back(benchRunWithSetup("analyze.PrepareData", 2 * frame_count, 2 * frame_count * (sizeof(double) + sizeof(float)), min_seconds,
+        [&]() {
+            channel.m_time.clear();
+            channel.m_value.clear();
+            for (int run = 0; run < 2; ++run) {
+                for (const CanOverUdpMsg& msg : capture.frames) {
+                    channel.m_time.push_back(static_cast<double>(msg.timestamp) + run);
+                    channel.m_value.push_back(static_cast<float>(msg.can_id & 0xFFU));
+                }
+            }
+            channel.m_is_prepared = false;
+        },
+        [&]() {
+            channel.PrepareData();
+        }));
+
+    // bytes here are the line protocol produced, not the capture size
+    channel.PrepareData();
+    const size_t point_count = channel.m_time.size();
+    const long long millis_now = convertLogIdToTimestampMs(kLogId);
+    const uint64_t line_protocol_bytes = channel.FormatLineProtocol(0, point_count, millis_now).size();
+    results.push_back(benchRun("analyze.lineProtocol", point_count, line_protocol_bytes, min_seconds, [&]() {
+        std::string data = channel.FormatLineProtocol(0, point_count, millis_now);
+        benchDoNotOptimize(data);
+    }));
+
+    // End to end through the batch writer, once, the mock counts what arrived
+    nlohmann::json mock_json;
+    {
+        MockInfluxDB mock;
+        std::string error;
+        if (!mock.Start(&error)) {
+            std::cerr << "Could not start the mock InfluxDB: " << error << std::endl;
+            return 1;
+        }
+        data_manager = std::make_unique<DataManager>();
+        for (const CanOverUdpMsg& msg : capture.frames) {
+            const char* field = firstFieldNames()[parseCanId(msg.can_id).port_id];
+            if (field != nullptr)
+                data_manager->AddDatapoint<float>(kLogId, "vcu", field, static_cast<double>(msg.timestamp), 1.f);
+        }
+        InfluxDBClient client("127.0.0.1", std::to_string(mock.Port()), "bench", "bench");
+        const auto start = std::chrono::steady_clock::now();
+        data_manager->writeToInfluxDBPacked(client);
+        client.flush();
+        BenchResult result;
+        result.name = "analyze.influxUpload";
+        result.iterations = 1;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const MockInfluxStats mock_stats = mock.Stats();
+        // lines and line protocol bytes accepted by the mock
+        result.frames = mock_stats.lines;
+        result.bytes = mock_stats.bytes_decoded;
+        std::cerr << result.name << ": " << result.FramesPerSecond() / 1e6 << " Mlines/s, " << result.BytesPerSecond() / 1e6 << " MB/s\n";
+        results.push_back(result);
+        mock_json = mock_stats.ToJson();
+    }
+
+    nlohmann::json context = {
+        {"pcap",            pcap_file_path},
+        {"datagrams",       capture.datagrams.size()},
+        {"frames",          frame_count},
+        {"udp_bytes",       capture.bytes},
+        {"min_seconds",     min_seconds},
+        {"transfers",       ingest_stats.transfers},
+        {"ingest_errors",   ingest_stats.TotalErrors()},
+        {"influx_mock",     mock_json},
+    };
+    return benchWriteJson(benchToJson(results, context), output_path) ? 0 : 1;
+}
@@ -29,7 +29,9 @@
 #include "DataManager.hpp"
 #include "Deserialization.hpp"
 #include "PcapReader.hpp"
+#include "IngestStats.hpp"
 #include "InfluxDBClient.hpp"
+#include "InfluxLoader.hpp"
 
 #define GL_SILENCE_DEPRECATION
 #if defined(IMGUI_IMPL_OPENGL_ES2)
@@ -56,6 +58,7 @@ private:
 	DeserializationMap 			deserialization_map;
 
 	InfluxDBClient  			influxDB_client;
+	UploadWatermarkStore 		upload_watermarks;		// what of the session has been uploaded where, next to its first pcap file
 
 	std::mutex 					pcap_mutex;
 
@@ -170,6 +173,7 @@ private:
 
 		readPcapFile();
 		writeToInfluxDB();
+		loadFromInfluxDB();
 		plotting1();
 
         // 1. Show the big demo window (Most of the sample code is in ImGui::ShowDemoWindow()! You can browse its code to learn more about Dear ImGui!).
@@ -180,7 +184,9 @@ private:
 	void readPcapFile() {
 	    static bool reading_pcap_files = false;
 	    static std::atomic<bool> stop_flag(false);
-	    static std::vector<std::future<void>> futures;
+	    static std::vector<std::future<IngestStats>> futures;
+	    static std::vector<std::shared_ptr<IngestCounters>> futures_counters;    // same order as futures
+	    static IngestStats finished_stats;
 
 	    if (ImGui::Begin("read pcap files", nullptr)) {
 	        // Button to open the file dialog
@@ -197,11 +203,19 @@ private:
 	                reading_pcap_files = true;
 	                stop_flag.store(false);
 	                futures.clear(); // Clear any existing futures
+	                futures_counters.clear();
+	                finished_stats = IngestStats();
+	                // the session's upload watermarks live next to its (first) pcap file
+	                if (!pcap_file_paths.empty() && !upload_watermarks.Open(uploadWatermarkPath(pcap_file_paths.front()))) {
+	                    std::cerr << "could not read " << upload_watermarks.Path() << ", uploading everything again" << std::endl;
+	                }
 	                // Start tasks for each PCAP file
 	                for (const auto& filePath : pcap_file_paths) {
 	                	printf("%s\n", filePath.c_str());
-	                    futures.emplace_back(std::async(std::launch::async, [this, filePath, stop_flag]() mutable {
-	                        readPcapFileToDataManager(filePath, data_manager, deserialization_map, stop_flag);
+	                    std::shared_ptr<IngestCounters> counters = IngestRegistry::instance().Register();
+	                    futures_counters.push_back(counters);
+	                    futures.emplace_back(std::async(std::launch::async, [this, filePath, stop_flag, counters]() mutable {
+	                        IngestStats stats = readPcapFileToDataManager(filePath, data_manager, deserialization_map, stop_flag, *counters);
 	                        
 	                        // Thread-safe removal of the file path
 	                        {
@@ -211,6 +225,7 @@ private:
 	                                pcap_file_paths.erase(it);
 	                            }
 	                        }
+	                        return stats;
 	                    }));
 	                }
 	            }
@@ -223,17 +238,20 @@ private:
 
 	        // Check if all tasks have finished
 	        bool all_tasks_done = true;
-	        for (auto& f : futures) {
+	        for (size_t i = 0; i < futures.size(); ++i) {
+	            auto& f = futures[i];
 	            if (f.valid()) {
 	                auto status = f.wait_for(std::chrono::milliseconds(0));
 	                if (status != std::future_status::ready) {
 	                    all_tasks_done = false;
 	                } else {
 	                    try {
-	                        f.get();
+	                        finished_stats += f.get();
 	                    } catch (const std::exception& e) {
 	                        std::cerr << "Exception in task: " << e.what() << std::endl;
 	                    }
+	                    // not before its stats are in finished_stats, or the totals would miss the file for a frame
+	                    IngestRegistry::instance().Unregister(futures_counters[i]);
 	                }
 	            }
 	        }
@@ -241,9 +259,17 @@ private:
 	        if (all_tasks_done && reading_pcap_files) {
 	            reading_pcap_files = false;
 	            futures.clear(); // Clean up futures
+	            futures_counters.clear();
 	            data_manager.PrintMetadata();
 	        }
 
+	        // Live counters of the files still being read, plus the totals of the ones already done
+	        {
+	            IngestStats stats = finished_stats;
+	            stats += IngestRegistry::instance().Snapshot();
+	            showIngestStats(stats);
+	        }
+
 	        // Handle file dialog and display code...
 	        if (ImGuiFileDialog::Instance()->Display("ChooseFileDlgKey")) {
 	            if (ImGuiFileDialog::Instance()->IsOk()) {
@@ -291,21 +317,290 @@ private:
 	    }
 	}
 
+	void showIngestStats(const IngestStats& stats) {
+	    ImGui::Separator();
+	    ImGui::Text("packets: %lu   udp payloads: %lu   can frames: %lu   transfers: %lu",
+	        static_cast<unsigned long>(stats.packets),
+	        static_cast<unsigned long>(stats.udp_payloads),
+	        static_cast<unsigned long>(stats.can_frames),
+	        static_cast<unsigned long>(stats.transfers));
+	    ImGui::Text("%.1f MB in %.2f s (%.1f MB/s)", stats.udp_bytes / 1e6, stats.elapsed_seconds, stats.BytesPerSecond() / 1e6);
+	    if (stats.TotalErrors() == 0) {
+	        return;
+	    }
+	    if (ImGui::TreeNode("errors", "errors: %lu", static_cast<unsigned long>(stats.TotalErrors()))) {
+	        for (size_t i = 0; i < kIngestErrorCount; ++i) {
+	            if (stats.errors[i] > 0) {
+	                ImGui::BulletText("%s: %lu", IngestErrorName(static_cast<IngestError>(i)), static_cast<unsigned long>(stats.errors[i]));
+	            }
+	        }
+	        if (!stats.port_errors.empty() && ImGui::BeginTable("ingest_port_errors", 4, ImGuiTableFlags_Borders)) {
+	            ImGui::TableSetupColumn("kind");
+	            ImGui::TableSetupColumn("port_id");
+	            ImGui::TableSetupColumn("error");
+	            ImGui::TableSetupColumn("count");
+	            ImGui::TableHeadersRow();
+	            for (const IngestPortErrors& entry : stats.port_errors) {
+	                ImGui::TableNextRow();
+	                ImGui::TableSetColumnIndex(0);
+	                ImGui::Text("%s", TransferKindName(entry.transfer_kind));
+	                ImGui::TableSetColumnIndex(1);
+	                ImGui::Text("%u", static_cast<unsigned>(entry.port_id));
+	                ImGui::TableSetColumnIndex(2);
+	                ImGui::Text("%s", IngestErrorName(entry.error));
+	                ImGui::TableSetColumnIndex(3);
+	                ImGui::Text("%lu", static_cast<unsigned long>(entry.count));
+	            }
+	            ImGui::EndTable();
+	        }
+	        ImGui::TreePop();
+	    }
+	}
+
 	void writeToInfluxDB() {
+		// Batches are encoded on this task and sent by the client's background writer, the GUI thread only polls
+		static std::future<void> encode_future;
+		// one line per timestamp with every field of the series, instead of one line per field
+		static bool pack_fields = true;
+		static float pack_tolerance_us = 0.0f;
+		// shards of one series and time window, uploaded in parallel and retried on their own
+		static bool partition = true;
+		static float shard_duration_s = 60.0f;
+		static int parallel_shards = 4;
+		// skip what earlier exports already uploaded to this bucket
+		static bool incremental = true;
+		// requests are cut by encoded size, whatever the channel mix
+		static int batch_kib = static_cast<int>(LineBatchPolicy().target_bytes / 1024);
+		static std::unique_ptr<InfluxUploadScheduler> scheduler;
+
 		if (ImGui::Begin("write to InfluxDB", nullptr)) {
-			if (ImGui::Button("write to InfluxDB")) {
-				auto channel_ptrs = data_manager.GetCommonMembersChannelPtrs(std::string("CAN_2024-11-20(142000)"));
-				printf("channel_ptrs.size() = %ld\n", channel_ptrs.size());
-				for (auto channel_ptr : channel_ptrs) {
-					channel_ptr->m_car = "Hera";
-					channel_ptr->m_driver = "Balin";
+			bool encoding = encode_future.valid() && encode_future.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready;
+			if (encode_future.valid() && !encoding) {
+				try {
+					encode_future.get();
+				} catch (const std::exception& e) {
+					std::cerr << "Exception in task: " << e.what() << std::endl;
+				}
+				if (scheduler) {
+					for (const std::string& label : scheduler->FailedShards()) {
+						std::cerr << "upload failed: " << label << std::endl;
+					}
 				}
-				data_manager.writeToInfluxDB(influxDB_client);
 			}
+			InfluxWriteProgress progress = influxDB_client.GetProgress();
+			if (!encoding && progress.Idle()) {
+				ImGui::Checkbox("pack fields sharing a timestamp into one line", &pack_fields);
+				if (pack_fields) {
+					ImGui::InputFloat("timestamp tolerance [us]", &pack_tolerance_us, 10.0f, 100.0f, "%.0f");
+					pack_tolerance_us = std::max(pack_tolerance_us, 0.0f);
+				}
+				ImGui::InputInt("batch size [KiB]", &batch_kib, 64, 256);
+				batch_kib = std::clamp(batch_kib, 16, 64 * 1024);
+				ImGui::Checkbox("upload in parallel shards", &partition);
+				if (partition) {
+					ImGui::InputFloat("shard duration [s] (0 = one per series)", &shard_duration_s, 10.0f, 60.0f, "%.0f");
+					ImGui::InputInt("parallel shards", &parallel_shards);
+					shard_duration_s = std::max(shard_duration_s, 0.0f);
+					parallel_shards = std::clamp(parallel_shards, 1, 64);
+					// without a session there is nowhere to keep what was uploaded
+					if (upload_watermarks.Path().empty()) {
+						incremental = false;
+					} else {
+						ImGui::Checkbox("only upload new data", &incremental);
+						ImGui::SameLine();
+						if (ImGui::Button("forget previous uploads")) {
+							upload_watermarks.Clear(influxDB_client.GetDestination("CAN_Car"));
+							upload_watermarks.Save();
+						}
+					}
+				}
+				if (ImGui::Button("write to InfluxDB")) {
+					auto channel_ptrs = data_manager.GetCommonMembersChannelPtrs(std::string("CAN_2024-11-20(142000)"));
+					printf("channel_ptrs.size() = %ld\n", channel_ptrs.size());
+					for (auto channel_ptr : channel_ptrs) {
+						channel_ptr->m_car = "Hera";
+						channel_ptr->m_driver = "Balin";
+					}
+					LineBatchPolicy batching = influxDB_client.GetBatchPolicy();
+					batching.target_bytes = static_cast<size_t>(batch_kib) * 1024;
+					influxDB_client.SetBatchPolicy(batching);
+					if (partition) {
+						UploadSchedulerConfig config;
+						config.parallel_shards = static_cast<size_t>(parallel_shards);
+						scheduler = std::make_unique<InfluxUploadScheduler>(influxDB_client.GetWriter(), "CAN_Car", "ms", config);
+						InfluxExportOptions options;
+						options.packed = pack_fields;
+						options.tolerance_us = pack_tolerance_us;
+						options.shard_duration_us = shard_duration_s * 1e6;
+						options.batching = batching;
+						if (incremental) {
+							options.watermarks = &upload_watermarks;
+							options.destination = influxDB_client.GetDestination("CAN_Car");
+						}
+						encode_future = std::async(std::launch::async, [this, options]() {
+							data_manager.addInfluxShards(*scheduler, options);
+							scheduler->Run();
+							// here rather than in the writer's callbacks, which must not wait for the disk
+							if (options.watermarks && !options.watermarks->Save()) {
+								std::cerr << "could not save " << options.watermarks->Path() << std::endl;
+							}
+						});
+					} else {
+						scheduler.reset();
+						encode_future = std::async(std::launch::async, [this, packed = pack_fields, tolerance_us = pack_tolerance_us]() {
+							if (packed) {
+								data_manager.writeToInfluxDBPacked(influxDB_client, tolerance_us);
+							} else {
+								data_manager.writeToInfluxDB(influxDB_client);
+							}
+						});
+					}
+				}
+			} else {
+				ImGui::TextUnformatted(encoding ? "encoding and uploading..." : "uploading...");
+			}
+			if (scheduler) {
+				showUploadSchedulerProgress(scheduler->Progress());
+			}
+			showInfluxWriteProgress(progress, encoding);
+			showHttpPoolStats(influxDB_client.GetStats());
 			ImGui::End();
 		}	
 	}
 
+	void loadFromInfluxDB() {
+		// the query result is parsed while it streams in, the GUI thread only polls
+		static std::future<InfluxLoadResult> load_future;
+		static InfluxLoadResult last_result;
+		static bool loaded_once = false;
+		static char bucket[64] = "CAN_Car";
+		static char log_id[64] = "CAN_2024-11-20(142000)";
+		static char measure[64] = "";
+		static char fields[256] = "";		// comma separated, empty for every field
+		static char start[64] = "0";
+		static char target_log_id[96] = "";	// empty for "<log_id> (InfluxDB)"
+
+		if (ImGui::Begin("load from InfluxDB", nullptr)) {
+			bool loading = load_future.valid() && load_future.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready;
+			if (load_future.valid() && !loading) {
+				try {
+					last_result = load_future.get();
+				} catch (const std::exception& e) {
+					last_result = InfluxLoadResult();
+					last_result.error = e.what();
+				}
+				loaded_once = true;
+				if (!last_result.ok) {
+					std::cerr << "loading from InfluxDB failed: " << last_result.error << std::endl;
+				}
+			}
+			if (!loading) {
+				ImGui::InputText("bucket", bucket, sizeof(bucket));
+				ImGui::InputText("log_id", log_id, sizeof(log_id));
+				ImGui::InputText("measurement (empty for all)", measure, sizeof(measure));
+				ImGui::InputText("fields (comma separated, empty for all)", fields, sizeof(fields));
+				ImGui::InputText("start", start, sizeof(start));
+				ImGui::InputText("load as log_id", target_log_id, sizeof(target_log_id));
+				if (ImGui::Button("load from InfluxDB")) {
+					FluxQuery query;
+					query.bucket = bucket;
+					query.log_id = log_id;
+					query.measure = measure;
+					query.start = start;
+					std::string field_list = fields;
+					for (size_t begin = 0; begin <= field_list.size(); ) {
+						size_t end = std::min(field_list.find(',', begin), field_list.size());
+						std::string field = field_list.substr(begin, end - begin);
+						field.erase(0, field.find_first_not_of(' '));
+						field.erase(field.find_last_not_of(' ') + 1);
+						if (!field.empty()) {
+							query.fields.push_back(field);
+						}
+						begin = end + 1;
+					}
+					// a separate log_id by default, so loaded channels never mix with the ones read from pcap
+					std::string target = target_log_id[0] ? std::string(target_log_id) : query.log_id + " (InfluxDB)";
+					load_future = std::async(std::launch::async, [this, query, target]() {
+						return loadChannelsFromInfluxDB(influxDB_client, data_manager, query, target);
+					});
+				}
+			} else {
+				ImGui::TextUnformatted("loading...");
+			}
+			if (loaded_once && !loading) {
+				ImGui::Separator();
+				if (last_result.ok) {
+					ImGui::Text("%lu rows into %zu channels, %.1f MB in %.2f s (%lu rows skipped)",
+						static_cast<unsigned long>(last_result.rows), last_result.channels,
+						last_result.bytes / 1e6, last_result.seconds,
+						static_cast<unsigned long>(last_result.rows_skipped));
+				} else {
+					ImGui::TextWrapped("failed: %s", last_result.error.c_str());
+				}
+			}
+			ImGui::End();
+		}
+	}
+
+	void showUploadSchedulerProgress(const UploadSchedulerProgress& progress) {
+		if (progress.shards_total == 0) {
+			return;
+		}
+		ImGui::Separator();
+		ImGui::Text("shards: %zu / %zu done, %zu failed, %zu active, %zu waiting to retry (%lu retries)",
+			progress.shards_done, progress.shards_total, progress.shards_failed,
+			progress.shards_active, progress.shards_retrying,
+			static_cast<unsigned long>(progress.shard_retries));
+	}
+
+	void showInfluxWriteProgress(const InfluxWriteProgress& progress, bool encoding) {
+		if (progress.batches_enqueued == 0) {
+			return;
+		}
+		ImGui::Separator();
+		// the total is only known once encoding is done, until then the bar follows what has been queued
+		float fraction = static_cast<float>(progress.bytes_written + progress.bytes_failed) / static_cast<float>(progress.bytes_enqueued);
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "%s%.1f / %.1f MB", encoding ? ">= " : "", (progress.bytes_written + progress.bytes_failed) / 1e6, progress.bytes_enqueued / 1e6);
+		ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay);
+		ImGui::Text("batches: %lu written, %lu failed, %lu remaining (%lu spilled)   in flight: %zu / %zu   retries: %lu",
+			static_cast<unsigned long>(progress.batches_written),
+			static_cast<unsigned long>(progress.batches_failed),
+			static_cast<unsigned long>(progress.BatchesRemaining()),
+			static_cast<unsigned long>(progress.batches_spilled),
+			progress.in_flight,
+			progress.concurrency_limit,
+			static_cast<unsigned long>(progress.retries));
+		ImGui::Text("%.1f MB remaining, %.1f MB queued in memory, %.1f MB/s",
+			progress.BytesRemaining() / 1e6,
+			progress.bytes_in_memory / 1e6,
+			progress.BytesPerSecond() / 1e6);
+		if (progress.bytes_sent > 0 && progress.bytes_sent != progress.bytes_written) {
+			ImGui::Text("%.1f MB sent, compression %.1fx", progress.bytes_sent / 1e6, static_cast<double>(progress.bytes_written) / progress.bytes_sent);
+		}
+	}
+
+	void showHttpPoolStats(const HttpPoolStats& stats) {
+		if (stats.requests == 0) {
+			return;
+		}
+		ImGui::Separator();
+		ImGui::Text("requests: %lu   2xx: %lu   4xx: %lu   5xx: %lu   transport errors: %lu",
+			static_cast<unsigned long>(stats.requests),
+			static_cast<unsigned long>(stats.responses_2xx),
+			static_cast<unsigned long>(stats.responses_4xx),
+			static_cast<unsigned long>(stats.responses_5xx),
+			static_cast<unsigned long>(stats.transport_errors));
+		ImGui::Text("connections opened: %lu   reused: %lu   %.1f MB sent",
+			static_cast<unsigned long>(stats.connections_opened),
+			static_cast<unsigned long>(stats.connections_reused),
+			stats.request_bytes / 1e6);
+		ImGui::Text("latency mean: %.1f ms   max: %.1f ms", stats.MeanLatencySeconds() * 1e3, stats.latency_max_seconds * 1e3);
+		if (!stats.last_error.empty()) {
+			ImGui::TextWrapped("last error (%u): %s", stats.last_error_status, stats.last_error.c_str());
+		}
+	}
+
 	void plotting1() {
 		if (this->pcap_file_paths.size() == 0) {
 			auto channel_INS_vx = data_manager.GetChannelPtr<float>("CAN_2024-11-20(142000)", "vcu", "INS.vx");
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_DECODER_AVX2_GATHER 1
+#endif
+#include "libcanard/canard.h"
+#include "DataManager.hpp"
+
+#include "vcu_reflection.hpp"
+
+//#define DEBUG
+#include "debug.hpp"
+
+// Columnar decoder for high rate message ports.
+//
+// Instead of running a nunavut _deserialize_ routine per transfer, payloads of the same port_id are
+// gathered into a fixed stride row buffer and decoded column by column once BatchDecoder::kBatchRows
+// rows are buffered (or on Flush). Each column is written straight into its Channel<T> with a single
+// AppendColumn call. Byte aligned float32/float64 fields are copied out of the rows without bit shifting,
+// with AVX2 gathers when the CPU has them (checked at run time, the build does not need -mavx2).
+//
+// Every message type in VcuDsdlTypes is a candidate, with the field names and types from its
+// DsdlType<T> descriptor (vcu_reflection.hpp), so channels match the ones DataManagerSink creates.
+// The wire layout (bit offset and width of each field) is not written by hand: it is derived at
+// construction by probing the generated nunavut serializer, one field at a time. A type whose probed
+// layout does not look like a plain, non-overlapping sequence of scalars, or that has a field stored
+// as another channel type than its member type, is left to the per-transfer path in
+// createDeserializationMap, so a DSDL change can never make the batch path decode garbage.
+
+// Strided column copies: out[i] is the value at base + i * stride. The AVX2 versions are compiled with a
+// target attribute and only called when the CPU reports AVX2, the scalar ones handle the tail rows and
+// every other CPU.
+
+inline void gatherRowsF32Scalar(const uint8_t* base, size_t stride, size_t count, float* out) {
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(out + i, base + i * stride, sizeof(float));
+    }
+}
+
+inline void gatherRowsF64Scalar(const uint8_t* base, size_t stride, size_t count, double* out) {
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(out + i, base + i * stride, sizeof(double));
+    }
+}
+
+#if defined(BATCH_DECODER_AVX2_GATHER)
+__attribute__((target("avx2")))
+inline void gatherRowsF32Avx2(const uint8_t* base, size_t stride, size_t count, float* out) {
+    const int s = static_cast<int>(stride);
+    const __m256i index = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 values = _mm256_i32gather_ps(reinterpret_cast<const float*>(base + i * stride), index, 1);
+        _mm256_storeu_ps(out + i, values);
+    }
+    gatherRowsF32Scalar(base + i * stride, stride, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline void gatherRowsF64Avx2(const uint8_t* base, size_t stride, size_t count, double* out) {
+    const int s = static_cast<int>(stride);
+    const __m128i index = _mm_setr_epi32(0, s, 2 * s, 3 * s);
+    // masked form with a zero source, the unmasked one trips -Wmaybe-uninitialized on GCC 12
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d values = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), reinterpret_cast<const double*>(base + i * stride), index, all, 1);
+        _mm256_storeu_pd(out + i, values);
+    }
+    gatherRowsF64Scalar(base + i * stride, stride, count - i, out + i);
+}
+#endif
+
+inline bool gatherRowsUseAvx2() {
+#if defined(BATCH_DECODER_AVX2_GATHER)
+    static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return supported;
+#else
+    return false;
+#endif
+}
+
+inline void gatherRowsF32(const uint8_t* base, size_t stride, size_t count, float* out) {
+#if defined(BATCH_DECODER_AVX2_GATHER)
+    if (gatherRowsUseAvx2()) {
+        gatherRowsF32Avx2(base, stride, count, out);
+        return;
+    }
+#endif
+    gatherRowsF32Scalar(base, stride, count, out);
+}
+
+inline void gatherRowsF64(const uint8_t* base, size_t stride, size_t count, double* out) {
+#if defined(BATCH_DECODER_AVX2_GATHER)
+    if (gatherRowsUseAvx2()) {
+        gatherRowsF64Avx2(base, stride, count, out);
+        return;
+    }
+#endif
+    gatherRowsF64Scalar(base, stride, count, out);
+}
+
+enum class ColumnKind : uint8_t {
+    U8,
+    U32,
+    Bool,
+    F32,
+    F64,
+};
+
+template <typename T> struct ColumnKindOf;
+template <> struct ColumnKindOf<uint8_t>  { static constexpr ColumnKind kind = ColumnKind::U8; };
+template <> struct ColumnKindOf<uint32_t> { static constexpr ColumnKind kind = ColumnKind::U32; };
+template <> struct ColumnKindOf<bool>     { static constexpr ColumnKind kind = ColumnKind::Bool; };
+template <> struct ColumnKindOf<float>    { static constexpr ColumnKind kind = ColumnKind::F32; };
+template <> struct ColumnKindOf<double>   { static constexpr ColumnKind kind = ColumnKind::F64; };
+
+template <typename T, typename = void>
+struct IsColumnType : std::false_type {};
+template <typename T>
+struct IsColumnType<T, std::void_t<decltype(ColumnKindOf<T>::kind)>> : std::true_type {};
+
+class BatchDecoder {
+public:
+    static constexpr size_t kBatchRows = 1024;
+
+    BatchDecoder(DataManager& data_manager, const std::string& log_id)
+        : m_data_manager(data_manager),
+          m_log_id(log_id)
+    {
+        dsdlForEachType(VcuDsdlTypes{}, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            if (DsdlType<T>::transfer_kind != CanardTransferKindMessage)
+                return;
+            std::unique_ptr<PortBatch> batch = ResolveLayout<T>();
+            if (!batch) {
+                printf("BatchDecoder: port %u falls back to per-transfer deserialization\n", static_cast<unsigned>(DsdlType<T>::port_id));
+                return;
+            }
+            m_ports[DsdlType<T>::port_id] = std::move(batch);
+        });
+    }
+    ~BatchDecoder() {
+        Flush();
+    }
+    BatchDecoder(const BatchDecoder&) = delete;
+    BatchDecoder& operator=(const BatchDecoder&) = delete;
+    BatchDecoder(BatchDecoder&&) = delete;
+    BatchDecoder& operator=(BatchDecoder&&) = delete;
+
+    // Returns false if the port is not batched, in which case the caller deserializes the transfer itself.
+    inline bool Push(const CanardRxTransfer& transfer) {
+        if (transfer.metadata.transfer_kind != CanardTransferKindMessage || transfer.metadata.port_id > CANARD_SUBJECT_ID_MAX)
+            return false;
+        PortBatch* batch = m_ports[transfer.metadata.port_id].get();
+        if (batch == nullptr)
+            return false;
+
+        uint8_t* row = batch->rows.data() + batch->row_count * batch->stride;
+        const size_t copy_size = (transfer.payload_size < batch->stride) ? transfer.payload_size : batch->stride;
+        std::memcpy(row, transfer.payload, copy_size);
+        // DSDL implicit zero extension for truncated payloads
+        std::memset(row + copy_size, 0, batch->stride - copy_size);
+        batch->times[batch->row_count] = static_cast<double>(transfer.timestamp_usec);
+
+        if (++batch->row_count == kBatchRows)
+            Decode(*batch);
+        return true;
+    }
+
+    void Flush() {
+        for (auto& batch : m_ports) {
+            if (batch && batch->row_count > 0)
+                Decode(*batch);
+        }
+    }
+
+private:
+    struct Column {
+        const char*             name;
+        ColumnKind              kind;
+        uint32_t                bit_offset;
+        uint32_t                bit_width;
+        CommonMembersChannel*   channel = nullptr;
+    };
+
+    struct PortBatch {
+        const char*             measure = nullptr;
+        std::vector<Column>     columns;
+        size_t                  stride = 0;             // bytes per row, multiple of 8
+        size_t                  row_count = 0;
+        std::vector<uint8_t>    rows;                   // kBatchRows * stride + 8 bytes of slack for 64 bit loads
+        std::vector<double>     times;
+        std::vector<uint8_t>    column_scratch;         // kBatchRows values of the widest column type
+    };
+
+    DataManager&                                                    m_data_manager;
+    std::string                                                     m_log_id;
+    std::array<std::unique_ptr<PortBatch>, CANARD_SUBJECT_ID_MAX + 1U>  m_ports;
+
+    static size_t KindBits(ColumnKind kind) {
+        switch (kind) {
+            case ColumnKind::U8:   return 8;
+            case ColumnKind::U32:  return 32;
+            case ColumnKind::Bool: return 1;
+            case ColumnKind::F32:  return 32;
+            case ColumnKind::F64:  return 64;
+        }
+        return 0;
+    }
+
+    // A value whose serialized form has every wire bit of the field set:
+    // all ones for floats (NaN payloads survive a float32/float64 memcpy) and saturated integers.
+    template <typename M>
+    static M ProbeValue() {
+        M value;
+        if constexpr (std::is_same<M, bool>::value) {
+            value = true;
+        } else {
+            std::memset(&value, 0xFF, sizeof(value));
+        }
+        return value;
+    }
+
+    template <typename T>
+    static std::unique_ptr<PortBatch> ResolveLayout() {
+        auto batch = std::make_unique<PortBatch>();
+        batch->measure = DsdlType<T>::measure;
+        std::vector<uint8_t> buffer(DsdlType<T>::serialization_buffer_size);
+        std::vector<bool> used_bits(buffer.size() * 8, false);
+        size_t footprint_bits = 0;
+        bool ok = true;
+
+        dsdlForEachField<T>([&](size_t, const auto& field) {
+            using Field = std::decay_t<decltype(field)>;
+            using Member = typename Field::member_type;
+            if constexpr (!std::is_same<Member, typename Field::value_type>::value || !IsColumnType<Member>::value) {
+                ok = false;
+            } else {
+                if (!ok)
+                    return;
+                const ColumnKind kind = ColumnKindOf<Member>::kind;
+                T obj;
+                std::memset(&obj, 0, sizeof(obj));
+                obj.*(field.member) = ProbeValue<Member>();
+                std::fill(buffer.begin(), buffer.end(), 0);
+                size_t size = buffer.size();
+                if (DsdlType<T>::serialize(&obj, buffer.data(), &size) < 0) {
+                    ok = false;
+                    return;
+                }
+
+                // the field must show up as one contiguous run of set bits
+                size_t first = 0, last = 0, count = 0;
+                for (size_t bit = 0; bit < size * 8; ++bit) {
+                    if ((buffer[bit / 8] >> (bit % 8)) & 1U) {
+                        if (count == 0)
+                            first = bit;
+                        last = bit;
+                        ++count;
+                    }
+                }
+                if (count == 0 || last - first + 1 != count) {
+                    ok = false;
+                    return;
+                }
+
+                const size_t expected_bits = KindBits(kind);
+                const bool is_float = kind == ColumnKind::F32 || kind == ColumnKind::F64;
+                if ((is_float ? (count != expected_bits) : (count > expected_bits)) || (kind == ColumnKind::F64 && first % 8 != 0)) {
+                    ok = false;
+                    return;
+                }
+                for (size_t bit = first; bit <= last; ++bit) {
+                    if (used_bits[bit]) {
+                        ok = false;
+                        return;
+                    }
+                    used_bits[bit] = true;
+                }
+
+                batch->columns.push_back({field.name, kind, static_cast<uint32_t>(first), static_cast<uint32_t>(count)});
+                if (last + 1 > footprint_bits)
+                    footprint_bits = last + 1;
+            }
+        });
+        if (!ok)
+            return nullptr;
+
+        batch->stride = ((footprint_bits + 63) / 64) * 8;
+        batch->rows.assign(kBatchRows * batch->stride + 8, 0);
+        batch->times.resize(kBatchRows);
+        batch->column_scratch.resize(kBatchRows * sizeof(double));
+        return batch;
+    }
+
+    // channels are created on first decode, so ports that never show up do not leave empty channels behind
+    void AttachChannel(const PortBatch& batch, Column& column) {
+        const std::string& log_id = m_log_id;
+        const std::string measure = batch.measure;
+        const std::string field = column.name;
+        switch (column.kind) {
+            case ColumnKind::U8:   column.channel = m_data_manager.GetOrCreateChannelPtr<uint8_t>(log_id, measure, field);  break;
+            case ColumnKind::U32:  column.channel = m_data_manager.GetOrCreateChannelPtr<uint32_t>(log_id, measure, field); break;
+            case ColumnKind::Bool: column.channel = m_data_manager.GetOrCreateChannelPtr<bool>(log_id, measure, field);     break;
+            case ColumnKind::F32:  column.channel = m_data_manager.GetOrCreateChannelPtr<float>(log_id, measure, field);    break;
+            case ColumnKind::F64:  column.channel = m_data_manager.GetOrCreateChannelPtr<double>(log_id, measure, field);   break;
+        }
+    }
+
+    static inline uint64_t ReadBits(const uint8_t* row, uint32_t bit_offset, uint32_t bit_width) {
+        uint64_t word;
+        std::memcpy(&word, row + bit_offset / 8, sizeof(word));
+        const uint32_t shift = bit_offset % 8;
+        word >>= shift;
+        if (shift + bit_width > 64)
+            word |= static_cast<uint64_t>(row[bit_offset / 8 + 8]) << (64 - shift);
+        return (bit_width >= 64) ? word : (word & ((1ULL << bit_width) - 1ULL));
+    }
+
+    static void GatherF32(const PortBatch& batch, const Column& column, float* out) {
+        gatherRowsF32(batch.rows.data() + column.bit_offset / 8, batch.stride, batch.row_count, out);
+    }
+
+    static void GatherF64(const PortBatch& batch, const Column& column, double* out) {
+        gatherRowsF64(batch.rows.data() + column.bit_offset / 8, batch.stride, batch.row_count, out);
+    }
+
+    template <typename T>
+    static void ExtractBits(const PortBatch& batch, const Column& column, T* out) {
+        const uint8_t* row = batch.rows.data();
+        for (size_t i = 0; i < batch.row_count; ++i, row += batch.stride) {
+            out[i] = static_cast<T>(ReadBits(row, column.bit_offset, column.bit_width));
+        }
+    }
+
+    template <typename T>
+    static void Append(const PortBatch& batch, const Column& column, const T* values) {
+        static_cast<Channel<T>*>(column.channel)->AppendColumn(batch.times.data(), values, batch.row_count);
+    }
+
+    void Decode(PortBatch& batch) {
+        void* scratch = batch.column_scratch.data();
+        for (Column& column : batch.columns) {
+            if (column.channel == nullptr)
+                AttachChannel(batch, column);
+            switch (column.kind) {
+                case ColumnKind::F32: {
+                    float* out = static_cast<float*>(scratch);
+                    if (column.bit_offset % 8 == 0)
+                        GatherF32(batch, column, out);
+                    else
+                        for (size_t i = 0; i < batch.row_count; ++i) {
+                            uint32_t bits = static_cast<uint32_t>(ReadBits(batch.rows.data() + i * batch.stride, column.bit_offset, 32));
+                            std::memcpy(out + i, &bits, sizeof(bits));
+                        }
+                    Append(batch, column, out);
+                    break;
+                }
+                case ColumnKind::F64: {
+                    double* out = static_cast<double*>(scratch);
+                    GatherF64(batch, column, out);
+                    Append(batch, column, out);
+                    break;
+                }
+                case ColumnKind::U8: {
+                    uint8_t* out = static_cast<uint8_t*>(scratch);
+                    ExtractBits(batch, column, out);
+                    Append(batch, column, out);
+                    break;
+                }
+                case ColumnKind::U32: {
+                    uint32_t* out = static_cast<uint32_t*>(scratch);
+                    ExtractBits(batch, column, out);
+                    Append(batch, column, out);
+                    break;
+                }
+                case ColumnKind::Bool: {
+                    bool* out = static_cast<bool*>(scratch);
+                    ExtractBits(batch, column, out);
+                    Append(batch, column, out);
+                    break;
+                }
+            }
+        }
+        batch.row_count = 0;
+    }
+};
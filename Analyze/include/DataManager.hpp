@@ -22,6 +22,9 @@
 #include <cxxabi.h>
 #include "implot.h"  // Include ImPlot for plotting
 #include "InfluxDBClient.hpp"
+#include "line_protocol.hpp"
+#include "upload_scheduler.hpp"
+#include "upload_watermarks.hpp"
 
 long long convertLogIdToTimestampMs(const std::string& datetime_str) {
     // Expected format: "CAN_YYYY-MM-DD(HHMMSS)"
@@ -71,6 +74,26 @@ inline std::string Demangle(const char* name) {
     return (status == 0) ? res.get() : name;
 }
 
+// Points of one channel copied out under its lock, so they can be encoded and uploaded without it
+class ChannelSlice {
+public:
+    std::vector<double>     times;
+    double                  next_time = std::numeric_limits<double>::infinity();   // first point left out, see CopySlice
+
+    virtual                 ~ChannelSlice() {}
+    virtual bool            AppendField(LineProtocolEncoder& encoder, std::string_view field_key, size_t index) const = 0;
+};
+
+template <typename T>
+class TypedChannelSlice : public ChannelSlice {
+public:
+    std::vector<T>          values;
+
+    bool AppendField(LineProtocolEncoder& encoder, std::string_view field_key, size_t index) const override {
+        return encoder.AddField(field_key, static_cast<T>(values[index]));
+    }
+};
+
 class CommonMembersChannel {
 public:
 
@@ -118,7 +141,32 @@ public:
     virtual float                           GetMaxValueView() const = 0;
     virtual void                            AppendDataFrom(const CommonMembersChannel& other) = 0;
     virtual void                            writeToInfluxDB(InfluxDBClient& client) const = 0;
+    virtual void                            writeToInfluxDB(LineProtocolBatcher& batcher) const = 0;
     virtual void                            postPlot() const = 0;
+
+    // For DataManager::writeToInfluxDBPacked, which joins several channels into one line per timestamp
+    virtual void                            PrepareData() const = 0;
+    virtual std::unique_lock<std::mutex>    LockData() const = 0;
+    virtual const std::vector<double>&      GetTimesNoLock() const = 0;
+    virtual double                          GetValueAsDoubleNoLock(size_t index) const = 0;
+    virtual std::unique_ptr<ChannelSlice>   CopySlice(double t_begin, double t_end, size_t max_points) const = 0;
+
+    // log_id is only tagged together with car, as it always has been
+    LineProtocolSeriesKey SeriesKey() const {
+        return LineProtocolSeriesKey(m_measure, {
+            {"log_id", m_car != "" ? m_log_id : std::string()},
+            {"car", m_car},
+            {"driver", m_driver},
+            {"event", m_event},
+            {"competition", m_competition},
+            {"log_type", m_log_type},
+        });
+    }
+
+    // Identifies the channel in an UploadWatermarkStore, other tags or another type are another series
+    std::string UploadKey() const {
+        return m_log_id + " " + std::string(SeriesKey().View()) + " " + m_field + " " + GetTypeName();
+    }
 };
 
 template <typename T>
@@ -210,7 +258,22 @@ public:
         m_is_prepared = false;
         m_updated = true;
     }
-    void PrepareData() const {
+    // Appends a whole column at once, used by the batch decoder. One lock for the whole column.
+    void AppendColumn(const double* times, const T* values, size_t count) {
+        if (count == 0)
+            return;
+        std::lock_guard<std::mutex> lock(m_data_mutex);
+        bool in_order = m_time.empty() || times[0] > m_time.back();
+        for (size_t i = 1; i < count && in_order; ++i) {
+            in_order = times[i] > times[i - 1];
+        }
+        if (!in_order)
+            m_is_prepared = false;
+        m_time.insert(m_time.end(), times, times + count);
+        m_value.insert(m_value.end(), values, values + count);
+        m_updated = true;
+    }
+    void PrepareData() const override {
         std::lock_guard<std::mutex> lock(m_data_mutex);
         if (!m_is_prepared) {
             // Step 1: Create indices and sort them based on time values
@@ -328,80 +391,89 @@ public:
         ImPlot::PlotLine(m_field.c_str(), plot_time_double.data(), value_double.data(), static_cast<int>(plot_time_double.size()));
     }
     void writeToInfluxDB(InfluxDBClient& client) const override {
+        LineProtocolBatcher batcher(client.GetBatchPolicy(), [&client](std::string&& batch) {
+            client.enqueueToInfluxDB("CAN_Car", std::move(batch));
+        });
+        writeToInfluxDB(batcher);
+        batcher.Flush();
+    }
+    // Adds the lines of this channel to batcher, which channels can share so requests stay full
+    void writeToInfluxDB(LineProtocolBatcher& batcher) const override {
 
         if (!m_is_prepared) {
             PrepareData();
         }
 
-        std::lock_guard<std::mutex> lock(m_data_mutex);
-
-        if (m_time.empty() || m_value.empty()) {
+        // encoded from a copy, emitting can block on a full upload queue and postPlot takes the same lock
+        std::vector<double> times;
+        std::vector<T> values;
+        GetDataForPlot(times, values);
+        if (times.empty()) {
             return;
         }
         
         long long millis_now = convertLogIdToTimestampMs(m_log_id);
 
-        size_t batch_size = 5000;
-        size_t total_points = m_time.size();
-        size_t num_batches = (total_points + batch_size - 1) / batch_size;
-        for (size_t batch = 0; batch < num_batches; ++batch) {
-            size_t start_idx = batch * batch_size;
-            size_t end_idx = std::min(start_idx + batch_size, total_points);
-            std::ostringstream oss;
-            for (size_t i = start_idx; i < end_idx; ++i) {
-                oss << m_measure;
-                if (m_car != "") {oss << ",log_id=" << m_log_id;}
-                if (m_car != "") {oss << ",car=" << m_car;}
-                if (m_driver != "") {oss << ",driver=" << m_driver;}
-                if (m_event != "") {oss << ",event=" << m_event;}
-                if (m_competition != "") {oss << ",competition=" << m_competition;}
-                if (m_log_type != "") {oss << ",log_type=" << m_log_type;}
-                oss << " ";
-                oss << m_field << "=" << FormatValue(m_value.at(i)) << " ";
-                oss << millis_now + static_cast<long long>(m_time[i]/1000.f) << "\n";
+        // the series key and field key are escaped once for the whole upload
+        const LineProtocolSeriesKey series_key = SeriesKey();
+        const std::string field_key = line_protocol::escapeKey(m_field);
+
+        LineProtocolEncoder& encoder = batcher.Encoder();
+        for (size_t i = 0; i < times.size(); ++i) {
+            if (encoder.AppendPoint(series_key.View(), field_key, static_cast<T>(values[i]), millis_now + static_cast<long long>(times[i]/1000.f))) {
+                batcher.LineDone();
             }
-            std::string data = oss.str();
-            client.postToInfluxDB("CAN_Car", data);
         }
     }
-
-
-private:
-    // Helper function to escape special characters in measurement, tag keys/values
-    std::string EscapeString(const std::string& str) const {
-        std::string escaped;
-        for (char c : str) {
-            if (c == ',' || c == '=' || c == ' ' || c == '\\') {
-                escaped += '\\';
-            }
-            escaped += c;
+    // Line protocol for the points [start_idx, end_idx), millis_now is the start of the log in unix ms
+    std::string FormatLineProtocol(size_t start_idx, size_t end_idx, long long millis_now) const {
+        LineProtocolEncoder encoder;
+        AppendLineProtocol(encoder, SeriesKey(), line_protocol::escapeKey(m_field), start_idx, end_idx, millis_now);
+        return encoder.Take();
+    }
+    void AppendLineProtocol(LineProtocolEncoder& encoder, const LineProtocolSeriesKey& series_key, const std::string& field_key,
+                            size_t start_idx, size_t end_idx, long long millis_now) const {
+        std::lock_guard<std::mutex> lock(m_data_mutex);
+        end_idx = std::min(end_idx, m_time.size());
+        if (start_idx >= end_idx) {
+            return;
+        }
+        // ~ key + field + value + timestamp per line, so the buffer grows at most once per batch
+        encoder.Reserve(encoder.Size() + (end_idx - start_idx) * (series_key.View().size() + field_key.size() + 40));
+        for (size_t i = start_idx; i < end_idx; ++i) {
+            encoder.AppendPoint(series_key.View(), field_key, static_cast<T>(m_value[i]), millis_now + static_cast<long long>(m_time[i]/1000.f));
         }
-        return escaped;
     }
 
-    // Helper function to format field values
-    std::string FormatValue(const T& val) const {
-        if constexpr (std::is_same<T, std::string>::value) {
-            // Escape double quotes and backslashes
-            std::string escaped = val;
-            size_t pos = 0;
-            while ((pos = escaped.find_first_of("\\\"", pos)) != std::string::npos) {
-                escaped.insert(pos, "\\");
-                pos += 2;
-            }
-            return "\"" + escaped + "\"";
-        } else if constexpr (std::is_same<T, bool>::value) {
-            return val ? "true" : "false";
-        } else if constexpr (std::is_integral<T>::value) {
-            return std::to_string(val) + "i"; // Append 'i' to indicate integer
-        } else if constexpr (std::is_floating_point<T>::value) {
-            return std::to_string(val);
-        } else {
-            // Default case
-            return std::to_string(val);
+    std::unique_lock<std::mutex> LockData() const override {
+        return std::unique_lock<std::mutex>(m_data_mutex);
+    }
+    const std::vector<double>& GetTimesNoLock() const override {
+        return m_time;
+    }
+    double GetValueAsDoubleNoLock(size_t index) const override {
+        return static_cast<double>(m_value[index]);
+    }
+    // The first max_points points with t_begin <= time < t_end. If there are more, next_time is the
+    // time of the first one left out.
+    std::unique_ptr<ChannelSlice> CopySlice(double t_begin, double t_end, size_t max_points) const override {
+        PrepareData();
+        auto slice = std::make_unique<TypedChannelSlice<T>>();
+        std::lock_guard<std::mutex> lock(m_data_mutex);
+        const size_t begin = std::lower_bound(m_time.begin(), m_time.end(), t_begin) - m_time.begin();
+        size_t end = std::max(begin, static_cast<size_t>(std::lower_bound(m_time.begin(), m_time.end(), t_end) - m_time.begin()));
+        if (end - begin > max_points) {
+            end = begin + max_points;
+            slice->next_time = m_time[end];
         }
+        slice->times.assign(m_time.begin() + begin, m_time.begin() + end);
+        slice->values.assign(m_value.begin() + begin, m_value.begin() + end);
+        return slice;
     }
 
+
+private:
+
     std::string unixToISO8601(long long unixTimestamp) {
         std::chrono::system_clock::time_point tp = std::chrono::system_clock::from_time_t(unixTimestamp);
         std::time_t tt = std::chrono::system_clock::to_time_t(tp);
@@ -415,6 +487,16 @@ private:
     }
 };
 
+// How DataManager::addInfluxShards splits and encodes an upload
+struct InfluxExportOptions {
+    bool                    packed = true;              // fields sharing a timestamp share a line
+    double                  tolerance_us = 0.0;         // see DataManager::writeToInfluxDBPacked
+    double                  shard_duration_us = 0.0;    // 0 for one shard per series
+    LineBatchPolicy         batching;                   // request size, see LineProtocolBatcher
+    UploadWatermarkStore*   watermarks = nullptr;       // only upload what is new since the last export
+    std::string             destination;                // key of the destination in watermarks
+};
+
 class DataManager {
 public:
     std::vector<std::unique_ptr<CommonMembersChannel>> channels;
@@ -486,6 +568,15 @@ public:
         return true;
     }
 
+    template <typename T>
+    Channel<T>* GetOrCreateChannelPtr(const std::string& log_id, const std::string& measure, const std::string& field) {
+        Channel<T>* channel_ptr = GetChannelPtr<T>(log_id, measure, field);
+        if (!channel_ptr) {
+            channel_ptr = CreateNewChannel<T>(log_id, measure, field);
+        }
+        return channel_ptr;
+    }
+
     void PrintData() const {
         std::lock_guard<std::mutex> lock(channels_mutex);  // Lock the mutex
         for (const auto& channel_ptr : channels) {
@@ -572,21 +663,332 @@ public:
         std::cout << "============================================================\n";
     }
 
+    // channels_mutex is only held to list the channels, not while they are uploaded. Channels share
+    // batches, a batch is cut by size only.
     void writeToInfluxDB(InfluxDBClient& client) {
-        std::lock_guard<std::mutex> lock(channels_mutex);
+        std::vector<CommonMembersChannel*> channel_list;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex);
+            for (const auto& channel_ptr : channels) {
+                if (!channel_ptr) {
+                    printf("channel_ptr is nullptr\n");
+                    exit(-1);
+                }
+                channel_list.push_back(channel_ptr.get());
+            }
+        }
 
-        for (const auto& channel_ptr : channels) {
-            if (channel_ptr) {
-                channel_ptr->writeToInfluxDB(client);
+        LineProtocolBatcher batcher(client.GetBatchPolicy(), [&client](std::string&& batch) {
+            client.enqueueToInfluxDB("CAN_Car", std::move(batch));
+        });
+        for (CommonMembersChannel* channel : channel_list) {
+            channel->writeToInfluxDB(batcher);
+        }
+        batcher.Flush();
+    }
+
+    // Like writeToInfluxDB, but channels with the same log_id, measure and tags share lines:
+    //   vcu,car=Hera INS.vx=1.5,INS.vy=0.25,... 1732107600123
+    // The channels of a series are merge joined on time. Each line starts at the earliest pending
+    // timestamp and takes the next point of every channel within tolerance_us of it, so fields from
+    // one transfer (identical timestamps) always share a line and slightly skewed ones can too.
+    void writeToInfluxDBPacked(InfluxDBClient& client, double tolerance_us = 0.0) {
+        std::vector<std::shared_ptr<const InfluxSeries>> series_list;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex);
+            series_list = collectInfluxSeries(true);
+        }
+
+        // series share batches, a batch is cut by size only
+        LineProtocolBatcher batcher(client.GetBatchPolicy(), [&client](std::string&& batch) {
+            client.enqueueToInfluxDB("CAN_Car", std::move(batch));
+        });
+        for (const auto& series : series_list) {
+            encodeSeriesPacked(batcher, *series, tolerance_us,
+                -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), {});
+        }
+        batcher.Flush();
+    }
+
+    // Adds the upload of every channel to scheduler, one shard per series and shard_duration_us of
+    // log time (0 for one shard per series), so shards upload in parallel and a failed one is sent
+    // again on its own. A series smaller than one request is not split, and shares its shard (and so
+    // its requests) with the next small series until they fill about one request. packed and tolerance_us as in writeToInfluxDBPacked, otherwise one line per
+    // field like writeToInfluxDB. With watermarks, each channel starts after the points it already
+    // uploaded to destination and the watermarks of a series move on once all its shards are written. They are
+    // only set in memory, from the writer's callback: save the store after scheduler.Run() has
+    // returned, on the thread that ran it. Channels must not be removed until then.
+    void addInfluxShards(InfluxUploadScheduler& scheduler, const InfluxExportOptions& options) {
+        std::vector<std::shared_ptr<const InfluxSeries>> series_list;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex);
+            series_list = collectInfluxSeries(options.packed);
+        }
+
+        const double tolerance_us = options.tolerance_us;
+        const LineBatchPolicy batching = options.batching;
+        auto addShard = [&scheduler, tolerance_us, batching](const std::string& label, std::vector<InfluxShardPart> parts,
+                                                            std::vector<InfluxUploadScheduler::SettledFn> settled) {
+            InfluxUploadScheduler::SettledFn on_settled;
+            if (!settled.empty()) {
+                on_settled = [settled = std::move(settled)](bool ok) {
+                    for (const auto& fn : settled) {
+                        fn(ok);
+                    }
+                };
+            }
+            scheduler.AddShard(label, [parts = std::move(parts), tolerance_us, batching](const InfluxUploadScheduler::EmitFn& emit) {
+                LineProtocolBatcher batcher(batching, emit);
+                for (const InfluxShardPart& part : parts) {
+                    encodeSeriesPacked(batcher, *part.series, tolerance_us, part.t_begin, part.t_end, *part.resume_times);
+                }
+                batcher.Flush();
+            }, std::move(on_settled));
+        };
+
+        // small series waiting for a shard to share
+        std::vector<InfluxShardPart> small_parts;
+        std::vector<InfluxUploadScheduler::SettledFn> small_settled;
+        std::string small_label;
+        size_t small_bytes = 0;
+        auto addSmallShard = [&]() {
+            if (small_parts.size() > 1) {
+                small_label += " and " + std::to_string(small_parts.size() - 1) + " more";
+            }
+            addShard(small_label, std::move(small_parts), std::move(small_settled));
+            small_parts.clear();
+            small_settled.clear();
+            small_bytes = 0;
+        };
+
+        for (const auto& series : series_list) {
+            // time range of the series still to upload, where each channel resumes, how many bytes
+            // that is about, and the watermarks once it is uploaded
+            double first = std::numeric_limits<double>::infinity();
+            double last = -std::numeric_limits<double>::infinity();
+            auto resume_times = std::make_shared<std::vector<double>>();
+            auto uploaded = std::make_shared<std::vector<UploadWatermark>>();
+            size_t field_bytes = 0;
+            size_t line_count = 0;
+            for (size_t c = 0; c < series->channels.size(); ++c) {
+                CommonMembersChannel* channel = series->channels[c];
+                channel->PrepareData();
+                auto lock = channel->LockData();
+                const std::vector<double>& times = channel->GetTimesNoLock();
+                auto value_at = [channel](size_t i) { return channel->GetValueAsDoubleNoLock(i); };
+                size_t resume_index = 0;
+                if (options.watermarks) {
+                    if (auto watermark = options.watermarks->Get(options.destination, channel->UploadKey())) {
+                        resume_index = uploadResumeIndex(times, *watermark, value_at);
+                    }
+                    uploaded->push_back(makeUploadWatermark(times, times.size(), value_at));
+                }
+                if (resume_index < times.size()) {
+                    first = std::min(first, times[resume_index]);
+                    last = std::max(last, times.back());
+                    resume_times->push_back(times[resume_index]);
+                    // ",field=value" per point, at least the longest channel's point count in lines
+                    const size_t points = times.size() - resume_index;
+                    field_bytes += points * (series->field_keys[c].size() + 16);
+                    line_count = std::max(line_count, points);
+                } else {
+                    resume_times->push_back(std::numeric_limits<double>::infinity());
+                }
+            }
+            if (first > last) {
+                continue;   // nothing new
+            }
+
+            // key and timestamp per line
+            const size_t estimated_bytes = field_bytes + line_count * (series->key.View().size() + 16);
+            const bool small = estimated_bytes < batching.target_bytes;
+
+            const double shard_duration_us = options.shard_duration_us;
+            const size_t shard_count = (shard_duration_us > 0.0 && !small)
+                ? static_cast<size_t>((last - first) / shard_duration_us) + 1
+                : 1;
+
+            InfluxUploadScheduler::SettledFn on_settled;
+            if (options.watermarks) {
+                struct SeriesUpload {
+                    std::mutex  mutex;
+                    size_t      shards_left;
+                    bool        failed = false;
+                };
+                auto upload = std::make_shared<SeriesUpload>();
+                upload->shards_left = shard_count;
+                on_settled = [series, uploaded, upload, watermarks = options.watermarks, destination = options.destination](bool ok) {
+                    {
+                        std::lock_guard<std::mutex> lock(upload->mutex);
+                        upload->failed = upload->failed || !ok;
+                        if (--upload->shards_left > 0 || upload->failed) {
+                            return;
+                        }
+                    }
+                    for (size_t c = 0; c < series->channels.size(); ++c) {
+                        watermarks->Set(destination, series->channels[c]->UploadKey(), (*uploaded)[c]);
+                    }
+                };
+            }
+
+            const std::string label = series->log_id + " " + std::string(series->key.View());
+            if (small) {
+                if (small_parts.empty()) {
+                    small_label = label;
+                }
+                small_parts.push_back({series, resume_times, first, std::numeric_limits<double>::infinity()});
+                if (on_settled) {
+                    small_settled.push_back(std::move(on_settled));
+                }
+                small_bytes += estimated_bytes;
+                if (small_bytes >= batching.target_bytes) {
+                    addSmallShard();
+                }
+                continue;
+            }
+
+            for (size_t shard = 0; shard < shard_count; ++shard) {
+                // the first shard starts at the first point not uploaded yet, the last one is open ended
+                const double t_begin = first + shard * shard_duration_us;
+                const double t_end = (shard + 1 == shard_count) ? std::numeric_limits<double>::infinity() : first + (shard + 1) * shard_duration_us;
+                std::string shard_label = label;
+                if (shard_count > 1) {
+                    shard_label += " [" + std::to_string(shard + 1) + "/" + std::to_string(shard_count) + "]";
+                }
+                std::vector<InfluxUploadScheduler::SettledFn> settled;
+                if (on_settled) {
+                    settled.push_back(on_settled);
+                }
+                addShard(shard_label, {{series, resume_times, t_begin, t_end}}, std::move(settled));
             }
-            else {
+        }
+        if (!small_parts.empty()) {
+            addSmallShard();
+        }
+    }
+
+private:
+
+    // Channels written together into one series: log_id, measure and tags are the same
+    struct InfluxSeries {
+        std::string                         log_id;
+        LineProtocolSeriesKey               key;
+        std::vector<CommonMembersChannel*>  channels;
+        std::vector<std::string>            field_keys;
+    };
+
+    // What a shard of addInfluxShards encodes: the points of series with t_begin <= time < t_end,
+    // each channel from its resume time on
+    struct InfluxShardPart {
+        std::shared_ptr<const InfluxSeries>         series;
+        std::shared_ptr<const std::vector<double>>  resume_times;
+        double                                      t_begin;
+        double                                      t_end;
+    };
+
+    // channels_mutex held. With packed, channels of one series are grouped, otherwise every channel
+    // is a series of its own.
+    std::vector<std::shared_ptr<const InfluxSeries>> collectInfluxSeries(bool packed) const {
+        std::vector<std::shared_ptr<InfluxSeries>> series_list;
+        std::map<std::string, size_t> series_index;
+        for (const auto& channel_ptr : channels) {
+            if (!channel_ptr) {
                 printf("channel_ptr is nullptr\n");
                 exit(-1);
             }
+            LineProtocolSeriesKey key = channel_ptr->SeriesKey();
+            std::string field_key = line_protocol::escapeKey(channel_ptr->GetField());
+            std::shared_ptr<InfluxSeries> series;
+            if (packed) {
+                auto [it, inserted] = series_index.try_emplace(channel_ptr->GetLogId() + '\n' + std::string(key.View()), series_list.size());
+                if (!inserted) {
+                    series = series_list[it->second];
+                    // the same field in two types cannot share a line, the second one is written on its own
+                    if (std::find(series->field_keys.begin(), series->field_keys.end(), field_key) != series->field_keys.end()) {
+                        series = nullptr;
+                    }
+                }
+            }
+            if (!series) {
+                series = std::make_shared<InfluxSeries>();
+                series->log_id = channel_ptr->GetLogId();
+                series->key = std::move(key);
+                series_list.push_back(series);
+            }
+            series->channels.push_back(channel_ptr.get());
+            series->field_keys.push_back(std::move(field_key));
         }
+        return {series_list.begin(), series_list.end()};
     }
 
-private:
+    // Points copied out of a channel at a time by encodeSeriesPacked
+    static constexpr size_t kSliceRows = 64 * 1024;
+
+    // Lines of series for the points with t_begin <= time < t_end. The points are copied out of the
+    // channels in windows of at most kSliceRows points per channel, so a channel lock is only held
+    // for one short copy, never while lines are encoded and the batcher emits, and shards of one series
+    // do not wait for each other. Like at a shard boundary, fields within tolerance_us of the end of a
+    // window may end up on two lines. channel_begin, unless empty, holds a later start for each channel.
+    static void encodeSeriesPacked(
+        LineProtocolBatcher& batcher,
+        const InfluxSeries& series,
+        double tolerance_us,
+        double t_begin,
+        double t_end,
+        const std::vector<double>& channel_begin)
+    {
+        LineProtocolEncoder& encoder = batcher.Encoder();
+        const long long millis_now = convertLogIdToTimestampMs(series.log_id);
+        const size_t channel_count = series.channels.size();
+
+        std::vector<std::unique_ptr<ChannelSlice>> slices(channel_count);
+        std::vector<const std::vector<double>*> times(channel_count);
+        std::vector<size_t> cursors(channel_count, 0);
+        std::vector<size_t> ends(channel_count, 0);
+        double window_begin = t_begin;
+        while (window_begin < t_end) {
+            // the window ends at the first point a channel left out, every point before it has been copied
+            double window_end = t_end;
+            for (size_t c = 0; c < channel_count; ++c) {
+                const double begin = channel_begin.empty() ? window_begin : std::max(window_begin, channel_begin[c]);
+                slices[c] = series.channels[c]->CopySlice(begin, t_end, kSliceRows);
+                times[c] = &slices[c]->times;
+                window_end = std::min(window_end, slices[c]->next_time);
+            }
+            for (size_t c = 0; c < channel_count; ++c) {
+                cursors[c] = 0;
+                ends[c] = std::lower_bound(times[c]->begin(), times[c]->end(), window_end) - times[c]->begin();
+            }
+            while (true) {
+                // earliest pending timestamp over all channels of the series
+                double line_time = std::numeric_limits<double>::infinity();
+                for (size_t c = 0; c < channel_count; ++c) {
+                    if (cursors[c] < ends[c]) {
+                        line_time = std::min(line_time, (*times[c])[cursors[c]]);
+                    }
+                }
+                if (line_time == std::numeric_limits<double>::infinity()) {
+                    break;
+                }
+
+                const size_t line_start = encoder.Size();
+                encoder.BeginLine(series.key.View());
+                for (size_t c = 0; c < channel_count; ++c) {
+                    if (cursors[c] < ends[c] && (*times[c])[cursors[c]] <= line_time + tolerance_us) {
+                        slices[c]->AppendField(encoder, series.field_keys[c], cursors[c]);
+                        cursors[c]++;
+                    }
+                }
+                if (!encoder.HasFields()) {
+                    encoder.DiscardLine(line_start);
+                    continue;
+                }
+                encoder.EndLine(millis_now + static_cast<long long>(line_time/1000.f));
+                batcher.LineDone();
+            }
+            window_begin = window_end;
+        }
+    }
 
     template <typename T>
     Channel<T>* CreateNewChannel(const std::string& log_id, const std::string& measure, const std::string& field) {
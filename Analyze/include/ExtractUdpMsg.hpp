@@ -2,27 +2,32 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <unordered_map>
 #include <functional>
 #include <chrono> // Include for timing
 #include "libcanard/canard.h"
+#include "canard_pool.hpp"
+#include "canard_single_frame.hpp"
+#include "DataManager.hpp"
+#include "Deserialization.hpp"
+#include "BatchDecoder.hpp"
+#include "IngestStats.hpp"
 
 //#define DEBUG
 #include "debug.hpp"
 
 using namespace std;
 
-// Memory allocation functions
+// Memory allocation functions, served by the reader thread's CanardBlockPool
 void* memoryAllocate(CanardInstance* const ins, const size_t amount) {
-    (void)ins;
-    return malloc(amount);
+    return canardPoolAllocate(ins, amount);
 }
 
 void memoryFree(CanardInstance* const ins, void* const pointer) {
-    (void)ins;
-    free(pointer);
+    canardPoolFree(ins, pointer);
 }
 
 // struct to parse CAN ID
@@ -118,46 +123,109 @@ bool readSingleMsg(const uint8_t* buffer, size_t buffer_size, size_t& offset, Ca
     return true;
 }
 
-// look at these for better performance. you have to add all subscriptions before parsing
-/*
-        // Initialization phase
-    void initializeSubscriptions(CanardInstance* ins) {
-        static CanardRxSubscription subscription_array[MAX_SUBSCRIPTIONS];
-        for (size_t i = 0; i < NUM_KNOWN_PORT_IDS; ++i) {
-            int8_t res = canardRxSubscribe(ins,
-                                           CanardTransferKindMessage,
-                                           known_port_ids[i],
-                                           MAX_EXTENT,
-                                           TRANSFER_ID_TIMEOUT_USEC,
-                                           &subscription_array[i]);
+// Per-reader libcanard RX state. Every port in the DeserializationMap is subscribed once at construction
+// with subscription storage owned by this struct, so the frame loop never allocates a subscription and
+// frames for ports we cannot deserialize are rejected with a single table load before canardRxAccept.
+// One context per reader thread: pcap files are read in parallel and libcanard sessions are not thread safe.
+struct CanardRxContext {
+    static constexpr size_t kMaxSubscriptions = 64;
+
+    CanardInstance                                                  canard_instance;
+    std::array<CanardRxSubscription, kMaxSubscriptions>             subscriptions;
+    std::array<CanardTransferKind, kMaxSubscriptions>               subscription_kinds;
+    size_t                                                          subscription_count = 0;
+
+    // indexed by port_id, nullptr means not subscribed
+    std::array<CanardRxSubscription*, CANARD_SUBJECT_ID_MAX + 1U>   message_ports = {};
+    std::array<CanardRxSubscription*, CANARD_SERVICE_ID_MAX + 1U>   request_ports = {};
+    std::array<CanardRxSubscription*, CANARD_SERVICE_ID_MAX + 1U>   response_ports = {};
+    // transfer-ID dedup for the transfers that bypass canardRxAccept
+    CanardSingleFrameSessions                                       single_frame_sessions;
+
+    explicit CanardRxContext(const DeserializationMap& deserialization_map) {
+        canard_instance = canardInit(memoryAllocate, memoryFree);
+        canard_instance.node_id = CANARD_NODE_ID_UNSET;
+
+        for (const auto& [port_id, deserializer] : deserialization_map) {
+            if (subscription_count == kMaxSubscriptions) {
+                printf("CanardRxContext: more than %zu ports in DeserializationMap, port %u is not subscribed\n", kMaxSubscriptions, static_cast<unsigned>(port_id));
+                continue;
+            }
+            CanardRxSubscription** slot = portSlot(deserializer.transfer_kind, port_id);
+            if (slot == nullptr) {
+                printf("CanardRxContext: port %u is out of range for its transfer kind\n", static_cast<unsigned>(port_id));
+                continue;
+            }
+            CanardRxSubscription* subscription = &subscriptions[subscription_count];
+            int8_t res = canardRxSubscribe(&canard_instance, deserializer.transfer_kind, port_id, deserializer.extent, CANARD_DEFAULT_TRANSFER_ID_TIMEOUT_USEC, subscription);
             if (res < 0) {
-                // Handle error
+                printf("Subscription failed for port %u with error: %d\n", static_cast<unsigned>(port_id), static_cast<int>(res));
+                continue;
             }
+            // the deserializer travels with the subscription so a completed transfer needs no map lookup
+            subscription->user_reference = const_cast<Deserializer*>(&deserializer);
+            *slot = subscription;
+            subscription_kinds[subscription_count] = deserializer.transfer_kind;
+            ++subscription_count;
         }
     }
-
-    // Main processing loop
-    void processFrames(CanardInstance* ins, const CanardFrame* frame) {
-        CanardRxTransfer transfer;
-        int8_t result = canardRxAccept(ins, timestamp, frame, 0, &transfer, NULL);
-        if (result > 0) {
-            // Process the transfer
-            processTransfer(&transfer);
-            // Release the payload
-            ins->memory_free(ins, (void*)transfer.payload);
+    ~CanardRxContext() {
+        // releases the RX sessions libcanard allocated for each subscription
+        for (size_t i = 0; i < subscription_count; ++i) {
+            canardRxUnsubscribe(&canard_instance, subscription_kinds[i], subscriptions[i].port_id);
         }
-    }    
+    }
+    CanardRxContext(const CanardRxContext&) = delete;
+    CanardRxContext& operator=(const CanardRxContext&) = delete;
+    CanardRxContext(CanardRxContext&&) = delete;
+    CanardRxContext& operator=(CanardRxContext&&) = delete;
+
+    inline CanardRxSubscription* findSubscription(CanardTransferKind transfer_kind, CanardPortID port_id) {
+        CanardRxSubscription** slot = portSlot(transfer_kind, port_id);
+        return (slot != nullptr) ? *slot : nullptr;
+    }
 
-*/
+private:
+    inline CanardRxSubscription** portSlot(CanardTransferKind transfer_kind, CanardPortID port_id) {
+        switch (transfer_kind) {
+            case CanardTransferKindMessage:
+                return (port_id <= CANARD_SUBJECT_ID_MAX) ? &message_ports[port_id] : nullptr;
+            case CanardTransferKindRequest:
+                return (port_id <= CANARD_SERVICE_ID_MAX) ? &request_ports[port_id] : nullptr;
+            case CanardTransferKindResponse:
+                return (port_id <= CANARD_SERVICE_ID_MAX) ? &response_ports[port_id] : nullptr;
+            default:
+                return nullptr;
+        }
+    }
+};
 
+// High rate ports are buffered for columnar decoding, everything else is deserialized right away
+inline void deliverTransfer(
+    const CanardRxTransfer& transfer,
+    const CanardRxSubscription* subscription,
+    BatchDecoder& batch_decoder,
+    DataManagerSink& sink,
+    IngestCounters& counters)
+{
+    counters.CountTransfer();
+    if (batch_decoder.Push(transfer)) {
+        return;
+    }
+    const Deserializer* deserializer = static_cast<const Deserializer*>(subscription->user_reference);
+    if (!deserializer->deserialize(sink, transfer)) {
+        counters.CountError(IngestError::DeserializationFailed, transfer.metadata.transfer_kind, transfer.metadata.port_id);
+    }
+}
 
 bool extractUdpMsg(
     const uint8_t* payload, 
     size_t payload_length, 
     size_t& offset, 
-    CanardInstance& canard_instance,
-    DataManager& data_manager,
-    DeserializationMap& deserialization_map) 
+    CanardRxContext& rx_context,
+    BatchDecoder& batch_decoder,
+    DataManagerSink& sink,
+    IngestCounters& counters) 
 {
     CanOverUdpMsg udp_msg;
 
@@ -166,51 +234,45 @@ bool extractUdpMsg(
         frame.extended_can_id = udp_msg.can_id;
         frame.payload_size = udp_msg.data_length;
         frame.payload = udp_msg.data;
+        counters.CountCanFrame();
 
         // Parse CAN ID
         CanIdFields can_id_fields = parseCanId(frame.extended_can_id);
 
-        // Get or create subscription
-        CanardRxSubscription* subscription = nullptr;
-        int8_t sub_result = canardRxGetSubscription(&canard_instance, can_id_fields.transfer_kind, can_id_fields.port_id, &subscription);
+        // Ports without a deserializer are dropped here instead of being reassembled for nothing
+        CanardRxSubscription* subscription = rx_context.findSubscription(can_id_fields.transfer_kind, can_id_fields.port_id);
+        if (subscription == nullptr) {
+            counters.CountError(IngestError::UnknownPort, can_id_fields.transfer_kind, can_id_fields.port_id);
+            return true;
+        }
 
-        if (sub_result <= 0) {
-            // Subscription does not exist; create it
-            CanardRxSubscription* new_subscription = (CanardRxSubscription*)malloc(sizeof(CanardRxSubscription));
-            size_t extent = 1024;  // Use the maximum extent or adjust as needed
-            CanardMicrosecond transfer_id_timeout_usec = CANARD_DEFAULT_TRANSFER_ID_TIMEOUT_USEC;
-            int8_t res = canardRxSubscribe(&canard_instance, can_id_fields.transfer_kind, can_id_fields.port_id, extent, transfer_id_timeout_usec, new_subscription);
+        CanardInstance& canard_instance = rx_context.canard_instance;
+        CanardRxTransfer transfer;
 
-            if (res < 0) {
-                printf("Subscription failed with error: %d\n", static_cast<int>(res));
-                free(new_subscription);
-                return false;
-            }
-            subscription = new_subscription;
+        // Single-frame transfers are deserialized straight from the frame, the payload is not ours to free
+        const CanardSingleFrameResult single_frame = canardAcceptSingleFrame(canard_instance, rx_context.single_frame_sessions, udp_msg.timestamp, frame, transfer);
+        if (single_frame == CanardSingleFrameResult::Accepted) {
+            deliverTransfer(transfer, subscription, batch_decoder, sink, counters);
+            return true;
+        } else if (single_frame == CanardSingleFrameResult::Duplicate) {
+            // dropped like libcanard drops a repeated transfer-ID
+            return true;
         }
 
-        // Accept the frame
-        CanardRxTransfer transfer;
+        // Multi-frame transfer, let libcanard reassemble it
         int8_t result = canardRxAccept(&canard_instance, udp_msg.timestamp, &frame, 0, &transfer, &subscription);
 
         if (result == 1) {
-            // Deserialization
-            auto it = deserialization_map.find(transfer.metadata.port_id);
-            if (it != deserialization_map.end()) {
-                //printf("Deserializing port ID: %d\n", transfer.metadata.port_id);
-                it->second(data_manager, transfer);
-            } else {
-                //printf("No deserialization function for port ID: %d\n", transfer.metadata.port_id);
-            }
+            deliverTransfer(transfer, subscription, batch_decoder, sink, counters);
             canard_instance.memory_free(&canard_instance, (void*)transfer.payload);
         } else if (result < 0) {
-            printf("Reception error: %d", static_cast<int>(result));
+            counters.CountError(IngestError::ReceptionError, can_id_fields.transfer_kind, can_id_fields.port_id);
             return false;
         } else {
             // Frame accepted but transfer not yet complete
         }
     } else {
-        printf("Failed to deserialize CanOverUdpMsg at offset %ld.\n", offset);
+        counters.CountError(IngestError::MalformedRecord);
         return false;
     }
 
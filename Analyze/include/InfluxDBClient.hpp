@@ -1,10 +1,13 @@
 #pragma once
 
-#include <boost/asio.hpp>
-#include <iostream>
 #include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
 
-using boost::asio::ip::tcp;
+#include "gzip.hpp"
+#include "http_connection_pool.hpp"
+#include "influx_batch_writer.hpp"
+#include "line_protocol.hpp"
 
 class InfluxDBClient {
 
@@ -14,6 +17,11 @@ private:
     std::string port;
     std::string org;
     std::string token;
+    int gzip_level;     // 0 sends plain bodies
+
+    HttpConnectionPool connection_pool;
+    InfluxBatchWriter batch_writer;     // after connection_pool, which it sends through
+    LineBatchPolicy batch_policy;       // how the encoders cut uploads into requests
 
     std::vector<std::string> cars = {"Hera", "Lyra"};
     std::vector<std::string> competitions = {"FSEast", "FSG"};
@@ -24,40 +32,75 @@ private:
 
 public:
 
-    InfluxDBClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token): host(host), port(port), org(org), token(token) {}
+    InfluxDBClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token, int gzip_level = Z_BEST_SPEED)
+        : host(host), port(port), org(org), token(token), gzip_level(gzip_level),
+          connection_pool(host, port), batch_writer(connection_pool, org, token, writerConfig(gzip_level)) {}
     ~InfluxDBClient() {}
 
-    void postToInfluxDB(const std::string& bucket,
+    // Returns false if the write was not accepted, the reason is kept in GetStats().last_error
+    bool postToInfluxDB(const std::string& bucket,
                          const std::string& data) {
-        try {
-            boost::asio::io_context io_context;
-            tcp::resolver resolver(io_context);
-            tcp::resolver::results_type endpoints = resolver.resolve(this->host, this->port);
-            tcp::socket socket(io_context);
-            boost::asio::connect(socket, endpoints);
-            std::string request = "POST /api/v2/write?org=" + this->org +
-                                  "&bucket=" + bucket + "&precision=ms HTTP/1.1\r\n" +
-                                  "Host: " + this->host + ":" + this->port + "\r\n" +
-                                  "Authorization: Token " + this->token + "\r\n" +
-                                  "Content-Type: text/plain; charset=utf-8\r\n" +
-                                  "Content-Length: " + std::to_string(data.length()) + "\r\n" +
-                                  "Connection: close\r\n\r\n" + data;
-            printf("%s\n", request.c_str());
-            boost::asio::write(socket, boost::asio::buffer(request));
-            boost::asio::streambuf response;
-            boost::system::error_code error;
-            boost::asio::read(socket, response, boost::asio::transfer_all(), error);
-            if (error != boost::asio::error::eof) {
-                throw boost::system::system_error(error);
-            }
-            std::istream response_stream(&response);
-            std::string response_str((std::istreambuf_iterator<char>(response_stream)),
-                                     std::istreambuf_iterator<char>());
-            std::cout << "Response:\n" << response_str << std::endl;
-        }
-        catch (std::exception& e) {
-            std::cerr << "Exception: " << e.what() << "\n";
+        HttpConnectionPool::Headers headers = {
+            {"Authorization", "Token " + this->token},
+            {"Content-Type", "text/plain; charset=utf-8"},
+        };
+        std::string compressed;
+        if (this->gzip_level > 0 && GzipCompressor(this->gzip_level).Compress(data, compressed)) {
+            headers.emplace_back("Content-Encoding", "gzip");
         }
+        HttpResponse response = this->connection_pool.request(
+            boost::beast::http::verb::post,
+            "/api/v2/write?org=" + this->org + "&bucket=" + bucket + "&precision=ms",
+            headers,
+            compressed.empty() ? data : compressed);
+        return response.ok();
+    }
+
+    // Runs a Flux query, the annotated CSV result is handed to on_data as it arrives (see flux_query.hpp)
+    HttpResponse queryFlux(const std::string& flux, const HttpConnectionPool::BodyChunkFn& on_data) {
+        const nlohmann::json request = {
+            {"query", flux},
+            {"type", "flux"},
+            {"dialect", {{"header", true}, {"annotations", {"datatype"}}}},
+        };
+        HttpConnectionPool::Headers headers = {
+            {"Authorization", "Token " + this->token},
+            {"Content-Type", "application/json"},
+            {"Accept", "application/csv"},
+        };
+        return this->connection_pool.requestStreaming(
+            boost::beast::http::verb::post,
+            "/api/v2/query?org=" + this->org,
+            headers,
+            request.dump(),
+            on_data);
+    }
+
+    // Queues the batch for the background writer, blocks while the queue is full
+    bool enqueueToInfluxDB(const std::string& bucket, std::string data) {
+        return this->batch_writer.Enqueue({bucket, "ms", std::move(data)});
+    }
+    void flush() { this->batch_writer.Flush(); }
+    const LineBatchPolicy& GetBatchPolicy() const { return this->batch_policy; }
+    void SetBatchPolicy(const LineBatchPolicy& policy) { this->batch_policy = policy; }
+    // for InfluxUploadScheduler, which enqueues shard batches itself
+    InfluxBatchWriter& GetWriter() { return this->batch_writer; }
+
+    // identifies the bucket in an UploadWatermarkStore
+    std::string GetDestination(const std::string& bucket) const {
+        return this->host + ":" + this->port + "/" + this->org + "/" + bucket;
+    }
+
+    HttpPoolStats GetStats() const { return this->connection_pool.Stats(); }
+    InfluxWriteProgress GetProgress() const { return this->batch_writer.Progress(); }
+
+private:
+
+    // the background writer compresses on its own threads
+    static InfluxBatchWriterConfig writerConfig(int gzip_level) {
+        InfluxBatchWriterConfig config;
+        config.gzip_level = gzip_level;
+        return config;
     }
 
 };
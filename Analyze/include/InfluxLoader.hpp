@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "DataManager.hpp"
+#include "InfluxDBClient.hpp"
+#include "flux_query.hpp"
+
+// Loads channels back from InfluxDB into a DataManager.
+//
+// The query result is parsed while it streams in (AnnotatedCsvReader) and every row is appended to a
+// small per-channel column buffer, which goes into Channel<T>::AppendColumn every kFlushRows rows or
+// when the series changes. The channel type follows the #datatype of _value: double, long (int64_t),
+// unsignedLong (uint64_t) or boolean. Times are turned back into microseconds since the start of the
+// log, the inverse of what writeToInfluxDB does.
+
+struct InfluxLoadResult {
+    bool        ok = false;
+    std::string error;
+    uint64_t    rows = 0;
+    uint64_t    rows_skipped = 0;       // unparsable time or value, or an unsupported type
+    uint64_t    bytes = 0;
+    size_t      channels = 0;
+    double      seconds = 0.0;
+};
+
+class InfluxChannelLoader {
+public:
+    // Channels are created under log_id. Times in the result are relative to log_start_ms (unix ms).
+    InfluxChannelLoader(DataManager& data_manager, const std::string& log_id, long long log_start_ms)
+        : m_data_manager(data_manager), m_log_id(log_id), m_log_start_us(static_cast<double>(log_start_ms) * 1000.0) {}
+
+    void OnTable(const AnnotatedCsvReader::Table& table) {
+        flush();
+        m_time_index = table.ColumnIndex("_time");
+        m_value_index = table.ColumnIndex("_value");
+        m_measurement_index = table.ColumnIndex("_measurement");
+        m_field_index = table.ColumnIndex("_field");
+        m_error_index = table.ColumnIndex("error");
+        m_type = ValueType::Unsupported;
+        if (m_value_index >= 0 && static_cast<size_t>(m_value_index) < table.datatypes.size()) {
+            const std::string& datatype = table.datatypes[m_value_index];
+            m_type = datatype == "double" ? ValueType::Double
+                   : datatype == "long" ? ValueType::Long
+                   : datatype == "unsignedLong" ? ValueType::UnsignedLong
+                   : datatype == "boolean" ? ValueType::Boolean
+                   : ValueType::Unsupported;
+        }
+        // a new type means a new channel even for the same measurement and field
+        m_measurement.clear();
+        m_field.clear();
+    }
+
+    void OnRow(const std::vector<std::string_view>& cells) {
+        // errors that happen after the response has started come as a table of their own
+        if (m_error_index >= 0 && static_cast<size_t>(m_error_index) < cells.size() && !cells[m_error_index].empty()) {
+            m_error.assign(cells[m_error_index]);
+            return;
+        }
+        const int last_index = std::max(std::max(m_time_index, m_value_index), std::max(m_measurement_index, m_field_index));
+        if (m_type == ValueType::Unsupported || m_time_index < 0 || m_measurement_index < 0 || m_field_index < 0
+            || static_cast<size_t>(last_index) >= cells.size()) {
+            m_rows_skipped++;
+            return;
+        }
+
+        const std::string_view measurement = cells[m_measurement_index];
+        const std::string_view field = cells[m_field_index];
+        if (measurement != m_measurement || field != m_field) {
+            flush();
+            m_measurement.assign(measurement);
+            m_field.assign(field);
+            openChannel();
+        }
+
+        int64_t nanos = 0;
+        if (!flux::parseRfc3339Nanos(cells[m_time_index], nanos)) {
+            m_rows_skipped++;
+            return;
+        }
+        const double time = static_cast<double>(nanos) / 1000.0 - m_log_start_us;
+        const std::string_view value = cells[m_value_index];
+        bool parsed = false;
+        switch (m_type) {
+            case ValueType::Double:         parsed = append(m_double, time, value); break;
+            case ValueType::Long:           parsed = append(m_long, time, value); break;
+            case ValueType::UnsignedLong:   parsed = append(m_unsigned_long, time, value); break;
+            case ValueType::Boolean:        parsed = append(m_boolean, time, value); break;
+            case ValueType::Unsupported:    break;
+        }
+        if (!parsed) {
+            m_rows_skipped++;
+        }
+    }
+
+    void Finish() { flush(); }
+
+    uint64_t RowsSkipped() const { return m_rows_skipped; }
+    size_t Channels() const { return m_channels; }
+    const std::string& Error() const { return m_error; }
+
+private:
+    enum class ValueType { Double, Long, UnsignedLong, Boolean, Unsupported };
+
+    static constexpr size_t kFlushRows = 8192;
+
+    template <typename T>
+    struct Column {
+        Channel<T>*         channel = nullptr;
+        std::vector<double> times;
+        std::vector<T>      values;
+
+        void Flush() {
+            if (!channel || times.empty()) {
+                return;
+            }
+            if constexpr (std::is_same<T, bool>::value) {
+                // std::vector<bool> has no data(), one pair per point instead
+                std::vector<std::pair<double, bool>> points;
+                points.reserve(times.size());
+                for (size_t i = 0; i < times.size(); ++i) {
+                    points.emplace_back(times[i], values[i]);
+                }
+                channel->AddDatapoints(points);
+            } else {
+                channel->AppendColumn(times.data(), values.data(), times.size());
+            }
+            times.clear();
+            values.clear();
+        }
+    };
+
+    template <typename T>
+    static bool parseValue(std::string_view text, T& value) {
+        if constexpr (std::is_same<T, bool>::value) {
+            value = (text == "true");
+            return value || text == "false";
+        } else {
+            const std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), value);
+            return result.ec == std::errc() && result.ptr == text.data() + text.size();
+        }
+    }
+
+    template <typename T>
+    bool append(Column<T>& column, double time, std::string_view text) {
+        T value{};
+        if (!column.channel || !parseValue(text, value)) {
+            return false;
+        }
+        column.times.push_back(time);
+        column.values.push_back(value);
+        if (column.times.size() >= kFlushRows) {
+            column.Flush();
+        }
+        return true;
+    }
+
+    template <typename T>
+    void open(Column<T>& column) {
+        column.channel = m_data_manager.GetOrCreateChannelPtr<T>(m_log_id, m_measurement, m_field);
+        column.times.reserve(kFlushRows);
+        column.values.reserve(kFlushRows);
+        m_channels++;
+    }
+
+    void openChannel() {
+        switch (m_type) {
+            case ValueType::Double:         open(m_double); break;
+            case ValueType::Long:           open(m_long); break;
+            case ValueType::UnsignedLong:   open(m_unsigned_long); break;
+            case ValueType::Boolean:        open(m_boolean); break;
+            case ValueType::Unsupported:    break;
+        }
+    }
+
+    void flush() {
+        m_double.Flush();
+        m_long.Flush();
+        m_unsigned_long.Flush();
+        m_boolean.Flush();
+    }
+
+    DataManager&        m_data_manager;
+    std::string         m_log_id;
+    double              m_log_start_us;
+
+    int                 m_time_index = -1;
+    int                 m_value_index = -1;
+    int                 m_measurement_index = -1;
+    int                 m_field_index = -1;
+    int                 m_error_index = -1;
+    ValueType           m_type = ValueType::Unsupported;
+
+    // the series rows are currently appended to
+    std::string         m_measurement;
+    std::string         m_field;
+    Column<double>      m_double;
+    Column<int64_t>     m_long;
+    Column<uint64_t>    m_unsigned_long;
+    Column<bool>        m_boolean;
+
+    uint64_t            m_rows_skipped = 0;
+    size_t              m_channels = 0;
+    std::string         m_error;
+};
+
+// Runs query and loads the result into data_manager under target_log_id (query.log_id if empty)
+inline InfluxLoadResult loadChannelsFromInfluxDB(InfluxDBClient& client, DataManager& data_manager, const FluxQuery& query, const std::string& target_log_id = std::string()) {
+    const auto start = std::chrono::steady_clock::now();
+    // the upload wrote times relative to the start of the log
+    const long long log_start_ms = query.log_id.empty() ? 0 : convertLogIdToTimestampMs(query.log_id);
+    InfluxChannelLoader loader(data_manager, target_log_id.empty() ? query.log_id : target_log_id, std::max(log_start_ms, 0LL));
+    AnnotatedCsvReader reader(
+        [&loader](const AnnotatedCsvReader::Table& table) { loader.OnTable(table); },
+        [&loader](const std::vector<std::string_view>& cells) { loader.OnRow(cells); });
+
+    InfluxLoadResult result;
+    HttpResponse response = client.queryFlux(buildFluxQuery(query), [&](const char* data, size_t size) {
+        reader.Feed(data, size);
+        return true;
+    });
+    reader.Finish();
+    loader.Finish();
+
+    result.rows = reader.Rows();
+    result.rows_skipped = loader.RowsSkipped();
+    result.bytes = response.streamed_bytes;
+    result.channels = loader.Channels();
+    result.ok = response.ok() && response.error.empty() && loader.Error().empty();
+    result.error = !response.error.empty() ? response.error
+                 : !response.ok() ? "HTTP " + std::to_string(response.status) + ": " + response.body
+                 : loader.Error();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "libcanard/canard.h"
+
+// Ingest statistics for readPcapFileToDataManager.
+//
+// Every reader thread owns one IngestCounters and is the only thread writing to it, so counting is a
+// relaxed load and store with no lock and no read-modify-write. The GUI thread reads the same atomics
+// through IngestRegistry while the file is being read. Errors are counted instead of printed, per kind
+// and, where the port is known, per transfer kind and port_id (subject and service ids overlap).
+
+enum class IngestError : uint8_t {
+    MalformedRecord,        // CAN over UDP record that does not fit in the datagram
+    UnknownPort,            // frame for a port without a deserializer
+    ReceptionError,         // canardRxAccept failed
+    DeserializationFailed,  // nunavut _deserialize_ rejected the payload
+    Count,
+};
+
+inline const char* IngestErrorName(IngestError error) {
+    switch (error) {
+        case IngestError::MalformedRecord:       return "malformed record";
+        case IngestError::UnknownPort:           return "unknown port";
+        case IngestError::ReceptionError:        return "reception error";
+        case IngestError::DeserializationFailed: return "deserialization failed";
+        case IngestError::Count:                 break;
+    }
+    return "?";
+}
+
+constexpr size_t kIngestErrorCount = static_cast<size_t>(IngestError::Count);
+
+inline const char* TransferKindName(CanardTransferKind transfer_kind) {
+    switch (transfer_kind) {
+        case CanardTransferKindMessage:  return "message";
+        case CanardTransferKindRequest:  return "request";
+        case CanardTransferKindResponse: return "response";
+    }
+    return "?";
+}
+
+// Subjects first, then the requests and the responses of every service id
+constexpr size_t kIngestServiceSlots = CANARD_SERVICE_ID_MAX + 1U;
+constexpr size_t kIngestPortSlots = CANARD_SUBJECT_ID_MAX + 1U + 2U * kIngestServiceSlots;
+
+struct IngestPortErrors {
+    IngestError         error;
+    CanardTransferKind  transfer_kind;
+    CanardPortID        port_id;
+    uint64_t            count;
+};
+
+// Plain snapshot of one or more IngestCounters
+struct IngestStats {
+    bool                                        opened = false;         // false if the pcap file could not be opened
+    uint64_t                                    packets = 0;
+    uint64_t                                    udp_payloads = 0;
+    uint64_t                                    udp_bytes = 0;
+    uint64_t                                    can_frames = 0;
+    uint64_t                                    transfers = 0;
+    std::array<uint64_t, kIngestErrorCount>     errors = {};
+    std::vector<IngestPortErrors>               port_errors;            // sorted by count, largest first
+    double                                      elapsed_seconds = 0.0;
+
+    uint64_t TotalErrors() const {
+        uint64_t total = 0;
+        for (uint64_t count : errors)
+            total += count;
+        return total;
+    }
+    double BytesPerSecond() const {
+        return (elapsed_seconds > 0.0) ? static_cast<double>(udp_bytes) / elapsed_seconds : 0.0;
+    }
+
+    // Files are read in parallel, so the combined elapsed time is the longest one and not the sum
+    IngestStats& operator+=(const IngestStats& other) {
+        opened = opened || other.opened;
+        packets += other.packets;
+        udp_payloads += other.udp_payloads;
+        udp_bytes += other.udp_bytes;
+        can_frames += other.can_frames;
+        transfers += other.transfers;
+        for (size_t i = 0; i < kIngestErrorCount; ++i)
+            errors[i] += other.errors[i];
+        for (const IngestPortErrors& entry : other.port_errors) {
+            auto it = std::find_if(port_errors.begin(), port_errors.end(), [&](const IngestPortErrors& e) {
+                return e.error == entry.error && e.transfer_kind == entry.transfer_kind && e.port_id == entry.port_id;
+            });
+            if (it == port_errors.end())
+                port_errors.push_back(entry);
+            else
+                it->count += entry.count;
+        }
+        std::sort(port_errors.begin(), port_errors.end(), [](const IngestPortErrors& a, const IngestPortErrors& b) {
+            return a.count > b.count;
+        });
+        elapsed_seconds = std::max(elapsed_seconds, other.elapsed_seconds);
+        return *this;
+    }
+};
+
+class IngestCounters {
+public:
+    IngestCounters() : m_start(std::chrono::steady_clock::now()) {
+        for (auto& count : m_errors)
+            count.store(0, std::memory_order_relaxed);
+        for (auto& ports : m_port_errors)
+            for (auto& count : ports)
+                count.store(0, std::memory_order_relaxed);
+    }
+    IngestCounters(const IngestCounters&) = delete;
+    IngestCounters& operator=(const IngestCounters&) = delete;
+
+    inline void CountPacket()                   { Add(m_packets, 1); }
+    inline void CountUdpPayload(size_t bytes)   { Add(m_udp_payloads, 1); Add(m_udp_bytes, bytes); }
+    inline void CountCanFrame()                 { Add(m_can_frames, 1); }
+    inline void CountTransfer()                 { Add(m_transfers, 1); }
+    inline void CountError(IngestError error) {
+        Add(m_errors[static_cast<size_t>(error)], 1);
+    }
+    inline void CountError(IngestError error, CanardTransferKind transfer_kind, CanardPortID port_id) {
+        CountError(error);
+        const size_t slot = PortSlot(transfer_kind, port_id);
+        if (slot < kIngestPortSlots)
+            Add32(m_port_errors[static_cast<size_t>(error)][slot], 1);
+    }
+
+    // Safe to call from any thread while the owner keeps counting
+    IngestStats Snapshot() const {
+        IngestStats stats;
+        stats.opened = m_opened.load(std::memory_order_relaxed);
+        stats.packets = m_packets.load(std::memory_order_relaxed);
+        stats.udp_payloads = m_udp_payloads.load(std::memory_order_relaxed);
+        stats.udp_bytes = m_udp_bytes.load(std::memory_order_relaxed);
+        stats.can_frames = m_can_frames.load(std::memory_order_relaxed);
+        stats.transfers = m_transfers.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kIngestErrorCount; ++i) {
+            stats.errors[i] = m_errors[i].load(std::memory_order_relaxed);
+            if (stats.errors[i] == 0)
+                continue;
+            for (size_t slot = 0; slot < kIngestPortSlots; ++slot) {
+                const uint32_t count = m_port_errors[i][slot].load(std::memory_order_relaxed);
+                if (count > 0) {
+                    const auto [transfer_kind, port_id] = SlotPort(slot);
+                    stats.port_errors.push_back({static_cast<IngestError>(i), transfer_kind, port_id, count});
+                }
+            }
+        }
+        std::sort(stats.port_errors.begin(), stats.port_errors.end(), [](const IngestPortErrors& a, const IngestPortErrors& b) {
+            return a.count > b.count;
+        });
+        const auto end = m_finished.load(std::memory_order_acquire) ? m_end : std::chrono::steady_clock::now();
+        stats.elapsed_seconds = std::chrono::duration<double>(end - m_start).count();
+        return stats;
+    }
+
+    void SetOpened() { m_opened.store(true, std::memory_order_relaxed); }
+    void Finish() {
+        m_end = std::chrono::steady_clock::now();
+        m_finished.store(true, std::memory_order_release);
+    }
+
+private:
+    // kIngestPortSlots for a port id out of range of its transfer kind
+    static size_t PortSlot(CanardTransferKind transfer_kind, CanardPortID port_id) {
+        if (transfer_kind == CanardTransferKindMessage)
+            return (port_id <= CANARD_SUBJECT_ID_MAX) ? port_id : kIngestPortSlots;
+        if (port_id > CANARD_SERVICE_ID_MAX)
+            return kIngestPortSlots;
+        const size_t base = CANARD_SUBJECT_ID_MAX + 1U + ((transfer_kind == CanardTransferKindResponse) ? kIngestServiceSlots : 0U);
+        return base + port_id;
+    }
+    static std::pair<CanardTransferKind, CanardPortID> SlotPort(size_t slot) {
+        if (slot <= CANARD_SUBJECT_ID_MAX)
+            return {CanardTransferKindMessage, static_cast<CanardPortID>(slot)};
+        slot -= CANARD_SUBJECT_ID_MAX + 1U;
+        if (slot < kIngestServiceSlots)
+            return {CanardTransferKindRequest, static_cast<CanardPortID>(slot)};
+        return {CanardTransferKindResponse, static_cast<CanardPortID>(slot - kIngestServiceSlots)};
+    }
+
+    // single writer, so no fetch_add needed
+    static inline void Add(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    static inline void Add32(std::atomic<uint32_t>& counter, uint32_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    // keep the hot counters of the reader thread on their own cache line
+    alignas(64) std::atomic<uint64_t>                   m_packets{0};
+    std::atomic<uint64_t>                               m_udp_payloads{0};
+    std::atomic<uint64_t>                               m_udp_bytes{0};
+    std::atomic<uint64_t>                               m_can_frames{0};
+    std::atomic<uint64_t>                               m_transfers{0};
+    std::array<std::atomic<uint64_t>, kIngestErrorCount> m_errors;
+    std::array<std::array<std::atomic<uint32_t>, kIngestPortSlots>, kIngestErrorCount> m_port_errors;
+
+    std::atomic<bool>                                   m_opened{false};
+    std::atomic<bool>                                   m_finished{false};
+    std::chrono::steady_clock::time_point               m_start;
+    std::chrono::steady_clock::time_point               m_end;
+};
+
+// Counters of the readers currently running, for the live view in the GUI
+class IngestRegistry {
+public:
+    static IngestRegistry& instance() {
+        static IngestRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<IngestCounters> Register() {
+        auto counters = std::make_shared<IngestCounters>();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active.push_back(counters);
+        return counters;
+    }
+    void Unregister(const std::shared_ptr<IngestCounters>& counters) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active.erase(std::remove(m_active.begin(), m_active.end(), counters), m_active.end());
+    }
+
+    IngestStats Snapshot() const {
+        std::vector<std::shared_ptr<IngestCounters>> active;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            active = m_active;
+        }
+        IngestStats stats;
+        for (const auto& counters : active)
+            stats += counters->Snapshot();
+        return stats;
+    }
+    size_t ActiveCount() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_active.size();
+    }
+
+private:
+    mutable std::mutex                              m_mutex;
+    std::vector<std::shared_ptr<IngestCounters>>    m_active;
+};
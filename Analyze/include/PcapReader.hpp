@@ -14,15 +14,21 @@
 
 #include "Deserialization.hpp"
 #include "ExtractUdpMsg.hpp"
+#include "BatchDecoder.hpp"
+#include "IngestStats.hpp"
 
 //#define DEBUG
 #include "debug.hpp"
 
-int readPcapFileToDataManager(
+// Counts into counters and returns their final snapshot, stats.opened is false if the file could not
+// be opened. The caller registers the counters with IngestRegistry for a live view, and unregisters
+// them once it holds the returned stats so the file is never missing from its totals.
+IngestStats readPcapFileToDataManager(
     const std::string& pcap_file_path,
     DataManager& uber_data_manager,
     DeserializationMap& deserialization_map,
-    std::atomic<bool>& stop_flag)
+    std::atomic<bool>& stop_flag,
+    IngestCounters& counters)
 {
     // Check if the file ends with ".pcap"
     if (pcap_file_path.rfind(".pcap") != (pcap_file_path.size() - 5)) {
@@ -30,22 +36,22 @@ int readPcapFileToDataManager(
         exit(-1);
     }
 
-    // Initialize Canard instance
-    CanardInstance canard_instance = canardInit(memoryAllocate, memoryFree);
-    canard_instance.node_id = CANARD_NODE_ID_UNSET;
+    // Initialize Canard instance and subscribe every port we can deserialize
+    auto rx_context = std::make_unique<CanardRxContext>(deserialization_map);
 
     // Open the pcap file
     pcpp::IFileReaderDevice* reader = pcpp::IFileReaderDevice::getReader(pcap_file_path.c_str());
     if (!reader->open()) {
         std::cerr << "Error opening the pcap file" << std::endl;
-        return 1;
+        delete reader;
+        counters.Finish();
+        return counters.Snapshot();
     }
+    counters.SetOpened();
 
     DataManager sub_data_manager;
-
-    // Counters
-    size_t packet_count = 0;
-    size_t udp_packet_count = 0;
+    DataManagerSink sink(sub_data_manager, "CAN_2024-11-20(142000)");
+    BatchDecoder batch_decoder(sub_data_manager, "CAN_2024-11-20(142000)");
 
     pcpp::RawPacket rawPacket;
     while (true) {
@@ -54,22 +60,24 @@ int readPcapFileToDataManager(
         bool hasPacket = reader->getNextPacket(rawPacket);
         if (!hasPacket)
             break;
-        packet_count++;
+        counters.CountPacket();
         pcpp::Packet parsedPacket(&rawPacket, false, pcpp::UDP);
         pcpp::UdpLayer* udpLayer = parsedPacket.getLayerOfType<pcpp::UdpLayer>();
         if (udpLayer == nullptr)
             continue;
-        udp_packet_count++;
         const uint8_t* payload = udpLayer->getLayerPayload();
         size_t payloadLength = udpLayer->getLayerPayloadSize();
+        counters.CountUdpPayload(payloadLength);
         size_t offset = 0;
         while (offset < payloadLength) {
-            if (!extractUdpMsg(payload, payloadLength, offset, canard_instance, sub_data_manager, deserialization_map)) {
+            if (!extractUdpMsg(payload, payloadLength, offset, *rx_context, batch_decoder, sink, counters)) {
                 break;
             }
         }
     }
 
+    batch_decoder.Flush();
+
     Channel<float>* channel_ptr = uber_data_manager.GetChannelPtr<float>("CAN_2024-11-20(142000)", "vcu", "INS.vx");
     if (!channel_ptr) {printf("could not find channel\n");} 
     else {printf("size=%ld\n", channel_ptr->m_value.size());}
@@ -80,5 +88,18 @@ int readPcapFileToDataManager(
     reader->close();
     delete reader;
 
-    return 0;
+    // the pool is per thread, so this is the high-water mark of this file only
+    CanardBlockPool::local().printStats(pcap_file_path.c_str());
+
+    counters.Finish();
+    IngestStats stats = counters.Snapshot();
+    printf("%s: %lu packets, %lu udp payloads, %lu can frames, %lu transfers, %lu errors, %.1f MB/s\n",
+        pcap_file_path.c_str(),
+        static_cast<unsigned long>(stats.packets),
+        static_cast<unsigned long>(stats.udp_payloads),
+        static_cast<unsigned long>(stats.can_frames),
+        static_cast<unsigned long>(stats.transfers),
+        static_cast<unsigned long>(stats.TotalErrors()),
+        stats.BytesPerSecond() / 1e6);
+    return stats;
 }
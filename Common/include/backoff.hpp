@@ -0,0 +1,18 @@
+// backoff.hpp
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Exponential backoff with full jitter: attempt n waits a uniform random time in
+// [0, min(max_seconds, base_seconds * 2^n)], so clients that failed together do not retry together.
+inline double jitteredBackoffSeconds(unsigned attempt, double base_seconds, double max_seconds, std::mt19937_64& rng) {
+    const double ceiling = std::min(max_seconds, base_seconds * std::ldexp(1.0, static_cast<int>(std::min(attempt, 30U))));
+    return std::uniform_real_distribution<double>(0.0, ceiling)(rng);
+}
+
+// Transient failures worth retrying: no response at all, request timeout, rate limiting and server errors
+inline bool isRetryableHttpStatus(unsigned int status) {
+    return status == 0 || status == 408 || status == 429 || (status >= 500 && status < 600);
+}
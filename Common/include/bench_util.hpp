@@ -0,0 +1,108 @@
+// bench_util.hpp
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Minimal benchmark harness shared by the Analyze and Relay bench targets.
+//
+// A benchmark body processes a known number of CAN frames and bytes per call. It is repeated until
+// min_seconds have passed, and the result is reported as frames/s and bytes/s so runs on
+// different captures stay comparable.
+
+struct BenchResult {
+    std::string name;
+    uint64_t    iterations = 0;
+    uint64_t    frames = 0;         // total over all iterations
+    uint64_t    bytes = 0;          // total over all iterations
+    double      seconds = 0.0;
+
+    double FramesPerSecond() const { return seconds > 0.0 ? frames / seconds : 0.0; }
+    double BytesPerSecond() const { return seconds > 0.0 ? bytes / seconds : 0.0; }
+    double NanosecondsPerIteration() const { return iterations > 0 ? seconds * 1e9 / iterations : 0.0; }
+};
+
+// Keeps the compiler from dropping a computation whose result is otherwise unused
+template <typename T>
+inline void benchDoNotOptimize(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// body() is called at least once and until min_seconds have passed, everything not being measured belongs outside it
+template <typename Body>
+BenchResult benchRun(const std::string& name, uint64_t frames_per_iteration, uint64_t bytes_per_iteration, double min_seconds, Body&& body) {
+    using clock = std::chrono::steady_clock;
+    BenchResult result;
+    result.name = name;
+    const auto start = clock::now();
+    auto now = start;
+    do {
+        body();
+        ++result.iterations;
+        now = clock::now();
+    } while (std::chrono::duration<double>(now - start).count() < min_seconds);
+    result.seconds = std::chrono::duration<double>(now - start).count();
+    result.frames = frames_per_iteration * result.iterations;
+    result.bytes = bytes_per_iteration * result.iterations;
+    std::cerr << name << ": " << result.FramesPerSecond() / 1e6 << " Mframes/s, " << result.BytesPerSecond() / 1e6 << " MB/s\n";
+    return result;
+}
+
+// For bodies that need untimed setup before every iteration (e.g. PrepareData on fresh unsorted data)
+template <typename Setup, typename Body>
+BenchResult benchRunWithSetup(const std::string& name, uint64_t frames_per_iteration, uint64_t bytes_per_iteration, double min_seconds, Setup&& setup, Body&& body) {
+    using clock = std::chrono::steady_clock;
+    BenchResult result;
+    result.name = name;
+    do {
+        setup();
+        const auto start = clock::now();
+        body();
+        result.seconds += std::chrono::duration<double>(clock::now() - start).count();
+        ++result.iterations;
+    } while (result.seconds < min_seconds);
+    result.frames = frames_per_iteration * result.iterations;
+    result.bytes = bytes_per_iteration * result.iterations;
+    std::cerr << name << ": " << result.FramesPerSecond() / 1e6 << " Mframes/s, " << result.BytesPerSecond() / 1e6 << " MB/s\n";
+    return result;
+}
+
+inline nlohmann::json benchToJson(const std::vector<BenchResult>& results, const nlohmann::json& context) {
+    nlohmann::json j;
+    j["context"] = context;
+    j["benchmarks"] = nlohmann::json::array();
+    for (const BenchResult& result : results) {
+        j["benchmarks"].push_back({
+            {"name",            result.name},
+            {"iterations",      result.iterations},
+            {"frames",          result.frames},
+            {"bytes",           result.bytes},
+            {"seconds",         result.seconds},
+            {"frames_per_s",    result.FramesPerSecond()},
+            {"bytes_per_s",     result.BytesPerSecond()},
+            {"ns_per_iteration", result.NanosecondsPerIteration()},
+        });
+    }
+    return j;
+}
+
+// Writes to path, or to stdout if path is empty
+inline bool benchWriteJson(const nlohmann::json& j, const std::string& path) {
+    if (path.empty()) {
+        std::cout << j.dump(2) << std::endl;
+        return true;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Error: could not open " << path << " for writing\n";
+        return false;
+    }
+    out << j.dump(2) << std::endl;
+    return true;
+}
@@ -0,0 +1,200 @@
+// canard_pool.hpp
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "libcanard/canard.h"
+
+// O(1) size-classed block pool for libcanard (o1heap style), shared by Analyze and Relay.
+//
+// libcanard allocates one payload buffer per reassembled transfer and one session per
+// (port, source node) pair, and frees them again almost immediately. Going to malloc/new for
+// each of those is visible in profiles and fragments the heap over a multi-million transfer log.
+// Blocks are power-of-two sized from kMinBlockSize to kMaxBlockSize and are recycled through a
+// free list per size class, so both allocate and free are a bit scan plus a list push/pop.
+// Requests larger than kMaxBlockSize fall through to malloc and are counted separately.
+//
+// The pool is thread local: every libcanard instance lives on a single thread, and blocks must
+// be freed on the thread that allocated them. Use canardPoolAllocate/canardPoolFree as the
+// canardInit callbacks.
+class CanardBlockPool {
+public:
+    static constexpr size_t kHeaderSize = 16;               // keeps payloads max_align_t aligned
+    static constexpr size_t kMinBlockSize = 32;
+    static constexpr size_t kMaxBlockSize = 8192;
+    static constexpr size_t kSlabSize = 64 * 1024;
+    static constexpr size_t kClassCount = 9;                // 32, 64, ..., 8192
+    static constexpr uint32_t kLargeClass = 0xFFFFFFFFU;
+
+    struct ClassStats {
+        size_t block_size = 0;
+        size_t blocks_in_use = 0;
+        size_t peak_blocks_in_use = 0;
+        size_t blocks_reserved = 0;
+    };
+
+    struct Stats {
+        size_t allocations = 0;
+        size_t frees = 0;
+        size_t large_allocations = 0;                       // served by malloc, above kMaxBlockSize
+        size_t failed_allocations = 0;
+        size_t bytes_in_use = 0;                            // requested bytes currently allocated
+        size_t peak_bytes_in_use = 0;                       // high-water mark of bytes_in_use
+        size_t bytes_reserved = 0;                          // slab memory taken from the system
+        std::array<ClassStats, kClassCount> classes = {};
+    };
+
+    CanardBlockPool() {
+        for (size_t i = 0; i < kClassCount; ++i) {
+            m_stats.classes[i].block_size = kMinBlockSize << i;
+        }
+    }
+    ~CanardBlockPool() = default;
+
+    CanardBlockPool(const CanardBlockPool&) = delete;
+    CanardBlockPool& operator=(const CanardBlockPool&) = delete;
+    CanardBlockPool(CanardBlockPool&&) = delete;
+    CanardBlockPool& operator=(CanardBlockPool&&) = delete;
+
+    static CanardBlockPool& local() {
+        thread_local CanardBlockPool pool;
+        return pool;
+    }
+
+    void* allocate(size_t amount) {
+        if (amount == 0) {
+            return nullptr;
+        }
+        const size_t needed = amount + kHeaderSize;
+        BlockHeader* header = nullptr;
+        uint32_t size_class = kLargeClass;
+
+        if (needed <= kMaxBlockSize) {
+            size_class = classForSize(needed);
+            FreeBlock*& head = m_free_lists[size_class];
+            if (head == nullptr && !refill(size_class)) {
+                ++m_stats.failed_allocations;
+                return nullptr;
+            }
+            FreeBlock* block = head;
+            head = block->next;
+            header = reinterpret_cast<BlockHeader*>(block);
+            ClassStats& class_stats = m_stats.classes[size_class];
+            if (++class_stats.blocks_in_use > class_stats.peak_blocks_in_use) {
+                class_stats.peak_blocks_in_use = class_stats.blocks_in_use;
+            }
+        } else {
+            header = static_cast<BlockHeader*>(std::malloc(needed));
+            if (header == nullptr) {
+                ++m_stats.failed_allocations;
+                return nullptr;
+            }
+            ++m_stats.large_allocations;
+        }
+
+        header->owner = this;
+        header->size_class = size_class;
+        header->amount = static_cast<uint32_t>(amount);
+
+        ++m_stats.allocations;
+        m_stats.bytes_in_use += amount;
+        if (m_stats.bytes_in_use > m_stats.peak_bytes_in_use) {
+            m_stats.peak_bytes_in_use = m_stats.bytes_in_use;
+        }
+        return reinterpret_cast<uint8_t*>(header) + kHeaderSize;
+    }
+
+    void free(void* pointer) {
+        if (pointer == nullptr) {
+            return;
+        }
+        BlockHeader* header = reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(pointer) - kHeaderSize);
+        assert(header->owner == this && "libcanard block freed on a different thread than it was allocated on");
+
+        ++m_stats.frees;
+        m_stats.bytes_in_use -= header->amount;
+
+        if (header->size_class == kLargeClass) {
+            std::free(header);
+            return;
+        }
+        --m_stats.classes[header->size_class].blocks_in_use;
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+        block->next = m_free_lists[header->size_class];
+        m_free_lists[header->size_class] = block;
+    }
+
+    const Stats& stats() const { return m_stats; }
+
+    void printStats(const char* label) const {
+        printf("%s canard pool: %zu allocs, %zu large, %zu failed, peak %zu bytes in use, %zu bytes reserved\n",
+               label, m_stats.allocations, m_stats.large_allocations, m_stats.failed_allocations,
+               m_stats.peak_bytes_in_use, m_stats.bytes_reserved);
+        for (const ClassStats& c : m_stats.classes) {
+            if (c.blocks_reserved > 0) {
+                printf("    %5zu B blocks: peak %zu in use, %zu reserved\n", c.block_size, c.peak_blocks_in_use, c.blocks_reserved);
+            }
+        }
+    }
+
+private:
+    struct BlockHeader {
+        CanardBlockPool*    owner;
+        uint32_t            size_class;
+        uint32_t            amount;
+    };
+    static_assert(sizeof(BlockHeader) <= kHeaderSize, "BlockHeader does not fit in kHeaderSize");
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static uint32_t classForSize(size_t needed) {
+        if (needed <= kMinBlockSize) {
+            return 0;
+        }
+        // ceil(log2(needed)) - log2(kMinBlockSize)
+        const uint32_t bits = 64U - static_cast<uint32_t>(__builtin_clzll(static_cast<unsigned long long>(needed - 1U)));
+        return bits - 5U;
+    }
+
+    bool refill(uint32_t size_class) {
+        const size_t block_size = kMinBlockSize << size_class;
+        const size_t slab_size = (block_size > kSlabSize) ? block_size : kSlabSize;
+        std::unique_ptr<uint8_t[]> slab(new (std::nothrow) uint8_t[slab_size]);
+        if (!slab) {
+            return false;
+        }
+        const size_t block_count = slab_size / block_size;
+        for (size_t i = 0; i < block_count; ++i) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab.get() + i * block_size);
+            block->next = m_free_lists[size_class];
+            m_free_lists[size_class] = block;
+        }
+        m_stats.bytes_reserved += slab_size;
+        m_stats.classes[size_class].blocks_reserved += block_count;
+        m_slabs.push_back(std::move(slab));
+        return true;
+    }
+
+    std::array<FreeBlock*, kClassCount>     m_free_lists = {};
+    std::vector<std::unique_ptr<uint8_t[]>> m_slabs;
+    Stats                                   m_stats;
+};
+
+inline void* canardPoolAllocate(CanardInstance* const ins, const size_t amount) {
+    (void)ins;
+    return CanardBlockPool::local().allocate(amount);
+}
+
+inline void canardPoolFree(CanardInstance* const ins, void* const pointer) {
+    (void)ins;
+    CanardBlockPool::local().free(pointer);
+}
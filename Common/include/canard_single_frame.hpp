@@ -0,0 +1,145 @@
+// canard_single_frame.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "libcanard/canard.h"
+
+// Single-frame transfer fast path, shared by Analyze and Relay.
+//
+// Nearly every vcu message fits in one CAN-FD frame. For those, canardRxAccept only adds a session
+// lookup, a payload allocation and copy, and the memory_free that follows. This inspects the tail
+// byte and, for a frame that both starts and ends a transfer with the toggle bit set, fills
+// out_transfer with a payload pointer straight into the frame (tail byte excluded). It applies the
+// same CAN ID validity and destination rules as libcanard. Anything else (multi-frame transfers,
+// malformed frames, services addressed to another node) returns false and must go through
+// canardRxAccept as before.
+//
+// A transfer accepted here does not own its payload: it is only valid as long as the frame is,
+// and must NOT be passed to memory_free.
+//
+// libcanard also drops duplicates (the same transfer again from a redundant interface or a
+// retransmit) per session, i.e. per transfer kind, port and source node. CanardSingleFrameSessions
+// keeps the same state for the transfers taken here: canardAcceptSingleFrame returns Duplicate for a
+// transfer whose transfer-ID is the one last accepted on its session, unless the transfer-ID timeout
+// has passed since. Anonymous transfers have no session and are never duplicates, as in libcanard.
+
+// Cyphal/CAN tail byte: start_of_transfer | end_of_transfer | toggle | transfer_id (5 bits)
+constexpr uint8_t kCanardTailStartOfTransfer = 0x80U;
+constexpr uint8_t kCanardTailEndOfTransfer   = 0x40U;
+constexpr uint8_t kCanardTailToggle          = 0x20U;
+constexpr uint8_t kCanardTailTransferIdMask  = 0x1FU;
+constexpr uint8_t kCanardTailSingleFrame     = kCanardTailStartOfTransfer | kCanardTailEndOfTransfer | kCanardTailToggle;
+
+inline bool canardTryAcceptSingleFrame(const CanardInstance& ins,
+                                       const CanardMicrosecond timestamp_usec,
+                                       const CanardFrame& frame,
+                                       CanardRxTransfer& out_transfer)
+{
+    if (frame.payload_size == 0U || frame.payload == nullptr) {
+        return false;
+    }
+    const uint8_t* const payload = static_cast<const uint8_t*>(frame.payload);
+    const uint8_t tail = payload[frame.payload_size - 1U];
+    if ((tail & kCanardTailSingleFrame) != kCanardTailSingleFrame) {
+        return false;
+    }
+
+    const uint32_t can_id = frame.extended_can_id;
+    const bool is_service = ((can_id >> 25U) & 1U) != 0U;
+    const bool reserved_23 = ((can_id >> 23U) & 1U) != 0U;
+    if (reserved_23) {
+        return false;
+    }
+
+    CanardTransferMetadata& metadata = out_transfer.metadata;
+    metadata.priority = static_cast<CanardPriority>((can_id >> 26U) & 0x7U);
+    metadata.transfer_id = static_cast<CanardTransferID>(tail & kCanardTailTransferIdMask);
+
+    if (!is_service) {
+        const bool reserved_7 = ((can_id >> 7U) & 1U) != 0U;
+        if (reserved_7) {
+            return false;
+        }
+        const bool is_anonymous = ((can_id >> 24U) & 1U) != 0U;
+        metadata.transfer_kind = CanardTransferKindMessage;
+        metadata.port_id = static_cast<CanardPortID>((can_id >> 8U) & CANARD_SUBJECT_ID_MAX);
+        metadata.remote_node_id = is_anonymous ? static_cast<CanardNodeID>(CANARD_NODE_ID_UNSET)
+                                               : static_cast<CanardNodeID>(can_id & CANARD_NODE_ID_MAX);
+    } else {
+        const CanardNodeID source = static_cast<CanardNodeID>(can_id & CANARD_NODE_ID_MAX);
+        const CanardNodeID destination = static_cast<CanardNodeID>((can_id >> 7U) & CANARD_NODE_ID_MAX);
+        // libcanard drops service transfers that are not addressed to the local node
+        if (source == destination || destination != ins.node_id) {
+            return false;
+        }
+        metadata.transfer_kind = (((can_id >> 24U) & 1U) != 0U) ? CanardTransferKindRequest : CanardTransferKindResponse;
+        metadata.port_id = static_cast<CanardPortID>((can_id >> 14U) & CANARD_SERVICE_ID_MAX);
+        metadata.remote_node_id = source;
+    }
+
+    out_transfer.timestamp_usec = timestamp_usec;
+    out_transfer.payload_size = frame.payload_size - 1U;
+    out_transfer.payload = const_cast<uint8_t*>(payload);
+    return true;
+}
+
+enum class CanardSingleFrameResult : uint8_t {
+    NotSingleFrame,     // go through canardRxAccept
+    Accepted,
+    Duplicate,          // already delivered, drop it
+};
+
+class CanardSingleFrameSessions {
+public:
+    explicit CanardSingleFrameSessions(CanardMicrosecond transfer_id_timeout_usec = CANARD_DEFAULT_TRANSFER_ID_TIMEOUT_USEC)
+        : m_transfer_id_timeout_usec(transfer_id_timeout_usec) {}
+
+    // false if transfer repeats the last one of its session, otherwise it becomes the last one
+    bool Accept(const CanardRxTransfer& transfer) {
+        const CanardTransferMetadata& metadata = transfer.metadata;
+        if (metadata.remote_node_id > CANARD_NODE_ID_MAX) {
+            return true;
+        }
+        const uint32_t key = (static_cast<uint32_t>(metadata.transfer_kind) << 24U)
+                           | (static_cast<uint32_t>(metadata.port_id) << 8U)
+                           | static_cast<uint32_t>(metadata.remote_node_id);
+        Session& session = m_sessions[key];
+        const bool timed_out = transfer.timestamp_usec > session.timestamp_usec
+                            && transfer.timestamp_usec - session.timestamp_usec > m_transfer_id_timeout_usec;
+        if (session.valid && !timed_out && session.transfer_id == metadata.transfer_id) {
+            return false;
+        }
+        session.valid = true;
+        session.transfer_id = metadata.transfer_id;
+        session.timestamp_usec = transfer.timestamp_usec;
+        return true;
+    }
+
+    void Clear() { m_sessions.clear(); }
+
+private:
+    struct Session {
+        CanardMicrosecond   timestamp_usec = 0;
+        CanardTransferID    transfer_id = 0;
+        bool                valid = false;
+    };
+
+    CanardMicrosecond                       m_transfer_id_timeout_usec;
+    std::unordered_map<uint32_t, Session>   m_sessions;
+};
+
+// canardTryAcceptSingleFrame with duplicate rejection
+inline CanardSingleFrameResult canardAcceptSingleFrame(const CanardInstance& ins,
+                                                       CanardSingleFrameSessions& sessions,
+                                                       const CanardMicrosecond timestamp_usec,
+                                                       const CanardFrame& frame,
+                                                       CanardRxTransfer& out_transfer)
+{
+    if (!canardTryAcceptSingleFrame(ins, timestamp_usec, frame, out_transfer)) {
+        return CanardSingleFrameResult::NotSingleFrame;
+    }
+    return sessions.Accept(out_transfer) ? CanardSingleFrameResult::Accepted : CanardSingleFrameResult::Duplicate;
+}
@@ -0,0 +1,276 @@
+// delta_stream.hpp
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "wire_format.hpp"
+
+// The relay.delta websocket encoding: the schema once, then only the values that changed.
+//
+// Every field of every port becomes a channel with a 16 bit id, numbered in the order of the packed
+// schema (see Converter::packedSchema). A client gets Schema() as one text frame on connect, then a
+// keyframe with the current value of every channel, then binary frames built from packed records:
+//
+//   uint8 kind (0 delta, 1 keyframe), uint64 base_timestamp_us,
+//   then records: int32 timestamp_offset_us, uint16 pair_count, pair_count x (uint16 channel_id, value)
+//
+// all little-endian, the value at the width of the channel type. A record holds the fields of one
+// message that differ from the last value sent on the stream, a message without changes is left out.
+// A keyframe frame starts with one record of every channel that has a value (offset 0), after that
+// its records are deltas like in any other frame. The first frame after keyframe_interval_seconds is
+// a keyframe, so a client that missed something is back in sync within that time.
+//
+// All delta clients share one encoder: they all get every frame, so their last values are the same
+// once a new client has had its keyframe. The encoder is not thread safe.
+
+struct DeltaStreamConfig {
+    double keyframe_interval_seconds = 1.0;
+};
+
+class DeltaStreamEncoder {
+public:
+    enum FrameKind : uint8_t { kDelta = 0, kKeyframe = 1 };
+
+    DeltaStreamEncoder(const nlohmann::json& packed_schema, const DeltaStreamConfig& config = DeltaStreamConfig())
+        : m_config(config)
+    {
+        for (const auto& [port_key, port] : packed_schema.at("ports").items()) {
+            Port layout;
+            layout.first_channel = m_channels.size();
+            size_t offset = wire::kPackedHeaderSize;
+            for (const auto& field : port.at("fields")) {
+                Channel channel;
+                channel.name = field.at("name").get<std::string>();
+                channel.type = field.at("type").get<std::string>();
+                channel.measure = port.at("measure").get<std::string>();
+                channel.port_id = static_cast<uint16_t>(std::stoul(port_key));
+                channel.width = typeWidth(channel.type);
+                channel.offset = offset;
+                offset += channel.width;
+                m_channels.push_back(channel);
+            }
+            layout.channel_count = m_channels.size() - layout.first_channel;
+            layout.record_size = offset;
+            m_ports[static_cast<uint16_t>(std::stoul(port_key))] = layout;
+        }
+        m_values.assign(m_channels.size(), 0);
+        m_known.assign(m_channels.size(), false);
+    }
+
+    size_t Channels() const { return m_channels.size(); }
+
+    // Sent as text frame to a client on connect
+    nlohmann::json Schema() const {
+        nlohmann::json schema;
+        schema["format"] = wire::subprotocol(WireFormat::Delta);
+        schema["version"] = 1;
+        schema["keyframe_interval_ms"] = static_cast<int64_t>(m_config.keyframe_interval_seconds * 1000.0);
+        nlohmann::json& channels = schema["channels"];
+        channels = nlohmann::json::array();
+        for (size_t id = 0; id < m_channels.size(); ++id) {
+            const Channel& channel = m_channels[id];
+            channels.push_back({{"id", id}, {"name", channel.name}, {"measure", channel.measure}, {"port_id", channel.port_id}, {"type", channel.type}});
+        }
+        return schema;
+    }
+
+    // One packed record (see wire_format.hpp), false if its port is not in the schema or it is too short
+    bool AddRecord(const char* record, size_t size) {
+        if (size < wire::kPackedHeaderSize) {
+            return false;
+        }
+        const uint16_t port_id = readLittleEndian<uint16_t>(record + 2);
+        const uint64_t timestamp = readLittleEndian<uint64_t>(record + 8);
+        const auto port = m_ports.find(port_id);
+        if (port == m_ports.end() || size < port->second.record_size) {
+            return false;
+        }
+
+        if (m_frame.empty()) {
+            beginFrame(timestamp);
+        }
+        const size_t record_start = m_frame.size();
+        wire::appendLittleEndian(m_frame, timestampOffset(timestamp));
+        wire::appendLittleEndian(m_frame, uint16_t(0));
+        uint16_t pairs = 0;
+        for (size_t id = port->second.first_channel; id < port->second.first_channel + port->second.channel_count; ++id) {
+            const Channel& channel = m_channels[id];
+            uint64_t value = 0;
+            std::memcpy(&value, record + channel.offset, channel.width);
+            if (m_known[id] && m_values[id] == value) {
+                continue;
+            }
+            m_values[id] = value;
+            m_known[id] = true;
+            appendPair(id, value);
+            pairs++;
+        }
+        if (pairs == 0) {
+            m_frame.resize(record_start);
+        } else {
+            patchPairCount(m_frame, record_start, pairs);
+            m_records++;
+        }
+        m_latest_timestamp = timestamp;
+        return true;
+    }
+
+    // Every record in packed, which holds records back to back
+    size_t AddRecords(const std::string& packed) {
+        size_t added = 0;
+        size_t offset = 0;
+        while (offset + sizeof(uint16_t) <= packed.size()) {
+            const uint16_t record_size = readLittleEndian<uint16_t>(packed.data() + offset);
+            if (record_size == 0 || offset + record_size > packed.size()) {
+                break;
+            }
+            added += AddRecord(packed.data() + offset, record_size) ? 1 : 0;
+            offset += record_size;
+        }
+        return added;
+    }
+
+    // The frame built since the last call, empty if no value changed. A keyframe that is due without
+    // any change comes out as a frame of its own.
+    std::string TakeFrame() {
+        if (m_frame.empty() && keyframeDue() && m_latest_timestamp > 0) {
+            beginFrame(m_latest_timestamp);
+        }
+        if (m_records == 0 && m_frame.size() <= kFrameHeaderSize) {
+            m_frame.clear();
+            return std::string();
+        }
+        std::string frame = std::move(m_frame);
+        m_frame = std::string();
+        m_frame.reserve(frame.capacity());
+        m_records = 0;
+        return frame;
+    }
+
+    // A keyframe of the current values alone, for a client that joins between frames
+    std::string Keyframe() const {
+        std::string frame;
+        frame.push_back(static_cast<char>(kKeyframe));
+        wire::appendLittleEndian(frame, m_latest_timestamp);
+        appendStateRecord(frame);
+        return frame;
+    }
+
+private:
+    struct Channel {
+        std::string name;
+        std::string type;
+        std::string measure;
+        uint16_t    port_id = 0;
+        size_t      width = 0;
+        size_t      offset = 0;         // in the packed record
+    };
+
+    struct Port {
+        size_t first_channel = 0;
+        size_t channel_count = 0;
+        size_t record_size = 0;
+    };
+
+    static constexpr size_t kFrameHeaderSize = 1 + sizeof(uint64_t);
+
+    static size_t typeWidth(const std::string& type) {
+        if (type == "bool" || type == "u8" || type == "i8") {
+            return 1;
+        } else if (type == "u16" || type == "i16") {
+            return 2;
+        } else if (type == "u32" || type == "i32" || type == "f32") {
+            return 4;
+        }
+        return 8;
+    }
+
+    template <typename T>
+    static T readLittleEndian(const char* data) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, data, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        }
+#endif
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    bool keyframeDue() const {
+        return std::chrono::steady_clock::now() - m_last_keyframe >= std::chrono::duration<double>(m_config.keyframe_interval_seconds);
+    }
+
+    void beginFrame(uint64_t base_timestamp) {
+        m_base_timestamp = base_timestamp;
+        const bool keyframe = keyframeDue();
+        m_frame.push_back(static_cast<char>(keyframe ? kKeyframe : kDelta));
+        wire::appendLittleEndian(m_frame, base_timestamp);
+        if (keyframe) {
+            appendStateRecord(m_frame);
+            m_last_keyframe = std::chrono::steady_clock::now();
+        }
+    }
+
+    int32_t timestampOffset(uint64_t timestamp) const {
+        const int64_t offset = static_cast<int64_t>(timestamp - m_base_timestamp);
+        if (offset > std::numeric_limits<int32_t>::max()) {
+            return std::numeric_limits<int32_t>::max();
+        } else if (offset < std::numeric_limits<int32_t>::min()) {
+            return std::numeric_limits<int32_t>::min();
+        }
+        return static_cast<int32_t>(offset);
+    }
+
+    // every channel with a value, at offset 0
+    void appendStateRecord(std::string& frame) const {
+        const size_t record_start = frame.size();
+        wire::appendLittleEndian(frame, int32_t(0));
+        wire::appendLittleEndian(frame, uint16_t(0));
+        uint16_t pairs = 0;
+        for (size_t id = 0; id < m_channels.size(); ++id) {
+            if (!m_known[id]) {
+                continue;
+            }
+            wire::appendLittleEndian(frame, static_cast<uint16_t>(id));
+            frame.append(reinterpret_cast<const char*>(&m_values[id]), m_channels[id].width);
+            pairs++;
+        }
+        patchPairCount(frame, record_start, pairs);
+    }
+
+    // the count is only known after the pairs, its place was kept free
+    static void patchPairCount(std::string& frame, size_t record_start, uint16_t pairs) {
+        frame[record_start + sizeof(int32_t)] = static_cast<char>(pairs & 0xFF);
+        frame[record_start + sizeof(int32_t) + 1] = static_cast<char>(pairs >> 8);
+    }
+
+    void appendPair(size_t id, uint64_t value) {
+        wire::appendLittleEndian(m_frame, static_cast<uint16_t>(id));
+        m_frame.append(reinterpret_cast<const char*>(&value), m_channels[id].width);
+    }
+
+    DeltaStreamConfig                       m_config;
+    std::vector<Channel>                    m_channels;
+    std::unordered_map<uint16_t, Port>      m_ports;
+    // last value sent per channel, the raw little-endian bytes of the packed record
+    std::vector<uint64_t>                   m_values;
+    std::vector<bool>                       m_known;
+
+    std::string                             m_frame;
+    size_t                                  m_records = 0;
+    uint64_t                                m_base_timestamp = 0;
+    uint64_t                                m_latest_timestamp = 0;
+    std::chrono::steady_clock::time_point   m_last_keyframe;
+};
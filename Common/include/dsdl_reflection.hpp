@@ -0,0 +1,162 @@
+// dsdl_reflection.hpp
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "libcanard/canard.h"
+
+// Compile-time field reflection for nunavut generated DSDL structs, shared by Analyze and Relay.
+//
+// Each supported struct gets one DsdlType<T> specialization (see vcu_reflection.hpp) that names its
+// port, its generated (de)serialization functions and a constexpr tuple of its fields. Every sink
+// (DataManager channels, JSON, line protocol, ...) is then written once as a generic visitor and
+// instantiated per type, so per-message dispatch is a table lookup plus fully inlined field writes,
+// with no std::function and no switch over port ids.
+//
+// A DsdlType<T> specialization provides:
+//     static constexpr CanardPortID       port_id;
+//     static constexpr CanardTransferKind transfer_kind;
+//     static constexpr size_t             extent;                      // <TYPE>_EXTENT_BYTES_
+//     static constexpr size_t             serialization_buffer_size;   // <TYPE>_SERIALIZATION_BUFFER_SIZE_BYTES_
+//     static constexpr const char*        measure;
+//     static void   initialize(T*);
+//     static int8_t serialize(const T*, uint8_t*, size_t*);
+//     static int8_t deserialize(T*, const uint8_t*, size_t*);
+//     static constexpr auto fields = std::make_tuple(dsdlField<V>("Name.field", &T::field), ...);
+
+// value_type is the channel type Analyze stores the field as, normally the member type. It differs
+// where the channel has historically used another type than the generated struct.
+template <typename Struct, typename Member, typename Value>
+struct DsdlField {
+    using struct_type = Struct;
+    using member_type = Member;
+    using value_type = Value;
+
+    const char*         name;
+    Member Struct::*    member;
+};
+
+template <typename Value, typename Struct, typename Member>
+constexpr DsdlField<Struct, Member, Value> dsdlField(const char* name, Member Struct::* member) {
+    return {name, member};
+}
+
+template <typename T>
+struct DsdlType;
+
+template <typename... Ts>
+struct DsdlTypeList {};
+
+template <typename... Lists>
+struct DsdlTypeListConcat;
+template <typename... As, typename... Bs>
+struct DsdlTypeListConcat<DsdlTypeList<As...>, DsdlTypeList<Bs...>> {
+    using type = DsdlTypeList<As..., Bs...>;
+};
+
+template <typename T>
+struct DsdlTypeTag {
+    using type = T;
+};
+
+template <typename T>
+using DsdlFieldsTuple = std::decay_t<decltype(DsdlType<T>::fields)>;
+
+template <typename T>
+constexpr size_t dsdlFieldCount() {
+    return std::tuple_size<DsdlFieldsTuple<T>>::value;
+}
+
+// visitor(size_t index, const DsdlField<...>& field), for code that works on the descriptors themselves
+template <typename T, typename Visitor, size_t... I>
+inline void dsdlForEachFieldImpl(Visitor& visitor, std::index_sequence<I...>) {
+    (visitor(I, std::get<I>(DsdlType<T>::fields)), ...);
+}
+template <typename T, typename Visitor>
+inline void dsdlForEachField(Visitor&& visitor) {
+    dsdlForEachFieldImpl<T>(visitor, std::make_index_sequence<dsdlFieldCount<T>()>{});
+}
+
+// visitor(size_t index, const DsdlField<...>& field, const member_type& value)
+// Sinks that keep typed state (channels) convert to field value_type themselves, sinks that only
+// format (JSON, line protocol) take the member as generated.
+template <typename T, typename Visitor, size_t... I>
+inline void dsdlVisitFieldsImpl(const T& obj, Visitor& visitor, std::index_sequence<I...>) {
+    (visitor(I, std::get<I>(DsdlType<T>::fields), obj.*(std::get<I>(DsdlType<T>::fields).member)), ...);
+}
+template <typename T, typename Visitor>
+inline void dsdlVisitFields(const T& obj, Visitor&& visitor) {
+    dsdlVisitFieldsImpl(obj, visitor, std::make_index_sequence<dsdlFieldCount<T>()>{});
+}
+
+// reader(const DsdlField<...>& field, member_type& out) -> bool, stops at the first field the reader cannot provide
+template <typename T, typename Reader, size_t... I>
+inline bool dsdlAssignFieldsImpl(T& obj, Reader& reader, std::index_sequence<I...>) {
+    return (reader(std::get<I>(DsdlType<T>::fields), obj.*(std::get<I>(DsdlType<T>::fields).member)) && ...);
+}
+template <typename T, typename Reader>
+inline bool dsdlAssignFields(T& obj, Reader&& reader) {
+    return dsdlAssignFieldsImpl(obj, reader, std::make_index_sequence<dsdlFieldCount<T>()>{});
+}
+
+template <typename T>
+inline bool dsdlDeserialize(const CanardRxTransfer& transfer, T& obj) {
+    size_t inout_buffer_size_bytes = transfer.payload_size;
+    return DsdlType<T>::deserialize(&obj, static_cast<const uint8_t*>(transfer.payload), &inout_buffer_size_bytes) >= 0;
+}
+
+// f(DsdlTypeTag<T>) for every type in the list
+template <typename... Ts, typename F>
+inline void dsdlForEachType(DsdlTypeList<Ts...>, F&& f) {
+    (f(DsdlTypeTag<Ts>{}), ...);
+}
+
+// Index of the first field of T when the fields of every type in List are laid out back to back.
+// Lets a sink keep per-field state (e.g. cached channel pointers) in one flat array.
+template <typename T, typename List>
+struct DsdlFieldBase;
+template <typename T, typename... Rest>
+struct DsdlFieldBase<T, DsdlTypeList<T, Rest...>> : std::integral_constant<size_t, 0> {};
+template <typename T, typename U, typename... Rest>
+struct DsdlFieldBase<T, DsdlTypeList<U, Rest...>>
+    : std::integral_constant<size_t, dsdlFieldCount<U>() + DsdlFieldBase<T, DsdlTypeList<Rest...>>::value> {};
+
+template <typename List>
+struct DsdlTotalFieldCount;
+template <typename... Ts>
+struct DsdlTotalFieldCount<DsdlTypeList<Ts...>> : std::integral_constant<size_t, (dsdlFieldCount<Ts>() + ... + 0)> {};
+
+// Compile-time checks on a type list, for static_assert
+template <typename... Ts>
+constexpr bool dsdlHasPort(DsdlTypeList<Ts...>, CanardPortID port_id, CanardTransferKind transfer_kind) {
+    return ((DsdlType<Ts>::port_id == port_id && DsdlType<Ts>::transfer_kind == transfer_kind) || ... || false);
+}
+// the port tables below are indexed by port id alone, so two types on one port would overwrite each other
+template <typename... Ts>
+constexpr bool dsdlPortsUnique(DsdlTypeList<Ts...>) {
+    constexpr CanardPortID ports[] = {DsdlType<Ts>::port_id..., 0};
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+        for (size_t j = i + 1; j < sizeof...(Ts); ++j) {
+            if (ports[i] == ports[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// port_id indexed handler table, make(DsdlTypeTag<T>) returns the handler for T. Unlisted ports stay nullptr.
+template <typename Handler, typename... Ts, typename Make>
+std::array<Handler, CANARD_SUBJECT_ID_MAX + 1U> dsdlMakePortTable(DsdlTypeList<Ts...> types, Make&& make) {
+    std::array<Handler, CANARD_SUBJECT_ID_MAX + 1U> table = {};
+    dsdlForEachType(types, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        table[DsdlType<T>::port_id] = make(tag);
+    });
+    return table;
+}
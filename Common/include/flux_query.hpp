@@ -0,0 +1,286 @@
+// flux_query.hpp
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reading data back out of InfluxDB.
+//
+// buildFluxQuery() turns a FluxQuery (bucket, measure, log_id and fields) into Flux text for
+// /api/v2/query. AnnotatedCsvReader parses the annotated CSV response incrementally: Feed() takes the
+// response in whatever chunks it arrives, complete rows are handed to the row callback as views into
+// the chunk (only a row split across two chunks, or a quoted cell with escapes, is copied), so the
+// memory used does not grow with the size of the response.
+
+struct FluxQuery {
+    std::string                 bucket;
+    std::string                 measure;            // empty for every measurement
+    std::string                 log_id;             // empty for every log
+    std::vector<std::string>    fields;             // empty for every field
+    std::string                 start = "0";        // Flux time or duration, e.g. "0", "-1h", "2024-11-20T14:00:00Z"
+    std::string                 stop;               // empty for now
+};
+
+namespace flux {
+
+// "text" as a Flux string literal
+inline void appendStringLiteral(std::string& out, std::string_view text) {
+    out.push_back('"');
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char c = text[i];
+        if (c == '"' || c == '\\' || (c == '$' && i + 1 < text.size() && text[i + 1] == '{')) {
+            out.push_back('\\');
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+inline bool parseDigits(std::string_view text, size_t pos, size_t count, int& value) {
+    if (pos + count > text.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = pos; i < pos + count; ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+inline int64_t daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t year_of_era = year - era * 400;
+    const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// RFC 3339 as InfluxDB writes it ("2024-11-20T14:20:00.123456789Z", fraction optional, "Z" or
+// "+hh:mm") to nanoseconds since the epoch
+inline bool parseRfc3339Nanos(std::string_view text, int64_t& nanos) {
+    int year, month, day, hour, minute, second;
+    if (!parseDigits(text, 0, 4, year) || text.size() < 20 || text[4] != '-' || !parseDigits(text, 5, 2, month)
+        || text[7] != '-' || !parseDigits(text, 8, 2, day) || (text[10] != 'T' && text[10] != ' ')
+        || !parseDigits(text, 11, 2, hour) || text[13] != ':' || !parseDigits(text, 14, 2, minute)
+        || text[16] != ':' || !parseDigits(text, 17, 2, second)) {
+        return false;
+    }
+    size_t pos = 19;
+    int64_t fraction = 0;
+    if (text[pos] == '.') {
+        int digits = 0;
+        for (++pos; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; ++pos) {
+            if (digits < 9) {
+                fraction = fraction * 10 + (text[pos] - '0');
+                digits++;
+            }
+        }
+        for (; digits < 9; ++digits) {
+            fraction *= 10;
+        }
+    }
+    int64_t offset_seconds = 0;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+        int offset_hour, offset_minute;
+        if (!parseDigits(text, pos + 1, 2, offset_hour) || !parseDigits(text, pos + 4, 2, offset_minute)) {
+            return false;
+        }
+        offset_seconds = (offset_hour * 3600 + offset_minute * 60) * (text[pos] == '+' ? 1 : -1);
+    } else if (pos >= text.size() || (text[pos] != 'Z' && text[pos] != 'z')) {
+        return false;
+    }
+    const int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset_seconds;
+    nanos = seconds * 1000000000 + fraction;
+    return true;
+}
+
+} // namespace flux
+
+inline std::string buildFluxQuery(const FluxQuery& query) {
+    std::string flux = "from(bucket: ";
+    flux::appendStringLiteral(flux, query.bucket);
+    flux += ")\n  |> range(start: " + (query.start.empty() ? std::string("0") : query.start);
+    if (!query.stop.empty()) {
+        flux += ", stop: " + query.stop;
+    }
+    flux += ")\n";
+    if (!query.measure.empty()) {
+        flux += "  |> filter(fn: (r) => r._measurement == ";
+        flux::appendStringLiteral(flux, query.measure);
+        flux += ")\n";
+    }
+    if (!query.log_id.empty()) {
+        flux += "  |> filter(fn: (r) => r.log_id == ";
+        flux::appendStringLiteral(flux, query.log_id);
+        flux += ")\n";
+    }
+    if (!query.fields.empty()) {
+        flux += "  |> filter(fn: (r) => ";
+        for (size_t i = 0; i < query.fields.size(); ++i) {
+            flux += (i == 0) ? "r._field == " : " or r._field == ";
+            flux::appendStringLiteral(flux, query.fields[i]);
+        }
+        flux += ")\n";
+    }
+    // only what is needed to rebuild a channel, the fewer columns the smaller the response
+    flux += "  |> keep(columns: [\"_time\", \"_value\", \"_measurement\", \"_field\"])\n";
+    return flux;
+}
+
+// Annotated CSV as returned by /api/v2/query with the "datatype" annotation: a table starts with
+// annotation rows ("#datatype,string,long,..."), then a header row, then data rows, and ends at an
+// empty line. The first column is the annotation column and is empty in header and data rows.
+class AnnotatedCsvReader {
+public:
+    struct Table {
+        std::vector<std::string>    columns;
+        std::vector<std::string>    datatypes;      // from #datatype, empty if the response had none
+
+        int ColumnIndex(std::string_view name) const {
+            for (size_t i = 0; i < columns.size(); ++i) {
+                if (columns[i] == name) {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+    };
+
+    // A new table schema, followed by its rows. The cells are only valid during the call.
+    using TableFn = std::function<void(const Table& table)>;
+    using RowFn = std::function<void(const std::vector<std::string_view>& cells)>;
+
+    AnnotatedCsvReader(TableFn on_table, RowFn on_row) : m_on_table(std::move(on_table)), m_on_row(std::move(on_row)) {}
+
+    void Feed(const char* data, size_t size) {
+        size_t line_start = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const char c = data[i];
+            if (c == '"') {
+                m_in_quotes = !m_in_quotes;     // "" inside quotes toggles twice
+            } else if (c == '\n' && !m_in_quotes) {
+                if (m_partial.empty()) {
+                    processLine(std::string_view(data + line_start, i - line_start));
+                } else {
+                    m_partial.append(data + line_start, i - line_start);
+                    processLine(m_partial);
+                    m_partial.clear();
+                }
+                line_start = i + 1;
+            }
+        }
+        m_partial.append(data + line_start, size - line_start);
+    }
+
+    // The last row may come without a newline
+    void Finish() {
+        if (!m_partial.empty()) {
+            processLine(m_partial);
+            m_partial.clear();
+        }
+        m_in_quotes = false;
+    }
+
+    uint64_t Rows() const { return m_rows; }
+
+private:
+    void processLine(std::string_view line) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            // the next table brings its own annotations and header
+            m_expect_header = true;
+            m_table.datatypes.clear();
+            return;
+        }
+        splitCells(line);
+        if (!m_cells.empty() && !m_cells[0].empty() && m_cells[0][0] == '#') {
+            if (m_cells[0] == "#datatype") {
+                m_table.datatypes.assign(m_cells.begin(), m_cells.end());
+            }
+            m_expect_header = true;
+            return;
+        }
+        if (m_expect_header) {
+            m_table.columns.assign(m_cells.begin(), m_cells.end());
+            m_expect_header = false;
+            m_on_table(m_table);
+            return;
+        }
+        m_rows++;
+        m_on_row(m_cells);
+    }
+
+    void splitCells(std::string_view line) {
+        m_cells.clear();
+        size_t unescaped_used = 0;
+        size_t pos = 0;
+        while (true) {
+            if (pos < line.size() && line[pos] == '"') {
+                // quoted cell, "" stands for one quote
+                size_t end = pos + 1;
+                bool escaped = false;
+                while (end < line.size()) {
+                    if (line[end] == '"') {
+                        if (end + 1 < line.size() && line[end + 1] == '"') {
+                            escaped = true;
+                            end += 2;
+                            continue;
+                        }
+                        break;
+                    }
+                    end++;
+                }
+                std::string_view cell = line.substr(pos + 1, end - pos - 1);
+                if (escaped) {
+                    if (unescaped_used == m_unescaped.size()) {
+                        m_unescaped.emplace_back();
+                    }
+                    std::string& out = m_unescaped[unescaped_used++];
+                    out.clear();
+                    for (size_t i = 0; i < cell.size(); ++i) {
+                        out.push_back(cell[i]);
+                        if (cell[i] == '"') {
+                            i++;
+                        }
+                    }
+                    cell = out;
+                }
+                m_cells.push_back(cell);
+                pos = line.find(',', end);
+            } else {
+                const size_t end = line.find(',', pos);
+                m_cells.push_back(line.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+                pos = end;
+            }
+            if (pos == std::string_view::npos || pos >= line.size()) {
+                break;
+            }
+            pos++;
+            if (pos == line.size()) {
+                m_cells.emplace_back();     // trailing empty cell
+                break;
+            }
+        }
+    }
+
+    TableFn                         m_on_table;
+    RowFn                           m_on_row;
+    Table                           m_table;
+    std::string                     m_partial;          // a row split across chunks
+    std::vector<std::string_view>   m_cells;
+    std::deque<std::string>         m_unescaped;        // reused between rows, a deque so views stay valid as it grows
+    bool                            m_in_quotes = false;
+    bool                            m_expect_header = true;
+    uint64_t                        m_rows = 0;
+};
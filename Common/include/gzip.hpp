@@ -0,0 +1,168 @@
+// gzip.hpp
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+
+// Streaming gzip compression of HTTP request bodies (Content-Encoding: gzip) with zlib.
+//
+// GzipCompressor takes the input in as many pieces as the caller likes and appends the compressed
+// stream to one output string, so a batch can be compressed while it is being produced. The z_stream
+// is reset rather than reallocated between bodies, keep one compressor per thread. GzipDecompressor
+// is the receiving side, for servers and tests. Link with -lz.
+
+class GzipCompressor {
+public:
+    // level 1 (fastest) to 9 (smallest), Z_DEFAULT_COMPRESSION is 6
+    explicit GzipCompressor(int level = Z_BEST_SPEED) {
+        m_stream.zalloc = Z_NULL;
+        m_stream.zfree = Z_NULL;
+        m_stream.opaque = Z_NULL;
+        // 15 window bits + 16 selects the gzip wrapper instead of raw zlib
+        m_ok = deflateInit2(&m_stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~GzipCompressor() {
+        if (m_ok) {
+            deflateEnd(&m_stream);
+        }
+    }
+    GzipCompressor(const GzipCompressor&) = delete;
+    GzipCompressor& operator=(const GzipCompressor&) = delete;
+
+    // Starts a new gzip member written to the end of out
+    bool Begin(std::string& out) {
+        m_out = &out;
+        m_finished = false;
+        return m_ok && deflateReset(&m_stream) == Z_OK;
+    }
+
+    bool Append(const char* data, size_t size) {
+        return Deflate(data, size, Z_NO_FLUSH);
+    }
+    bool Append(const std::string& data) {
+        return Append(data.data(), data.size());
+    }
+
+    // Writes the gzip trailer, out holds a complete stream afterwards
+    bool Finish() {
+        const bool ok = Deflate(nullptr, 0, Z_FINISH);
+        m_finished = true;
+        return ok;
+    }
+
+    // Compresses a whole body into out (replacing its contents)
+    bool Compress(const char* data, size_t size, std::string& out) {
+        out.clear();
+        // line protocol usually shrinks by 5-10x, start there and let Deflate grow it
+        out.reserve(size / 4 + 64);
+        return Begin(out) && Append(data, size) && Finish();
+    }
+    bool Compress(const std::string& data, std::string& out) {
+        return Compress(data.data(), data.size(), out);
+    }
+
+private:
+    bool Deflate(const char* data, size_t size, int flush) {
+        if (!m_ok || m_out == nullptr || m_finished) {
+            return false;
+        }
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        // avail_in is 32 bits, feed larger inputs in slices
+        size_t remaining = size;
+        do {
+            const uInt slice = static_cast<uInt>(std::min<size_t>(remaining, UINT32_MAX));
+            m_stream.avail_in = slice;
+            remaining -= slice;
+            const int slice_flush = (remaining == 0) ? flush : Z_NO_FLUSH;
+            int result = Z_OK;
+            do {
+                const size_t used = m_out->size();
+                const size_t room = std::max<size_t>(deflateBound(&m_stream, m_stream.avail_in), 4096);
+                m_out->resize(used + room);
+                m_stream.next_out = reinterpret_cast<Bytef*>(&(*m_out)[used]);
+                m_stream.avail_out = static_cast<uInt>(room);
+                result = deflate(&m_stream, slice_flush);
+                m_out->resize(used + room - m_stream.avail_out);
+                if (result == Z_STREAM_ERROR) {
+                    return false;
+                }
+            } while (m_stream.avail_out == 0 || (slice_flush == Z_FINISH && result != Z_STREAM_END));
+        } while (remaining > 0);
+        return true;
+    }
+
+    z_stream        m_stream = {};
+    std::string*    m_out = nullptr;
+    bool            m_ok = false;
+    bool            m_finished = false;
+};
+
+class GzipDecompressor {
+public:
+    GzipDecompressor() {
+        m_stream.zalloc = Z_NULL;
+        m_stream.zfree = Z_NULL;
+        m_stream.opaque = Z_NULL;
+        // 15 window bits + 32 detects a gzip or zlib wrapper
+        m_ok = inflateInit2(&m_stream, 15 + 32) == Z_OK;
+    }
+    ~GzipDecompressor() {
+        if (m_ok) {
+            inflateEnd(&m_stream);
+        }
+    }
+    GzipDecompressor(const GzipDecompressor&) = delete;
+    GzipDecompressor& operator=(const GzipDecompressor&) = delete;
+
+    // Decompresses a whole body into out (replacing its contents). Concatenated gzip members are
+    // decompressed one after the other. Fails on corrupt or truncated input, and once out would grow
+    // past max_size, so a small body cannot expand without bound.
+    bool Decompress(const char* data, size_t size, std::string& out, size_t max_size = SIZE_MAX) {
+        out.clear();
+        if (!m_ok || inflateReset(&m_stream) != Z_OK) {
+            return false;
+        }
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        size_t remaining = size;
+        int result = Z_OK;
+        do {
+            if (m_stream.avail_in == 0) {
+                const uInt slice = static_cast<uInt>(std::min<size_t>(remaining, UINT32_MAX));
+                m_stream.avail_in = slice;
+                remaining -= slice;
+            }
+            const size_t used = out.size();
+            const size_t room = std::max<size_t>(std::min<size_t>(size * 4, 1 << 20), 4096);
+            if (used >= max_size) {
+                return false;
+            }
+            out.resize(used + std::min(room, max_size - used));
+            m_stream.next_out = reinterpret_cast<Bytef*>(&out[used]);
+            m_stream.avail_out = static_cast<uInt>(out.size() - used);
+            result = inflate(&m_stream, Z_NO_FLUSH);
+            out.resize(out.size() - m_stream.avail_out);
+            if (result == Z_STREAM_END && (m_stream.avail_in > 0 || remaining > 0)) {
+                // another member follows
+                if (inflateReset(&m_stream) != Z_OK) {
+                    return false;
+                }
+                result = Z_OK;
+            } else if (result == Z_BUF_ERROR && m_stream.avail_in == 0 && remaining == 0) {
+                return false;       // truncated
+            } else if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                return false;
+            }
+        } while (result != Z_STREAM_END);
+        return true;
+    }
+    bool Decompress(const std::string& data, std::string& out, size_t max_size = SIZE_MAX) {
+        return Decompress(data.data(), data.size(), out, max_size);
+    }
+
+private:
+    z_stream        m_stream = {};
+    bool            m_ok = false;
+};
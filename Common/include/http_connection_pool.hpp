@@ -0,0 +1,376 @@
+// http_connection_pool.hpp
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http.hpp>
+
+// Persistent HTTP/1.1 connections to one host, shared by the InfluxDB clients of Analyze and Relay.
+//
+// The endpoint is resolved once and cached, connections are kept alive and handed back to an idle
+// list after every request, and response framing (Content-Length or chunked) is left to Beast's
+// parser instead of reading to EOF. A request on an idle connection the server has already closed
+// is retried once on a fresh connection. Nothing is printed, callers read the status of each
+// response and the counters in HttpPoolStats.
+//
+// Connecting, writing the request and every read of the response each have config.timeout to finish.
+// A step that takes longer fails the request like a transport error (status 0, timed_out set) and the
+// connection is closed, so a stalled server costs a caller one timeout instead of blocking it for good.
+// The deadline is a beast::tcp_stream expiry, which only async operations honour: each step is started
+// async and run to completion on the calling thread on the connection's own io_context.
+//
+// request() is blocking and safe to call from several threads, each call holds its own connection.
+// requestStreaming() hands a successful response body to a callback as it arrives instead of
+// collecting it, for responses too large to hold (e.g. query results).
+
+struct HttpResponse {
+    unsigned int    status = 0;             // 0 if no response was received
+    std::string     body;
+    std::string     error;                  // transport error, empty if a response was received
+    double          latency_seconds = 0.0;
+    double          retry_after_seconds = 0.0;  // Retry-After in seconds, 0 if absent or given as a date
+    uint64_t        streamed_bytes = 0;         // body bytes handed to a requestStreaming() callback
+    bool            timed_out = false;          // a step took longer than HttpPoolConfig::timeout
+
+    bool ok() const { return status >= 200 && status < 300; }
+};
+
+struct HttpPoolStats {
+    uint64_t    requests = 0;
+    uint64_t    responses_2xx = 0;
+    uint64_t    responses_4xx = 0;
+    uint64_t    responses_5xx = 0;
+    uint64_t    responses_other = 0;
+    uint64_t    transport_errors = 0;
+    uint64_t    timeouts = 0;           // also counted in transport_errors unless part of a body was delivered
+    uint64_t    connections_opened = 0;
+    uint64_t    connections_reused = 0;
+    uint64_t    resolves = 0;
+    uint64_t    request_bytes = 0;      // bodies only
+    uint64_t    response_bytes = 0;     // bodies only
+    double      latency_total_seconds = 0.0;
+    double      latency_max_seconds = 0.0;
+    unsigned    last_error_status = 0;
+    std::string last_error;             // transport error or the body of the last non 2xx response, truncated
+
+    double MeanLatencySeconds() const {
+        const uint64_t completed = requests - transport_errors;
+        return completed > 0 ? latency_total_seconds / completed : 0.0;
+    }
+};
+
+struct HttpPoolConfig {
+    size_t                      max_idle_connections = 4;
+    std::chrono::milliseconds   timeout{30000};     // per connect, request write and response read
+};
+
+class HttpConnectionPool {
+public:
+    using Headers = std::vector<std::pair<std::string, std::string>>;
+
+    HttpConnectionPool(const std::string& host, const std::string& port, const HttpPoolConfig& config = HttpPoolConfig())
+        : m_host(host), m_port(port), m_config(config) {}
+
+    HttpConnectionPool(const HttpConnectionPool&) = delete;
+    HttpConnectionPool& operator=(const HttpConnectionPool&) = delete;
+
+    HttpResponse request(boost::beast::http::verb method, const std::string& target, const Headers& headers, const std::string& body = std::string()) {
+        return execute(method, target, headers, body, nullptr);
+    }
+
+    // Returns false from on_body to stop reading, the connection is then closed. Non 2xx bodies
+    // (error messages) are collected in HttpResponse::body as usual.
+    using BodyChunkFn = std::function<bool(const char* data, size_t size)>;
+    HttpResponse requestStreaming(boost::beast::http::verb method, const std::string& target, const Headers& headers, const std::string& body, const BodyChunkFn& on_body) {
+        return execute(method, target, headers, body, &on_body);
+    }
+
+    HttpPoolStats Stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    size_t IdleConnectionCount() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_idle.size();
+    }
+
+    const std::string& Host() const { return m_host; }
+    const std::string& Port() const { return m_port; }
+
+private:
+    struct Connection {
+        Connection() : stream(io_context) {}
+        boost::asio::io_context         io_context;     // runs this connection's operations only
+        boost::beast::tcp_stream        stream;
+        boost::beast::flat_buffer       buffer;
+        bool                            keep_alive = false;
+    };
+
+    static constexpr size_t kMaxErrorBodyLength = 256;
+    static constexpr size_t kStreamChunkSize = 64 * 1024;
+
+    HttpResponse execute(boost::beast::http::verb method, const std::string& target, const Headers& headers, const std::string& body, const BodyChunkFn* on_body) {
+        namespace http = boost::beast::http;
+
+        http::request<http::string_body> req{method, target, 11};
+        req.set(http::field::host, m_host + ":" + m_port);
+        for (const auto& [name, value] : headers) {
+            req.set(name, value);
+        }
+        req.keep_alive(true);
+        if (!body.empty() || method == http::verb::post || method == http::verb::put) {
+            req.body() = body;
+            req.prepare_payload();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        HttpResponse response;
+        bool reused = false;
+        bool delivered = false;     // part of the body went to on_body, the request cannot be repeated
+        std::unique_ptr<Connection> connection = acquire(reused, response);
+        if (connection) {
+            boost::system::error_code ec = on_body ? roundTripStreaming(*connection, req, response, *on_body, delivered) : roundTrip(*connection, req, response);
+            // the server may have closed an idle connection since we last used it, that is not a failure
+            if (ec && reused && !delivered && isStaleConnectionError(ec)) {
+                connection.reset();
+                reused = false;
+                connection = acquire(reused, response, true);
+                if (connection) {
+                    ec = on_body ? roundTripStreaming(*connection, req, response, *on_body, delivered) : roundTrip(*connection, req, response);
+                }
+            }
+            if (ec) {
+                response.error = ec.message();
+                response.timed_out = (ec == boost::beast::error::timeout);
+                if (!delivered) {
+                    response.status = 0;
+                }
+                connection.reset();
+            }
+        }
+        response.latency_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        release(std::move(connection), response, body.size());
+        return response;
+    }
+
+    static double parseRetryAfter(boost::beast::string_view value) {
+        double seconds = 0.0;
+        for (char c : value) {
+            if (c < '0' || c > '9') {
+                return 0.0;
+            }
+            seconds = seconds * 10.0 + (c - '0');
+        }
+        return seconds;
+    }
+
+    static bool isStaleConnectionError(const boost::system::error_code& ec) {
+        return ec == boost::beast::http::error::end_of_stream
+            || ec == boost::asio::error::eof
+            || ec == boost::asio::error::connection_reset
+            || ec == boost::asio::error::connection_aborted
+            || ec == boost::asio::error::broken_pipe;
+    }
+
+    // Starts one async operation of the connection, operation(handler), and runs it to completion
+    template <typename Operation>
+    static boost::system::error_code run(Connection& connection, Operation&& operation) {
+        boost::system::error_code result;
+        connection.io_context.restart();
+        operation([&result](boost::system::error_code ec, auto&&...) { result = ec; });
+        connection.io_context.run();
+        return result;
+    }
+
+    // An idle connection if there is one, otherwise a new one to the cached endpoints
+    std::unique_ptr<Connection> acquire(bool& reused, HttpResponse& response, bool force_new = false) {
+        boost::asio::ip::tcp::resolver::results_type endpoints;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!force_new && !m_idle.empty()) {
+                std::unique_ptr<Connection> connection = std::move(m_idle.back());
+                m_idle.pop_back();
+                m_stats.connections_reused++;
+                reused = true;
+                return connection;
+            }
+            endpoints = m_endpoints;
+        }
+
+        boost::system::error_code ec;
+        if (endpoints.empty()) {
+            endpoints = resolve(ec);
+            if (ec) {
+                response.error = ec.message();
+                return nullptr;
+            }
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->stream.expires_after(m_config.timeout);
+        ec = run(*connection, [&](auto handler) { connection->stream.async_connect(endpoints, handler); });
+        if (ec) {
+            // the address may have changed, resolve again on the next request
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_endpoints = boost::asio::ip::tcp::resolver::results_type();
+            response.error = ec.message();
+            response.timed_out = (ec == boost::beast::error::timeout);
+            return nullptr;
+        }
+        connection->stream.socket().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.connections_opened++;
+        reused = false;
+        return connection;
+    }
+
+    boost::asio::ip::tcp::resolver::results_type resolve(boost::system::error_code& ec) {
+        boost::asio::ip::tcp::resolver resolver(m_io_context);
+        auto endpoints = resolver.resolve(m_host, m_port, ec);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.resolves++;
+        if (!ec) {
+            m_endpoints = endpoints;
+        }
+        return endpoints;
+    }
+
+    boost::system::error_code roundTrip(Connection& connection, boost::beast::http::request<boost::beast::http::string_body>& req, HttpResponse& response) {
+        namespace http = boost::beast::http;
+        connection.stream.expires_after(m_config.timeout);
+        boost::system::error_code ec = run(connection, [&](auto handler) { http::async_write(connection.stream, req, handler); });
+        if (ec) {
+            return ec;
+        }
+        http::response<http::string_body> res;
+        connection.stream.expires_after(m_config.timeout);
+        ec = run(connection, [&](auto handler) { http::async_read(connection.stream, connection.buffer, res, handler); });
+        if (ec) {
+            return ec;
+        }
+        response.status = res.result_int();
+        response.retry_after_seconds = parseRetryAfter(res[http::field::retry_after]);
+        response.body = std::move(res.body());
+        response.error.clear();
+        connection.keep_alive = res.keep_alive();
+        return ec;
+    }
+
+    // The deadline is per read, so a large body that keeps arriving is not cut off
+    boost::system::error_code roundTripStreaming(Connection& connection, boost::beast::http::request<boost::beast::http::string_body>& req,
+                                                 HttpResponse& response, const BodyChunkFn& on_body, bool& delivered) {
+        namespace http = boost::beast::http;
+        connection.stream.expires_after(m_config.timeout);
+        boost::system::error_code ec = run(connection, [&](auto handler) { http::async_write(connection.stream, req, handler); });
+        if (ec) {
+            return ec;
+        }
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        connection.stream.expires_after(m_config.timeout);
+        ec = run(connection, [&](auto handler) { http::async_read_header(connection.stream, connection.buffer, parser, handler); });
+        if (ec) {
+            return ec;
+        }
+        const unsigned int status = parser.get().result_int();
+        const bool ok = status >= 200 && status < 300;
+        response.retry_after_seconds = parseRetryAfter(parser.get()[http::field::retry_after]);
+        response.body.clear();
+        connection.keep_alive = false;
+
+        char chunk[kStreamChunkSize];
+        while (!parser.is_done()) {
+            parser.get().body().data = chunk;
+            parser.get().body().size = sizeof(chunk);
+            connection.stream.expires_after(m_config.timeout);
+            ec = run(connection, [&](auto handler) { http::async_read(connection.stream, connection.buffer, parser, handler); });
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            if (ec) {
+                return ec;
+            }
+            const size_t size = sizeof(chunk) - parser.get().body().size;
+            if (size == 0) {
+                continue;
+            }
+            if (!ok) {
+                response.body.append(chunk, size);
+                continue;
+            }
+            delivered = true;
+            response.status = status;   // a failure from here on still reports the status
+            response.streamed_bytes += size;
+            if (!on_body(chunk, size)) {
+                return ec;              // stopped early, the rest of the body is never read
+            }
+        }
+        response.status = status;
+        response.error.clear();
+        connection.keep_alive = parser.get().keep_alive();
+        return ec;
+    }
+
+    void release(std::unique_ptr<Connection> connection, const HttpResponse& response, size_t request_bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.requests++;
+        m_stats.request_bytes += request_bytes;
+        if (response.timed_out) {
+            m_stats.timeouts++;
+        }
+        if (response.status == 0) {
+            m_stats.transport_errors++;
+            m_stats.last_error_status = 0;
+            m_stats.last_error = response.error;
+            return;
+        }
+        m_stats.response_bytes += response.body.size() + response.streamed_bytes;
+        m_stats.latency_total_seconds += response.latency_seconds;
+        m_stats.latency_max_seconds = std::max(m_stats.latency_max_seconds, response.latency_seconds);
+        if (response.status >= 200 && response.status < 300) {
+            m_stats.responses_2xx++;
+        } else {
+            if (response.status >= 400 && response.status < 500) {
+                m_stats.responses_4xx++;
+            } else if (response.status >= 500 && response.status < 600) {
+                m_stats.responses_5xx++;
+            } else {
+                m_stats.responses_other++;
+            }
+            m_stats.last_error_status = response.status;
+            m_stats.last_error = response.body.substr(0, kMaxErrorBodyLength);
+        }
+        if (connection && connection->keep_alive && m_idle.size() < m_config.max_idle_connections) {
+            m_idle.push_back(std::move(connection));
+        }
+    }
+
+    std::string                                     m_host;
+    std::string                                     m_port;
+    HttpPoolConfig                                  m_config;
+
+    // only used for resolving, which is synchronous, so one io_context serves every thread
+    boost::asio::io_context                         m_io_context;
+
+    mutable std::mutex                              m_mutex;
+    boost::asio::ip::tcp::resolver::results_type    m_endpoints;
+    std::vector<std::unique_ptr<Connection>>        m_idle;
+    HttpPoolStats                                   m_stats;
+};
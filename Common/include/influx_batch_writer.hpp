@@ -0,0 +1,377 @@
+// influx_batch_writer.hpp
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backoff.hpp"
+#include "gzip.hpp"
+#include "http_connection_pool.hpp"
+
+// Background writer for line protocol batches.
+//
+// Producers hand encoded batches to Enqueue() and return to encoding the next one, while a fixed
+// number of worker threads keep that many /api/v2/write requests in flight over a shared
+// HttpConnectionPool. The queue is bounded by the bytes it holds: once max_queued_bytes is reached a
+// producer either blocks until the workers catch up, or, with QueueFullPolicy::Spill, writes the
+// batch to spill_directory and queues only its path. Spill files are named after a random id of the
+// writer and a sequence number, so writers sharing the directory (in one process or several, or after a
+// restart) never overwrite each other's files. A spilled batch that fails for good stays on disk, its
+// file is only removed once it has been written. Progress() is cheap enough to call every frame.
+// With gzip_level set, each worker compresses the batch it is about to send, so compression of one
+// batch overlaps with the network I/O of the others.
+//
+// Transient failures (no response, 408, 429, 5xx) are retried up to max_retries times with jittered
+// exponential backoff, waiting at least as long as the server's Retry-After. The number of requests
+// in flight adapts to the server (AIMD): it is halved on 429/503, transport errors or responses slower
+// than target_latency_seconds, and grows by one after a full window of fast successes.
+
+enum class QueueFullPolicy {
+    Block,      // Enqueue waits for room
+    Spill,      // Enqueue writes the batch to disk, falls back to Block if that fails
+};
+
+struct InfluxBatchWriterConfig {
+    size_t                  connections = 4;                        // worker threads = requests in flight
+    size_t                  max_queued_bytes = 64 * 1024 * 1024;    // batch bodies held in memory
+    QueueFullPolicy         queue_full_policy = QueueFullPolicy::Block;
+    std::filesystem::path   spill_directory = std::filesystem::temp_directory_path() / "influx_spill";
+    int                     gzip_level = 0;                         // 0 sends plain bodies, 1-9 gzip
+    unsigned                max_retries = 5;                        // per batch, after the first attempt
+    double                  backoff_base_seconds = 0.25;
+    double                  backoff_max_seconds = 30.0;
+    double                  target_latency_seconds = 2.0;           // slower responses reduce concurrency
+};
+
+struct InfluxWriteBatch {
+    std::string                 bucket;
+    std::string                 precision = "ms";
+    std::string                 body;
+    std::function<void(bool)>   on_done;        // optional, called from a worker with the final outcome
+};
+
+struct InfluxWriteProgress {
+    uint64_t    batches_enqueued = 0;
+    uint64_t    batches_written = 0;
+    uint64_t    batches_failed = 0;
+    uint64_t    batches_spilled = 0;
+    uint64_t    retries = 0;
+    uint64_t    bytes_enqueued = 0;
+    uint64_t    bytes_written = 0;
+    uint64_t    bytes_sent = 0;             // on the wire, after compression
+    uint64_t    bytes_failed = 0;
+    uint64_t    bytes_in_memory = 0;        // queued bodies, not counting spilled ones
+    size_t      in_flight = 0;                // includes batches waiting out a backoff
+    size_t      concurrency_limit = 0;
+    double      elapsed_seconds = 0.0;      // since the first batch of the current run was enqueued
+
+    uint64_t BatchesRemaining() const { return batches_enqueued - batches_written - batches_failed; }
+    uint64_t BytesRemaining() const { return bytes_enqueued - bytes_written - bytes_failed; }
+    bool Idle() const { return BatchesRemaining() == 0; }
+    double BytesPerSecond() const {
+        return (elapsed_seconds > 0.0) ? static_cast<double>(bytes_written) / elapsed_seconds : 0.0;
+    }
+};
+
+class InfluxBatchWriter {
+public:
+    InfluxBatchWriter(HttpConnectionPool& pool, const std::string& org, const std::string& token, const InfluxBatchWriterConfig& config = InfluxBatchWriterConfig())
+        : m_pool(pool), m_org(org), m_token(token), m_config(config), m_spill_prefix(randomSpillPrefix())
+    {
+        if (m_config.connections == 0) {
+            m_config.connections = 1;
+        }
+        m_progress.concurrency_limit = m_config.connections;
+        for (size_t i = 0; i < m_config.connections; ++i) {
+            m_workers.emplace_back(&InfluxBatchWriter::workerLoop, this);
+        }
+    }
+
+    // Writes everything still queued before returning
+    ~InfluxBatchWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closing = true;
+        }
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+        m_closing_cv.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    InfluxBatchWriter(const InfluxBatchWriter&) = delete;
+    InfluxBatchWriter& operator=(const InfluxBatchWriter&) = delete;
+
+    // Returns false only if the writer is shutting down
+    bool Enqueue(InfluxWriteBatch batch) {
+        if (batch.body.empty()) {
+            return true;
+        }
+        const size_t size = batch.body.size();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_closing) {
+            return false;
+        }
+        if (isFull(size) && m_config.queue_full_policy == QueueFullPolicy::Spill) {
+            const uint64_t sequence = m_spill_sequence++;
+            lock.unlock();
+            std::filesystem::path spill_path = spill(batch.body, sequence);
+            lock.lock();
+            if (!spill_path.empty()) {
+                Entry entry;
+                entry.bucket = std::move(batch.bucket);
+                entry.precision = std::move(batch.precision);
+                entry.spill_path = std::move(spill_path);
+                entry.on_done = std::move(batch.on_done);
+                entry.size = size;
+                push(std::move(entry));
+                m_progress.batches_spilled++;
+                lock.unlock();
+                m_not_empty.notify_one();
+                return true;
+            }
+        }
+        m_not_full.wait(lock, [&] { return m_closing || !isFull(size); });
+        if (m_closing) {
+            return false;
+        }
+        Entry entry;
+        entry.bucket = std::move(batch.bucket);
+        entry.precision = std::move(batch.precision);
+        entry.body = std::move(batch.body);
+        entry.on_done = std::move(batch.on_done);
+        entry.size = size;
+        m_progress.bytes_in_memory += size;
+        push(std::move(entry));
+        lock.unlock();
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // Blocks until every batch enqueued so far has been written or has failed
+    void Flush() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [&] { return m_queue.empty() && m_progress.in_flight == 0; });
+    }
+
+    InfluxWriteProgress Progress() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        InfluxWriteProgress progress = m_progress;
+        if (progress.batches_enqueued > 0) {
+            const auto end = progress.Idle() ? m_last_completion : std::chrono::steady_clock::now();
+            progress.elapsed_seconds = std::chrono::duration<double>(end - m_run_start).count();
+        }
+        return progress;
+    }
+
+private:
+    struct Entry {
+        std::string             bucket;
+        std::string             precision;
+        std::string             body;           // empty if spilled
+        std::filesystem::path   spill_path;
+        std::function<void(bool)> on_done;
+        size_t                  size = 0;
+    };
+
+    // a single batch larger than the limit still goes through, alone
+    bool isFull(size_t size) const {
+        return m_progress.bytes_in_memory > 0 && m_progress.bytes_in_memory + size > m_config.max_queued_bytes;
+    }
+
+    // m_mutex held
+    void push(Entry&& entry) {
+        if (m_progress.Idle()) {
+            // a new run starts, throughput is measured from here
+            m_run_start = std::chrono::steady_clock::now();
+        }
+        m_progress.batches_enqueued++;
+        m_progress.bytes_enqueued += entry.size;
+        m_queue.push_back(std::move(entry));
+    }
+
+    static std::string randomSpillPrefix() {
+        std::random_device random;
+        const uint64_t id = (static_cast<uint64_t>(random()) << 32) ^ random();
+        char prefix[32];
+        std::snprintf(prefix, sizeof(prefix), "batch_%016llx_", static_cast<unsigned long long>(id));
+        return prefix;
+    }
+
+    std::filesystem::path spill(const std::string& body, uint64_t sequence) const {
+        std::error_code ec;
+        std::filesystem::create_directories(m_config.spill_directory, ec);
+        std::filesystem::path path = m_config.spill_directory / (m_spill_prefix + std::to_string(sequence) + ".lp");
+        std::ofstream out(path, std::ios::binary);
+        if (!out || !out.write(body.data(), static_cast<std::streamsize>(body.size()))) {
+            return {};
+        }
+        return path;
+    }
+
+    static bool readSpilled(const std::filesystem::path& path, std::string& body) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // one request, retried while the failure is transient; returns the last response
+    HttpResponse send(const Entry& entry, const std::string& body, bool gzipped, std::mt19937_64& rng) {
+        HttpConnectionPool::Headers headers = {
+            {"Authorization", "Token " + m_token},
+            {"Content-Type", "text/plain; charset=utf-8"},
+        };
+        if (gzipped) {
+            headers.emplace_back("Content-Encoding", "gzip");
+        }
+        const std::string target = "/api/v2/write?org=" + m_org + "&bucket=" + entry.bucket + "&precision=" + entry.precision;
+        for (unsigned attempt = 0; ; ++attempt) {
+            HttpResponse response = m_pool.request(boost::beast::http::verb::post, target, headers, body);
+            adaptConcurrency(response);
+            if (response.ok() || !isRetryableHttpStatus(response.status) || attempt >= m_config.max_retries) {
+                return response;
+            }
+            const double delay = std::max(response.retry_after_seconds,
+                jitteredBackoffSeconds(attempt, m_config.backoff_base_seconds, m_config.backoff_max_seconds, rng));
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_progress.retries++;
+            // on shutdown the remaining attempts are given up instead of waited out
+            if (m_closing_cv.wait_for(lock, std::chrono::duration<double>(delay), [&] { return m_closing; })) {
+                return response;
+            }
+        }
+    }
+
+    // AIMD on the number of requests in flight
+    void adaptConcurrency(const HttpResponse& response) {
+        const bool overloaded = response.status == 0 || response.status == 429 || response.status == 503
+            || response.latency_seconds > m_config.target_latency_seconds;
+        bool raised = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t& limit = m_progress.concurrency_limit;
+            const auto now = std::chrono::steady_clock::now();
+            if (overloaded) {
+                // one decrease per burst: responses already in flight at the last decrease do not count again
+                if (now - m_last_decrease > std::chrono::duration<double>(std::max(response.latency_seconds, 0.1))) {
+                    limit = std::max<size_t>(1, limit / 2);
+                    m_last_decrease = now;
+                }
+                m_fast_successes = 0;
+            } else if (response.ok() && limit < m_config.connections && ++m_fast_successes >= limit) {
+                limit++;
+                m_fast_successes = 0;
+                raised = true;
+            }
+        }
+        if (raised) {
+            m_not_empty.notify_one();
+        }
+    }
+
+    void workerLoop() {
+        const bool compress = m_config.gzip_level > 0;
+        GzipCompressor compressor(compress ? m_config.gzip_level : Z_BEST_SPEED);
+        std::string compressed;
+        std::mt19937_64 rng(std::random_device{}());
+        while (true) {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_not_empty.wait(lock, [&] {
+                    return m_closing || (!m_queue.empty() && m_progress.in_flight < m_progress.concurrency_limit);
+                });
+                if (m_queue.empty()) {
+                    return;     // closing and drained
+                }
+                entry = std::move(m_queue.front());
+                m_queue.pop_front();
+                if (entry.spill_path.empty()) {
+                    m_progress.bytes_in_memory -= entry.size;
+                }
+                m_progress.in_flight++;
+            }
+            m_not_full.notify_all();
+
+            bool ok = true;
+            if (!entry.spill_path.empty()) {
+                ok = readSpilled(entry.spill_path, entry.body);
+            }
+            const bool gzipped = ok && compress && compressor.Compress(entry.body, compressed);
+            const std::string& body = gzipped ? compressed : entry.body;
+            if (ok) {
+                ok = send(entry, body, gzipped, rng).ok();
+            }
+            const size_t sent = body.size();
+            // a failed batch keeps its file, the data is not lost with it
+            if (ok && !entry.spill_path.empty()) {
+                std::error_code ec;
+                std::filesystem::remove(entry.spill_path, ec);
+            }
+
+            bool idle = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_progress.in_flight--;
+                if (ok) {
+                    m_progress.batches_written++;
+                    m_progress.bytes_written += entry.size;
+                    m_progress.bytes_sent += sent;
+                } else {
+                    m_progress.batches_failed++;
+                    m_progress.bytes_failed += entry.size;
+                }
+                m_last_completion = std::chrono::steady_clock::now();
+                idle = m_queue.empty() && m_progress.in_flight == 0;
+            }
+            // after the counters, so whoever waits on it sees the batch in Progress()
+            if (entry.on_done) {
+                entry.on_done(ok);
+            }
+            // a slot is free again
+            m_not_empty.notify_one();
+            if (idle) {
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    HttpConnectionPool&                     m_pool;
+    std::string                             m_org;
+    std::string                             m_token;
+    InfluxBatchWriterConfig                 m_config;
+    const std::string                       m_spill_prefix;     // unique per writer
+
+    mutable std::mutex                      m_mutex;
+    std::condition_variable                 m_not_empty;
+    std::condition_variable                 m_not_full;
+    std::condition_variable                 m_idle;
+    std::condition_variable                 m_closing_cv;
+    std::deque<Entry>                       m_queue;
+    InfluxWriteProgress                     m_progress;
+    uint64_t                                m_spill_sequence = 0;
+    bool                                    m_closing = false;
+    std::chrono::steady_clock::time_point   m_run_start;
+    std::chrono::steady_clock::time_point   m_last_completion;
+    std::chrono::steady_clock::time_point   m_last_decrease;
+    size_t                                  m_fast_successes = 0;
+
+    std::vector<std::thread>                m_workers;      // last, started once everything above exists
+};
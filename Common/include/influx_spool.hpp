@@ -0,0 +1,573 @@
+// influx_spool.hpp
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "backoff.hpp"
+
+// Write-ahead spool for InfluxDB batches, for when the database is out of reach (e.g. Relay at the
+// track without a route to the global InfluxDB).
+//
+// Append() writes the batch to the end of the current segment file, fsyncs it (unless sync is off) and
+// returns, it never touches the network. A drainer thread replays the batches oldest first through the
+// send callback; when a send fails transiently (see isRetryableHttpStatus) it waits with jittered
+// backoff, checks the probe callback (e.g. a /ping) and then retries the same batch, so the order is
+// kept. A batch the database refuses for good (400 bad lines, 401/403 token, 404 bucket, 413 too
+// large) would be refused forever and hold up everything behind it: it is moved to rejected.spool in
+// the same directory, as long as that stays under rejected_max_bytes, and counted. A fully replayed
+// segment is deleted.
+//
+// Neither Append() nor the drainer does file I/O under the mutex that guards the segment list, so a
+// slow disk holds up neither the other side nor Stats(). Segments are opened between two locked
+// sections of Append(); files to close or delete are only collected under the mutex and handled by
+// whichever thread takes them after releasing it.
+//
+// Records are [magic][payload length][crc32 of payload][payload], the payload holds bucket, precision
+// and body. Segments found in the directory at startup are replayed first; a torn or corrupt record
+// ends its segment. Replaying a segment again after a crash is harmless, InfluxDB keeps one value per
+// series, field and timestamp. Once the spool holds max_bytes, the oldest segments are dropped to make
+// room, so a long outage loses the oldest data instead of blocking ingest.
+
+struct InfluxSpoolConfig {
+    std::filesystem::path   directory = std::filesystem::temp_directory_path() / "influx_spool";
+    uint64_t                max_bytes = 1024ULL * 1024 * 1024;      // on disk, over all segments
+    uint64_t                segment_bytes = 16 * 1024 * 1024;       // a segment is sealed once it is this large
+    double                  backoff_base_seconds = 1.0;
+    double                  backoff_max_seconds = 30.0;
+    bool                    sync = true;                            // fsync every batch before Append() returns
+    uint64_t                rejected_max_bytes = 64 * 1024 * 1024;  // rejected.spool, refused batches beyond it are only counted
+};
+
+struct InfluxSpoolStats {
+    uint64_t    batches_appended = 0;
+    uint64_t    batches_replayed = 0;
+    uint64_t    batches_dropped = 0;        // not written or deleted unsent to stay under max_bytes
+    uint64_t    batches_pending = 0;        // on disk, not replayed yet
+    uint64_t    bytes_appended = 0;         // bodies
+    uint64_t    bytes_replayed = 0;         // bodies
+    uint64_t    bytes_on_disk = 0;          // segment files, replayed records count until their segment is deleted
+    uint64_t    corrupt_records = 0;
+    uint64_t    send_failures = 0;          // transient, the batch is sent again
+    uint64_t    batches_rejected = 0;       // refused for good by the database and skipped
+    uint64_t    batches_quarantined = 0;    // of those, the ones kept in rejected.spool
+    unsigned    last_rejected_status = 0;
+    size_t      segments = 0;
+    bool        connected = true;           // false while the last send failed
+};
+
+class InfluxSpool {
+public:
+    // send returns the HTTP status of the write (0 without a response), probe returns true if the
+    // database is reachable
+    using SendFn = std::function<unsigned int(const std::string& bucket, const std::string& precision, const std::string& body)>;
+    using ProbeFn = std::function<bool()>;
+
+    InfluxSpool(SendFn send, ProbeFn probe, const InfluxSpoolConfig& config = InfluxSpoolConfig())
+        : m_send(std::move(send)), m_probe(std::move(probe)), m_config(config)
+    {
+        // room for a few segments, so dropping the oldest one frees a useful share
+        m_config.segment_bytes = std::max<uint64_t>(1, std::min(m_config.segment_bytes, m_config.max_bytes / 4));
+        recover();
+        m_drainer = std::thread(&InfluxSpool::drainLoop, this);
+    }
+
+    // Stops replaying, whatever has not been sent stays on disk for the next start
+    ~InfluxSpool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closing = true;
+        }
+        m_changed.notify_all();
+        m_drainer.join();
+        releaseWriter();
+        releaseFiles(m_released);
+    }
+
+    InfluxSpool(const InfluxSpool&) = delete;
+    InfluxSpool& operator=(const InfluxSpool&) = delete;
+
+    // Returns false if the batch could not be written to disk
+    bool Append(const std::string& bucket, const std::string& precision, const std::string& body) {
+        if (body.empty()) {
+            return true;
+        }
+        std::string payload;
+        encodePayload(payload, bucket, precision, body);
+        char header[kHeaderSize];
+        putU32(header, kMagic);
+        putU32(header + 4, static_cast<uint32_t>(payload.size()));
+        putU32(header + 8, crc(payload));
+        const uint64_t record_size = kHeaderSize + payload.size();
+
+        // one Append at a time, the segment list is only locked around the bookkeeping
+        std::lock_guard<std::mutex> append_lock(m_append_mutex);
+        FileRelease released;
+        uint64_t new_sequence = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_write_fd < 0 || m_segments.back().size >= m_config.segment_bytes) {
+                // sealed, the drainer deletes it once it has been replayed
+                releaseWriter();
+                new_sequence = m_next_sequence++;
+            }
+            std::swap(released, m_released);
+        }
+        releaseFiles(released);
+        const int new_fd = (new_sequence != 0) ? openSegmentFile(segmentPath(new_sequence)) : -1;
+
+        int fd = -1;
+        uint64_t offset = 0;
+        bool fits = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (new_sequence != 0) {
+                if (new_fd < 0) {
+                    m_stats.batches_dropped++;
+                    return false;
+                }
+                Segment segment;
+                segment.sequence = new_sequence;
+                segment.path = segmentPath(new_sequence);
+                m_segments.push_back(segment);
+                m_write_fd = new_fd;
+            }
+            makeRoom(record_size);
+            fits = m_stats.bytes_on_disk + record_size <= m_config.max_bytes || m_segments.back().size == 0;
+            if (fits) {
+                // keeps the drainer from sealing the segment while the record is written past its size
+                m_appending = true;
+                fd = m_write_fd;
+                offset = m_segments.back().size;
+            } else {
+                m_stats.batches_dropped++;
+            }
+            std::swap(released, m_released);
+        }
+        releaseFiles(released);
+        if (!fits) {
+            return false;
+        }
+
+        const bool written = writeAll(fd, header, kHeaderSize) && writeAll(fd, payload.data(), payload.size())
+            && (!m_config.sync || ::fsync(fd) == 0);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_appending = false;
+            if (!written) {
+                // given up, the next Append starts a new segment. The drainer never reads past
+                // segment.size, so the partial record can be cut off after unlocking.
+                m_write_fd = -1;
+                m_stats.batches_dropped++;
+            }
+        }
+        if (!written) {
+            (void)::ftruncate(fd, static_cast<off_t>(offset));
+            ::close(fd);
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // complete records only, the drainer may read them right away
+            Segment& segment = m_segments.back();
+            segment.size += record_size;
+            segment.records++;
+            m_stats.bytes_on_disk += record_size;
+            m_stats.batches_pending++;
+            m_stats.batches_appended++;
+            m_stats.bytes_appended += body.size();
+        }
+        m_changed.notify_all();
+        return true;
+    }
+
+    InfluxSpoolStats Stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        InfluxSpoolStats stats = m_stats;
+        stats.segments = m_segments.size();
+        return stats;
+    }
+
+private:
+    struct Segment {
+        std::filesystem::path   path;
+        uint64_t                sequence = 0;
+        uint64_t                size = 0;       // of the file, complete records only
+        uint64_t                records = 0;    // not replayed yet
+    };
+
+    struct Record {
+        std::string bucket;
+        std::string precision;
+        std::string body;
+    };
+
+    // File work decided under m_mutex, done after releasing it
+    struct FileRelease {
+        std::vector<int>                    fds;        // to close
+        std::vector<std::filesystem::path>  paths;      // to delete
+
+        bool empty() const { return fds.empty() && paths.empty(); }
+    };
+
+    static constexpr uint32_t   kMagic = 0x31505349;     // "ISP1"
+    static constexpr size_t     kHeaderSize = 12;
+    static constexpr uint32_t   kMaxPayload = 256 * 1024 * 1024;
+
+    static void putU32(char* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            out[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+    }
+    static uint32_t getU32(const char* in) {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        }
+        return value;
+    }
+    static bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+    static uint32_t crc(const std::string& data) {
+        return static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef*>(data.data()), static_cast<uInt>(data.size())));
+    }
+
+    // [u32 bucket length][bucket][u32 precision length][precision][body]
+    static void encodePayload(std::string& out, const std::string& bucket, const std::string& precision, const std::string& body) {
+        out.resize(8 + bucket.size() + precision.size());
+        putU32(&out[0], static_cast<uint32_t>(bucket.size()));
+        std::copy(bucket.begin(), bucket.end(), out.begin() + 4);
+        putU32(&out[4 + bucket.size()], static_cast<uint32_t>(precision.size()));
+        std::copy(precision.begin(), precision.end(), out.begin() + 8 + bucket.size());
+        out.reserve(out.size() + body.size());
+        out += body;
+    }
+    static bool decodePayload(const std::string& payload, Record& record) {
+        if (payload.size() < 8) {
+            return false;
+        }
+        const uint64_t bucket_size = getU32(payload.data());
+        if (payload.size() < 8 + bucket_size) {
+            return false;
+        }
+        const uint64_t precision_size = getU32(payload.data() + 4 + bucket_size);
+        const uint64_t body_start = 8 + bucket_size + precision_size;
+        if (payload.size() < body_start) {
+            return false;
+        }
+        record.bucket.assign(payload, 4, bucket_size);
+        record.precision.assign(payload, 8 + bucket_size, precision_size);
+        record.body.assign(payload, body_start, std::string::npos);
+        return true;
+    }
+
+    std::filesystem::path segmentPath(uint64_t sequence) const {
+        char name[40];
+        std::snprintf(name, sizeof(name), "segment_%020llu.spool", static_cast<unsigned long long>(sequence));
+        return m_config.directory / name;
+    }
+
+    // Segments left by an earlier run are replayed before anything new. Their records are counted
+    // by walking the headers, checksums are only checked when a record is replayed.
+    void recover() {
+        std::error_code ec;
+        std::filesystem::create_directories(m_config.directory, ec);
+        for (const auto& entry : std::filesystem::directory_iterator(m_config.directory, ec)) {
+            const std::string name = entry.path().filename().string();
+            unsigned long long sequence = 0;
+            if (std::sscanf(name.c_str(), "segment_%llu.spool", &sequence) != 1) {
+                continue;
+            }
+            Segment segment;
+            segment.path = entry.path();
+            segment.sequence = sequence;
+            segment.size = entry.file_size(ec);
+            std::ifstream in(segment.path, std::ios::binary);
+            char header[kHeaderSize];
+            uint64_t offset = 0;
+            while (in.read(header, kHeaderSize) && getU32(header) == kMagic) {
+                const uint64_t length = getU32(header + 4);
+                if (offset + kHeaderSize + length > segment.size) {
+                    break;
+                }
+                offset += kHeaderSize + length;
+                segment.records++;
+                in.seekg(static_cast<std::streamoff>(offset));
+            }
+            m_segments.push_back(segment);
+        }
+        std::sort(m_segments.begin(), m_segments.end(), [](const Segment& a, const Segment& b) { return a.sequence < b.sequence; });
+        for (const Segment& segment : m_segments) {
+            m_stats.bytes_on_disk += segment.size;
+            m_stats.batches_pending += segment.records;
+            m_next_sequence = segment.sequence + 1;
+        }
+    }
+
+    // Without m_mutex. The file of a new segment after the last one, earlier ones are never appended
+    // to again. -1 if it cannot be created.
+    int openSegmentFile(const std::filesystem::path& path) const {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd >= 0 && m_config.sync) {
+            // the directory entry too, or a synced record could sit in a file that is gone after a power cut
+            const int directory_fd = ::open(m_config.directory.c_str(), O_RDONLY | O_CLOEXEC);
+            if (directory_fd >= 0) {
+                ::fsync(directory_fd);
+                ::close(directory_fd);
+            }
+        }
+        return fd;
+    }
+
+    // m_mutex held. Nothing is written to the current segment any more, its file is closed later.
+    void releaseWriter() {
+        if (m_write_fd >= 0) {
+            m_released.fds.push_back(m_write_fd);
+            m_write_fd = -1;
+        }
+    }
+
+    // Without m_mutex
+    static void releaseFiles(FileRelease& files) {
+        for (int fd : files.fds) {
+            ::close(fd);
+        }
+        std::error_code ec;
+        for (const std::filesystem::path& path : files.paths) {
+            std::filesystem::remove(path, ec);
+        }
+        files.fds.clear();
+        files.paths.clear();
+    }
+
+    // m_mutex held. Drops the oldest segments until the record fits, never the one being written.
+    void makeRoom(uint64_t record_size) {
+        while (m_stats.bytes_on_disk + record_size > m_config.max_bytes && m_segments.size() > 1) {
+            removeOldestSegment(true);
+        }
+    }
+
+    // m_mutex held. The drainer notices that its segment is gone by m_read_sequence.
+    void removeOldestSegment(bool dropped) {
+        const Segment& oldest = m_segments.front();
+        if (m_read_sequence == oldest.sequence) {
+            m_read_sequence = 0;
+            m_read_offset = 0;
+        }
+        m_released.paths.push_back(oldest.path);
+        m_stats.bytes_on_disk -= std::min(m_stats.bytes_on_disk, oldest.size);
+        m_stats.batches_pending -= std::min(m_stats.batches_pending, oldest.records);
+        if (dropped) {
+            m_stats.batches_dropped += oldest.records;
+        }
+        m_segments.pop_front();
+    }
+
+    // m_mutex held. The oldest segment with a record left at m_read_offset, false if there is none
+    // yet. A segment that has been read to the end is deleted; if it is the one being written, it is
+    // sealed first.
+    bool nextSegment(Segment& next) {
+        while (!m_segments.empty()) {
+            const Segment& segment = m_segments.front();
+            if (m_read_sequence != segment.sequence) {
+                m_read_sequence = segment.sequence;
+                m_read_offset = 0;
+            }
+            if (m_read_offset < segment.size) {
+                next = segment;
+                return true;
+            }
+            const bool active = m_write_fd >= 0 && m_segments.size() == 1;
+            if (active) {
+                if (segment.size == 0 || m_appending) {
+                    return false;
+                }
+                // caught up with the writer, the next Append starts a new segment
+                releaseWriter();
+            }
+            removeOldestSegment(false);
+        }
+        return false;
+    }
+
+    // The record at offset of a segment of size bytes, false if it is torn or corrupt
+    static bool readRecord(std::ifstream& reader, uint64_t offset, uint64_t size, Record& record, uint64_t& record_size) {
+        char header[kHeaderSize];
+        reader.clear();
+        reader.seekg(static_cast<std::streamoff>(offset));
+        bool valid = reader.read(header, kHeaderSize) && getU32(header) == kMagic;
+        const uint32_t length = valid ? getU32(header + 4) : 0;
+        valid = valid && length <= kMaxPayload && offset + kHeaderSize + length <= size;
+        if (!valid) {
+            return false;
+        }
+        std::string payload;
+        payload.resize(length);
+        if (!reader.read(&payload[0], length) || crc(payload) != getU32(header + 8) || !decodePayload(payload, record)) {
+            return false;
+        }
+        record_size = kHeaderSize + length;
+        return true;
+    }
+
+    // Drainer only. Appends a refused batch to rejected.spool, in the format of a segment, so it can
+    // be looked at or replayed by hand once the cause is fixed. False if it would not fit.
+    bool quarantine(const Record& record) {
+        const std::filesystem::path path = m_config.directory / "rejected.spool";
+        std::error_code ec;
+        const uint64_t size = std::filesystem::exists(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+        std::string payload;
+        encodePayload(payload, record.bucket, record.precision, record.body);
+        if (ec || size + kHeaderSize + payload.size() > m_config.rejected_max_bytes) {
+            return false;
+        }
+        char header[kHeaderSize];
+        putU32(header, kMagic);
+        putU32(header + 4, static_cast<uint32_t>(payload.size()));
+        putU32(header + 8, crc(payload));
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.write(header, kHeaderSize);
+        out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        return static_cast<bool>(out.flush());
+    }
+
+    void drainLoop() {
+        std::mt19937_64 rng(std::random_device{}());
+        unsigned failures = 0;
+        // only touched here, files are read without m_mutex
+        std::ifstream reader;
+        uint64_t reader_sequence = 0;
+        FileRelease released;
+        while (true) {
+            Segment segment;
+            uint64_t offset = 0;
+            bool found = false;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                // also wakes up for the segment nextSegment() just deleted, so it is gone from disk now
+                m_changed.wait(lock, [&] {
+                    found = nextSegment(segment);
+                    return m_closing || found || !m_released.empty();
+                });
+                if (m_closing) {
+                    return;
+                }
+                offset = m_read_offset;
+                std::swap(released, m_released);
+            }
+            if (!found) {
+                // caught up, the last segment may be one of the deleted ones
+                reader.close();
+                reader_sequence = 0;
+            }
+            releaseFiles(released);
+            if (!found) {
+                continue;
+            }
+
+            if (reader_sequence != segment.sequence) {
+                reader.close();
+                reader.clear();
+                reader.open(segment.path, std::ios::binary);
+                reader_sequence = segment.sequence;
+            }
+            Record record;
+            uint64_t record_size = 0;
+            const bool valid = readRecord(reader, offset, segment.size, record, record_size);
+
+            if (!valid) {
+                // a torn or corrupt record ends its segment
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_read_sequence == segment.sequence && m_read_offset == offset) {
+                    Segment& front = m_segments.front();
+                    m_stats.corrupt_records++;
+                    m_stats.batches_pending -= std::min(m_stats.batches_pending, front.records);
+                    front.records = 0;
+                    m_read_offset = front.size;
+                }
+                continue;
+            }
+
+            // after a failure, make sure the database is back before sending again
+            const bool reachable = failures == 0 || m_probe();
+            const unsigned int status = reachable ? m_send(record.bucket, record.precision, record.body) : 0;
+            const bool sent = status >= 200 && status < 300;
+            const bool rejected = reachable && !sent && !isRetryableHttpStatus(status);
+            const bool quarantined = rejected && quarantine(record);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!sent && !rejected) {
+                m_stats.send_failures++;
+                m_stats.connected = false;
+                const double delay = jitteredBackoffSeconds(failures++, m_config.backoff_base_seconds, m_config.backoff_max_seconds, rng);
+                m_changed.wait_for(lock, std::chrono::duration<double>(delay), [&] { return m_closing; });
+                continue;   // the same record again, unless its segment was dropped meanwhile
+            }
+            failures = 0;
+            m_stats.connected = true;
+            if (sent) {
+                m_stats.batches_replayed++;
+                m_stats.bytes_replayed += record.body.size();
+            } else {
+                m_stats.batches_rejected++;
+                m_stats.batches_quarantined += quarantined ? 1 : 0;
+                m_stats.last_rejected_status = status;
+            }
+            // the segment may have been dropped to make room while the record was being sent
+            if (m_read_sequence == segment.sequence && m_read_offset == offset) {
+                m_read_offset += record_size;
+                m_segments.front().records--;
+                m_stats.batches_pending--;
+            }
+        }
+    }
+
+    SendFn                                  m_send;
+    ProbeFn                                 m_probe;
+    InfluxSpoolConfig                       m_config;
+
+    std::mutex                              m_append_mutex; // before m_mutex
+    mutable std::mutex                      m_mutex;
+    std::condition_variable                 m_changed;
+    std::deque<Segment>                     m_segments;     // oldest first, the last one may be open for writing
+    int                                     m_write_fd = -1;
+    bool                                    m_appending = false;    // a record is being written past the last segment's size
+    FileRelease                             m_released;     // taken by Append() and the drainer, done once they release m_mutex
+    uint64_t                                m_read_sequence = 0;    // segment the drainer is reading, 0 for none
+    uint64_t                                m_read_offset = 0;
+    uint64_t                                m_next_sequence = 1;
+    InfluxSpoolStats                        m_stats;
+    bool                                    m_closing = false;
+
+    std::thread                             m_drainer;      // last, started once everything above exists
+};
@@ -0,0 +1,200 @@
+// json_writer.hpp
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// JSON text written straight into one byte buffer, without building a document first.
+//
+// Keys that are known up front (DSDL field names, the message keys) are quoted and escaped once with
+// json_text::quotedKey and then appended as they are. Numbers go through std::to_chars (shortest
+// representation that round-trips for floats, with ".0" on whole numbers), NaN and infinity are
+// written as null like nlohmann::json::dump() does. The buffer keeps its capacity between Clear() calls, so writing a
+// message does not allocate once it has grown to the size of the output.
+//
+// Values written one after another at the top level are separated by commas, so a run of array
+// elements can be written on its own (e.g. by one thread) and spliced into an array later.
+//
+//   JsonWriter writer;
+//   writer.BeginObject();
+//   writer.Key(quoted_key);        // "\"vx\":"
+//   writer.Value(1.25f);
+//   writer.EndObject();
+
+namespace json_text {
+
+// text as the inside of a JSON string: quote, backslash and control characters escaped
+inline void appendEscaped(std::string& out, std::string_view text) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    for (const char c : text) {
+        switch (c) {
+            case '"':   out.append("\\\""); break;
+            case '\\':  out.append("\\\\"); break;
+            case '\b':  out.append("\\b"); break;
+            case '\f':  out.append("\\f"); break;
+            case '\n':  out.append("\\n"); break;
+            case '\r':  out.append("\\r"); break;
+            case '\t':  out.append("\\t"); break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(kHex[(c >> 4) & 0xF]);
+                    out.push_back(kHex[c & 0xF]);
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+}
+
+// "\"name\":", to be passed to JsonWriter::Key
+inline std::string quotedKey(std::string_view name) {
+    std::string out;
+    out.reserve(name.size() + 3);
+    out.push_back('"');
+    appendEscaped(out, name);
+    out.append("\":");
+    return out;
+}
+
+} // namespace json_text
+
+class JsonWriter {
+public:
+    explicit JsonWriter(size_t reserve_bytes = 0) {
+        m_buffer.reserve(reserve_bytes);
+    }
+
+    void BeginObject() { beginValue(); open('{'); }
+    void EndObject() { close('}'); }
+    void BeginArray() { beginValue(); open('['); }
+    void EndArray() { close(']'); }
+
+    // quoted_key must come from json_text::quotedKey
+    void Key(std::string_view quoted_key) {
+        separate();
+        m_buffer.append(quoted_key.data(), quoted_key.size());
+        m_after_key = true;
+    }
+
+    // Quotes and escapes the key on the way, for keys that are not known up front
+    void KeyEscaping(std::string_view key) {
+        separate();
+        m_buffer.push_back('"');
+        json_text::appendEscaped(m_buffer, key);
+        m_buffer.append("\":");
+        m_after_key = true;
+    }
+
+    template <typename T>
+    void Value(T value) {
+        static_assert(std::is_arithmetic<T>::value, "JsonWriter::Value takes numbers and bools, String() takes text");
+        beginValue();
+        if constexpr (std::is_same<T, bool>::value) {
+            m_buffer.append(value ? "true" : "false");
+        } else if constexpr (std::is_floating_point<T>::value) {
+            if (!std::isfinite(value)) {
+                m_buffer.append("null");
+                return;
+            }
+            char text[32];
+            const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value);
+            m_buffer.append(text, result.ptr);
+            // "1.0" rather than "1", so the value still reads back as a float
+            if (std::find_if(text, result.ptr, [](char c) { return c == '.' || c == 'e'; }) == result.ptr) {
+                m_buffer.append(".0");
+            }
+        } else {
+            char text[std::numeric_limits<T>::digits10 + 3];
+            const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value);
+            m_buffer.append(text, result.ptr);
+        }
+    }
+
+    void String(std::string_view text) {
+        beginValue();
+        m_buffer.push_back('"');
+        json_text::appendEscaped(m_buffer, text);
+        m_buffer.push_back('"');
+    }
+
+    // Already serialized JSON, e.g. a pre-quoted string constant
+    void Raw(std::string_view json) {
+        beginValue();
+        m_buffer.append(json.data(), json.size());
+    }
+
+    void Reserve(size_t bytes) { m_buffer.reserve(bytes); }
+    size_t Size() const { return m_buffer.size(); }
+    bool Empty() const { return m_buffer.empty(); }
+    const std::string& Buffer() const { return m_buffer; }
+    std::string_view View() const { return m_buffer; }
+
+    // Starts over at the top level, keeping the capacity
+    void Clear() {
+        m_buffer.clear();
+        m_depth = 0;
+        m_first[0] = true;
+        m_after_key = false;
+    }
+
+    // Drops the text written so far but stays inside the open objects and arrays, for handing a large
+    // document on in pieces: the pieces together are the document
+    void ClearText() { m_buffer.clear(); }
+
+    // Hands the text over and starts a new one of the same capacity
+    std::string Take() {
+        const size_t capacity = m_buffer.capacity();
+        std::string text = std::move(m_buffer);
+        m_buffer = std::string();
+        m_buffer.reserve(capacity);
+        Clear();
+        return text;
+    }
+
+private:
+    // deep enough for the messages, nesting beyond it is not tracked
+    static constexpr size_t kMaxDepth = 16;
+
+    void separate() {
+        if (!m_first[m_depth]) {
+            m_buffer.push_back(',');
+        }
+        m_first[m_depth] = false;
+    }
+
+    // a value after a key was separated by Key(), anything else is an element of an array or of the top level
+    void beginValue() {
+        if (m_after_key) {
+            m_after_key = false;
+        } else {
+            separate();
+        }
+    }
+
+    void open(char bracket) {
+        m_buffer.push_back(bracket);
+        if (m_depth + 1 < kMaxDepth) {
+            m_depth++;
+        }
+        m_first[m_depth] = true;
+    }
+
+    void close(char bracket) {
+        m_buffer.push_back(bracket);
+        if (m_depth > 0) {
+            m_depth--;
+        }
+    }
+
+    std::string m_buffer;
+    size_t      m_depth = 0;
+    bool        m_first[kMaxDepth] = {true};
+    bool        m_after_key = false;
+};
@@ -0,0 +1,442 @@
+// line_protocol.hpp
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// InfluxDB line protocol encoding shared by Analyze and Relay.
+//
+// A series key (escaped measurement plus tag set) is built once with LineProtocolSeriesKey and reused
+// for every point of the series. Field keys are escaped once the same way. LineProtocolEncoder then
+// appends points into one byte buffer that keeps its capacity between batches: numbers go through
+// std::to_chars and the type suffix is picked at compile time from the C++ type, so encoding a
+// point does not allocate once the buffer has grown to the batch size.
+//
+//   float, double                  1.25        (shortest representation that round-trips)
+//   bool                           true/false
+//   signed and narrow unsigned     42i
+//   uint64_t                       42u         (does not fit an InfluxDB integer)
+//
+// LineProtocolBatcher cuts the encoder output into requests by size: a batch ends at the last line
+// boundary before LineBatchPolicy::target_bytes, or once its first line is max_latency_seconds old,
+// whatever the number or width of the lines.
+//
+// line_protocol::validateLine goes the other way and checks a received line, see mock_influxdb.hpp.
+
+namespace line_protocol {
+
+// measurement: comma and space, tag keys, tag values and field keys: comma, equals sign and space
+inline void appendEscaped(std::string& out, std::string_view text, bool is_measurement) {
+    for (char c : text) {
+        if (c == ',' || c == ' ' || (c == '=' && !is_measurement)) {
+            out.push_back('\\');
+        }
+        out.push_back(c);
+    }
+}
+
+inline std::string escapeKey(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    appendEscaped(out, text, false);
+    return out;
+}
+
+template <typename T>
+struct ValueTraits {
+    static_assert(std::is_arithmetic<T>::value, "line protocol fields must be numeric or bool");
+    // largest text to_chars can produce for T, plus the suffix
+    static constexpr size_t kMaxChars = std::is_floating_point<T>::value ? 32 : std::numeric_limits<T>::digits10 + 3;
+    static constexpr char kSuffix =
+        std::is_same<T, bool>::value || std::is_floating_point<T>::value ? '\0'
+        : std::is_unsigned<T>::value && (sizeof(T) >= sizeof(int64_t)) ? 'u'
+        : 'i';
+};
+
+} // namespace line_protocol
+
+// "measurement,tag1=a,tag2=b", tags with an empty value are left out like the Channel tags always were
+class LineProtocolSeriesKey {
+public:
+    LineProtocolSeriesKey() = default;
+    LineProtocolSeriesKey(std::string_view measurement, const std::vector<std::pair<std::string, std::string>>& tags) {
+        Build(measurement, tags);
+    }
+
+    void Build(std::string_view measurement, const std::vector<std::pair<std::string, std::string>>& tags) {
+        m_key.clear();
+        line_protocol::appendEscaped(m_key, measurement, true);
+        for (const auto& [key, value] : tags) {
+            if (value.empty()) {
+                continue;
+            }
+            m_key.push_back(',');
+            line_protocol::appendEscaped(m_key, key, false);
+            m_key.push_back('=');
+            line_protocol::appendEscaped(m_key, value, false);
+        }
+    }
+
+    std::string_view View() const { return m_key; }
+    bool Empty() const { return m_key.empty(); }
+
+private:
+    std::string m_key;
+};
+
+class LineProtocolEncoder {
+public:
+    explicit LineProtocolEncoder(size_t reserve_bytes = 0) {
+        m_buffer.reserve(reserve_bytes);
+    }
+
+    // "series_key " and then fields with AddField until EndLine
+    inline void BeginLine(std::string_view series_key) {
+        m_buffer.append(series_key.data(), series_key.size());
+        m_buffer.push_back(' ');
+        m_first_field = true;
+    }
+
+    // escaped_field_key must already be escaped (see line_protocol::escapeKey). Returns false and
+    // writes nothing for NaN and infinity, which line protocol cannot carry.
+    template <typename T>
+    inline bool AddField(std::string_view escaped_field_key, T value) {
+        if constexpr (std::is_floating_point<T>::value) {
+            if (!std::isfinite(value)) {
+                return false;
+            }
+        }
+        if (!m_first_field) {
+            m_buffer.push_back(',');
+        }
+        m_first_field = false;
+        m_buffer.append(escaped_field_key.data(), escaped_field_key.size());
+        m_buffer.push_back('=');
+        AppendValue(value);
+        return true;
+    }
+
+    // Escapes the key on the way, for keys that are not known up front (Relay's JSON messages)
+    template <typename T>
+    inline bool AddFieldEscaping(std::string_view field_key, T value) {
+        if constexpr (std::is_floating_point<T>::value) {
+            if (!std::isfinite(value)) {
+                return false;
+            }
+        }
+        if (!m_first_field) {
+            m_buffer.push_back(',');
+        }
+        m_first_field = false;
+        line_protocol::appendEscaped(m_buffer, field_key, false);
+        m_buffer.push_back('=');
+        AppendValue(value);
+        return true;
+    }
+
+    inline void EndLine(int64_t timestamp) {
+        m_buffer.push_back(' ');
+        AppendInteger(timestamp);
+        m_buffer.push_back('\n');
+    }
+
+    // One point of a single field series, the common case for Channel
+    template <typename T>
+    inline bool AppendPoint(std::string_view series_key, std::string_view escaped_field_key, T value, int64_t timestamp) {
+        const size_t line_start = m_buffer.size();
+        BeginLine(series_key);
+        if (!AddField(escaped_field_key, value)) {
+            m_buffer.resize(line_start);
+            return false;
+        }
+        EndLine(timestamp);
+        return true;
+    }
+
+    // Drops a line started with BeginLine, e.g. when none of its fields could be written
+    void DiscardLine(size_t line_start) { m_buffer.resize(line_start); }
+    bool HasFields() const { return !m_first_field; }
+
+    void Reserve(size_t bytes) { m_buffer.reserve(bytes); }
+    void Clear() { m_buffer.clear(); }
+    size_t Size() const { return m_buffer.size(); }
+    bool Empty() const { return m_buffer.empty(); }
+    const std::string& Buffer() const { return m_buffer; }
+
+    // Hands the encoded batch over, e.g. to InfluxBatchWriter, and starts a new one of the same capacity
+    std::string Take() {
+        const size_t capacity = m_buffer.capacity();
+        std::string batch = std::move(m_buffer);
+        m_buffer = std::string();
+        m_buffer.reserve(capacity);
+        return batch;
+    }
+
+    // Hands the first bytes (which must end on a line boundary) over and keeps the rest as the start
+    // of the next batch, only the rest is copied
+    std::string TakePrefix(size_t bytes) {
+        if (bytes >= m_buffer.size()) {
+            return Take();
+        }
+        const size_t capacity = m_buffer.capacity();
+        std::string batch = std::move(m_buffer);
+        m_buffer = std::string();
+        m_buffer.reserve(capacity);
+        m_buffer.append(batch, bytes, std::string::npos);
+        batch.resize(bytes);
+        return batch;
+    }
+
+private:
+    template <typename T>
+    inline void AppendValue(T value) {
+        using Traits = line_protocol::ValueTraits<T>;
+        if constexpr (std::is_same<T, bool>::value) {
+            m_buffer.append(value ? "true" : "false");
+        } else {
+            char text[Traits::kMaxChars];
+            const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value);
+            m_buffer.append(text, result.ptr);
+            if constexpr (Traits::kSuffix != '\0') {
+                m_buffer.push_back(Traits::kSuffix);
+            }
+        }
+    }
+
+    inline void AppendInteger(int64_t value) {
+        char text[24];
+        const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value);
+        m_buffer.append(text, result.ptr);
+    }
+
+    std::string m_buffer;
+    bool        m_first_field = true;
+};
+
+// When LineProtocolBatcher cuts a batch
+struct LineBatchPolicy {
+    size_t  target_bytes = 512 * 1024;      // uncompressed, a batch ends at the last line boundary before this
+    double  max_latency_seconds = 1.0;      // a batch is sent at the latest this long after its first line, 0 for no limit
+    size_t  max_lines = 0;                  // 0 for no limit
+};
+
+// Lines are encoded straight into Encoder(), LineDone() after each one decides whether to cut.
+// A line that does not fit the target any more starts the next batch, unless it is alone, so a
+// batch only exceeds target_bytes if a single line does. The age of a batch is checked by LineDone()
+// (every 256 lines, the clock is not free) and by FlushIfDue(), which streaming writers call when
+// no new lines arrive.
+class LineProtocolBatcher {
+public:
+    using EmitFn = std::function<void(std::string&& batch)>;
+
+    LineProtocolBatcher(const LineBatchPolicy& policy, EmitFn emit)
+        : m_policy(policy), m_emit(std::move(emit)), m_encoder(policy.target_bytes + policy.target_bytes / 8) {}
+
+    LineProtocolEncoder& Encoder() { return m_encoder; }
+
+    // After every complete line (EndLine) written to Encoder()
+    void LineDone() {
+        if (m_lines == 0) {
+            m_first_line_time = now();
+        }
+        m_lines++;
+        const size_t size = m_encoder.Size();
+        if (size >= m_policy.target_bytes) {
+            if (size > m_policy.target_bytes && m_boundary > 0) {
+                // this line overshoots, it opens the next batch
+                send(m_encoder.TakePrefix(m_boundary));
+                m_lines = 1;
+                m_first_line_time = now();
+            } else {
+                send(m_encoder.Take());
+                m_lines = 0;
+            }
+        } else if (m_policy.max_lines > 0 && m_lines >= m_policy.max_lines) {
+            send(m_encoder.Take());
+            m_lines = 0;
+        } else if ((m_lines & 255) == 0) {
+            FlushIfDue();
+        }
+        m_boundary = m_encoder.Size();
+    }
+
+    // Sends the pending lines if the first of them is max_latency_seconds old, true if it did
+    bool FlushIfDue() {
+        if (m_lines == 0 || m_policy.max_latency_seconds <= 0.0
+            || std::chrono::duration<double>(now() - m_first_line_time).count() < m_policy.max_latency_seconds) {
+            return false;
+        }
+        Flush();
+        return true;
+    }
+
+    // Sends whatever is pending
+    void Flush() {
+        if (!m_encoder.Empty()) {
+            send(m_encoder.Take());
+        }
+        m_lines = 0;
+        m_boundary = 0;
+    }
+
+    // Sends what is pending under the old policy first
+    void SetPolicy(const LineBatchPolicy& policy) {
+        Flush();
+        m_policy = policy;
+    }
+    const LineBatchPolicy& Policy() const { return m_policy; }
+
+    size_t PendingLines() const { return m_lines; }
+    uint64_t Batches() const { return m_batches; }
+
+private:
+    static std::chrono::steady_clock::time_point now() { return std::chrono::steady_clock::now(); }
+
+    void send(std::string&& batch) {
+        m_batches++;
+        m_emit(std::move(batch));
+    }
+
+    LineBatchPolicy                         m_policy;
+    EmitFn                                  m_emit;
+    LineProtocolEncoder                     m_encoder;
+    size_t                                  m_lines = 0;        // complete lines in the encoder
+    size_t                                  m_boundary = 0;     // end of the last complete line
+    std::chrono::steady_clock::time_point   m_first_line_time;
+    uint64_t                                m_batches = 0;
+};
+
+namespace line_protocol {
+
+// Moves pos to the first unescaped character of stops (or the end), backslash escapes are skipped
+inline void scanIdentifier(std::string_view line, size_t& pos, std::string_view stops) {
+    while (pos < line.size()) {
+        if (line[pos] == '\\' && pos + 1 < line.size()) {
+            pos += 2;
+        } else if (stops.find(line[pos]) != std::string_view::npos) {
+            return;
+        } else {
+            pos++;
+        }
+    }
+}
+
+inline bool isInteger(std::string_view text, bool allow_sign) {
+    if (allow_sign && !text.empty() && text[0] == '-') {
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        return false;
+    }
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// An unquoted field value: float, integer (42i), unsigned (42u) or boolean
+inline bool isFieldValue(std::string_view text) {
+    if (text.empty()) {
+        return false;
+    }
+    if (text == "t" || text == "T" || text == "true" || text == "True" || text == "TRUE"
+        || text == "f" || text == "F" || text == "false" || text == "False" || text == "FALSE") {
+        return true;
+    }
+    if (text.back() == 'i') {
+        return isInteger(text.substr(0, text.size() - 1), true);
+    }
+    if (text.back() == 'u') {
+        return isInteger(text.substr(0, text.size() - 1), false);
+    }
+    double value = 0.0;
+    const char* begin = text.data() + (text[0] == '+' ? 1 : 0);
+    const std::from_chars_result result = std::from_chars(begin, text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size() && std::isfinite(value);
+}
+
+// Checks one line (without its newline) roughly the way InfluxDB parses it: measurement, optional
+// tags, at least one field and an optional integer timestamp. Empty lines and comments are valid.
+// On failure error names what is wrong.
+inline bool validateLine(std::string_view line, const char*& error) {
+    if (line.empty() || line[0] == '#') {
+        return true;
+    }
+    size_t pos = 0;
+    scanIdentifier(line, pos, ", ");
+    if (pos == 0) {
+        error = "missing measurement";
+        return false;
+    }
+    while (pos < line.size() && line[pos] == ',') {
+        const size_t key_start = ++pos;
+        scanIdentifier(line, pos, "=, ");
+        if (pos == key_start || pos >= line.size() || line[pos] != '=') {
+            error = "missing tag key";
+            return false;
+        }
+        const size_t value_start = ++pos;
+        scanIdentifier(line, pos, ", ");
+        if (pos == value_start) {
+            error = "missing tag value";
+            return false;
+        }
+    }
+    if (pos >= line.size() || line[pos] != ' ') {
+        error = "missing fields";
+        return false;
+    }
+    pos++;
+    while (true) {
+        const size_t key_start = pos;
+        scanIdentifier(line, pos, "=, ");
+        if (pos == key_start || pos >= line.size() || line[pos] != '=') {
+            error = "missing field key";
+            return false;
+        }
+        const size_t value_start = ++pos;
+        if (pos < line.size() && line[pos] == '"') {
+            // string field, commas and spaces inside the quotes belong to the value
+            pos++;
+            scanIdentifier(line, pos, "\"");
+            if (pos >= line.size()) {
+                error = "unterminated string field value";
+                return false;
+            }
+            pos++;
+        } else {
+            while (pos < line.size() && line[pos] != ',' && line[pos] != ' ') {
+                pos++;
+            }
+            if (!isFieldValue(line.substr(value_start, pos - value_start))) {
+                error = "invalid field value";
+                return false;
+            }
+        }
+        if (pos < line.size() && line[pos] == ',') {
+            pos++;
+            continue;
+        }
+        break;
+    }
+    if (pos < line.size()) {
+        if (line[pos] != ' ' || !isInteger(line.substr(pos + 1), true)) {
+            error = "invalid timestamp";
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace line_protocol
@@ -0,0 +1,512 @@
+// mock_influxdb.hpp
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <nlohmann/json.hpp>
+
+#include "gzip.hpp"
+#include "line_protocol.hpp"
+
+// A stand-in for the InfluxDB write API on loopback, to measure and test the upload paths without a
+// database.
+//
+// MockInfluxDB answers GET /ping with 204 and POST /api/v2/write like InfluxDB 2 does: the body is
+// gunzipped if it comes with Content-Encoding: gzip, optionally checked line by line, and answered
+// with 204, or 400 with an InfluxDB style JSON error. MockInfluxFaults adds latency and answers a
+// share of the writes with 429 (with Retry-After) or a server error, and can be changed while the
+// server runs. Every request is recorded in MockInfluxStats: status counters, lines and bytes, and
+// histograms of request size and of the time from the last request byte to the last response byte.
+//
+// One thread per connection with blocking Beast reads and writes, the clients keep a handful of
+// keep-alive connections, so that is all it needs.
+
+struct MockInfluxFaults {
+    double      latency_ms = 0.0;               // added before every write is answered
+    double      latency_jitter_ms = 0.0;        // plus uniform [0, jitter)
+    double      rate_limit_probability = 0.0;   // share of writes answered 429
+    double      retry_after_seconds = 1.0;      // Retry-After of a 429, 0 leaves the header out
+    double      failure_probability = 0.0;      // share of writes answered failure_status
+    unsigned    failure_status = 503;
+};
+
+struct MockInfluxConfig {
+    std::string         address = "127.0.0.1";
+    unsigned short      port = 0;                   // 0 picks a free port, see Port()
+    std::string         token;                      // empty accepts any Authorization
+    bool                decompress = true;          // gunzip Content-Encoding: gzip bodies
+    bool                validate = true;            // check every line, needs decompress for gzip bodies
+    size_t              max_body_bytes = 256 * 1024 * 1024;     // compressed and decompressed
+    MockInfluxFaults    faults;
+};
+
+// Log-linear histogram: 8 buckets per power of two, so a percentile is within 12.5% of the true value
+class MockHistogram {
+public:
+    void Add(uint64_t value) {
+        m_buckets[bucketIndex(value)]++;
+        m_count++;
+        m_sum += value;
+        m_max = std::max(m_max, value);
+        m_min = (m_count == 1) ? value : std::min(m_min, value);
+    }
+
+    uint64_t Count() const { return m_count; }
+    uint64_t Min() const { return m_min; }
+    uint64_t Max() const { return m_max; }
+    double Mean() const { return m_count > 0 ? static_cast<double>(m_sum) / m_count : 0.0; }
+
+    // Upper bound of the bucket holding the given percentile (0-100)
+    uint64_t Percentile(double percentile) const {
+        if (m_count == 0) {
+            return 0;
+        }
+        const uint64_t rank = static_cast<uint64_t>(std::clamp(percentile, 0.0, 100.0) / 100.0 * (m_count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_buckets.size(); ++i) {
+            seen += m_buckets[i];
+            if (seen >= rank) {
+                return std::min(bucketUpperBound(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    nlohmann::json ToJson() const {
+        return {
+            {"count",   m_count},
+            {"min",     m_min},
+            {"mean",    Mean()},
+            {"p50",     Percentile(50.0)},
+            {"p90",     Percentile(90.0)},
+            {"p99",     Percentile(99.0)},
+            {"max",     m_max},
+        };
+    }
+
+private:
+    static constexpr unsigned kSubBits = 3;
+
+    // values below 8 get a bucket each, above that 8 per power of two
+    static size_t bucketIndex(uint64_t value) {
+        if (value < (1u << kSubBits)) {
+            return static_cast<size_t>(value);
+        }
+        unsigned exponent = 63;
+        while (!(value >> exponent)) {
+            exponent--;
+        }
+        const uint64_t sub = (value >> (exponent - kSubBits)) & ((1u << kSubBits) - 1);
+        return ((exponent - kSubBits + 1) << kSubBits) + static_cast<size_t>(sub);
+    }
+
+    static uint64_t bucketUpperBound(size_t index) {
+        if (index < (1u << kSubBits)) {
+            return index;
+        }
+        const unsigned exponent = static_cast<unsigned>(index >> kSubBits) + kSubBits - 1;
+        const uint64_t sub = index & ((1u << kSubBits) - 1);
+        const uint64_t lower = (uint64_t(1) << exponent) | (sub << (exponent - kSubBits));
+        return lower + (uint64_t(1) << (exponent - kSubBits)) - 1;
+    }
+
+    std::array<uint64_t, (64 - kSubBits + 1) << kSubBits> m_buckets{};
+    uint64_t    m_count = 0;
+    uint64_t    m_sum = 0;
+    uint64_t    m_min = 0;
+    uint64_t    m_max = 0;
+};
+
+struct MockInfluxStats {
+    uint64_t        requests = 0;
+    uint64_t        pings = 0;
+    uint64_t        writes = 0;             // POST /api/v2/write, whatever the answer
+    uint64_t        writes_accepted = 0;    // answered 204
+    uint64_t        rate_limited = 0;       // injected 429
+    uint64_t        failed = 0;             // injected failure_status
+    uint64_t        invalid = 0;            // 400, bad gzip or line protocol
+    uint64_t        unauthorized = 0;
+    uint64_t        not_found = 0;
+    uint64_t        connections = 0;
+    uint64_t        lines = 0;              // of accepted writes
+    uint64_t        bytes_received = 0;     // bodies as sent, of every write
+    uint64_t        bytes_decoded = 0;      // after gunzip, of accepted writes
+    MockHistogram   request_bytes;          // bodies as sent
+    MockHistogram   latency_us;             // request read to response written, including injected latency
+    std::string     last_error;             // message of the last 400
+
+    nlohmann::json ToJson() const {
+        return {
+            {"requests",            requests},
+            {"pings",               pings},
+            {"writes",              writes},
+            {"writes_accepted",     writes_accepted},
+            {"rate_limited",        rate_limited},
+            {"failed",              failed},
+            {"invalid",             invalid},
+            {"unauthorized",        unauthorized},
+            {"not_found",           not_found},
+            {"connections",         connections},
+            {"lines",               lines},
+            {"bytes_received",      bytes_received},
+            {"bytes_decoded",       bytes_decoded},
+            {"request_bytes",       request_bytes.ToJson()},
+            {"latency_us",          latency_us.ToJson()},
+            {"last_error",          last_error},
+        };
+    }
+};
+
+class MockInfluxDB {
+public:
+    // Called for every accepted write with the decoded body, from the connection's thread
+    using WriteFn = std::function<void(const std::string& bucket, const std::string& precision, const std::string& body)>;
+
+    explicit MockInfluxDB(const MockInfluxConfig& config = MockInfluxConfig(), WriteFn on_write = nullptr)
+        : m_config(config), m_on_write(std::move(on_write)), m_acceptor(m_io) {}
+    ~MockInfluxDB() { Stop(); }
+
+    MockInfluxDB(const MockInfluxDB&) = delete;
+    MockInfluxDB& operator=(const MockInfluxDB&) = delete;
+
+    // Binds and starts accepting, false (with the reason in error) if the address cannot be bound
+    bool Start(std::string* error = nullptr) {
+        namespace asio = boost::asio;
+        boost::system::error_code ec;
+        const asio::ip::tcp::endpoint endpoint(asio::ip::make_address(m_config.address, ec), m_config.port);
+        if (!ec) {
+            m_acceptor.open(endpoint.protocol(), ec);
+        }
+        if (!ec) {
+            m_acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+            m_acceptor.bind(endpoint, ec);
+        }
+        if (!ec) {
+            m_acceptor.listen(asio::socket_base::max_listen_connections, ec);
+        }
+        if (ec) {
+            if (error) {
+                *error = ec.message();
+            }
+            boost::system::error_code ignored;
+            m_acceptor.close(ignored);
+            return false;
+        }
+        m_port = m_acceptor.local_endpoint().port();
+        m_stopping = false;
+        m_accept_thread = std::thread(&MockInfluxDB::acceptLoop, this);
+        return true;
+    }
+
+    // Closes every connection and joins the threads, requests in progress are cut off
+    void Stop() {
+        if (!m_accept_thread.joinable()) {
+            return;
+        }
+        m_stopping = true;
+        // accept() blocks, a connection of our own wakes it up
+        {
+            boost::system::error_code ec;
+            boost::asio::io_context io;
+            boost::asio::ip::tcp::socket socket(io);
+            socket.connect(m_acceptor.local_endpoint(ec), ec);
+        }
+        m_accept_thread.join();
+        boost::system::error_code ec;
+        m_acceptor.close(ec);
+
+        std::list<std::shared_ptr<Connection>> connections;
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            connections.swap(m_connections);
+        }
+        for (const auto& connection : connections) {
+            connection->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        }
+        for (const auto& connection : connections) {
+            connection->thread.join();
+        }
+    }
+
+    unsigned short Port() const { return m_port; }
+
+    void SetFaults(const MockInfluxFaults& faults) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_config.faults = faults;
+    }
+
+    MockInfluxStats Stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void ResetStats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats = MockInfluxStats();
+    }
+
+private:
+    using Request = boost::beast::http::request<boost::beast::http::string_body>;
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+
+    struct Connection {
+        explicit Connection(boost::asio::io_context& io) : socket(io) {}
+        boost::asio::ip::tcp::socket    socket;
+        std::thread                     thread;
+        std::atomic<bool>               done{false};
+    };
+
+    void acceptLoop() {
+        while (true) {
+            auto connection = std::make_shared<Connection>(m_io);
+            boost::system::error_code ec;
+            m_acceptor.accept(connection->socket, ec);
+            if (m_stopping) {
+                return;
+            }
+            if (ec) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            // join the connections that have closed since, so a long run does not pile up threads
+            for (auto it = m_connections.begin(); it != m_connections.end();) {
+                if ((*it)->done) {
+                    (*it)->thread.join();
+                    it = m_connections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            connection->thread = std::thread(&MockInfluxDB::serve, this, connection);
+            m_connections.push_back(connection);
+            std::lock_guard<std::mutex> stats_lock(m_mutex);
+            m_stats.connections++;
+        }
+    }
+
+    void serve(std::shared_ptr<Connection> connection) {
+        namespace http = boost::beast::http;
+        boost::beast::flat_buffer buffer;
+        GzipDecompressor decompressor;
+        std::string decoded;
+        while (!m_stopping) {
+            http::request_parser<http::string_body> parser;
+            parser.body_limit(m_config.max_body_bytes);
+            boost::system::error_code ec;
+            http::read(connection->socket, buffer, parser, ec);
+            if (ec) {
+                break;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            const Request& request = parser.get();
+            Response response = handle(request, decompressor, decoded);
+            response.version(request.version());
+            response.keep_alive(request.keep_alive());
+            response.prepare_payload();
+            http::write(connection->socket, response, ec);
+            const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.latency_us.Add(static_cast<uint64_t>(latency.count()));
+            }
+            if (ec || !response.keep_alive()) {
+                break;
+            }
+        }
+        boost::system::error_code ec;
+        connection->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        connection->done = true;
+    }
+
+    static Response makeResponse(unsigned status, const std::string& code = std::string(), const std::string& message = std::string()) {
+        Response response;
+        response.result(status);
+        response.set(boost::beast::http::field::server, "mock-influxdb");
+        if (!code.empty()) {
+            response.set(boost::beast::http::field::content_type, "application/json; charset=utf-8");
+            response.body() = nlohmann::json{{"code", code}, {"message", message}}.dump();
+        }
+        return response;
+    }
+
+    // "name=value" out of the query string of target
+    static std::string queryParameter(std::string_view target, std::string_view name) {
+        const size_t query = target.find('?');
+        if (query == std::string_view::npos) {
+            return std::string();
+        }
+        size_t pos = query + 1;
+        while (pos < target.size()) {
+            size_t end = target.find('&', pos);
+            if (end == std::string_view::npos) {
+                end = target.size();
+            }
+            const std::string_view pair = target.substr(pos, end - pos);
+            if (pair.size() > name.size() && pair.substr(0, name.size()) == name && pair[name.size()] == '=') {
+                return std::string(pair.substr(name.size() + 1));
+            }
+            pos = end + 1;
+        }
+        return std::string();
+    }
+
+    Response handle(const Request& request, GzipDecompressor& decompressor, std::string& decoded) {
+        namespace http = boost::beast::http;
+        const std::string_view target(request.target().data(), request.target().size());
+        const std::string_view path = target.substr(0, target.find('?'));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.requests++;
+        }
+
+        if (path == "/ping" && (request.method() == http::verb::get || request.method() == http::verb::head)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.pings++;
+            return makeResponse(204);
+        }
+        if (path != "/api/v2/write" || request.method() != http::verb::post) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.not_found++;
+            return makeResponse(404, "not found", "path not found");
+        }
+
+        MockInfluxFaults faults;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.writes++;
+            m_stats.bytes_received += request.body().size();
+            m_stats.request_bytes.Add(request.body().size());
+            faults = m_config.faults;
+        }
+        if (!m_config.token.empty()) {
+            const auto authorization = request.find(http::field::authorization);
+            if (authorization == request.end() || authorization->value() != "Token " + m_config.token) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.unauthorized++;
+                return makeResponse(401, "unauthorized", "unauthorized access");
+            }
+        }
+
+        double delay_ms = faults.latency_ms;
+        double draw = 0.0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (faults.latency_jitter_ms > 0.0) {
+                delay_ms += std::uniform_real_distribution<double>(0.0, faults.latency_jitter_ms)(m_rng);
+            }
+            draw = std::uniform_real_distribution<double>(0.0, 1.0)(m_rng);
+        }
+        if (delay_ms > 0.0) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay_ms));
+        }
+        if (draw < faults.rate_limit_probability) {
+            Response response = makeResponse(429, "too many requests", "injected rate limit");
+            if (faults.retry_after_seconds > 0.0) {
+                response.set(http::field::retry_after, std::to_string(static_cast<long long>(faults.retry_after_seconds + 0.5)));
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.rate_limited++;
+            return response;
+        }
+        if (draw < faults.rate_limit_probability + faults.failure_probability) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.failed++;
+            return makeResponse(faults.failure_status, "internal error", "injected failure");
+        }
+
+        const std::string bucket = queryParameter(target, "bucket");
+        std::string precision = queryParameter(target, "precision");
+        if (precision.empty()) {
+            precision = "ns";
+        }
+        std::string error;
+        if (bucket.empty()) {
+            error = "bucket not specified";
+        } else if (precision != "ns" && precision != "us" && precision != "ms" && precision != "s") {
+            error = "invalid precision " + precision;
+        }
+
+        // the body as InfluxDB would parse it, left compressed if decompress is off
+        const std::string* body = &request.body();
+        const auto encoding = request.find(http::field::content_encoding);
+        const bool gzipped = encoding != request.end() && encoding->value() == "gzip";
+        if (error.empty() && gzipped && m_config.decompress) {
+            if (!decompressor.Decompress(request.body(), decoded, m_config.max_body_bytes)) {
+                error = "gzip: invalid or oversized body";
+            }
+            body = &decoded;
+        }
+        uint64_t lines = 0;
+        if (error.empty() && (!gzipped || m_config.decompress)) {
+            size_t line_start = 0;
+            while (line_start < body->size()) {
+                size_t line_end = body->find('\n', line_start);
+                if (line_end == std::string::npos) {
+                    line_end = body->size();
+                }
+                std::string_view line(body->data() + line_start, line_end - line_start);
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                const char* line_error = nullptr;
+                if (m_config.validate && !line_protocol::validateLine(line, line_error)) {
+                    error = "unable to parse '" + std::string(line.substr(0, 200)) + "': " + line_error;
+                    break;
+                }
+                if (!line.empty() && line[0] != '#') {
+                    lines++;
+                }
+                line_start = line_end + 1;
+            }
+        }
+        if (!error.empty()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.invalid++;
+            m_stats.last_error = error;
+            return makeResponse(400, "invalid", error);
+        }
+
+        if (m_on_write) {
+            m_on_write(bucket, precision, *body);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.writes_accepted++;
+        m_stats.lines += lines;
+        m_stats.bytes_decoded += body->size();
+        return makeResponse(204);
+    }
+
+    MockInfluxConfig                            m_config;
+    WriteFn                                     m_on_write;
+    boost::asio::io_context                     m_io;
+    boost::asio::ip::tcp::acceptor              m_acceptor;
+    unsigned short                              m_port = 0;
+    std::atomic<bool>                           m_stopping{false};
+    std::thread                                 m_accept_thread;
+
+    std::mutex                                  m_connections_mutex;
+    std::list<std::shared_ptr<Connection>>      m_connections;
+
+    // stats, faults and the random numbers
+    mutable std::mutex                          m_mutex;
+    MockInfluxStats                             m_stats;
+    std::mt19937_64                             m_rng{std::random_device{}()};
+};
@@ -0,0 +1,194 @@
+// triple_buffer.hpp
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Hands the newest value from one producer to its readers without locks, the producer never waits.
+//
+// TripleBuffer<T> is for one producer and one consumer. Of its three buffers one is written by the
+// producer, one is read by the consumer and the one in the middle holds the newest published value.
+// Publish() and Update() each swap their own buffer with the middle one in a single atomic exchange,
+// so a consumer that is slower than the producer skips to the newest value and never sees a half
+// written one. The buffer Write() returns holds an older value afterwards, overwrite it in full.
+//
+//   producer:  fill(buffer.Write()); buffer.Publish();
+//   consumer:  if (buffer.Update()) use(buffer.Read());
+//
+// SnapshotBuffer<T> is the same for up to max_readers readers holding a snapshot at once (SPMC).
+// Acquire() pins the newest published value until the Snapshot is destroyed, a reader only retries if
+// the producer published in the few instructions between looking up the newest value and pinning it.
+// With max_readers + 2 buffers the producer always finds one that is neither pinned nor the newest, so
+// Publish() takes no longer with readers than without. Acquire() beyond max_readers returns an empty
+// Snapshot rather than letting the producer run out of buffers.
+//
+//   producer:  fill(snapshots.Write()); snapshots.Publish();
+//   reader:    auto snapshot = snapshots.Acquire();
+//              if (snapshot && snapshot.Sequence() != last_sequence) use(*snapshot);
+
+namespace triple_buffer {
+
+// keeps the producer's and the readers' hot variables off each other's cache lines
+constexpr size_t kCacheLineSize = 64;
+
+} // namespace triple_buffer
+
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    explicit TripleBuffer(const T& initial) : m_buffers{initial, initial, initial} {}
+
+    // Producer: the buffer to fill before Publish()
+    T& Write() { return m_buffers[m_write]; }
+
+    // Producer: makes the written buffer the newest value
+    void Publish() {
+        const uint8_t previous = m_middle.exchange(static_cast<uint8_t>(m_write | kFresh), std::memory_order_acq_rel);
+        m_write = previous & kIndexMask;
+    }
+
+    // Consumer: takes the newest value if one was published since the last call, true if it did
+    bool Update() {
+        if ((m_middle.load(std::memory_order_relaxed) & kFresh) == 0) {
+            return false;
+        }
+        const uint8_t previous = m_middle.exchange(m_read, std::memory_order_acq_rel);
+        m_read = previous & kIndexMask;
+        return true;
+    }
+
+    // Consumer: the value taken by the last Update(), T() or the initial value before the first
+    const T& Read() const { return m_buffers[m_read]; }
+
+private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh = 0x4;     // the middle buffer has not been taken yet
+
+    T                                                           m_buffers[3];
+    alignas(triple_buffer::kCacheLineSize) std::atomic<uint8_t> m_middle{1};
+    alignas(triple_buffer::kCacheLineSize) uint8_t              m_write = 0;    // producer only
+    alignas(triple_buffer::kCacheLineSize) uint8_t              m_read = 2;     // consumer only
+};
+
+template <typename T>
+class SnapshotBuffer {
+    struct Slot;
+
+public:
+    // A published value pinned for reading, the producer does not touch it until it is destroyed
+    class Snapshot {
+    public:
+        Snapshot() = default;
+        Snapshot(Snapshot&& other) noexcept { *this = std::move(other); }
+        Snapshot& operator=(Snapshot&& other) noexcept {
+            if (this != &other) {
+                release();
+                m_owner = other.m_owner;
+                m_slot = other.m_slot;
+                other.m_owner = nullptr;
+                other.m_slot = nullptr;
+            }
+            return *this;
+        }
+        ~Snapshot() { release(); }
+
+        explicit operator bool() const { return m_slot != nullptr; }
+        const T& operator*() const { return m_slot->value; }
+        const T* operator->() const { return &m_slot->value; }
+        // 1 for the first value published, counting up by one per Publish()
+        uint64_t Sequence() const { return m_slot ? m_slot->sequence : 0; }
+
+    private:
+        friend class SnapshotBuffer;
+
+        Snapshot(SnapshotBuffer* owner, Slot* slot) : m_owner(owner), m_slot(slot) {}
+
+        void release() {
+            if (m_slot) {
+                m_slot->readers.fetch_sub(1, std::memory_order_release);
+                m_owner->m_holders.fetch_sub(1, std::memory_order_release);
+                m_owner = nullptr;
+                m_slot = nullptr;
+            }
+        }
+
+        SnapshotBuffer* m_owner = nullptr;
+        Slot*           m_slot = nullptr;
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+    };
+
+    explicit SnapshotBuffer(size_t max_readers = 2)
+        : m_max_readers(max_readers), m_slot_count(max_readers + 2), m_slots(new Slot[max_readers + 2]) {}
+
+    // Producer: the buffer to fill before Publish(), it holds an older value
+    T& Write() { return m_slots[m_write].value; }
+
+    // Producer: makes the written buffer the newest value
+    void Publish() {
+        m_slots[m_write].sequence = ++m_sequence;
+        m_latest.store(m_write, std::memory_order_seq_cst);
+        m_write = freeSlot();
+    }
+
+    // Reader: the newest value, empty before the first Publish() and if max_readers are already held
+    Snapshot Acquire() {
+        if (m_holders.fetch_add(1, std::memory_order_acquire) >= m_max_readers) {
+            m_holders.fetch_sub(1, std::memory_order_release);
+            return Snapshot();
+        }
+        for (;;) {
+            const size_t latest = m_latest.load(std::memory_order_seq_cst);
+            if (latest == kNone) {
+                m_holders.fetch_sub(1, std::memory_order_release);
+                return Snapshot();
+            }
+            Slot& slot = m_slots[latest];
+            slot.readers.fetch_add(1, std::memory_order_seq_cst);
+            // still the newest, so the producer has finished it and will not pick it while it is pinned
+            if (m_latest.load(std::memory_order_seq_cst) == latest) {
+                return Snapshot(this, &slot);
+            }
+            slot.readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    size_t MaxReaders() const { return m_max_readers; }
+
+private:
+    struct Slot {
+        T                                                               value;
+        uint64_t                                                        sequence = 0;
+        alignas(triple_buffer::kCacheLineSize) std::atomic<uint32_t>    readers{0};
+    };
+
+    static constexpr size_t kNone = ~size_t(0);
+
+    // neither the newest nor pinned: at most max_readers slots are pinned, so one of the others is free
+    size_t freeSlot() const {
+        const size_t latest = m_latest.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < m_slot_count; ++i) {
+            if (i != latest && m_slots[i].readers.load(std::memory_order_seq_cst) == 0) {
+                return i;
+            }
+        }
+        return latest == 0 ? 1 : 0;     // not reached
+    }
+
+    const size_t                                                m_max_readers;
+    const size_t                                                m_slot_count;
+    std::unique_ptr<Slot[]>                                     m_slots;
+    alignas(triple_buffer::kCacheLineSize) std::atomic<size_t>  m_latest{kNone};
+    alignas(triple_buffer::kCacheLineSize) std::atomic<size_t>  m_holders{0};
+    // producer only
+    alignas(triple_buffer::kCacheLineSize) size_t               m_write = 0;
+    uint64_t                                                    m_sequence = 0;
+
+    SnapshotBuffer(const SnapshotBuffer&) = delete;
+    SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+};
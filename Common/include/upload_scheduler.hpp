@@ -0,0 +1,283 @@
+// upload_scheduler.hpp
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backoff.hpp"
+#include "influx_batch_writer.hpp"
+
+// Splits an export into shards (e.g. one series, or one time window of a series) and uploads them
+// through an InfluxBatchWriter.
+//
+// Up to parallel_shards shards are encoded at the same time. A shard is done once every batch it
+// emitted has been written. If any of them failed for good (the writer already retried transient
+// errors), the whole shard is encoded and sent again after a jittered backoff, up to max_attempts.
+// Sending a shard twice is harmless, InfluxDB keeps one value per series, field and timestamp.
+//
+// Batch callbacks and Cancel() run on other threads than Run(), and Run() may return (and the scheduler
+// be destroyed) as soon as the last shard has settled. Those paths therefore notify m_changed while
+// still holding m_mutex and touch nothing of the scheduler after releasing it.
+
+struct UploadSchedulerConfig {
+    size_t      parallel_shards = 4;
+    unsigned    max_attempts = 3;
+    double      backoff_base_seconds = 1.0;
+    double      backoff_max_seconds = 60.0;
+};
+
+struct UploadSchedulerProgress {
+    size_t      shards_total = 0;
+    size_t      shards_done = 0;
+    size_t      shards_failed = 0;      // gave up after max_attempts
+    size_t      shards_active = 0;      // being encoded or waiting for their batches
+    size_t      shards_retrying = 0;    // waiting out a backoff
+    uint64_t    shard_retries = 0;
+    bool        finished = false;
+};
+
+class InfluxUploadScheduler {
+public:
+    using EmitFn = std::function<void(std::string&& batch)>;
+    using EncodeFn = std::function<void(const EmitFn& emit)>;
+    using SettledFn = std::function<void(bool ok)>;
+
+    InfluxUploadScheduler(InfluxBatchWriter& writer, const std::string& bucket, const std::string& precision, const UploadSchedulerConfig& config = UploadSchedulerConfig())
+        : m_writer(writer), m_bucket(bucket), m_precision(precision), m_config(config)
+    {
+        if (m_config.parallel_shards == 0) {
+            m_config.parallel_shards = 1;
+        }
+    }
+
+    InfluxUploadScheduler(const InfluxUploadScheduler&) = delete;
+    InfluxUploadScheduler& operator=(const InfluxUploadScheduler&) = delete;
+
+    // encode is called once per attempt, from one of the scheduler threads, and hands its batches to emit.
+    // on_settled, if given, is called once with the final outcome, before Run() returns.
+    void AddShard(const std::string& label, EncodeFn encode, SettledFn on_settled = nullptr) {
+        auto shard = std::make_shared<Shard>();
+        shard->label = label;
+        shard->encode = std::move(encode);
+        shard->on_settled = std::move(on_settled);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shards.push_back(shard);
+        m_ready.push_back(shard);
+        m_progress.shards_total++;
+    }
+
+    // Blocks until every shard is done or has failed for good
+    void Run() {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < m_config.parallel_shards; ++i) {
+            threads.emplace_back(&InfluxUploadScheduler::encodeLoop, this);
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [&] { return allSettled(); });
+            m_progress.finished = true;
+        }
+        m_changed.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Shards not started yet are dropped, the ones in progress finish their current attempt
+    void Cancel() {
+        std::deque<std::shared_ptr<Shard>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cancelled = true;
+            for (const auto& shard : m_ready) {
+                shard->state = State::Failed;
+                m_progress.shards_failed++;
+                m_callbacks_pending++;
+            }
+            m_progress.shards_retrying = 0;
+            dropped.swap(m_ready);
+            m_changed.notify_all();
+        }
+        for (const auto& shard : dropped) {
+            notifySettled(shard);
+        }
+    }
+
+    UploadSchedulerProgress Progress() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_progress;
+    }
+
+    std::vector<std::string> FailedShards() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> labels;
+        for (const auto& shard : m_shards) {
+            if (shard->state == State::Failed) {
+                labels.push_back(shard->label);
+            }
+        }
+        return labels;
+    }
+
+private:
+    enum class State { Pending, Active, Done, Failed };
+
+    struct Shard {
+        std::string                             label;
+        EncodeFn                                encode;
+        SettledFn                               on_settled;
+        State                                   state = State::Pending;
+        unsigned                                attempts = 0;
+        std::chrono::steady_clock::time_point   not_before;
+        // batches of the current attempt, the attempt is over once encoding has finished and this is 0
+        size_t                                  outstanding = 0;
+        bool                                    encoded = false;
+        bool                                    any_failed = false;
+    };
+
+    // m_mutex held
+    bool allSettled() const {
+        return m_progress.shards_done + m_progress.shards_failed == m_progress.shards_total && m_callbacks_pending == 0;
+    }
+
+    void encodeLoop() {
+        while (true) {
+            std::shared_ptr<Shard> shard;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true) {
+                    if (m_progress.finished || m_cancelled || allSettled()) {
+                        return;
+                    }
+                    // the first shard whose backoff has passed
+                    const auto now = std::chrono::steady_clock::now();
+                    auto next_wake = std::chrono::steady_clock::time_point::max();
+                    for (auto it = m_ready.begin(); it != m_ready.end(); ++it) {
+                        if ((*it)->not_before <= now) {
+                            shard = *it;
+                            m_ready.erase(it);
+                            break;
+                        }
+                        next_wake = std::min(next_wake, (*it)->not_before);
+                    }
+                    if (shard) {
+                        break;
+                    }
+                    if (next_wake == std::chrono::steady_clock::time_point::max()) {
+                        m_changed.wait(lock);
+                    } else {
+                        m_changed.wait_until(lock, next_wake);
+                    }
+                }
+                if (shard->attempts > 0) {
+                    m_progress.shards_retrying--;
+                }
+                shard->state = State::Active;
+                shard->attempts++;
+                shard->outstanding = 0;
+                shard->encoded = false;
+                shard->any_failed = false;
+                m_progress.shards_active++;
+            }
+
+            shard->encode([&](std::string&& batch) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    shard->outstanding++;
+                }
+                InfluxWriteBatch write_batch;
+                write_batch.bucket = m_bucket;
+                write_batch.precision = m_precision;
+                write_batch.body = std::move(batch);
+                write_batch.on_done = [this, shard](bool ok) { onBatchDone(shard, ok); };
+                if (!m_writer.Enqueue(std::move(write_batch))) {
+                    // writer shutting down, the batch will never complete
+                    onBatchDone(shard, false);
+                }
+            });
+
+            bool settled = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                shard->encoded = true;
+                settled = (shard->outstanding == 0) && settle(shard);
+            }
+            if (settled) {
+                notifySettled(shard);
+            }
+            m_changed.notify_all();
+        }
+    }
+
+    void onBatchDone(const std::shared_ptr<Shard>& shard, bool ok) {
+        bool settled = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            shard->any_failed = shard->any_failed || !ok;
+            shard->outstanding--;
+            settled = shard->encoded && shard->outstanding == 0 && settle(shard);
+            m_changed.notify_all();
+        }
+        if (settled) {
+            notifySettled(shard);
+        }
+    }
+
+    // m_mutex held, the current attempt of the shard is over. Returns true if that was its last one,
+    // the caller then calls notifySettled once the lock is released.
+    bool settle(const std::shared_ptr<Shard>& shard) {
+        m_progress.shards_active--;
+        if (!shard->any_failed) {
+            shard->state = State::Done;
+            m_progress.shards_done++;
+            m_callbacks_pending++;
+            return true;
+        } else if (shard->attempts < m_config.max_attempts && !m_cancelled) {
+            shard->state = State::Pending;
+            const double delay = jitteredBackoffSeconds(shard->attempts - 1, m_config.backoff_base_seconds, m_config.backoff_max_seconds, m_rng);
+            shard->not_before = std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay));
+            m_ready.push_back(shard);
+            m_progress.shards_retrying++;
+            m_progress.shard_retries++;
+            return false;
+        }
+        shard->state = State::Failed;
+        m_progress.shards_failed++;
+        m_callbacks_pending++;
+        return true;
+    }
+
+    // Run() waits for m_callbacks_pending, so the callback never outlives the scheduler. Once the
+    // count is released Run() may return at once, the notify has to come before the unlock.
+    void notifySettled(const std::shared_ptr<Shard>& shard) {
+        if (shard->on_settled) {
+            shard->on_settled(shard->state == State::Done);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_callbacks_pending--;
+        m_changed.notify_all();
+    }
+
+    InfluxBatchWriter&                      m_writer;
+    std::string                             m_bucket;
+    std::string                             m_precision;
+    UploadSchedulerConfig                   m_config;
+
+    mutable std::mutex                      m_mutex;
+    std::condition_variable                 m_changed;
+    std::vector<std::shared_ptr<Shard>>     m_shards;
+    std::deque<std::shared_ptr<Shard>>      m_ready;
+    UploadSchedulerProgress                 m_progress;
+    bool                                    m_cancelled = false;
+    size_t                                  m_callbacks_pending = 0;
+    std::mt19937_64                         m_rng{std::random_device{}()};
+};
@@ -0,0 +1,233 @@
+// upload_watermarks.hpp
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// How far each channel has been uploaded to each destination, so a repeated export only sends what
+// is new.
+//
+// A watermark covers the first `points` points of a channel (sorted by time) up to and including
+// until_time, together with a checksum of their times and values. When the next export starts, the
+// checksum of the same prefix is computed again: if it still matches, only the points after the
+// prefix are sent, otherwise data was inserted or changed inside the uploaded range and the channel
+// is sent from the start. Sending a point twice is harmless, InfluxDB keeps one value per series,
+// field and timestamp.
+//
+// UploadWatermarkStore keeps the watermarks of all destinations in one JSON file next to the session
+// (see uploadWatermarkPath), so two sessions never share, or overwrite, each other's watermarks.
+
+struct UploadWatermark {
+    double      until_time = 0.0;   // time of the last covered point, meaningless while points == 0
+    uint64_t    points = 0;
+    uint64_t    checksum = 0;
+};
+
+// FNV-1a over the bytes of every (time, value) pair
+class UploadChecksum {
+public:
+    void Add(double time, double value) {
+        addBytes(time);
+        addBytes(value);
+    }
+    uint64_t Value() const { return m_hash; }
+
+private:
+    void addBytes(double number) {
+        unsigned char bytes[sizeof(double)];
+        std::memcpy(bytes, &number, sizeof(bytes));
+        for (unsigned char byte : bytes) {
+            m_hash ^= byte;
+            m_hash *= 1099511628211ULL;
+        }
+    }
+
+    uint64_t m_hash = 14695981039346656037ULL;
+};
+
+// Watermark for the points [0, end) of a channel, value_at(i) returns point i as a double
+template <typename ValueAt>
+UploadWatermark makeUploadWatermark(const std::vector<double>& times, size_t end, ValueAt value_at) {
+    UploadWatermark watermark;
+    end = std::min(end, times.size());
+    UploadChecksum checksum;
+    for (size_t i = 0; i < end; ++i) {
+        checksum.Add(times[i], value_at(i));
+    }
+    watermark.points = end;
+    watermark.until_time = (end > 0) ? times[end - 1] : 0.0;
+    watermark.checksum = checksum.Value();
+    return watermark;
+}
+
+// Index of the first point the watermark does not cover, 0 if the covered points changed since
+template <typename ValueAt>
+size_t uploadResumeIndex(const std::vector<double>& times, const UploadWatermark& watermark, ValueAt value_at) {
+    if (watermark.points == 0 || watermark.points > times.size()) {
+        return 0;
+    }
+    // a point inserted at until_time would move the end of the prefix
+    const size_t end = std::upper_bound(times.begin(), times.end(), watermark.until_time) - times.begin();
+    if (end != watermark.points) {
+        return 0;
+    }
+    UploadChecksum checksum;
+    for (size_t i = 0; i < end; ++i) {
+        checksum.Add(times[i], value_at(i));
+    }
+    return (checksum.Value() == watermark.checksum) ? end : 0;
+}
+
+// The store of a session, e.g. "run.pcap" => "run.pcap.influx_watermarks.json" in the same directory
+inline std::filesystem::path uploadWatermarkPath(const std::filesystem::path& session) {
+    std::filesystem::path path = std::filesystem::absolute(session);
+    path += ".influx_watermarks.json";
+    return path;
+}
+
+class UploadWatermarkStore {
+public:
+    // Without a path the store only lives in memory until Open()
+    UploadWatermarkStore() = default;
+    explicit UploadWatermarkStore(std::filesystem::path path) : m_path(std::move(path)) {}
+
+    UploadWatermarkStore(const UploadWatermarkStore&) = delete;
+    UploadWatermarkStore& operator=(const UploadWatermarkStore&) = delete;
+
+    // Switches to the store at path (of another session) and loads it, see Load()
+    bool Open(std::filesystem::path path) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_path = std::move(path);
+        }
+        return Load();
+    }
+
+    // A missing file is an empty store, a file that cannot be parsed is ignored and overwritten later
+    bool Load() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watermarks.clear();
+        if (m_path.empty()) {
+            return true;
+        }
+        std::ifstream in(m_path);
+        if (!in) {
+            return !std::filesystem::exists(m_path);
+        }
+        nlohmann::json j = nlohmann::json::parse(in, nullptr, false);
+        if (j.is_discarded() || !j.contains("destinations") || !j["destinations"].is_object()) {
+            return false;
+        }
+        for (const auto& [destination, channels] : j["destinations"].items()) {
+            if (!channels.is_object()) {
+                continue;
+            }
+            for (const auto& [channel, entry] : channels.items()) {
+                UploadWatermark watermark;
+                watermark.until_time = entry.value("until_time", 0.0);
+                watermark.points = entry.value("points", uint64_t(0));
+                watermark.checksum = entry.value("checksum", uint64_t(0));
+                m_watermarks[destination][channel] = watermark;
+            }
+        }
+        return true;
+    }
+
+    // Written to a temporary file first, so a crash never leaves a half written store behind
+    bool Save() const {
+        // one save at a time, so an older snapshot never overwrites a newer one
+        std::lock_guard<std::mutex> save_lock(m_save_mutex);
+        nlohmann::json j;
+        j["version"] = 1;
+        j["destinations"] = nlohmann::json::object();
+        std::filesystem::path path;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            path = m_path;
+            for (const auto& [destination, channels] : m_watermarks) {
+                nlohmann::json& out = j["destinations"][destination];
+                for (const auto& [channel, watermark] : channels) {
+                    out[channel] = {
+                        {"until_time", watermark.until_time},
+                        {"points", watermark.points},
+                        {"checksum", watermark.checksum},
+                    };
+                }
+            }
+        }
+
+        if (path.empty()) {
+            return false;
+        }
+
+        std::error_code ec;
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path(), ec);
+        }
+        std::filesystem::path temporary_path = path;
+        temporary_path += ".tmp";
+        {
+            std::ofstream out(temporary_path, std::ios::trunc);
+            if (!out || !(out << j.dump(1) << '\n')) {
+                return false;
+            }
+        }
+        std::filesystem::rename(temporary_path, path, ec);
+        return !ec;
+    }
+
+    std::optional<UploadWatermark> Get(const std::string& destination, const std::string& channel) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto destination_it = m_watermarks.find(destination);
+        if (destination_it == m_watermarks.end()) {
+            return std::nullopt;
+        }
+        auto channel_it = destination_it->second.find(channel);
+        if (channel_it == destination_it->second.end()) {
+            return std::nullopt;
+        }
+        return channel_it->second;
+    }
+
+    void Set(const std::string& destination, const std::string& channel, const UploadWatermark& watermark) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watermarks[destination][channel] = watermark;
+    }
+
+    std::vector<std::string> Destinations() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> destinations;
+        for (const auto& entry : m_watermarks) {
+            destinations.push_back(entry.first);
+        }
+        return destinations;
+    }
+
+    // Forget a destination, e.g. after its bucket was deleted, so everything is sent again
+    void Clear(const std::string& destination) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watermarks.erase(destination);
+    }
+
+    // Empty until the store has been given a path
+    std::filesystem::path Path() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_path;
+    }
+
+private:
+    std::filesystem::path                                                   m_path;
+    mutable std::mutex                                                      m_mutex;
+    mutable std::mutex                                                      m_save_mutex;
+    std::map<std::string, std::map<std::string, UploadWatermark>>           m_watermarks;
+};
@@ -0,0 +1,181 @@
+// vcu_reflection.hpp
+#pragma once
+
+#include "dsdl_reflection.hpp"
+
+#include "vcu/EbsActivation_1_0.h"              // 8
+#include "vcu/DriveMode_1_0.h"                  // 10
+#include "vcu/Config_1_0.h"                     // 13
+#include "vcu/INS_1_0.h"                        // 102
+#include "vcu/EnergyMeter_1_0.h"                // 111
+#include "vcu/DVStates_1_0.h"                   // 113
+#include "vcu/InsEstimates1_1_0.h"              // 114 lat and lon is double and not float
+#include "vcu/EPOSData_1_0.h"
+#include "vcu/EposStatus_1_0.h"
+#include "vcu/GetConfig_1_0.h"
+#include "vcu/GNSS_1_0.h"
+#include "vcu/Implausibilities_1_0.h"
+#include "vcu/ImuMeasurements_1_0.h"
+#include "vcu/InsEstimates2_1_0.h"
+#include "vcu/InsStatus_1_0.h"
+#include "vcu/InverterEstimates_1_0.h"
+#include "vcu/KERS_1_0.h"
+#include "vcu/MissionSelect_1_0.h"
+#include "vcu/ResetInverter_1_0.h"
+#include "vcu/RESStatus_1_0.h"
+#include "vcu/SCS_1_0.h"
+#include "vcu/State_1_0.h"
+#include "vcu/StaticOutputs_1_0.h"
+#include "vcu/Status_1_0.h"
+#include "vcu/TelemetryStatus_1_0.h"
+#include "vcu/TSABPressed_1_0.h"
+#include "vcu/TVOutputs_1_0.h"
+#include "vcu/TVStatus_1_0.h"
+#include "vcu/VcuStatus_1_0.h"
+#include "vcu/Warning_1_0.h"
+#include "vcu/ZeroIns_1_0.h"
+
+// The one place the vcu DSDL types are described; Analyze channels, Relay JSON and the batch decoder
+// pick them up from VcuDsdlTypes.
+//
+// Every vcu type with a fixed port-ID is in it. The specializations below are written by hand where a
+// channel needs another type or name than the generated struct; the rest are generated from the
+// compiled DSDL headers by Common/tools/generate_vcu_reflection.py (make runs it into the build directory),
+// so a type added to the DSDL definitions is picked up by the next build. Moving a type here from the
+// generated ones only takes writing its specialization, the generator skips the types specialized here.
+
+#define VCU_DSDL_TYPE_COMMON(TYPE, PORT_ID, TRANSFER_KIND)                                              \
+    static constexpr CanardPortID       port_id = PORT_ID;                                              \
+    static constexpr CanardTransferKind transfer_kind = TRANSFER_KIND;                                  \
+    static constexpr size_t             extent = TYPE##_EXTENT_BYTES_;                                  \
+    static constexpr size_t             serialization_buffer_size = TYPE##_SERIALIZATION_BUFFER_SIZE_BYTES_; \
+    static constexpr const char*        measure = "vcu";                                                \
+    static void initialize(TYPE* obj) {                                                                 \
+        TYPE##_initialize_(obj);                                                                        \
+    }                                                                                                   \
+    static int8_t serialize(const TYPE* obj, uint8_t* buffer, size_t* inout_buffer_size_bytes) {        \
+        return TYPE##_serialize_(obj, buffer, inout_buffer_size_bytes);                                 \
+    }                                                                                                   \
+    static int8_t deserialize(TYPE* obj, const uint8_t* buffer, size_t* inout_buffer_size_bytes) {      \
+        return TYPE##_deserialize_(obj, buffer, inout_buffer_size_bytes);                               \
+    }
+
+template <>
+struct DsdlType<vcu_EbsActivation_Request_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_EbsActivation_Request_1_0, 8, CanardTransferKindRequest)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<uint8_t>("EbsActivation.activate_ebs", &vcu_EbsActivation_Request_1_0::activate_ebs)
+    );
+};
+
+template <>
+struct DsdlType<vcu_DriveMode_Request_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_DriveMode_Request_1_0, 10, CanardTransferKindRequest)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<uint8_t>("DriveMode.command", &vcu_DriveMode_Request_1_0::command)
+    );
+};
+
+template <>
+struct DsdlType<vcu_Config_Request_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_Config_Request_1_0, 13, CanardTransferKindRequest)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<float>("Config.st_trq",       &vcu_Config_Request_1_0::st_trq),
+        dsdlField<float>("Config.st_rpm",       &vcu_Config_Request_1_0::st_rpm),
+        dsdlField<float>("Config.pitch_offset", &vcu_Config_Request_1_0::pitch_offset),
+        dsdlField<float>("Config.roll_offset",  &vcu_Config_Request_1_0::roll_offset)
+    );
+};
+
+template <>
+struct DsdlType<vcu_INS_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_INS_1_0, 102, CanardTransferKindMessage)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<float>("INS.vx",            &vcu_INS_1_0::vx),
+        dsdlField<float>("INS.vy",            &vcu_INS_1_0::vy),
+        dsdlField<float>("INS.vz",            &vcu_INS_1_0::vz),
+        dsdlField<float>("INS.ax",            &vcu_INS_1_0::ax),
+        dsdlField<float>("INS.ay",            &vcu_INS_1_0::ay),
+        dsdlField<float>("INS.az",            &vcu_INS_1_0::az),
+        dsdlField<float>("INS.roll",          &vcu_INS_1_0::roll),
+        dsdlField<float>("INS.pitch",         &vcu_INS_1_0::pitch),
+        dsdlField<float>("INS.yaw",           &vcu_INS_1_0::yaw),
+        dsdlField<float>("INS.roll_rate",     &vcu_INS_1_0::roll_rate),
+        dsdlField<float>("INS.pitch_rate",    &vcu_INS_1_0::pitch_rate),
+        dsdlField<float>("INS.yaw_rate",      &vcu_INS_1_0::yaw_rate),
+        dsdlField<float>("INS.roll_rate_dt",  &vcu_INS_1_0::roll_rate_dt),
+        dsdlField<float>("INS.pitch_rate_dt", &vcu_INS_1_0::pitch_rate_dt),
+        dsdlField<float>("INS.yaw_rate_dt",   &vcu_INS_1_0::yaw_rate_dt)
+    );
+};
+
+template <>
+struct DsdlType<vcu_EnergyMeter_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_EnergyMeter_1_0, 111, CanardTransferKindMessage)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<uint8_t>("EnergyMeter.counter",           &vcu_EnergyMeter_1_0::counter),
+        dsdlField<bool>   ("EnergyMeter.ready",             &vcu_EnergyMeter_1_0::ready),
+        dsdlField<bool>   ("EnergyMeter.logging",           &vcu_EnergyMeter_1_0::logging),
+        dsdlField<bool>   ("EnergyMeter.triggered_voltage", &vcu_EnergyMeter_1_0::triggered_voltage),
+        dsdlField<bool>   ("EnergyMeter.triggered_current", &vcu_EnergyMeter_1_0::triggered_current),
+        dsdlField<float>  ("EnergyMeter.voltage",           &vcu_EnergyMeter_1_0::voltage),
+        dsdlField<float>  ("EnergyMeter.current",           &vcu_EnergyMeter_1_0::current)
+    );
+};
+
+template <>
+struct DsdlType<vcu_DVStates_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_DVStates_1_0, 113, CanardTransferKindMessage)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<uint8_t>("DVStates.as_state",            &vcu_DVStates_1_0::as_state),
+        dsdlField<uint8_t>("DVStates.ebs_state",           &vcu_DVStates_1_0::ebs_state),
+        dsdlField<uint8_t>("DVStates.ami_state",           &vcu_DVStates_1_0::ami_state),
+        dsdlField<bool>   ("DVStates.steering_state",      &vcu_DVStates_1_0::steering_state),
+        dsdlField<uint8_t>("DVStates.service_brake_state", &vcu_DVStates_1_0::service_brake_state)
+    );
+};
+
+template <>
+struct DsdlType<vcu_InsEstimates1_1_0> {
+    VCU_DSDL_TYPE_COMMON(vcu_InsEstimates1_1_0, 114, CanardTransferKindMessage)
+    static constexpr auto fields = std::make_tuple(
+        dsdlField<uint32_t>("InsEstimates1.gps_time_msb", &vcu_InsEstimates1_1_0::gps_time_msb),
+        dsdlField<uint32_t>("InsEstimates1.gps_time_lsb", &vcu_InsEstimates1_1_0::gps_time_lsb),
+        dsdlField<uint32_t>("InsEstimates1.pps_time_msb", &vcu_InsEstimates1_1_0::pps_time_msb),
+        dsdlField<uint32_t>("InsEstimates1.pps_time_lsb", &vcu_InsEstimates1_1_0::pps_time_lsb),
+        dsdlField<double>  ("InsEstimates1.lat",          &vcu_InsEstimates1_1_0::lat),
+        dsdlField<double>  ("InsEstimates1.lon",          &vcu_InsEstimates1_1_0::lon),
+        dsdlField<double>  ("InsEstimates1.alt",          &vcu_InsEstimates1_1_0::alt),
+        dsdlField<float>   ("InsEstimates1.pos_std",      &vcu_InsEstimates1_1_0::pos_std),
+        dsdlField<float>   ("InsEstimates1.roll",         &vcu_InsEstimates1_1_0::roll),
+        dsdlField<float>   ("InsEstimates1.pitch",        &vcu_InsEstimates1_1_0::pitch),
+        dsdlField<float>   ("InsEstimates1.yaw",          &vcu_InsEstimates1_1_0::yaw)
+    );
+};
+
+#include "vcu_reflection_generated.hpp"
+
+#undef VCU_DSDL_TYPE_COMMON
+
+using VcuDsdlTypes = DsdlTypeListConcat<
+    DsdlTypeList<
+        vcu_EbsActivation_Request_1_0,
+        vcu_DriveMode_Request_1_0,
+        vcu_Config_Request_1_0,
+        vcu_INS_1_0,
+        vcu_EnergyMeter_1_0,
+        vcu_DVStates_1_0,
+        vcu_InsEstimates1_1_0
+    >,
+    VcuGeneratedDsdlTypes
+>::type;
+
+static_assert(dsdlPortsUnique(VcuDsdlTypes{}), "two vcu types on one port id");
+// the ports the hand written deserialization switches in Analyze and Relay handled
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 8, CanardTransferKindRequest), "EbsActivation request missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 10, CanardTransferKindRequest), "DriveMode request missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 13, CanardTransferKindRequest), "Config request missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 102, CanardTransferKindMessage), "INS missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 111, CanardTransferKindMessage), "EnergyMeter missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 113, CanardTransferKindMessage), "DVStates missing");
+static_assert(dsdlHasPort(VcuDsdlTypes{}, 114, CanardTransferKindMessage), "InsEstimates1 missing");
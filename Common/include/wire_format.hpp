@@ -0,0 +1,137 @@
+// wire_format.hpp
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "dsdl_reflection.hpp"
+
+// Encodings of the live messages Relay sends to websocket clients.
+//
+// A client picks one at the handshake with the Sec-WebSocket-Protocol header (or "?format=" in the
+// request target for clients that cannot set it), the server answers with the one it chose and
+// encodes every broadcast once per format in use:
+//
+//   relay.json       text frames, the JSON message objects back to back (the default)
+//   relay.cbor       binary frames, a CBOR sequence (RFC 8742) of the same message objects
+//   relay.msgpack    binary frames, MessagePack objects back to back
+//   relay.packed     binary frames of packed records, preceded by one text frame with the schema
+//   relay.delta      binary frames of changed values only, preceded by a schema, see delta_stream.hpp
+//
+// A packed record is little-endian and self-delimiting, so a client can skip ports it does not know:
+//
+//   uint16 record_size (header included), uint16 port_id, uint32 can_id, uint64 timestamp_us,
+//   then every field of the port in DSDL order at its natural width
+//   (bool and uint8 one byte, uint32 four, float f32, double f64)
+//
+// The schema lists the measure and the field names and types per port, see packedFieldType.
+
+enum class WireFormat : uint8_t { Json, Cbor, MsgPack, Packed, Delta };
+
+constexpr size_t kWireFormatCount = 5;
+
+namespace wire {
+
+constexpr size_t kPackedHeaderSize = 16;
+
+inline const char* subprotocol(WireFormat format) {
+    switch (format) {
+        case WireFormat::Json:      return "relay.json";
+        case WireFormat::Cbor:      return "relay.cbor";
+        case WireFormat::MsgPack:   return "relay.msgpack";
+        case WireFormat::Packed:    return "relay.packed";
+        case WireFormat::Delta:     return "relay.delta";
+    }
+    return "relay.json";
+}
+
+// "relay.cbor" as well as the short "cbor"
+inline bool parseFormat(std::string_view name, WireFormat& format) {
+    if (name.substr(0, 6) == "relay.") {
+        name.remove_prefix(6);
+    }
+    if (name == "json") {
+        format = WireFormat::Json;
+    } else if (name == "cbor") {
+        format = WireFormat::Cbor;
+    } else if (name == "msgpack") {
+        format = WireFormat::MsgPack;
+    } else if (name == "packed") {
+        format = WireFormat::Packed;
+    } else if (name == "delta") {
+        format = WireFormat::Delta;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline bool isBinary(WireFormat format) {
+    return format != WireFormat::Json;
+}
+
+template <typename T>
+inline void appendLittleEndian(std::string& out, T value) {
+    static_assert(std::is_arithmetic<T>::value, "packed fields are scalars");
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+        std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+    }
+#endif
+    out.append(reinterpret_cast<const char*>(bytes), sizeof(T));
+}
+
+// Type name of a packed field in the schema
+template <typename T>
+constexpr const char* packedFieldType() {
+    if constexpr (std::is_same<T, bool>::value) {
+        return "bool";
+    } else if constexpr (std::is_same<T, float>::value) {
+        return "f32";
+    } else if constexpr (std::is_same<T, double>::value) {
+        return "f64";
+    } else if constexpr (std::is_integral<T>::value) {
+        static_assert(sizeof(T) <= 8, "packed integers are at most 64 bit");
+        return std::is_signed<T>::value
+            ? (sizeof(T) == 1 ? "i8" : sizeof(T) == 2 ? "i16" : sizeof(T) == 4 ? "i32" : "i64")
+            : (sizeof(T) == 1 ? "u8" : sizeof(T) == 2 ? "u16" : sizeof(T) == 4 ? "u32" : "u64");
+    } else {
+        static_assert(std::is_arithmetic<T>::value, "packed fields are scalars");
+        return "";
+    }
+}
+
+template <typename T>
+inline size_t packedRecordSize() {
+    size_t size = kPackedHeaderSize;
+    dsdlForEachField<T>([&](size_t, const auto& field) {
+        size += sizeof(typename std::decay_t<decltype(field)>::member_type);
+    });
+    return size;
+}
+
+// One record of obj appended to out
+template <typename T>
+inline void appendPackedRecord(std::string& out, const T& obj, uint32_t can_id, uint64_t timestamp_us) {
+    static const size_t record_size = packedRecordSize<T>();
+    appendLittleEndian(out, static_cast<uint16_t>(record_size));
+    appendLittleEndian(out, static_cast<uint16_t>(DsdlType<T>::port_id));
+    appendLittleEndian(out, can_id);
+    appendLittleEndian(out, timestamp_us);
+    dsdlVisitFields(obj, [&](size_t, const auto&, const auto& value) {
+        using Member = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same<Member, bool>::value) {
+            out.push_back(value ? 1 : 0);
+        } else {
+            appendLittleEndian(out, value);
+        }
+    });
+}
+
+} // namespace wire
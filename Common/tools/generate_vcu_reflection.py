@@ -0,0 +1,155 @@
+"""Generates the DsdlType specializations of the vcu types that vcu_reflection.hpp does not write by hand.
+
+Reads the nunavut generated C headers (external/dsdl/compiled/vcu/*.h) and emits, for every type with a
+fixed port-ID, a DsdlType<T> specialization with one dsdlField per scalar member, plus the list of them:
+
+    using VcuGeneratedDsdlTypes = DsdlTypeList<...>;
+
+Services are registered by their request type, as the hand written ones are. Array, composite and union
+members are left out (the sinks only handle scalars), as are types without a fixed port-ID since nothing
+can be dispatched to them.
+
+    python3 generate_vcu_reflection.py <compiled/vcu dir> <vcu_reflection.hpp> <output header>
+"""
+
+import os
+import re
+import sys
+
+SCALAR_TYPES = {
+    "bool", "float", "double",
+    "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    "int8_t", "int16_t", "int32_t", "int64_t",
+}
+
+PORT_ID_RE = re.compile(r"#define\s+vcu_(\w+?)_(\d+)_(\d+)_FIXED_PORT_ID_\s+(\d+)U?")
+HAND_WRITTEN_RE = re.compile(r"struct\s+DsdlType<\s*(\w+)\s*>")
+MEMBER_RE = re.compile(r"^(\w+)\s+(\w+)$")
+
+
+def strip_comments(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    return re.sub(r"//[^\n]*", "", text)
+
+
+def struct_body(text, type_name):
+    """The text between the braces of 'typedef struct { ... } type_name;', None if there is none"""
+    end = re.search(r"}\s*" + re.escape(type_name) + r"\s*;", text)
+    if not end:
+        return None
+    depth = 0
+    for i in range(end.start(), -1, -1):
+        if text[i] == "}":
+            depth += 1
+        elif text[i] == "{":
+            depth -= 1
+            if depth == 0:
+                return text[i + 1:end.start()]
+    return None
+
+
+def scalar_members(body):
+    """(c type, name) of the scalar members at the top level of a struct body, and the names skipped"""
+    members, skipped = [], []
+    depth, statement = 0, ""
+    for char in body:
+        if char == "{":
+            depth += 1
+        elif char == "}":
+            depth -= 1
+        if char == ";" and depth == 0:
+            statement = " ".join(statement.split())
+            match = MEMBER_RE.match(statement)
+            if match and match.group(1) in SCALAR_TYPES and not match.group(2).startswith("_"):
+                members.append((match.group(1), match.group(2)))
+            elif statement and not statement.endswith("_"):
+                skipped.append(statement.split()[-1].rstrip("]").split("[")[0])
+            statement = ""
+        else:
+            statement += char
+    return members, skipped
+
+
+def types_in_header(path):
+    text = strip_comments(open(path).read())
+    match = PORT_ID_RE.search(text)
+    if not match:
+        return None
+    name, major, minor, port_id = match.group(1), match.group(2), match.group(3), int(match.group(4))
+    request = "vcu_%s_Request_%s_%s" % (name, major, minor)
+    if re.search(r"}\s*" + request + r"\s*;", text):
+        return name, request, port_id, "CanardTransferKindRequest", text
+    return name, "vcu_%s_%s_%s" % (name, major, minor), port_id, "CanardTransferKindMessage", text
+
+
+def specialization(header, name, type_name, port_id, kind, text):
+    lines = ['#include "%s"' % header]
+    body = struct_body(text, type_name)
+    if body is None:
+        return None
+    members, skipped = scalar_members(body)
+    if re.search(r"\bunion\b", body):
+        members, skipped = [], ["union"]
+    if skipped:
+        lines.append("// not reflected: %s" % ", ".join(skipped))
+    lines += [
+        "template <>",
+        "struct DsdlType<%s> {" % type_name,
+        "    VCU_DSDL_TYPE_COMMON(%s, %d, %s)" % (type_name, port_id, kind),
+        "    static constexpr auto fields = std::make_tuple(",
+    ]
+    fields = ['        dsdlField<%s>("%s.%s", &%s::%s)' % (c_type, name, member, type_name, member)
+              for c_type, member in members]
+    if fields:
+        lines.append(",\n".join(fields))
+    lines += ["    );", "};", ""]
+    return "\n".join(lines)
+
+
+def main(argv):
+    if len(argv) != 4:
+        sys.stderr.write(__doc__)
+        return 2
+    vcu_dir, hand_written_path, output_path = argv[1:]
+    hand_written = set(HAND_WRITTEN_RE.findall(open(hand_written_path).read()))
+
+    sections, type_names = [], []
+    for header in sorted(os.listdir(vcu_dir)):
+        if not header.endswith(".h"):
+            continue
+        found = types_in_header(os.path.join(vcu_dir, header))
+        if found is None:
+            sections.append("// vcu/%s: no fixed port-ID\n" % header)
+            continue
+        name, type_name, port_id, kind, text = found
+        if type_name in hand_written:
+            continue
+        section = specialization("vcu/" + header, name, type_name, port_id, kind, text)
+        if section is None:
+            sys.stderr.write("%s: no struct %s\n" % (header, type_name))
+            return 1
+        sections.append(section)
+        type_names.append(type_name)
+
+    out = [
+        "// vcu_reflection_generated.hpp",
+        "// Generated by Common/tools/generate_vcu_reflection.py from %s, do not edit." % vcu_dir,
+        "// Included by vcu_reflection.hpp, which defines VCU_DSDL_TYPE_COMMON.",
+        "#pragma once",
+        "",
+    ]
+    out += sections
+    out.append("using VcuGeneratedDsdlTypes = DsdlTypeList<%s\n>;" % ",".join("\n    " + t for t in type_names))
+    out.append("")
+
+    content = "\n".join(out)
+    # leave an unchanged header alone so make does not rebuild everything that includes it
+    if os.path.exists(output_path) and open(output_path).read() == content:
+        return 0
+    with open(output_path, "w") as f:
+        f.write(content)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
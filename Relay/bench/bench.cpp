@@ -0,0 +1,725 @@
+// Relay benchmarks
+//
+//   make bench
+//   ./bin/bench generate bench.pcap [--frames N] [--frames-per-datagram K] [--mix 102:8,111:1] [--seed S]
+//   ./bin/bench run bench.pcap [--seconds S] [--json-threads T] [-o results.json]
+//   ./bin/bench upload bench.pcap [--batch-kib N] [--gzip L] [--direct 0|1] [mock options] [-o results.json]
+//   ./bin/bench mock-influx [--port P] [mock options]
+//   ./bin/bench check-upload [--frames N]       (make check)
+//   ./bin/bench live bench.pcap [--repeat N] [--rate D] [--batch B] [--rcvbuf-kib K] [-o results.json]
+//
+// generate writes a deterministic capture (see PcapGenerator), run measures Converter::udpToJson,
+// Converter::udpToJsonText (per datagram, and on the whole capture with --json-threads threads),
+// Converter::pcapFileToJsonText, Converter::jsonToUdp, the websocket encodings, line protocol
+// formatting from JSON and Converter::udpToLineProtocol on it and prints the results as JSON.
+// The same capture is the input of the Analyze bench target.
+//
+// upload sends the decoded capture through InfluxdbClient::writeJsonToInfluxdb to an in-process
+// MockInfluxDB (or with --direct 1 through writeUdpToInfluxdb, without JSON) and reports the
+// throughput with the request size and latency histograms of the mock.
+// mock-influx runs the same mock on its own until Enter is pressed, for measuring other clients such
+// as Analyze. Mock options: --latency-ms L, --jitter-ms J, --rate-limit P, --fail P, --token T,
+// --validate 0|1.
+//
+// check-upload is not a measurement: it sends a generated capture of N frames to the mock and checks
+// what the mock received, exiting with 1 if anything is off. Plain bodies must arrive with one line
+// per decoded message, gzip bodies must decode to the same number of valid lines, and
+// InfluxBatchWriter must get every batch through, unchanged, while the mock answers half the writes
+// with 503.
+//
+// live sends the capture N times over loopback to a UdpReceiver (D datagrams per second, 0 for as
+// fast as possible) which decodes every datagram with Converter::udpToJsonMessages on its receive
+// thread, and reports what arrived and what the kernel dropped.
+
+#include "converter.hpp"
+#include "influxdb_client.hpp"
+#include "pcap_generator.hpp"
+#include "bench_util.hpp"
+#include "http_connection_pool.hpp"
+#include "influx_batch_writer.hpp"
+#include "mock_influxdb.hpp"
+#include "delta_stream.hpp"
+#include "udp_receiver.hpp"
+
+#include "pcapplusplus/PcapFileDevice.h"
+#include "pcapplusplus/Packet.h"
+#include "pcapplusplus/UdpLayer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace {
+
+struct Capture {
+    std::vector<std::vector<uint8_t>>   datagrams;
+    uint64_t                            frames = 0;
+    uint64_t                            bytes = 0;
+};
+
+// counts records the same way Converter walks them: 8 byte timestamp, 4 byte can id, 1 byte length, payload
+uint64_t countCanFrames(const std::vector<uint8_t>& datagram) {
+    constexpr size_t header_length = 8 + 4 + 1;
+    uint64_t frames = 0;
+    size_t offset = 0;
+    while (offset + header_length <= datagram.size()) {
+        const size_t data_length = datagram[offset + header_length - 1];
+        if (offset + header_length + data_length > datagram.size())
+            break;
+        offset += header_length + data_length;
+        ++frames;
+    }
+    return frames;
+}
+
+bool loadCapture(const std::string& pcap_file_path, Capture& capture) {
+    std::unique_ptr<pcpp::IFileReaderDevice> reader(pcpp::IFileReaderDevice::getReader(pcap_file_path.c_str()));
+    if (!reader || !reader->open()) {
+        std::cerr << "Error opening the pcap file: " << pcap_file_path << std::endl;
+        return false;
+    }
+    pcpp::RawPacket raw_packet;
+    while (reader->getNextPacket(raw_packet)) {
+        pcpp::Packet parsed_packet(&raw_packet, false, pcpp::UDP);
+        pcpp::UdpLayer* udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
+        if (udp_layer == nullptr)
+            continue;
+        const uint8_t* payload = udp_layer->getLayerPayload();
+        std::vector<uint8_t> datagram(payload, payload + udp_layer->getLayerPayloadSize());
+        capture.frames += countCanFrames(datagram);
+        capture.bytes += datagram.size();
+        capture.datagrams.push_back(std::move(datagram));
+    }
+    reader->close();
+    return !capture.datagrams.empty();
+}
+
+int generate(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: bench generate <out.pcap> [--frames N] [--frames-per-datagram K] [--mix port:weight,...] [--seed S]\n";
+        return 1;
+    }
+    PcapGeneratorConfig config;
+    const std::string pcap_file_path = argv[2];
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--frames") {
+            config.frames = std::stoull(value);
+        } else if (option == "--frames-per-datagram") {
+            config.frames_per_datagram = std::stoul(value);
+        } else if (option == "--mix") {
+            if (!PcapGenerator::parsePortMix(value, config.port_mix))
+                return 1;
+        } else if (option == "--seed") {
+            config.seed = std::stoull(value);
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    PcapGenerator generator(config);
+    PcapGeneratorResult result = generator.writePcap(pcap_file_path);
+    if (!result.ok)
+        return 1;
+
+    json mix = json::object();
+    for (const auto& [port_id, weight] : config.port_mix)
+        mix[std::to_string(port_id)] = weight;
+    json j = {
+        {"pcap",                pcap_file_path},
+        {"seed",                config.seed},
+        {"port_mix",            mix},
+        {"frames",              result.frames},
+        {"datagrams",           result.datagrams},
+        {"udp_bytes",           result.udp_bytes},
+    };
+    std::cout << j.dump(2) << std::endl;
+    return 0;
+}
+
+int run(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: bench run <in.pcap> [--seconds S] [--json-threads T] [-o results.json]\n";
+        return 1;
+    }
+    const std::string pcap_file_path = argv[2];
+    double min_seconds = 1.0;
+    size_t json_threads = 1;
+    std::string output_path;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--seconds") {
+            min_seconds = std::stod(argv[i + 1]);
+        } else if (option == "--json-threads") {
+            json_threads = std::stoul(argv[i + 1]);
+        } else if (option == "-o") {
+            output_path = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    Capture capture;
+    if (!loadCapture(pcap_file_path, capture))
+        return 1;
+
+    std::vector<BenchResult> results;
+    Converter converter;
+
+    // the decoded datagrams are the input of the encode benchmarks
+    std::vector<json> decoded;
+    decoded.reserve(capture.datagrams.size());
+    for (const auto& datagram : capture.datagrams)
+        decoded.push_back(converter.udpToJson(datagram.data(), datagram.size()));
+
+    results.push_back(benchRun("relay.udpToJson", capture.frames, capture.bytes, min_seconds, [&]() {
+        for (const auto& datagram : capture.datagrams) {
+            json j = converter.udpToJson(datagram.data(), datagram.size());
+            benchDoNotOptimize(j);
+        }
+    }));
+
+    // the same messages as text without the json DOM, bytes are the capture size like udpToJson
+    results.push_back(benchRun("relay.udpToJsonText", capture.frames, capture.bytes, min_seconds, [&]() {
+        for (const auto& datagram : capture.datagrams) {
+            std::string text = converter.udpToJsonText(datagram.data(), datagram.size());
+            benchDoNotOptimize(text);
+        }
+    }));
+
+    // the whole capture at once as pcapFileToJson sees it, serialized on json_threads threads
+    std::vector<uint8_t> whole_capture;
+    whole_capture.reserve(capture.bytes);
+    for (const auto& datagram : capture.datagrams)
+        whole_capture.insert(whole_capture.end(), datagram.begin(), datagram.end());
+    JsonTextOptions json_options;
+    json_options.threads = json_threads;
+    results.push_back(benchRun("relay.udpToJsonText.capture", capture.frames, capture.bytes, min_seconds, [&]() {
+        std::string text = converter.udpToJsonText(whole_capture.data(), whole_capture.size(), json_options);
+        benchDoNotOptimize(text);
+    }));
+
+    // straight from the file in 1 MiB pieces, memory stays the same whatever the capture length
+    results.push_back(benchRun("relay.pcapFileToJsonText", capture.frames, capture.bytes, min_seconds, [&]() {
+        size_t text_bytes = 0;
+        converter.pcapFileToJsonText(pcap_file_path, [&](std::string_view chunk) {
+            text_bytes += chunk.size();
+            return true;
+        });
+        benchDoNotOptimize(text_bytes);
+    }));
+
+    results.push_back(benchRun("relay.jsonToUdp", capture.frames, capture.bytes, min_seconds, [&]() {
+        for (const auto& j : decoded) {
+            std::vector<uint8_t> udp_msg = converter.jsonToUdp(j);
+            benchDoNotOptimize(udp_msg);
+        }
+    }));
+
+    // websocket encodings (see wire_format.hpp), bytes are the encoded size so the ratio to
+    // relay.encode.json is the saving on the link
+    auto benchEncode = [&](const std::string& name, const std::function<void(const json& message, std::string& out)>& encode) {
+        std::string out;
+        for (const auto& j : decoded)
+            for (const auto& msg : j["messages"])
+                encode(msg, out);
+        const uint64_t encoded_bytes = out.size();
+        results.push_back(benchRun(name, capture.frames, encoded_bytes, min_seconds, [&]() {
+            out.clear();
+            for (const auto& j : decoded)
+                for (const auto& msg : j["messages"])
+                    encode(msg, out);
+            benchDoNotOptimize(out);
+        }));
+    };
+    benchEncode("relay.encode.json", [](const json& msg, std::string& out) { out += msg.dump(); });
+    benchEncode("relay.encode.cbor", [](const json& msg, std::string& out) { json::to_cbor(msg, out); });
+    benchEncode("relay.encode.msgpack", [](const json& msg, std::string& out) { json::to_msgpack(msg, out); });
+    benchEncode("relay.encode.packed", [&](const json& msg, std::string& out) { converter.jsonToPacked(msg, out); });
+
+    // delta frames from the packed records, one frame per datagram as if every datagram was one send
+    std::vector<std::string> packed_datagrams;
+    for (const auto& j : decoded) {
+        std::string packed;
+        for (const auto& msg : j["messages"])
+            converter.jsonToPacked(msg, packed);
+        packed_datagrams.push_back(std::move(packed));
+    }
+    DeltaStreamEncoder delta(Converter::packedSchema());
+    uint64_t delta_bytes = 0;
+    for (const auto& packed : packed_datagrams) {
+        delta.AddRecords(packed);
+        delta_bytes += delta.TakeFrame().size();
+    }
+    results.push_back(benchRun("relay.encode.delta", capture.frames, delta_bytes, min_seconds, [&]() {
+        for (const auto& packed : packed_datagrams) {
+            delta.AddRecords(packed);
+            std::string frame = delta.TakeFrame();
+            benchDoNotOptimize(frame);
+        }
+    }));
+
+    // bytes here are the line protocol produced, not the capture size
+    uint64_t line_protocol_bytes = 0;
+    LineProtocolEncoder encoder;
+    for (const auto& j : decoded)
+        for (const auto& msg : j["messages"])
+            InfluxdbClient::appendJsonMessageToLineProtocol(encoder, msg, 0);
+    line_protocol_bytes = encoder.Size();
+    results.push_back(benchRun("relay.lineProtocol", capture.frames, line_protocol_bytes, min_seconds, [&]() {
+        encoder.Clear();
+        for (const auto& j : decoded)
+            for (const auto& msg : j["messages"])
+                InfluxdbClient::appendJsonMessageToLineProtocol(encoder, msg, 0);
+        benchDoNotOptimize(encoder.Buffer());
+    }));
+
+    // the direct path, the same lines from the decoded structs without JSON in between
+    uint64_t direct_bytes = 0;
+    LineProtocolBatcher batcher(LineBatchPolicy(), [&](std::string&& batch) { direct_bytes += batch.size(); });
+    for (const auto& datagram : capture.datagrams)
+        converter.udpToLineProtocol(datagram.data(), datagram.size(), batcher, 0);
+    batcher.Flush();
+    const uint64_t direct_bytes_per_iteration = direct_bytes;
+    results.push_back(benchRun("relay.udpToLineProtocol", capture.frames, direct_bytes_per_iteration, min_seconds, [&]() {
+        for (const auto& datagram : capture.datagrams)
+            converter.udpToLineProtocol(datagram.data(), datagram.size(), batcher, 0);
+        batcher.Flush();
+    }));
+
+    json context = {
+        {"pcap",        pcap_file_path},
+        {"datagrams",   capture.datagrams.size()},
+        {"frames",      capture.frames},
+        {"udp_bytes",   capture.bytes},
+        {"min_seconds", min_seconds},
+        {"json_threads", json_threads},
+    };
+    return benchWriteJson(benchToJson(results, context), output_path) ? 0 : 1;
+}
+
+// Options of the mock, false if option is not one of them
+bool parseMockOption(const std::string& option, const std::string& value, MockInfluxConfig& config) {
+    if (option == "--latency-ms") {
+        config.faults.latency_ms = std::stod(value);
+    } else if (option == "--jitter-ms") {
+        config.faults.latency_jitter_ms = std::stod(value);
+    } else if (option == "--rate-limit") {
+        config.faults.rate_limit_probability = std::stod(value);
+    } else if (option == "--fail") {
+        config.faults.failure_probability = std::stod(value);
+    } else if (option == "--token") {
+        config.token = value;
+    } else if (option == "--validate") {
+        config.validate = value != "0";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+json httpPoolStatsToJson(const HttpPoolStats& stats) {
+    return {
+        {"requests",                stats.requests},
+        {"responses_2xx",           stats.responses_2xx},
+        {"responses_4xx",           stats.responses_4xx},
+        {"responses_5xx",           stats.responses_5xx},
+        {"transport_errors",        stats.transport_errors},
+        {"timeouts",                stats.timeouts},
+        {"connections_opened",      stats.connections_opened},
+        {"connections_reused",      stats.connections_reused},
+        {"request_bytes",           stats.request_bytes},
+        {"mean_latency_seconds",    stats.MeanLatencySeconds()},
+        {"max_latency_seconds",     stats.latency_max_seconds},
+    };
+}
+
+int upload(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: bench upload <in.pcap> [--batch-kib N] [--gzip L] [--direct 0|1] [mock options] [-o results.json]\n";
+        return 1;
+    }
+    const std::string pcap_file_path = argv[2];
+    LineBatchPolicy batching;
+    int gzip_level = 1;
+    bool direct = false;
+    std::string output_path;
+    MockInfluxConfig config;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--batch-kib") {
+            batching.target_bytes = std::stoul(value) * 1024;
+        } else if (option == "--gzip") {
+            gzip_level = std::stoi(value);
+        } else if (option == "--direct") {
+            direct = value != "0";
+        } else if (option == "-o") {
+            output_path = value;
+        } else if (!parseMockOption(option, value, config)) {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    Capture capture;
+    if (!loadCapture(pcap_file_path, capture))
+        return 1;
+    Converter converter;
+    json all = {{"messages", json::array()}};
+    if (!direct) {
+        for (const auto& datagram : capture.datagrams) {
+            json j = converter.udpToJson(datagram.data(), datagram.size());
+            for (auto& msg : j["messages"])
+                all["messages"].push_back(std::move(msg));
+        }
+    }
+
+    MockInfluxDB mock(config);
+    std::string error;
+    if (!mock.Start(&error)) {
+        std::cerr << "Could not start the mock InfluxDB: " << error << "\n";
+        return 1;
+    }
+    InfluxdbClient client("127.0.0.1", std::to_string(mock.Port()), "bench", config.token, gzip_level);
+    client.setBatchPolicy(batching);
+
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (direct) {
+        // decoding is part of the measurement here
+        for (const auto& datagram : capture.datagrams)
+            ok = client.writeUdpToInfluxdb(converter, datagram.data(), datagram.size()) && ok;
+    } else {
+        ok = client.writeJsonToInfluxdb(all);
+    }
+    ok = client.flushToInfluxdb() && ok;
+    BenchResult result;
+    result.name = "relay.influxUpload";
+    result.iterations = 1;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const MockInfluxStats mock_stats = mock.Stats();
+    mock.Stop();
+    // bytes here are the line protocol accepted by the mock, not the capture size
+    result.frames = mock_stats.lines;
+    result.bytes = mock_stats.bytes_decoded;
+    std::cerr << result.name << ": " << result.FramesPerSecond() / 1e6 << " Mlines/s, " << result.BytesPerSecond() / 1e6 << " MB/s\n";
+
+    json context = {
+        {"pcap",            pcap_file_path},
+        {"frames",          capture.frames},
+        {"batch_bytes",     batching.target_bytes},
+        {"gzip_level",      gzip_level},
+        {"direct",          direct},
+        {"completed",       ok},
+        {"client",          httpPoolStatsToJson(client.getStats())},
+        {"mock",            mock_stats.ToJson()},
+    };
+    if (!direct)
+        context["messages"] = all["messages"].size();
+    if (!benchWriteJson(benchToJson({result}, context), output_path))
+        return 1;
+    return ok ? 0 : 1;
+}
+
+int mockInflux(int argc, char** argv) {
+    MockInfluxConfig config;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--port") {
+            config.port = static_cast<unsigned short>(std::stoul(value));
+        } else if (!parseMockOption(option, value, config)) {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+    MockInfluxDB mock(config);
+    std::string error;
+    if (!mock.Start(&error)) {
+        std::cerr << "Could not start the mock InfluxDB: " << error << "\n";
+        return 1;
+    }
+    std::cerr << "Mock InfluxDB listening on " << config.address << ":" << mock.Port() << ", press Enter to stop\n";
+    std::string line;
+    std::getline(std::cin, line);
+    mock.Stop();
+    std::cout << mock.Stats().ToJson().dump(2) << std::endl;
+    return 0;
+}
+
+// Bodies of the writes the mock accepted, in the order they arrived
+struct ReceivedWrites {
+    std::mutex                  mutex;
+    std::vector<std::string>    bodies;
+
+    MockInfluxDB::WriteFn Recorder() {
+        return [this](const std::string&, const std::string&, const std::string& body) {
+            std::lock_guard<std::mutex> lock(mutex);
+            bodies.push_back(body);
+        };
+    }
+
+    uint64_t Lines() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t lines = 0;
+        for (const std::string& body : bodies)
+            lines += std::count(body.begin(), body.end(), '\n') + (!body.empty() && body.back() != '\n' ? 1 : 0);
+        return lines;
+    }
+};
+
+// Prints the outcome of one check, false if it failed
+bool checkUpload(const std::string& name, bool passed, const std::string& detail) {
+    std::cerr << (passed ? "ok      " : "FAILED  ") << name << ": " << detail << "\n";
+    return passed;
+}
+
+// Uploads messages through an InfluxdbClient sending gzip_level bodies and checks what arrived
+bool checkClientUpload(const std::string& name, const json& messages, int gzip_level, ReceivedWrites& received) {
+    MockInfluxDB mock(MockInfluxConfig(), received.Recorder());
+    std::string error;
+    if (!mock.Start(&error))
+        return checkUpload(name, false, "could not start the mock InfluxDB: " + error);
+    bool ok = true;
+    {
+        InfluxdbClient client("127.0.0.1", std::to_string(mock.Port()), "check", "", gzip_level);
+        LineBatchPolicy batching;
+        batching.target_bytes = 16 * 1024;      // a few dozen requests
+        client.setBatchPolicy(batching);
+        ok = client.writeJsonToInfluxdb(messages);
+        ok = client.flushToInfluxdb() && ok;
+    }
+    mock.Stop();
+    const MockInfluxStats stats = mock.Stats();
+    const uint64_t expected = messages["messages"].size();
+    const uint64_t lines = received.Lines();
+
+    bool passed = checkUpload(name + " sent", ok && stats.writes == stats.writes_accepted && stats.writes > 1,
+        std::to_string(stats.writes_accepted) + "/" + std::to_string(stats.writes) + " writes accepted");
+    passed = checkUpload(name + " lines", lines == expected && stats.lines == expected && stats.invalid == 0,
+        std::to_string(lines) + " lines received, " + std::to_string(expected) + " messages, " + std::to_string(stats.invalid) + " invalid") && passed;
+    if (gzip_level > 0) {
+        passed = checkUpload(name + " decoded", stats.bytes_received < stats.bytes_decoded,
+            std::to_string(stats.bytes_received) + " bytes on the wire, " + std::to_string(stats.bytes_decoded) + " decoded") && passed;
+    }
+    return passed;
+}
+
+int checkUploads(int argc, char** argv) {
+    PcapGeneratorConfig generator_config;
+    generator_config.frames = 20000;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--frames") {
+            generator_config.frames = std::stoull(value);
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    PcapGenerator generator(generator_config);
+    Converter converter;
+    json messages = {{"messages", json::array()}};
+    for (uint64_t frames = 0; frames < generator_config.frames; frames += generator_config.frames_per_datagram) {
+        const std::vector<uint8_t> datagram = generator.nextDatagram();
+        json j = converter.udpToJson(datagram.data(), datagram.size());
+        for (auto& msg : j["messages"])
+            messages["messages"].push_back(std::move(msg));
+    }
+
+    bool passed = checkUpload("capture", !messages["messages"].empty(),
+        std::to_string(messages["messages"].size()) + " messages from " + std::to_string(generator_config.frames) + " frames");
+
+    ReceivedWrites plain;
+    passed = checkClientUpload("plain", messages, 0, plain) && passed;
+    ReceivedWrites gzipped;
+    passed = checkClientUpload("gzip", messages, 6, gzipped) && passed;
+
+    // the plain bodies again, as batches of a writer that has to retry
+    MockInfluxConfig config;
+    config.faults.failure_probability = 0.5;
+    config.faults.failure_status = 503;
+    ReceivedWrites retried;
+    MockInfluxDB mock(config, retried.Recorder());
+    std::string error;
+    if (!mock.Start(&error)) {
+        checkUpload("retry", false, "could not start the mock InfluxDB: " + error);
+        return 1;
+    }
+    InfluxWriteProgress progress;
+    {
+        HttpConnectionPool pool("127.0.0.1", std::to_string(mock.Port()));
+        InfluxBatchWriterConfig writer_config;
+        writer_config.connections = 2;
+        writer_config.max_retries = 40;     // 0.5^41 per batch
+        writer_config.backoff_base_seconds = 0.001;
+        writer_config.backoff_max_seconds = 0.01;
+        InfluxBatchWriter writer(pool, "check", "", writer_config);
+        for (const std::string& body : plain.bodies) {
+            InfluxWriteBatch batch;
+            batch.bucket = "check";
+            batch.precision = "us";
+            batch.body = body;
+            writer.Enqueue(std::move(batch));
+        }
+        writer.Flush();
+        progress = writer.Progress();
+    }
+    mock.Stop();
+    const MockInfluxStats stats = mock.Stats();
+    std::vector<std::string> sent = plain.bodies;
+    std::vector<std::string> arrived = retried.bodies;
+    std::sort(sent.begin(), sent.end());
+    std::sort(arrived.begin(), arrived.end());
+    passed = checkUpload("retry injected", stats.failed > 0 && progress.retries >= stats.failed,
+        std::to_string(stats.failed) + " writes answered 503, " + std::to_string(progress.retries) + " retries") && passed;
+    passed = checkUpload("retry written", progress.batches_written == sent.size() && progress.batches_failed == 0,
+        std::to_string(progress.batches_written) + "/" + std::to_string(sent.size()) + " batches written, " + std::to_string(progress.batches_failed) + " failed") && passed;
+    passed = checkUpload("retry bodies", arrived == sent,
+        std::to_string(arrived.size()) + " bodies accepted, " + (arrived == sent ? "each once and unchanged" : "not the ones sent")) && passed;
+
+    std::cerr << (passed ? "all upload checks passed\n" : "upload checks FAILED\n");
+    return passed ? 0 : 1;
+}
+
+int live(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: bench live <in.pcap> [--repeat N] [--rate D] [--batch B] [--rcvbuf-kib K] [-o results.json]\n";
+        return 1;
+    }
+    const std::string pcap_file_path = argv[2];
+    size_t repeat = 10;
+    double datagrams_per_second = 0.0;
+    std::string output_path;
+    UdpReceiverConfig config;
+    config.bind_address = "127.0.0.1";
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--repeat") {
+            repeat = std::stoul(value);
+        } else if (option == "--rate") {
+            datagrams_per_second = std::stod(value);
+        } else if (option == "--batch") {
+            config.batch_size = std::stoul(value);
+        } else if (option == "--rcvbuf-kib") {
+            config.receive_buffer_bytes = std::stoi(value) * 1024;
+        } else if (option == "-o") {
+            output_path = value;
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    Capture capture;
+    if (!loadCapture(pcap_file_path, capture))
+        return 1;
+    Converter converter;
+    uint64_t messages = 0;
+    uint64_t message_bytes = 0;
+    UdpReceiver receiver(config, [&](const UdpDatagram* datagrams, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            messages += converter.udpToJsonMessages(datagrams[i].data, datagrams[i].size, [&](std::string_view message) {
+                message_bytes += message.size();
+            });
+        }
+    });
+    if (!receiver.start())
+        return 1;
+    UdpSender sender;
+    if (!sender.open(config.bind_address, receiver.port()))
+        return 1;
+
+    // paced in slices of one batch, so the receiver sees bursts of the size it reads
+    const size_t slice = std::max<size_t>(config.batch_size, 1);
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    uint64_t sent = 0;
+    std::vector<std::vector<uint8_t>> burst;
+    for (size_t round = 0; round < repeat && ok; ++round) {
+        for (size_t first = 0; first < capture.datagrams.size() && ok; first += slice) {
+            const size_t last = std::min(first + slice, capture.datagrams.size());
+            burst.assign(capture.datagrams.begin() + first, capture.datagrams.begin() + last);
+            if (datagrams_per_second > 0.0)
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(sent / datagrams_per_second)));
+            ok = sender.send(burst, slice);
+            sent += burst.size();
+        }
+    }
+    // what is still in flight on loopback is read well within this
+    const auto settle = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (receiver.stats().datagrams + receiver.stats().kernel_drops < sent && std::chrono::steady_clock::now() < settle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    receiver.stop();
+    const UdpReceiverStats stats = receiver.stats();
+
+    BenchResult result;
+    result.name = "relay.udpReceiver";
+    result.iterations = repeat;
+    result.seconds = seconds;
+    // frames here are the decoded messages, bytes the datagrams that arrived
+    result.frames = messages;
+    result.bytes = stats.bytes;
+    std::cerr << result.name << ": " << stats.datagrams << "/" << sent << " datagrams, " << stats.kernel_drops << " dropped, "
+              << result.BytesPerSecond() / 1e6 << " MB/s\n";
+
+    json context = {
+        {"pcap",                    pcap_file_path},
+        {"datagrams_sent",          sent},
+        {"rate",                    datagrams_per_second},
+        {"batch_size",              config.batch_size},
+        {"receive_buffer_bytes",    receiver.receiveBufferBytes()},
+        {"messages",                messages},
+        {"message_bytes",           message_bytes},
+        {"receiver", {
+            {"datagrams",       stats.datagrams},
+            {"bytes",           stats.bytes},
+            {"batches",         stats.batches},
+            {"full_batches",    stats.full_batches},
+            {"kernel_drops",    stats.kernel_drops},
+            {"truncated",       stats.truncated},
+            {"errors",          stats.errors},
+        }},
+    };
+    if (!benchWriteJson(benchToJson({result}, context), output_path))
+        return 1;
+    return ok && stats.kernel_drops == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && std::strcmp(argv[1], "generate") == 0)
+        return generate(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "run") == 0)
+        return run(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "upload") == 0)
+        return upload(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "mock-influx") == 0)
+        return mockInflux(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "live") == 0)
+        return live(argc, argv);
+    if (argc >= 2 && std::strcmp(argv[1], "check-upload") == 0)
+        return checkUploads(argc, argv);
+    std::cerr << "usage: bench generate <out.pcap> [options] | bench run <in.pcap> [options]\n"
+              << "       bench upload <in.pcap> [options] | bench mock-influx [options]\n"
+              << "       bench live <in.pcap> [options] | bench check-upload [--frames N]\n";
+    return 1;
+}
@@ -0,0 +1,160 @@
+#include "pcap_generator.hpp"
+#include "vcu_reflection.hpp"
+
+#include "pcapplusplus/PcapFileDevice.h"
+#include "pcapplusplus/Packet.h"
+#include "pcapplusplus/EthLayer.h"
+#include "pcapplusplus/IPv4Layer.h"
+#include "pcapplusplus/UdpLayer.h"
+#include "pcapplusplus/PayloadLayer.h"
+
+#include <array>
+#include <iostream>
+#include <sstream>
+
+using json = nlohmann::json;
+
+namespace {
+
+using FieldFillFn = void (*)(std::mt19937_64&, json&);
+
+template <typename T>
+void fillRandomFields(std::mt19937_64& rng, json& fields) {
+    dsdlForEachField<T>([&](size_t, const auto& field) {
+        using Member = typename std::decay_t<decltype(field)>::member_type;
+        if constexpr (std::is_same<Member, bool>::value) {
+            fields[field.name] = static_cast<bool>(rng() & 1U);
+        } else if constexpr (std::is_floating_point<Member>::value) {
+            fields[field.name] = std::uniform_real_distribution<Member>(-100, 100)(rng);
+        } else {
+            // small values so narrow DSDL integers stored in wider C types are not saturated
+            fields[field.name] = static_cast<Member>(rng() % 4U);
+        }
+    });
+}
+
+const std::array<FieldFillFn, CANARD_SUBJECT_ID_MAX + 1U>& fieldFillers() {
+    static const auto table = dsdlMakePortTable<FieldFillFn>(VcuDsdlTypes{}, [](auto tag) -> FieldFillFn {
+        return &fillRandomFields<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+std::vector<double> portWeights(const PcapGeneratorConfig& config) {
+    std::vector<double> weights;
+    for (const auto& [port_id, weight] : config.port_mix) {
+        weights.push_back(weight);
+    }
+    return weights;
+}
+
+} // namespace
+
+PcapGenerator::PcapGenerator(const PcapGeneratorConfig& config)
+    : m_config(config),
+      m_rng(config.seed),
+      m_timestamp_us(0),
+      m_frames_left(config.frames)
+{
+    const std::vector<double> weights = portWeights(config);
+    m_port_distribution = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+}
+
+bool PcapGenerator::parsePortMix(const std::string& text, std::vector<std::pair<CanardPortID, uint32_t>>& port_mix) {
+    port_mix.clear();
+    std::stringstream ss(text);
+    std::string entry;
+    while (std::getline(ss, entry, ',')) {
+        const size_t colon = entry.find(':');
+        try {
+            const unsigned long port_id = std::stoul(entry.substr(0, colon));
+            const unsigned long weight = (colon == std::string::npos) ? 1UL : std::stoul(entry.substr(colon + 1));
+            if (port_id > CANARD_SUBJECT_ID_MAX || fieldFillers()[port_id] == nullptr) {
+                std::cerr << "Error: port " << port_id << " is not described in vcu_reflection.hpp\n";
+                return false;
+            }
+            port_mix.emplace_back(static_cast<CanardPortID>(port_id), static_cast<uint32_t>(weight));
+        } catch (const std::exception&) {
+            std::cerr << "Error: bad port mix entry '" << entry << "'\n";
+            return false;
+        }
+    }
+    return !port_mix.empty();
+}
+
+json PcapGenerator::nextDatagramJson() {
+    json j;
+    j["messages"] = json::array();
+    const uint64_t count = std::min<uint64_t>(m_config.frames_per_datagram, m_frames_left);
+    for (uint64_t i = 0; i < count; ++i) {
+        const CanardPortID port_id = m_config.port_mix[m_port_distribution(m_rng)].first;
+        json msg;
+        msg["port_id"] = port_id;
+        msg["timestamp"] = m_timestamp_us;
+        msg["fields"] = json::object();
+        fieldFillers()[port_id](m_rng, msg["fields"]);
+        j["messages"].push_back(std::move(msg));
+        m_timestamp_us += m_config.frame_interval_us;
+    }
+    m_frames_left -= count;
+    return j;
+}
+
+std::vector<uint8_t> PcapGenerator::nextDatagram() {
+    return m_converter.jsonToUdp(nextDatagramJson());
+}
+
+PcapGeneratorResult PcapGenerator::writePcap(const std::string& pcap_file_path) {
+    PcapGeneratorResult result;
+
+    pcpp::PcapFileWriterDevice writer(pcap_file_path, pcpp::LINKTYPE_ETHERNET);
+    if (!writer.open()) {
+        std::cerr << "Error: could not open " << pcap_file_path << " for writing\n";
+        return result;
+    }
+
+    const pcpp::MacAddress src_mac("02:00:00:00:00:01");
+    const pcpp::MacAddress dst_mac("02:00:00:00:00:02");
+    const pcpp::IPv4Address src_ip("10.0.0.2");
+    const pcpp::IPv4Address dst_ip("10.0.0.1");
+
+    while (m_frames_left > 0) {
+        const uint64_t datagram_timestamp_us = m_timestamp_us;
+        const uint64_t frames_before = m_frames_left;
+        const std::vector<uint8_t> udp_payload = nextDatagram();
+        if (udp_payload.empty()) {
+            continue;
+        }
+
+        pcpp::EthLayer eth_layer(src_mac, dst_mac, PCPP_ETHERTYPE_IP);
+        pcpp::IPv4Layer ip_layer(src_ip, dst_ip);
+        ip_layer.getIPv4Header()->timeToLive = 64;
+        pcpp::UdpLayer udp_layer(m_config.udp_src_port, m_config.udp_dst_port);
+        pcpp::PayloadLayer payload_layer(udp_payload.data(), udp_payload.size());
+
+        pcpp::Packet packet(udp_payload.size() + 64);
+        packet.addLayer(&eth_layer);
+        packet.addLayer(&ip_layer);
+        packet.addLayer(&udp_layer);
+        packet.addLayer(&payload_layer);
+        packet.computeCalculateFields();
+
+        timespec timestamp;
+        timestamp.tv_sec = static_cast<time_t>(datagram_timestamp_us / 1000000U);
+        timestamp.tv_nsec = static_cast<long>((datagram_timestamp_us % 1000000U) * 1000U);
+        packet.getRawPacket()->setPacketTimeStamp(timestamp);
+
+        if (!writer.writePacket(*packet.getRawPacket())) {
+            std::cerr << "Error: failed to write packet to " << pcap_file_path << "\n";
+            writer.close();
+            return result;
+        }
+        result.frames += frames_before - m_frames_left;
+        result.datagrams++;
+        result.udp_bytes += udp_payload.size();
+    }
+
+    writer.close();
+    result.ok = true;
+    return result;
+}
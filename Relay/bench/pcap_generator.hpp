@@ -0,0 +1,57 @@
+// pcap_generator.hpp
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "converter.hpp"
+
+// Deterministic generator of CAN over UDP captures for the benchmarks.
+//
+// Messages are drawn from a weighted port mix and filled with pseudo random field values from a
+// seeded std::mt19937_64, so the same configuration always produces the same capture. Payloads go
+// through the real nunavut serializers via Converter::jsonToUdp, which means every port in the mix
+// must be described in vcu_reflection.hpp.
+
+struct PcapGeneratorConfig {
+    uint64_t                                        frames = 200000;
+    size_t                                          frames_per_datagram = 16;        // 16 * 77 bytes stays below a 1500 byte MTU
+    std::vector<std::pair<CanardPortID, uint32_t>>  port_mix = {{102, 8}, {111, 1}, {113, 1}, {114, 2}};
+    uint64_t                                        seed = 1;
+    uint64_t                                        frame_interval_us = 100;
+    uint16_t                                        udp_src_port = 12000;
+    uint16_t                                        udp_dst_port = 12001;
+};
+
+struct PcapGeneratorResult {
+    bool        ok = false;
+    uint64_t    frames = 0;
+    uint64_t    datagrams = 0;
+    uint64_t    udp_bytes = 0;
+};
+
+class PcapGenerator {
+public:
+    explicit PcapGenerator(const PcapGeneratorConfig& config);
+
+    // "102:8,111:1" -> {{102, 8}, {111, 1}}
+    static bool parsePortMix(const std::string& text, std::vector<std::pair<CanardPortID, uint32_t>>& port_mix);
+
+    // {"messages": [...]} for the next datagram, in the format Converter::jsonToUdp takes
+    nlohmann::json nextDatagramJson();
+    std::vector<uint8_t> nextDatagram();
+
+    PcapGeneratorResult writePcap(const std::string& pcap_file_path);
+
+private:
+    PcapGeneratorConfig                 m_config;
+    Converter                           m_converter;
+    std::mt19937_64                     m_rng;
+    std::discrete_distribution<size_t>  m_port_distribution;
+    uint64_t                            m_timestamp_us = 0;
+    uint64_t                            m_frames_left = 0;
+};
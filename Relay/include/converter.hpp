@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <nlohmann/json.hpp>
@@ -10,6 +12,14 @@
 #include <stdexcept>
 
 #include "libcanard/canard.h"
+#include "canard_single_frame.hpp"
+
+class LineProtocolBatcher;
+
+struct JsonTextOptions {
+    size_t threads = 1;                     // > 1 serializes chunks of transfers on that many threads
+    size_t transfers_per_chunk = 4096;
+};
 
 class Converter {
 public:
@@ -18,8 +28,32 @@ public:
 
     std::string jsonToFlux(const nlohmann::json& j);
     nlohmann::json pcapFileToJson(const std::string& pcap_file_path);
+    // pcapFileToJson as text, converted one datagram at a time and handed to on_chunk in pieces of
+    // about chunk_bytes, cut between messages. The pieces together are {"messages":[...]}, memory does
+    // not grow with the capture. on_chunk returns false to stop, false is returned then and if the
+    // file cannot be read.
+    bool pcapFileToJsonText(const std::string& pcap_file_path, const std::function<bool(std::string_view chunk)>& on_chunk, size_t chunk_bytes = 1024 * 1024);
+    // The UDP payload of every packet in the file in order, stops early if on_datagram returns false.
+    // Returns false if the file cannot be read or on_datagram stopped.
+    bool forEachPcapDatagram(const std::string& pcap_file_path, const std::function<bool(const uint8_t* udp_msg, size_t udp_msg_size)>& on_datagram);
     nlohmann::json udpToJson(const uint8_t* const udp_msg, const size_t udp_msg_size);
+    // {"messages":[...]} as text, written straight from the decoded DSDL structs without a json DOM.
+    // Parses to the same document as udpToJson(...).dump(), fields are in DSDL order.
+    std::string udpToJsonText(const uint8_t* const udp_msg, const size_t udp_msg_size, const JsonTextOptions& options = JsonTextOptions());
+    // on_message gets every message object on its own, the text is only valid during the call.
+    // Returns the number of messages.
+    size_t udpToJsonMessages(const uint8_t* const udp_msg, const size_t udp_msg_size, const std::function<void(std::string_view message)>& on_message);
+    // The same with the CAN id and timestamp of every message, so it can be kept by CAN id without
+    // parsing the text again
+    size_t udpToJsonMessages(const uint8_t* const udp_msg, const size_t udp_msg_size, const std::function<void(uint32_t can_id, uint64_t timestamp_us, std::string_view message)>& on_message);
+    // Line protocol straight from the decoded DSDL structs into batcher, the same lines as udpToJson
+    // followed by InfluxdbClient::writeJsonToInfluxdb, without building JSON. Returns the lines written.
+    size_t udpToLineProtocol(const uint8_t* const udp_msg, const size_t udp_msg_size, LineProtocolBatcher& batcher, long long timestamp_offset_us);
     std::vector<uint8_t> jsonToCan(const nlohmann::json& j);
+    // A JSON message (as in udpToJson) as a packed record appended to out, false for unknown ports
+    bool jsonToPacked(const nlohmann::json& msg_json, std::string& out);
+    // What a client needs to read packed records, sent to relay.packed websocket clients on connect
+    static nlohmann::json packedSchema();
     std::vector<uint8_t> jsonToUdp(const nlohmann::json& j);
 
 private:
@@ -44,6 +78,9 @@ private:
     // Internal utility methods
     bool getNextCanMessageOverUdpMessage(const uint8_t* const can_msg, const size_t can_msg_size, size_t& can_msg_offset, CanMessage& message);
     CanIdFields deserializeCanId(const uint32_t can_id);
+    // on_transfer(const CanardRxTransfer&, uint32_t can_id) for every complete transfer in the datagram
+    template <typename OnTransfer>
+    void forEachTransfer(const uint8_t* udp_msg, size_t udp_msg_size, OnTransfer&& on_transfer);
 
     bool deserializeDslsCanTransferToJson(const CanardPortID port_id, const CanardRxTransfer& transfer, nlohmann::json& msg_json);
     bool serializeJsonToDsdlCanPayload(const nlohmann::json& msg_json, void* const payload, size_t& payload_size);
@@ -59,4 +96,6 @@ private:
     // Canard instance and subscriptions
     CanardInstance m_canard_instance;
     std::unordered_map<CanardPortID, CanardRxSubscription*> m_subscriptions;
+    // transfer-ID dedup for the single-frame transfers that skip canardRxAccept
+    CanardSingleFrameSessions m_single_frame_sessions;
 };
@@ -1,23 +1,76 @@
 // influxdb_client.hpp
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <nlohmann/json.hpp>
 
+#include "line_protocol.hpp"
+
+class Converter;
+class HttpConnectionPool;
+struct HttpPoolStats;
+class InfluxSpool;
+struct InfluxSpoolStats;
+
 class InfluxdbClient {
 private:
     std::string host;
     std::string port;
     std::string org;
     std::string token;
+    int gzip_level;     // 0 sends plain bodies, 1-9 gzip
+
+    // keep-alive connections to host:port, see http_connection_pool.hpp
+    std::unique_ptr<HttpConnectionPool> connection_pool;
+    // batches written while InfluxDB is unreachable, see influx_spool.hpp. After connection_pool,
+    // so its drainer stops before the pool goes away.
+    std::unique_ptr<InfluxSpool> spool;
+    // lines of writeJsonToInfluxdb waiting for their batch to fill up, cut by encoded size (see
+    // LineProtocolBatcher). After spool, pending lines are flushed in the destructor.
+    std::mutex batch_mutex;
+    LineProtocolBatcher batcher;
+    bool batch_failed = false;      // a batch could not be sent since the last write returned
 
 public:
-    InfluxdbClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token);
+    InfluxdbClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token, int gzip_level = 1);
     ~InfluxdbClient();
 
     bool isConnectedToInfluxdb() const;
     bool postToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision);
-    bool writeJsonToInfluxdb(const nlohmann::json& j, size_t batch_size);
+    // As postToInfluxdb, the HTTP status of the write (0 without a response), so a caller can tell a
+    // batch the database refuses for good from one worth sending again
+    unsigned int sendToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision);
+    // Encodes the messages into the pending batch. A batch is sent once it reaches the byte target of
+    // the batch policy or its first line is max_latency_seconds old, so the last lines of one call can
+    // go out with the next one. False if a batch could not be sent since the last call.
+    bool writeJsonToInfluxdb(const nlohmann::json& j);
+    // The same lines straight from the CAN frames of a datagram, without the JSON messages in between
+    bool writeUdpToInfluxdb(Converter& converter, const uint8_t* udp_msg, size_t udp_msg_size);
+    // Runs encode on the pending batch, for sinks that write lines themselves. Batches are sent as in
+    // writeJsonToInfluxdb.
+    bool writeLinesToInfluxdb(const std::function<void(LineProtocolBatcher& batcher)>& encode);
+    // Sends the pending lines if they are due, for callers that stop writing for a while
+    bool flushDueToInfluxdb();
+    // Sends the pending lines now
+    bool flushToInfluxdb();
+    void setBatchPolicy(const LineBatchPolicy& policy);
+
+    // From now on batches go to a disk spool in directory and are sent from there in the background,
+    // so writing never waits for the network. Unsent batches of an earlier run are sent first.
+    bool startSpool(const std::string& directory, uint64_t max_bytes);
+    // Appends to the spool if it is started, otherwise posts right away
+    bool spoolToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision);
+    InfluxSpoolStats getSpoolStats() const;
+
+    // Status and latency counters of every request made so far
+    HttpPoolStats getStats() const;
+
+    // Appends one converter message ({"measure", "timestamp", "fields"}) as a line, false if the message is invalid
+    static bool appendJsonMessageToLineProtocol(LineProtocolEncoder& encoder, const nlohmann::json& msg, long long timestamp_offset_us);
 
     // Delete copy and move constructors and assignment operators
     InfluxdbClient(const InfluxdbClient&) = delete;
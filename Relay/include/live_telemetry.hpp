@@ -0,0 +1,65 @@
+// live_telemetry.hpp
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "converter.hpp"
+#include "udp_receiver.hpp"
+#include "triple_buffer.hpp"
+
+// The live view of the car: the newest decoded message of every CAN id.
+//
+// Datagrams from the UdpReceiver are decoded on its receive thread straight to JSON text
+// (Converter::udpToJsonMessages, no json DOM), and after every batch the state is published as one
+// LiveSnapshot into a SnapshotBuffer. The buffer to publish holds the state of a few batches ago, so
+// only the messages that changed since are copied into it, not the whole state. The websocket
+// broadcaster takes the newest snapshot whenever it is ready for one, without locks and without ever
+// holding up the decoder. A consumer slower than the car skips snapshots: it sees the newest value of
+// every channel, not every value in between, so snapshots are for display and not for InfluxDB.
+
+struct LiveSnapshot {
+    std::vector<std::string>    messages;           // as Converter::udpToJsonMessages, one per CAN id, see WebSocketServer::broadcastMessages
+    std::vector<uint64_t>       versions;           // per message, the batch that last changed it
+    uint64_t                    datagrams = 0;      // received up to this snapshot
+    uint64_t                    timestamp_us = 0;   // of the newest message
+};
+
+class LiveTelemetry {
+public:
+    using Snapshot = SnapshotBuffer<LiveSnapshot>::Snapshot;
+
+    // max_readers: how many consumers hold a snapshot at the same time
+    LiveTelemetry(const UdpReceiverConfig& config, size_t max_readers = 2);
+    ~LiveTelemetry();
+
+    bool                start();
+    void                stop();
+    bool                isRunning() const;
+    unsigned short      port() const;
+    // The newest snapshot, empty before the first datagram has been decoded. Compare Sequence() with
+    // the last one used to tell whether anything changed.
+    Snapshot            latest();
+    UdpReceiverStats    receiverStats() const;
+
+private:
+    void                onBatch(const UdpDatagram* datagrams, size_t count);
+
+    // only used on the receive thread
+    Converter                               m_converter;
+    std::vector<std::string>                m_state;                // newest message per CAN id
+    std::vector<uint64_t>                   m_state_versions;       // batch that last changed each of m_state
+    std::unordered_map<uint32_t, size_t>    m_state_index;          // CAN id => position in m_state
+    uint64_t                                m_batches = 0;
+    uint64_t                                m_datagrams = 0;
+    uint64_t                                m_timestamp_us = 0;
+
+    SnapshotBuffer<LiveSnapshot>            m_snapshots;
+    UdpReceiver                             m_receiver;
+
+    // Prevent copying
+    LiveTelemetry(const LiveTelemetry&) = delete;
+    LiveTelemetry& operator=(const LiveTelemetry&) = delete;
+};
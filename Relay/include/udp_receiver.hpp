@@ -0,0 +1,123 @@
+// udp_receiver.hpp
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Live CAN-over-UDP input: one non-blocking socket read in batches on a thread of its own.
+//
+// On Linux a batch is one recvmmsg call into batch_size fixed slots of max_datagram_bytes, with the
+// kernel receive time of every datagram (SO_TIMESTAMPNS) and the socket's drop counter (SO_RXQ_OVFL)
+// read from the control messages. Elsewhere datagrams are read one recvmsg at a time into the same
+// slots. The batch goes to the callback as views into the slots: nothing is copied, and the views are
+// only valid until the callback returns. The callback runs on the receive thread and should hand the
+// datagrams to the decoder (e.g. Converter::udpToJsonMessages) straight away, every moment spent in it
+// is a moment the socket buffer fills up.
+//
+//   UdpReceiver receiver(config, [&](const UdpDatagram* datagrams, size_t count) { ... });
+//   receiver.start();
+
+struct UdpReceiverConfig {
+    std::string bind_address = "0.0.0.0";
+    unsigned short port = 0;                        // 0 picks a free port, see port()
+    int         receive_buffer_bytes = 16 << 20;    // SO_RCVBUF asked for, see receiveBufferBytes()
+    size_t      batch_size = 64;                    // datagrams per recvmmsg
+    size_t      max_datagram_bytes = 9216;          // larger datagrams are cut off and counted as truncated
+    int         poll_timeout_ms = 100;              // how quickly stop() is noticed
+};
+
+struct UdpDatagram {
+    const uint8_t*  data = nullptr;
+    size_t          size = 0;
+    uint64_t        timestamp_ns = 0;       // kernel receive time (unix ns), the time of the read without SO_TIMESTAMPNS
+};
+
+struct UdpReceiverStats {
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    uint64_t batches = 0;
+    uint64_t full_batches = 0;      // every slot filled: more was waiting, the receiver is close to overrunning
+    uint64_t kernel_drops = 0;      // dropped by the kernel because the socket buffer was full (Linux only)
+    uint64_t truncated = 0;         // datagrams longer than max_datagram_bytes
+    uint64_t errors = 0;            // failed reads other than "nothing to read"
+};
+
+class UdpReceiver {
+public:
+    using BatchFn = std::function<void(const UdpDatagram* datagrams, size_t count)>;
+
+    UdpReceiver(const UdpReceiverConfig& config, BatchFn on_batch);
+    ~UdpReceiver();
+
+    // Binds the socket and starts the receive thread, false (with the reason on std::cerr) if it cannot
+    bool                start();
+    void                stop();
+    bool                isRunning() const;
+    unsigned short      port() const;
+    // What the kernel granted, which may be less than asked for (net.core.rmem_max)
+    int                 receiveBufferBytes() const;
+    UdpReceiverStats    stats() const;
+
+private:
+    bool                openSocket();
+    void                receiveLoop();
+    size_t              receiveBatch();
+    void                readKernelDrops();
+
+    UdpReceiverConfig           m_config;
+    BatchFn                     m_on_batch;
+    int                         m_fd = -1;
+    unsigned short              m_port = 0;
+    int                         m_receive_buffer_bytes = 0;
+    std::thread                 m_thread;
+    std::atomic<bool>           m_running;
+
+    // batch_size slots, reused for every batch
+    std::vector<uint8_t>        m_buffers;
+    std::vector<uint8_t>        m_controls;
+    std::vector<UdpDatagram>    m_datagrams;
+    std::vector<iovec>          m_iovecs;
+#ifdef __linux__
+    std::vector<mmsghdr>        m_messages;
+#else
+    std::vector<msghdr>         m_messages;
+#endif
+
+    std::atomic<uint64_t>       m_datagram_count;
+    std::atomic<uint64_t>       m_byte_count;
+    std::atomic<uint64_t>       m_batch_count;
+    std::atomic<uint64_t>       m_full_batch_count;
+    std::atomic<uint64_t>       m_kernel_drop_count;
+    std::atomic<uint64_t>       m_truncated_count;
+    std::atomic<uint64_t>       m_error_count;
+
+    // Prevent copying
+    UdpReceiver(const UdpReceiver&) = delete;
+    UdpReceiver& operator=(const UdpReceiver&) = delete;
+};
+
+// Sends datagrams to a UDP port, for feeding a UdpReceiver on loopback in tests and benchmarks
+class UdpSender {
+public:
+    UdpSender();
+    ~UdpSender();
+
+    bool    open(const std::string& address, unsigned short port);
+    // Up to batch_size datagrams per sendmmsg on Linux, false on the first one that cannot be sent
+    bool    send(const std::vector<std::vector<uint8_t>>& datagrams, size_t batch_size = 64);
+    void    close();
+
+private:
+    int     m_fd = -1;
+
+    UdpSender(const UdpSender&) = delete;
+    UdpSender& operator=(const UdpSender&) = delete;
+};
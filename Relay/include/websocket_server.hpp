@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 #include <memory>
@@ -16,6 +17,8 @@
 #include <nlohmann/json.hpp>
 
 #include "hotspot_manager.hpp" // Include the HotspotManager interface
+#include "wire_format.hpp"
+#include "delta_stream.hpp"
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
@@ -23,6 +26,9 @@ namespace websocket = boost::beast::websocket;
 
 class WebSocketServer {
 public:
+    // Appends the packed record of one JSON message to out, false if the message has none
+    using PackedEncodeFn = std::function<bool(const nlohmann::json& message, std::string& out)>;
+
     WebSocketServer();
     ~WebSocketServer();
 
@@ -31,11 +37,35 @@ public:
     void            startHotspot(const std::string& ssid, const std::string& password);
     void            stopHotspot();
     bool            broadcastJson(const nlohmann::json& j, const size_t bytes_per_second, const size_t time_ms_between_sends);
+    // Already serialized messages, e.g. from Converter::udpToJsonMessages, sent the same way as broadcastJson.
+    // Binary clients need every message parsed once more, broadcastJson is cheaper for them.
+    bool            broadcastMessages(const std::vector<std::string>& messages, const size_t bytes_per_second, const size_t time_ms_between_sends);
+    // Enables relay.packed (see wire_format.hpp) and relay.delta (see delta_stream.hpp), e.g. with
+    // Converter::jsonToPacked and Converter::packedSchema(). Without it clients asking for either get
+    // JSON. Call it before startServer.
+    void            setPackedEncoder(PackedEncodeFn encode, const nlohmann::json& schema, const DeltaStreamConfig& delta_config = DeltaStreamConfig());
     void            enqueueIncomingData(const std::string& data);
     std::string     dequeueIncomingData();
     bool            isRunning();
 
 private:
+    struct Client {
+        std::shared_ptr<websocket::stream<tcp::socket>> ws;
+        WireFormat                                      format = WireFormat::Json;
+        bool                                            needs_keyframe = false;     // relay.delta, until the first frame
+    };
+
+    // every message once per format, only the formats in use are filled
+    struct EncodedMessages {
+        std::array<std::vector<std::string>, kWireFormatCount>  messages;
+        std::array<bool, kWireFormatCount>                      used = {};
+    };
+
+    void            acceptClient(std::shared_ptr<tcp::socket> socket);
+    WireFormat      negotiateFormat(const boost::beast::http::request<boost::beast::http::string_body>& request, bool& echo_subprotocol);
+    std::array<bool, kWireFormatCount> formatsInUse();
+    bool            encodeMessage(const nlohmann::json& message, WireFormat format, std::string& out);
+    bool            broadcastEncoded(const EncodedMessages& encoded, const size_t bytes_per_second, const size_t time_ms_between_sends);
     void            handleClient(std::shared_ptr<websocket::stream<tcp::socket>> ws);
     static void     signalHandler(int signal);
 
@@ -46,8 +76,12 @@ private:
     unsigned short                                                  m_port = 0;
     asio::io_context                                                m_io_context;
     std::unique_ptr<tcp::acceptor>                                  m_acceptor;
-    std::vector<std::shared_ptr<websocket::stream<tcp::socket>>>    m_clients;
+    std::vector<Client>                                              m_clients;
     std::mutex                                                      m_clients_mutex;
+    PackedEncodeFn                                                  m_packed_encode;
+    std::string                                                     m_packed_schema;
+    std::unique_ptr<DeltaStreamEncoder>                             m_delta;            // only used by the broadcasting thread
+    std::string                                                     m_delta_schema;
     std::thread                                                     m_io_thread;
     std::atomic<bool>                                               m_running;
     std::queue<std::string>                                         m_incoming_data_queue;
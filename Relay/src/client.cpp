@@ -1,13 +1,17 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/asio.hpp>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 
-int main() {
+// ./bin/client [relay.json|relay.cbor|relay.msgpack|relay.packed|relay.delta]
+int main(int argc, char** argv) {
+    const std::string format = argc > 1 ? argv[1] : "relay.json";
     try {
         // I/O context
         asio::io_context ioc;
@@ -26,13 +30,17 @@ int main() {
         // Connect to the resolved endpoint
         asio::connect(ws.next_layer(), results.begin(), results.end());
 
-        // Perform the WebSocket handshake
-        ws.handshake(host, "/");
+        // Perform the WebSocket handshake, asking for the format
+        ws.set_option(boost::beast::websocket::stream_base::decorator([&format](boost::beast::websocket::request_type& request) {
+            request.set(boost::beast::http::field::sec_websocket_protocol, format);
+        }));
+        boost::beast::websocket::response_type response;
+        ws.handshake(response, host, "/");
 
         // Increase the maximum message size (example: 16MB)
         ws.read_message_max(1024ul * 1024ul * 1024ul); // 1 GB
 
-        std::cout << "Connected to server at " << host << ":" << port << "\n";
+        std::cout << "Connected to server at " << host << ":" << port << " with " << response[boost::beast::http::field::sec_websocket_protocol] << "\n";
 
         // Continuously read messages from the server and print them out
         for (;;) {
@@ -42,7 +50,25 @@ int main() {
 
             // Convert the received buffer to a string and print
             std::string message = boost::beast::buffers_to_string(buffer.data());
-            std::cout << "Received: " << message << "\n";
+            if (!ws.got_binary()) {
+                std::cout << "Received: " << message << "\n";
+                continue;
+            }
+            std::cout << "Received " << message.size() << " bytes";
+            if (format == "relay.packed") {
+                // records start with their size, see wire_format.hpp
+                size_t records = 0;
+                for (size_t offset = 0; offset + 2 <= message.size(); ++records) {
+                    uint16_t record_size = 0;
+                    std::memcpy(&record_size, message.data() + offset, sizeof(record_size));
+                    if (record_size == 0) {
+                        break;
+                    }
+                    offset += record_size;
+                }
+                std::cout << " in " << records << " packed records";
+            }
+            std::cout << "\n";
         }
 
     } catch (const std::exception &e) {
@@ -1,6 +1,14 @@
 #include "converter.hpp"
+#include "canard_pool.hpp"
+#include "canard_single_frame.hpp"
+#include "flux_query.hpp"
+#include "json_writer.hpp"
+#include "line_protocol.hpp"
+#include "wire_format.hpp"
+
+#include <atomic>
+#include <thread>
 
-#include "pcap_reader.hpp"
 #include "pcapplusplus/PcapFileDevice.h"
 #include "pcapplusplus/Packet.h"
 #include "pcapplusplus/ProtocolType.h"
@@ -8,45 +16,189 @@
 
 using json = nlohmann::json;
 
-#include "vcu/EbsActivation_1_0.h"              // 8
-#include "vcu/DriveMode_1_0.h"                  // 10
-#include "vcu/Config_1_0.h"                     // 13
-#include "vcu/INS_1_0.h"                        // 102
-#include "vcu/EnergyMeter_1_0.h"                // 111
-#include "vcu/DVStates_1_0.h"                   // 113
-#include "vcu/InsEstimates1_1_0.h"              // 114 lat and lon is double and not float
-#include "vcu/EPOSData_1_0.h"
-#include "vcu/EposStatus_1_0.h"
-#include "vcu/GetConfig_1_0.h"
-#include "vcu/GNSS_1_0.h"
-#include "vcu/Implausibilities_1_0.h"
-#include "vcu/ImuMeasurements_1_0.h"
-#include "vcu/InsEstimates2_1_0.h"
-#include "vcu/InsStatus_1_0.h"
-#include "vcu/InverterEstimates_1_0.h"
-#include "vcu/KERS_1_0.h"
-#include "vcu/MissionSelect_1_0.h"
-#include "vcu/ResetInverter_1_0.h"
-#include "vcu/RESStatus_1_0.h"
-#include "vcu/SCS_1_0.h"
-#include "vcu/State_1_0.h"
-#include "vcu/StaticOutputs_1_0.h"
-#include "vcu/Status_1_0.h"
-#include "vcu/TelemetryStatus_1_0.h"
-#include "vcu/TSABPressed_1_0.h"
-#include "vcu/TVOutputs_1_0.h"
-#include "vcu/TVStatus_1_0.h"
-#include "vcu/VcuStatus_1_0.h"
-#include "vcu/Warning_1_0.h"
-#include "vcu/ZeroIns_1_0.h"
-
-
-void* Converter::canardMemoryAllocate(CanardInstance*, const size_t amount) {
-    return new uint8_t[amount];
-}
-void Converter::canardMemoryFree(CanardInstance*, void* const pointer) {
-    auto ptr = static_cast<uint8_t*>(pointer);
-    delete[] ptr;
+#include "vcu_reflection.hpp"
+
+namespace {
+
+using JsonDeserializeFn = bool (*)(const CanardRxTransfer&, json&);
+using JsonSerializeFn   = int8_t (*)(const json&, uint8_t*, size_t*);
+using LineProtocolFn    = bool (*)(const CanardRxTransfer&, LineProtocolEncoder&, long long);
+using JsonTextFn        = bool (*)(const CanardRxTransfer&, uint32_t, JsonWriter&);
+using PackJsonFn        = void (*)(const json&, std::string&);
+
+template <typename T>
+bool deserializeTransferToJson(const CanardRxTransfer& transfer, json& msg_json) {
+    T obj;
+    DsdlType<T>::initialize(&obj);
+    if (!dsdlDeserialize(transfer, obj)) {
+        return false;
+    }
+    msg_json["measure"] = DsdlType<T>::measure;
+    json& fields = msg_json["fields"];
+    dsdlVisitFields(obj, [&](size_t, const auto& field, const auto& value) {
+        fields[field.name] = value;
+    });
+    return true;
+}
+
+// Throws nlohmann::json exceptions on missing or mistyped fields, like the hand written version did
+template <typename T>
+void readJsonFields(const json& fields, T& obj) {
+    DsdlType<T>::initialize(&obj);
+    dsdlAssignFields(obj, [&](const auto& field, auto& member) {
+        using Member = std::decay_t<decltype(member)>;
+        const json& value = fields.at(field.name);
+        if constexpr (std::is_same<Member, bool>::value) {
+            // bools are accepted as 0/1 too
+            member = value.is_boolean() ? value.get<bool>() : (value.get<double>() != 0.0);
+        } else {
+            member = value.get<Member>();
+        }
+        return true;
+    });
+}
+
+template <typename T>
+int8_t serializeJsonFields(const json& fields, uint8_t* buffer, size_t* inout_buffer_size) {
+    T obj;
+    readJsonFields(fields, obj);
+    return DsdlType<T>::serialize(&obj, buffer, inout_buffer_size);
+}
+
+template <typename T>
+void packJsonMessage(const json& msg_json, std::string& out) {
+    T obj;
+    readJsonFields(msg_json.at("fields"), obj);
+    wire::appendPackedRecord(out, obj, msg_json.value("can_id", uint32_t(0)), msg_json.at("timestamp").get<uint64_t>());
+}
+
+const std::array<JsonDeserializeFn, CANARD_SUBJECT_ID_MAX + 1U>& jsonDeserializers() {
+    static const auto table = dsdlMakePortTable<JsonDeserializeFn>(VcuDsdlTypes{}, [](auto tag) -> JsonDeserializeFn {
+        return &deserializeTransferToJson<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+// The same line appendJsonMessageToLineProtocol writes for the JSON message of the transfer: measure,
+// every field (numbers as floats, bools as bools) and the transfer timestamp in microseconds
+template <typename T>
+bool appendTransferToLineProtocol(const CanardRxTransfer& transfer, LineProtocolEncoder& encoder, long long timestamp_offset_us) {
+    // field keys are escaped once per type
+    static const std::array<std::string, dsdlFieldCount<T>()> field_keys = [] {
+        std::array<std::string, dsdlFieldCount<T>()> keys;
+        dsdlForEachField<T>([&](size_t index, const auto& field) { keys[index] = line_protocol::escapeKey(field.name); });
+        return keys;
+    }();
+    T obj;
+    DsdlType<T>::initialize(&obj);
+    if (!dsdlDeserialize(transfer, obj)) {
+        return false;
+    }
+    const size_t line_start = encoder.Size();
+    encoder.BeginLine(DsdlType<T>::measure);
+    dsdlVisitFields(obj, [&](size_t index, const auto&, const auto& value) {
+        using Member = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same<Member, bool>::value) {
+            encoder.AddField(field_keys[index], value);
+        } else {
+            encoder.AddField(field_keys[index], static_cast<double>(value));
+        }
+    });
+    if (!encoder.HasFields()) {
+        encoder.DiscardLine(line_start);
+        return false;
+    }
+    encoder.EndLine(static_cast<long long>(transfer.timestamp_usec) + timestamp_offset_us);
+    return true;
+}
+
+const std::array<LineProtocolFn, CANARD_SUBJECT_ID_MAX + 1U>& lineProtocolWriters() {
+    static const auto table = dsdlMakePortTable<LineProtocolFn>(VcuDsdlTypes{}, [](auto tag) -> LineProtocolFn {
+        return &appendTransferToLineProtocol<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+// The message deserializeDslsCanTransferToJson builds, written as text. The keys are in the order
+// dump() sorts them into, so only the fields differ in order (DSDL order instead of by name).
+template <typename T>
+bool writeTransferJson(const CanardRxTransfer& transfer, uint32_t can_id, JsonWriter& writer) {
+    [[maybe_unused]] static const std::array<std::string, dsdlFieldCount<T>()> field_keys = [] {
+        std::array<std::string, dsdlFieldCount<T>()> keys;
+        dsdlForEachField<T>([&](size_t index, const auto& field) { keys[index] = json_text::quotedKey(field.name); });
+        return keys;
+    }();
+    static const std::string measure = [] {
+        std::string quoted = "\"";
+        json_text::appendEscaped(quoted, DsdlType<T>::measure);
+        return quoted + "\"";
+    }();
+    T obj;
+    DsdlType<T>::initialize(&obj);
+    if (!dsdlDeserialize(transfer, obj)) {
+        return false;
+    }
+    writer.BeginObject();
+    writer.Key("\"can_id\":");
+    writer.Value(can_id);
+    writer.Key("\"fields\":");
+    writer.BeginObject();
+    dsdlVisitFields(obj, [&](size_t index, const auto&, const auto& value) {
+        using Member = std::decay_t<decltype(value)>;
+        writer.Key(field_keys[index]);
+        if constexpr (std::is_same<Member, float>::value) {
+            // json keeps floats as double, the text is that of the widened value like dump() writes it
+            writer.Value(static_cast<double>(value));
+        } else {
+            writer.Value(value);
+        }
+    });
+    writer.EndObject();
+    writer.Key("\"measure\":");
+    writer.Raw(measure);
+    writer.Key("\"port_id\":");
+    writer.Value(transfer.metadata.port_id);
+    writer.Key("\"timestamp\":");
+    writer.Value(transfer.timestamp_usec);
+    writer.EndObject();
+    return true;
+}
+
+const std::array<JsonTextFn, CANARD_SUBJECT_ID_MAX + 1U>& jsonTextWriters() {
+    static const auto table = dsdlMakePortTable<JsonTextFn>(VcuDsdlTypes{}, [](auto tag) -> JsonTextFn {
+        return &writeTransferJson<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+// false for ports without a DSDL type or if the payload does not deserialize, nothing is written then
+bool writeMessageJson(const CanardRxTransfer& transfer, uint32_t can_id, JsonWriter& writer) {
+    const CanardPortID port_id = transfer.metadata.port_id;
+    const JsonTextFn write = (port_id <= CANARD_SUBJECT_ID_MAX) ? jsonTextWriters()[port_id] : nullptr;
+    return write != nullptr && write(transfer, can_id, writer);
+}
+
+const std::array<JsonSerializeFn, CANARD_SUBJECT_ID_MAX + 1U>& jsonSerializers() {
+    static const auto table = dsdlMakePortTable<JsonSerializeFn>(VcuDsdlTypes{}, [](auto tag) -> JsonSerializeFn {
+        return &serializeJsonFields<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+const std::array<PackJsonFn, CANARD_SUBJECT_ID_MAX + 1U>& jsonPackers() {
+    static const auto table = dsdlMakePortTable<PackJsonFn>(VcuDsdlTypes{}, [](auto tag) -> PackJsonFn {
+        return &packJsonMessage<typename decltype(tag)::type>;
+    });
+    return table;
+}
+
+} // namespace
+
+void* Converter::canardMemoryAllocate(CanardInstance* const ins, const size_t amount) {
+    return canardPoolAllocate(ins, amount);
+}
+void Converter::canardMemoryFree(CanardInstance* const ins, void* const pointer) {
+    canardPoolFree(ins, pointer);
 }
 Converter::Converter() {
     m_canard_instance = canardInit(canardMemoryAllocate, canardMemoryFree);
@@ -77,55 +229,152 @@ uint32_t Converter::toBigEndian32(uint32_t value) {
 }
 
 // FLUX =======================================================================================================================================
-std::string jsonToFlux(const json& j) {
-
+// {"bucket": ..., "measure": ..., "log_id": ..., "fields": [...], "start": ..., "stop": ...}, only bucket is required
+std::string Converter::jsonToFlux(const json& j) {
+    FluxQuery query;
+    query.bucket = j.at("bucket").get<std::string>();
+    query.measure = j.value("measure", std::string());
+    query.log_id = j.value("log_id", std::string());
+    if (j.contains("fields")) {
+        query.fields = j.at("fields").get<std::vector<std::string>>();
+    }
+    query.start = j.value("start", std::string("0"));
+    query.stop = j.value("stop", std::string());
+    return buildFluxQuery(query);
 }
 
 // PCAP =======================================================================================================================================
-json Converter::pcapFileToJson(const std::string& pcap_file_path)
+bool Converter::forEachPcapDatagram(const std::string& pcap_file_path, const std::function<bool(const uint8_t* udp_msg, size_t udp_msg_size)>& on_datagram)
 {
     // Check for .pcap extension
     if (pcap_file_path.size() < 5 || pcap_file_path.substr(pcap_file_path.size() - 5) != ".pcap") {
         std::cerr << pcap_file_path << " does not have a .pcap extension." << std::endl;
-        return "";
+        return false;
     }
 
     std::unique_ptr<pcpp::IFileReaderDevice> reader(pcpp::IFileReaderDevice::getReader(pcap_file_path.c_str()));
 
     if (!reader || !reader->open()) {
         std::cerr << "Error opening the pcap file: " << pcap_file_path << std::endl;
-        return "";
+        return false;
     }
 
-    std::vector<uint8_t> accumulated_data;
-
+    // one packet at a time, the raw packet buffer is reused
     pcpp::RawPacket raw_packet;
-    while (true) {
-        if (!reader->getNextPacket(raw_packet))
-            break;
-
+    bool completed = true;
+    while (reader->getNextPacket(raw_packet)) {
         pcpp::Packet parsedPacket(&raw_packet, false, pcpp::UDP);
         pcpp::UdpLayer* udp_layer = parsedPacket.getLayerOfType<pcpp::UdpLayer>();
         if (udp_layer == nullptr)
             continue;
 
-        const uint8_t* payload = udp_layer->getLayerPayload();
-        size_t payloadLength = udp_layer->getLayerPayloadSize();
-
-        // Append this UDP payload to our accumulated buffer
-        size_t oldSize = accumulated_data.size();
-        accumulated_data.resize(oldSize + payloadLength);
-        std::copy_n(payload, payloadLength, accumulated_data.begin() + oldSize);
+        if (!on_datagram(udp_layer->getLayerPayload(), udp_layer->getLayerPayloadSize())) {
+            completed = false;
+            break;
+        }
     }
 
     reader->close();
+    return completed;
+}
+json Converter::pcapFileToJson(const std::string& pcap_file_path)
+{
+    // every datagram on its own, CAN records never span two of them
+    json result_json;
+    json& messages = result_json["messages"];
+    messages = json::array();
+    bool any_datagram = false;
+    const bool read = forEachPcapDatagram(pcap_file_path, [&](const uint8_t* udp_msg, size_t udp_msg_size) {
+        any_datagram = any_datagram || udp_msg_size > 0;
+        json datagram_json = udpToJson(udp_msg, udp_msg_size);
+        for (json& message : datagram_json["messages"]) {
+            messages.push_back(std::move(message));
+        }
+        return true;
+    });
 
-    // Now that we have all UDP payloads combined, convert them to JSON using the converter.
-    if (!accumulated_data.empty()) {
-        return udpToJson(accumulated_data.data(), accumulated_data.size());
-    } else {
+    if (!read || !any_datagram) {
         return "";
     }
+    return result_json;
+}
+bool Converter::pcapFileToJsonText(const std::string& pcap_file_path, const std::function<bool(std::string_view chunk)>& on_chunk, size_t chunk_bytes)
+{
+    JsonWriter writer(chunk_bytes + 4096);
+    writer.BeginObject();
+    writer.Key("\"messages\":");
+    writer.BeginArray();
+    bool aborted = false;
+    const bool read = forEachPcapDatagram(pcap_file_path, [&](const uint8_t* udp_msg, size_t udp_msg_size) {
+        this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t can_id) {
+            writeMessageJson(transfer, can_id, writer);
+        });
+        // cut between messages once a chunk is full
+        if (writer.Size() >= chunk_bytes) {
+            aborted = !on_chunk(writer.View());
+            writer.ClearText();
+        }
+        return !aborted;
+    });
+    if (!read) {
+        return false;
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return on_chunk(writer.View());
+}
+
+
+// PACKED =====================================================================================================================================
+// One packed record (see wire_format.hpp) per JSON message as udpToJson produces them, appended to out
+bool Converter::jsonToPacked(const json& msg_json, std::string& out) {
+    CanardPortID port_id = 0;
+    try {
+        port_id = msg_json.at("port_id").get<CanardPortID>();
+    } catch (const std::exception& e) {
+        std::cerr << "JSON error reading 'port_id': " << e.what() << "\n";
+        return false;
+    }
+    const PackJsonFn pack = (port_id <= CANARD_SUBJECT_ID_MAX) ? jsonPackers()[port_id] : nullptr;
+    if (pack == nullptr) {
+        return false;
+    }
+    const size_t record_start = out.size();
+    try {
+        pack(msg_json, out);
+    } catch (const std::exception& e) {
+        out.resize(record_start);
+        std::cerr << "Exception packing JSON message for port_id " << port_id << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+// {"format": "relay.packed", "version": 1, "header": [...], "ports": {"<port_id>": {"measure": ..., "fields": [{"name": ..., "type": ...}, ...]}}}
+json Converter::packedSchema() {
+    json schema;
+    schema["format"] = wire::subprotocol(WireFormat::Packed);
+    schema["version"] = 1;
+    schema["header"] = {
+        {{"name", "record_size"}, {"type", "u16"}},
+        {{"name", "port_id"},     {"type", "u16"}},
+        {{"name", "can_id"},      {"type", "u32"}},
+        {{"name", "timestamp"},   {"type", "u64"}},
+    };
+    json& ports = schema["ports"];
+    ports = json::object();
+    dsdlForEachType(VcuDsdlTypes{}, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        json port;
+        port["measure"] = DsdlType<T>::measure;
+        port["record_size"] = wire::packedRecordSize<T>();
+        port["fields"] = json::array();
+        dsdlForEachField<T>([&](size_t, const auto& field) {
+            using Member = typename std::decay_t<decltype(field)>::member_type;
+            port["fields"].push_back({{"name", field.name}, {"type", wire::packedFieldType<Member>()}});
+        });
+        ports[std::to_string(DsdlType<T>::port_id)] = port;
+    });
+    return schema;
 }
 
 
@@ -188,16 +437,10 @@ Converter::CanIdFields Converter::deserializeCanId(const uint32_t can_id) {
 
     return fields;
 }
-json Converter::udpToJson(const uint8_t* udp_msg, size_t udp_msg_size) {
-    if (udp_msg == nullptr) {
-        std::cerr << "Error: udp_msg pointer is nullptr\n";
-        return nlohmann::json::object();
-    }
-
-    json result_json;
-    result_json["messages"] = nlohmann::json::array();
+template <typename OnTransfer>
+void Converter::forEachTransfer(const uint8_t* udp_msg, size_t udp_msg_size, OnTransfer&& on_transfer) {
     size_t offset = 0;
-    
+
     while (offset < udp_msg_size) {
         CanMessage can_msg;
         if (!this->getNextCanMessageOverUdpMessage(udp_msg, udp_msg_size, offset, can_msg)) {
@@ -205,6 +448,24 @@ json Converter::udpToJson(const uint8_t* udp_msg, size_t udp_msg_size) {
             break;  // Stop processing
         }
 
+        // Prepare the Libcanard frame
+        CanardFrame can_frame{
+            .extended_can_id = can_msg.can_id,
+            .payload_size    = can_msg.data_length,
+            .payload         = can_msg.data
+        };
+
+        CanardRxTransfer transfer;
+
+        // Single-frame transfers skip libcanard reassembly and are deserialized straight from can_msg.data
+        const CanardSingleFrameResult single_frame = canardAcceptSingleFrame(m_canard_instance, m_single_frame_sessions, can_msg.timestamp, can_frame, transfer);
+        if (single_frame == CanardSingleFrameResult::Accepted) {
+            on_transfer(transfer, can_frame.extended_can_id);
+            continue;
+        } else if (single_frame == CanardSingleFrameResult::Duplicate) {
+            continue;
+        }
+
         Converter::CanIdFields fields = this->deserializeCanId(can_msg.can_id);
         CanardRxSubscription* subscription = nullptr;
         const int8_t get_sub_result = canardRxGetSubscription(&m_canard_instance, fields.transfer_kind, fields.port_id, &subscription);
@@ -226,22 +487,10 @@ json Converter::udpToJson(const uint8_t* udp_msg, size_t udp_msg_size) {
             m_subscriptions[fields.port_id] = subscription;
         }
 
-        // Prepare the Libcanard frame
-        CanardFrame can_frame{
-            .extended_can_id = can_msg.can_id,
-            .payload_size    = can_msg.data_length,
-            .payload         = can_msg.data
-        };
-
-        CanardRxTransfer transfer;
         const int8_t accept_result = canardRxAccept(&m_canard_instance, can_msg.timestamp, &can_frame, 0, &transfer, &subscription);
 
         if (accept_result == 1) {
-            nlohmann::json msg_json;
-            if (deserializeDslsCanTransferToJson(transfer.metadata.port_id, transfer, msg_json)) {
-                msg_json["can_id"] = can_frame.extended_can_id;
-                result_json["messages"].push_back(msg_json);
-            }
+            on_transfer(transfer, can_frame.extended_can_id);
             m_canard_instance.memory_free(&m_canard_instance, const_cast<void*>(transfer.payload));
         }
         else if (accept_result == 0) {
@@ -251,149 +500,162 @@ json Converter::udpToJson(const uint8_t* udp_msg, size_t udp_msg_size) {
             std::cerr << "Reception error: " << static_cast<int>(accept_result) << "\n";
         }
     }
+}
+json Converter::udpToJson(const uint8_t* udp_msg, size_t udp_msg_size) {
+    if (udp_msg == nullptr) {
+        std::cerr << "Error: udp_msg pointer is nullptr\n";
+        return nlohmann::json::object();
+    }
+
+    json result_json;
+    result_json["messages"] = nlohmann::json::array();
+    this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t can_id) {
+        nlohmann::json msg_json;
+        if (deserializeDslsCanTransferToJson(transfer.metadata.port_id, transfer, msg_json)) {
+            msg_json["can_id"] = can_id;
+            result_json["messages"].push_back(msg_json);
+        }
+    });
 
     return result_json;
 }
-bool Converter::deserializeDslsCanTransferToJson(const CanardPortID port_id, const CanardRxTransfer& transfer, nlohmann::json& msg_json) {
-
-    msg_json["port_id"]   = port_id;
-    msg_json["timestamp"] = transfer.timestamp_usec;
-    msg_json["fields"]    = nlohmann::json::object();
+std::string Converter::udpToJsonText(const uint8_t* udp_msg, size_t udp_msg_size, const JsonTextOptions& options) {
+    if (udp_msg == nullptr) {
+        std::cerr << "Error: udp_msg pointer is nullptr\n";
+        return "{}";
+    }
 
-    size_t payload_size = transfer.payload_size;
-    int8_t deserialization_result = -1;
+    if (options.threads <= 1) {
+        // roughly the size of the text, a frame of a few floats becomes about 4 times as long
+        JsonWriter writer(udp_msg_size * 4 + 64);
+        writer.BeginObject();
+        writer.Key("\"messages\":");
+        writer.BeginArray();
+        this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t can_id) {
+            writeMessageJson(transfer, can_id, writer);
+        });
+        writer.EndArray();
+        writer.EndObject();
+        return writer.Take();
+    }
 
-    try {
-        switch (port_id) {
-            case 8: // EbsActivation
-            {
-                vcu_EbsActivation_Request_1_0 obj;
-                vcu_EbsActivation_Request_1_0_initialize_(&obj);
-                deserialization_result = vcu_EbsActivation_Request_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0) {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["EbsActivation.activate_ebs"] = obj.activate_ebs;
-                }
-            }
-            break;
+    // Reassembly has to see the frames in order, so the transfers are collected first (the payloads
+    // copied into one arena, multi-frame ones are freed by forEachTransfer) and only deserializing
+    // and formatting, the expensive part, is spread over the threads
+    struct PendingTransfer {
+        CanardRxTransfer    transfer;
+        uint32_t            can_id;
+        size_t              payload_offset;
+    };
+    std::vector<PendingTransfer> pending;
+    std::vector<uint8_t> payloads;
+    payloads.reserve(udp_msg_size);
+    this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t can_id) {
+        const uint8_t* payload = static_cast<const uint8_t*>(transfer.payload);
+        pending.push_back({transfer, can_id, payloads.size()});
+        payloads.insert(payloads.end(), payload, payload + transfer.payload_size);
+    });
+    for (PendingTransfer& p : pending) {
+        p.transfer.payload = payloads.data() + p.payload_offset;
+    }
 
-            case 10: // DriveMode
-            {
-                vcu_DriveMode_Request_1_0 obj;
-                vcu_DriveMode_Request_1_0_initialize_(&obj);
-                deserialization_result = vcu_DriveMode_Request_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0) {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["DriveMode.command"] = obj.command;
-                }
+    const size_t per_chunk = std::max<size_t>(options.transfers_per_chunk, 1);
+    const size_t chunk_count = (pending.size() + per_chunk - 1) / per_chunk;
+    std::vector<std::string> chunks(chunk_count);
+    std::atomic<size_t> next_chunk{0};
+    auto serializeChunks = [&]() {
+        JsonWriter writer;
+        for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+            const size_t end = std::min(pending.size(), (chunk + 1) * per_chunk);
+            for (size_t i = chunk * per_chunk; i < end; ++i) {
+                writeMessageJson(pending[i].transfer, pending[i].can_id, writer);
             }
-            break;
+            chunks[chunk] = writer.Take();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(options.threads, chunk_count); ++i) {
+        threads.emplace_back(serializeChunks);
+    }
+    serializeChunks();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
 
-            case 13: // Config
-            {
-                vcu_Config_Request_1_0 obj;
-                vcu_Config_Request_1_0_initialize_(&obj);
-                deserialization_result = vcu_Config_Request_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0) {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["Config.st_trq"]       = obj.st_trq;
-                    msg_json["fields"]["Config.st_rpm"]       = obj.st_rpm;
-                    msg_json["fields"]["Config.pitch_offset"] = obj.pitch_offset;
-                    msg_json["fields"]["Config.roll_offset"]  = obj.roll_offset;
-                }
-            }
-            break;
+    size_t text_size = 16;
+    for (const std::string& chunk : chunks) {
+        text_size += chunk.size() + 1;
+    }
+    std::string text;
+    text.reserve(text_size);
+    text.append("{\"messages\":[");
+    bool first = true;
+    for (const std::string& chunk : chunks) {
+        if (chunk.empty()) {
+            continue;
+        }
+        if (!first) {
+            text.push_back(',');
+        }
+        first = false;
+        text.append(chunk);
+    }
+    text.append("]}");
+    return text;
+}
+size_t Converter::udpToJsonMessages(const uint8_t* udp_msg, size_t udp_msg_size, const std::function<void(std::string_view message)>& on_message) {
+    return this->udpToJsonMessages(udp_msg, udp_msg_size, [&](uint32_t, uint64_t, std::string_view message) { on_message(message); });
+}
+size_t Converter::udpToJsonMessages(const uint8_t* udp_msg, size_t udp_msg_size, const std::function<void(uint32_t can_id, uint64_t timestamp_us, std::string_view message)>& on_message) {
+    if (udp_msg == nullptr) {
+        std::cerr << "Error: udp_msg pointer is nullptr\n";
+        return 0;
+    }
 
-            case 102: // INS
-            {
-                vcu_INS_1_0 obj;
-                vcu_INS_1_0_initialize_(&obj);
-                deserialization_result = vcu_INS_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0)
-                {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["INS.vx"]            = obj.vx;
-                    msg_json["fields"]["INS.vy"]            = obj.vy;
-                    msg_json["fields"]["INS.vz"]            = obj.vz;
-                    msg_json["fields"]["INS.ax"]            = obj.ax;
-                    msg_json["fields"]["INS.ay"]            = obj.ay;
-                    msg_json["fields"]["INS.az"]            = obj.az;
-                    msg_json["fields"]["INS.roll"]          = obj.roll;
-                    msg_json["fields"]["INS.pitch"]         = obj.pitch;
-                    msg_json["fields"]["INS.yaw"]           = obj.yaw;
-                    msg_json["fields"]["INS.roll_rate"]     = obj.roll_rate;
-                    msg_json["fields"]["INS.pitch_rate"]    = obj.pitch_rate;
-                    msg_json["fields"]["INS.yaw_rate"]      = obj.yaw_rate;
-                    msg_json["fields"]["INS.roll_rate_dt"]  = obj.roll_rate_dt;
-                    msg_json["fields"]["INS.pitch_rate_dt"] = obj.pitch_rate_dt;
-                    msg_json["fields"]["INS.yaw_rate_dt"]   = obj.yaw_rate_dt;
-                }
-            }
-            break;
+    size_t messages = 0;
+    JsonWriter writer;
+    this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t can_id) {
+        writer.Clear();
+        if (writeMessageJson(transfer, can_id, writer)) {
+            on_message(can_id, transfer.timestamp_usec, writer.View());
+            messages++;
+        }
+    });
+    return messages;
+}
+size_t Converter::udpToLineProtocol(const uint8_t* udp_msg, size_t udp_msg_size, LineProtocolBatcher& batcher, long long timestamp_offset_us) {
+    if (udp_msg == nullptr) {
+        std::cerr << "Error: udp_msg pointer is nullptr\n";
+        return 0;
+    }
 
-            case 111: // EnergyMeter
-            {
-                vcu_EnergyMeter_1_0 obj;
-                vcu_EnergyMeter_1_0_initialize_(&obj);
-                deserialization_result = vcu_EnergyMeter_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0)
-                {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["EnergyMeter.counter"]           = obj.counter;
-                    msg_json["fields"]["EnergyMeter.ready"]             = obj.ready;
-                    msg_json["fields"]["EnergyMeter.logging"]           = obj.logging;
-                    msg_json["fields"]["EnergyMeter.triggered_voltage"] = obj.triggered_voltage;
-                    msg_json["fields"]["EnergyMeter.triggered_current"] = obj.triggered_current;
-                    msg_json["fields"]["EnergyMeter.voltage"]           = obj.voltage;
-                    msg_json["fields"]["EnergyMeter.current"]           = obj.current;
-                }
-            }
-            break;
+    size_t lines = 0;
+    this->forEachTransfer(udp_msg, udp_msg_size, [&](const CanardRxTransfer& transfer, uint32_t) {
+        const CanardPortID port_id = transfer.metadata.port_id;
+        const LineProtocolFn append = (port_id <= CANARD_SUBJECT_ID_MAX) ? lineProtocolWriters()[port_id] : nullptr;
+        if (append != nullptr && append(transfer, batcher.Encoder(), timestamp_offset_us)) {
+            batcher.LineDone();
+            lines++;
+        }
+    });
+    return lines;
+}
+bool Converter::deserializeDslsCanTransferToJson(const CanardPortID port_id, const CanardRxTransfer& transfer, nlohmann::json& msg_json) {
 
-            case 113: // DVStates
-            {
-                vcu_DVStates_1_0 obj;
-                vcu_DVStates_1_0_initialize_(&obj);
-                deserialization_result = vcu_DVStates_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0)
-                {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["DVStates.as_state"]            = obj.as_state;
-                    msg_json["fields"]["DVStates.ebs_state"]           = obj.ebs_state;
-                    msg_json["fields"]["DVStates.ami_state"]           = obj.ami_state;
-                    msg_json["fields"]["DVStates.steering_state"]      = obj.steering_state;
-                    msg_json["fields"]["DVStates.service_brake_state"] = obj.service_brake_state;
-                }
-            }
-            break;
+    msg_json["port_id"]   = port_id;
+    msg_json["timestamp"] = transfer.timestamp_usec;
+    msg_json["fields"]    = nlohmann::json::object();
 
-            case 114: // InsEstimates1
-            {
-                vcu_InsEstimates1_1_0 obj;
-                vcu_InsEstimates1_1_0_initialize_(&obj);
-                deserialization_result = vcu_InsEstimates1_1_0_deserialize_( &obj, static_cast<const uint8_t*>(transfer.payload), &payload_size);
-                if (deserialization_result >= 0)
-                {
-                    msg_json["measure"] = "vcu";
-                    msg_json["fields"]["InsEstimates1.gps_time_msb"] = obj.gps_time_msb;
-                    msg_json["fields"]["InsEstimates1.gps_time_lsb"] = obj.gps_time_lsb;
-                    msg_json["fields"]["InsEstimates1.pps_time_msb"] = obj.pps_time_msb;
-                    msg_json["fields"]["InsEstimates1.pps_time_lsb"] = obj.pps_time_lsb;
-                    msg_json["fields"]["InsEstimates1.lat"]          = obj.lat;
-                    msg_json["fields"]["InsEstimates1.lon"]          = obj.lon;
-                    msg_json["fields"]["InsEstimates1.alt"]          = obj.alt;
-                    msg_json["fields"]["InsEstimates1.pos_std"]      = obj.pos_std;
-                    msg_json["fields"]["InsEstimates1.roll"]         = obj.roll;
-                    msg_json["fields"]["InsEstimates1.pitch"]        = obj.pitch;
-                    msg_json["fields"]["InsEstimates1.yaw"]          = obj.yaw;
-                }
-            }
-            break;
+    const JsonDeserializeFn deserialize = (port_id <= CANARD_SUBJECT_ID_MAX) ? jsonDeserializers()[port_id] : nullptr;
+    if (deserialize == nullptr) {
+        //std::cerr << "Unknown port_id: " << port_id << std::endl;
+        return false;
+    }
 
-            default: {
-                //std::cerr << "Unknown port_id: " << port_id << std::endl;
-                return false;
-            }
+    try {
+        if (!deserialize(transfer, msg_json)) {
+            std::cerr << "Deserialization failed for port " << port_id << std::endl;
+            return false;
         }
     }
     catch (const std::exception& e) {
@@ -401,11 +663,6 @@ bool Converter::deserializeDslsCanTransferToJson(const CanardPortID port_id, con
         return false;
     }
 
-    if (deserialization_result < 0) {
-        std::cerr << "Deserialization failed for port " << port_id << " with error code = " << int(deserialization_result) << std::endl;
-        return false;
-    }
-
     return true;
 }
 
@@ -469,111 +726,15 @@ std::vector<uint8_t> Converter::jsonToCan(const json& msg_json)
             return {};
         }
         
+        const JsonSerializeFn serialize = (port_id <= CANARD_SUBJECT_ID_MAX) ? jsonSerializers()[port_id] : nullptr;
+        if (serialize == nullptr) {
+            std::cerr << "Error: Unknown or unsupported port_id " << port_id << std::endl;
+            return {};
+        }
+
         int8_t serialization_result = -1;
-        try
-        {
-            switch (port_id)
-            {
-                case 8:  // EbsActivation
-                {
-                    vcu_EbsActivation_Request_1_0 obj;
-                    vcu_EbsActivation_Request_1_0_initialize_(&obj);
-                    obj.activate_ebs = msg_json["fields"]["EbsActivation.activate_ebs"].get<uint8_t>();
-                    serialization_result = vcu_EbsActivation_Request_1_0_serialize_( &obj, buffer.data(), &inout_buffer_size);
-                    break;
-                }
-                case 10: // DriveMode
-                {
-                    vcu_DriveMode_Request_1_0 obj;
-                    vcu_DriveMode_Request_1_0_initialize_(&obj);
-                    obj.command = static_cast<uint8_t>(msg_json["fields"]["DriveMode.command"]);
-                    serialization_result = vcu_DriveMode_Request_1_0_serialize_(&obj, buffer.data(), &inout_buffer_size);
-                    break;
-                }
-                case 13: // Config
-                {
-                    vcu_Config_Request_1_0 obj;
-                    vcu_Config_Request_1_0_initialize_(&obj);
-                    obj.st_trq       = msg_json["fields"]["Config.st_trq"].get<float>();
-                    obj.st_rpm       = msg_json["fields"]["Config.st_rpm"].get<float>();
-                    obj.pitch_offset = msg_json["fields"]["Config.pitch_offset"].get<float>();
-                    obj.roll_offset  = msg_json["fields"]["Config.roll_offset"].get<float>();
-                    serialization_result = vcu_Config_Request_1_0_serialize_(&obj,buffer.data(),&inout_buffer_size);
-                    break;
-                }
-                case 102: // INS
-                {
-                    vcu_INS_1_0 obj;
-                    vcu_INS_1_0_initialize_(&obj);
-                    obj.vx              = msg_json["fields"]["INS.vx"].get<float>();
-                    obj.vy              = msg_json["fields"]["INS.vy"].get<float>();
-                    obj.vz              = msg_json["fields"]["INS.vz"].get<float>();
-                    obj.ax              = msg_json["fields"]["INS.ax"].get<float>();
-                    obj.ay              = msg_json["fields"]["INS.ay"].get<float>();
-                    obj.az              = msg_json["fields"]["INS.az"].get<float>();
-                    obj.roll            = msg_json["fields"]["INS.roll"].get<float>();
-                    obj.pitch           = msg_json["fields"]["INS.pitch"].get<float>();
-                    obj.yaw             = msg_json["fields"]["INS.yaw"].get<float>();
-                    obj.roll_rate       = msg_json["fields"]["INS.roll_rate"].get<float>();
-                    obj.pitch_rate      = msg_json["fields"]["INS.pitch_rate"].get<float>();
-                    obj.yaw_rate        = msg_json["fields"]["INS.yaw_rate"].get<float>();
-                    obj.roll_rate_dt    = msg_json["fields"]["INS.roll_rate_dt"].get<float>();
-                    obj.pitch_rate_dt   = msg_json["fields"]["INS.pitch_rate_dt"].get<float>();
-                    obj.yaw_rate_dt     = msg_json["fields"]["INS.yaw_rate_dt"].get<float>();
-                    serialization_result = vcu_INS_1_0_serialize_( &obj, buffer.data(), &inout_buffer_size);
-                    break;
-                }
-                case 111: // EnergyMeter
-                {
-                    vcu_EnergyMeter_1_0 obj;
-                    vcu_EnergyMeter_1_0_initialize_(&obj);
-                    obj.counter             = msg_json["fields"]["EnergyMeter.counter"].get<uint32_t>();
-                    obj.ready               = msg_json["fields"]["EnergyMeter.ready"].get<bool>();
-                    obj.logging             = msg_json["fields"]["EnergyMeter.logging"].get<bool>();
-                    obj.triggered_voltage   = msg_json["fields"]["EnergyMeter.triggered_voltage"].get<bool>();
-                    obj.triggered_current   = msg_json["fields"]["EnergyMeter.triggered_current"].get<bool>();
-                    obj.voltage             = msg_json["fields"]["EnergyMeter.voltage"].get<float>();
-                    obj.current             = msg_json["fields"]["EnergyMeter.current"].get<float>();
-                    serialization_result = vcu_EnergyMeter_1_0_serialize_(&obj, buffer.data(), &inout_buffer_size);
-                    break;
-                }
-                case 113: // DVStates
-                {
-                    vcu_DVStates_1_0 obj;
-                    vcu_DVStates_1_0_initialize_(&obj);
-                    obj.as_state            = msg_json["fields"]["DVStates.as_state"].get<uint8_t>();
-                    obj.ebs_state           = msg_json["fields"]["DVStates.ebs_state"].get<uint8_t>();
-                    obj.ami_state           = msg_json["fields"]["DVStates.ami_state"].get<uint8_t>();
-                    obj.steering_state      = msg_json["fields"]["DVStates.steering_state"].get<uint8_t>();
-                    obj.service_brake_state = msg_json["fields"]["DVStates.service_brake_state"].get<uint8_t>();
-                    serialization_result = vcu_DVStates_1_0_serialize_(&obj,buffer.data(),&inout_buffer_size);
-                    break;
-                }
-                case 114: // InsEstimates1
-                {
-                    vcu_InsEstimates1_1_0 obj;
-                    vcu_InsEstimates1_1_0_initialize_(&obj);
-                    obj.gps_time_msb    = msg_json["fields"]["InsEstimates1.gps_time_msb"].get<uint32_t>();
-                    obj.gps_time_lsb    = msg_json["fields"]["InsEstimates1.gps_time_lsb"].get<uint32_t>();
-                    obj.pps_time_msb    = msg_json["fields"]["InsEstimates1.pps_time_msb"].get<uint32_t>();
-                    obj.pps_time_lsb    = msg_json["fields"]["InsEstimates1.pps_time_lsb"].get<uint32_t>();
-                    obj.lat             = msg_json["fields"]["InsEstimates1.lat"].get<double>();
-                    obj.lon             = msg_json["fields"]["InsEstimates1.lon"].get<double>();
-                    obj.alt             = msg_json["fields"]["InsEstimates1.alt"].get<float>();
-                    obj.pos_std         = msg_json["fields"]["InsEstimates1.pos_std"].get<float>();
-                    obj.roll            = msg_json["fields"]["InsEstimates1.roll"].get<float>();
-                    obj.pitch           = msg_json["fields"]["InsEstimates1.pitch"].get<float>();
-                    obj.yaw             = msg_json["fields"]["InsEstimates1.yaw"].get<float>();
-                    serialization_result = vcu_InsEstimates1_1_0_serialize_(&obj,buffer.data(),&inout_buffer_size);
-                    break;
-                }
-
-                default:
-                {
-                    std::cerr << "Error: Unknown or unsupported port_id " << port_id << std::endl;
-                    return {};
-                }
-            }
+        try {
+            serialization_result = serialize(msg_json["fields"], buffer.data(), &inout_buffer_size);
         } catch (const std::exception& e) {
             std::cerr << "Exception filling UAVCAN object from JSON for port_id " << port_id << ": " << e.what() << std::endl;
             return {};
@@ -648,8 +809,8 @@ std::vector<uint8_t> Converter::jsonToCan(const json& msg_json)
         const uint8_t* payload_ptr = static_cast<const uint8_t*>(frame.payload);
         can.insert(can.end(), payload_ptr, payload_ptr + payload_size);
 
-        // Pop the item off the queue
-        canardTxPop(&tx_queue, tx_item);
+        // Pop the item off the queue and give it back to the pool
+        m_canard_instance.memory_free(&m_canard_instance, canardTxPop(&tx_queue, tx_item));
 
         // Ensure no leftover multi-frame data
         if (canardTxPeek(&tx_queue)) {
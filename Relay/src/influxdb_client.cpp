@@ -1,109 +1,143 @@
 
 #include "influxdb_client.hpp"
+#include "converter.hpp"
 using json = nlohmann::json;
 
-#include <boost/asio.hpp>
+#include "gzip.hpp"
+#include "http_connection_pool.hpp"
+#include "influx_spool.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
 
-using boost::asio::ip::tcp;
-
-InfluxdbClient::InfluxdbClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token) : host(host), port(port), org(org), token(token) {}
-InfluxdbClient::~InfluxdbClient() {}
+InfluxdbClient::InfluxdbClient(const std::string& host, const std::string& port, const std::string& org, const std::string& token, int gzip_level)
+    : host(host), port(port), org(org), token(token), gzip_level(gzip_level), connection_pool(std::make_unique<HttpConnectionPool>(host, port)),
+      batcher(LineBatchPolicy(), [this](std::string&& batch) {
+          if (!this->spoolToInfluxdb("test_2", batch, "us")) {
+              std::cerr << "Failed to post batch data to InfluxDB.\n";
+              this->batch_failed = true;
+          }
+      }) {}
+InfluxdbClient::~InfluxdbClient() {
+    this->flushToInfluxdb();
+}
 bool InfluxdbClient::isConnectedToInfluxdb() const {
-    try {
-        boost::asio::io_context io_context;
-        tcp::resolver resolver(io_context);
-        tcp::resolver::results_type endpoints = resolver.resolve(this->host, this->port);
-        tcp::socket socket(io_context);
-        boost::asio::connect(socket, endpoints);
-        std::string request = std::string("GET /ping HTTP/1.1\r\n") +
-                              "Host: " + this->host + ":" + this->port + "\r\n" +
-                              "Authorization: Token " + this->token + "\r\n" +
-                              "Connection: close\r\n\r\n";
-        boost::asio::write(socket, boost::asio::buffer(request));
-        boost::asio::streambuf response;
-        boost::system::error_code error;
-        boost::asio::read(socket, response, boost::asio::transfer_all(), error);
-        if (error != boost::asio::error::eof) {
-            throw boost::system::system_error(error);
-        }
-        std::istream response_stream(&response);
-        std::string http_version;
-        unsigned int status_code;
-        std::string status_message;
-        response_stream >> http_version >> status_code;
-        std::getline(response_stream, status_message);
-        if (!response_stream || http_version.substr(0, 5) != "HTTP/") {
-            std::cerr << "Invalid HTTP response.\n";
-            return false;
-        }
-        if (status_code == 204) {
-            return true; 
-        } else {
-            std::cerr << "Unexpected response status: " << status_code << " " << status_message << "\n";
-            return false;
-        }
+    HttpResponse response = this->connection_pool->request(
+        boost::beast::http::verb::get,
+        "/ping",
+        {{"Authorization", "Token " + this->token}});
+    if (response.status == 0) {
+        std::cerr << "Could not reach InfluxDB at " << this->host << ":" << this->port << ": " << response.error << "\n";
+        return false;
     }
-    catch (const std::exception& e) {
-        std::cerr << "Exception in connectedToInfluxDB: " << e.what() << "\n";
+    if (response.status != 204) {
+        std::cerr << "Unexpected response status: " << response.status << "\n";
         return false;
     }
+    return true;
 }
 bool InfluxdbClient::postToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision = "ms") {
-    try {
-        boost::asio::io_context io_context;
-        tcp::resolver resolver(io_context);
-        tcp::resolver::results_type endpoints = resolver.resolve(this->host, this->port);
-        tcp::socket socket(io_context);
-        boost::asio::connect(socket, endpoints);
-        std::string request = "POST /api/v2/write?org=" + this->org +
-                              "&bucket=" + bucket + "&precision=" + precision + " HTTP/1.1\r\n" +
-                              "Host: " + this->host + ":" + this->port + "\r\n" +
-                              "Authorization: Token " + this->token + "\r\n" +
-                              "Content-Type: text/plain; charset=utf-8\r\n" +
-                              "Content-Length: " + std::to_string(data.length()) + "\r\n" +
-                              "Connection: close\r\n\r\n" + data;
-        //printf("%s\n", request.c_str());
-        boost::asio::write(socket, boost::asio::buffer(request));
-        boost::asio::streambuf response;
-        boost::system::error_code error;
-        boost::asio::read(socket, response, boost::asio::transfer_all(), error);
-        if (error != boost::asio::error::eof) {
-            throw boost::system::system_error(error);
-        }
-        std::istream response_stream(&response);
-        std::string response_str((std::istreambuf_iterator<char>(response_stream)),
-                                 std::istreambuf_iterator<char>());
-        std::cout << "Response:\n" << response_str << std::endl;
-        return true;
+    const unsigned int status = this->sendToInfluxdb(bucket, data, precision);
+    return status >= 200 && status < 300;
+}
+unsigned int InfluxdbClient::sendToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision) {
+    HttpConnectionPool::Headers headers = {
+        {"Authorization", "Token " + this->token},
+        {"Content-Type", "text/plain; charset=utf-8"},
+    };
+    std::string compressed;
+    if (this->gzip_level > 0 && GzipCompressor(this->gzip_level).Compress(data, compressed)) {
+        headers.emplace_back("Content-Encoding", "gzip");
+    }
+    HttpResponse response = this->connection_pool->request(
+        boost::beast::http::verb::post,
+        "/api/v2/write?org=" + this->org + "&bucket=" + bucket + "&precision=" + precision,
+        headers,
+        compressed.empty() ? data : compressed);
+    return response.status;
+}
+bool InfluxdbClient::startSpool(const std::string& directory, uint64_t max_bytes) {
+    InfluxSpoolConfig config;
+    config.directory = directory;
+    config.max_bytes = max_bytes;
+    this->spool.reset();
+    this->spool = std::make_unique<InfluxSpool>(
+        [this](const std::string& bucket, const std::string& precision, const std::string& body) {
+            return this->sendToInfluxdb(bucket, body, precision);
+        },
+        [this]() { return this->isConnectedToInfluxdb(); },
+        config);
+    return std::filesystem::is_directory(config.directory);
+}
+bool InfluxdbClient::spoolToInfluxdb(const std::string& bucket, const std::string& data, const std::string& precision) {
+    if (!this->spool) {
+        return this->postToInfluxdb(bucket, data, precision);
     }
-    catch (std::exception& e) {
-        std::cerr << "Exception: " << e.what() << "\n";
+    if (!this->spool->Append(bucket, precision, data)) {
+        std::cerr << "Could not write batch to the spool, it is full or the disk is not writable.\n";
         return false;
     }
-    return false;
+    return true;
+}
+InfluxSpoolStats InfluxdbClient::getSpoolStats() const {
+    return this->spool ? this->spool->Stats() : InfluxSpoolStats();
+}
+HttpPoolStats InfluxdbClient::getStats() const {
+    return this->connection_pool->Stats();
 }
-static std::string FormatJsonValue(const nlohmann::json& val) {
-    if (val.is_boolean()) {
-        return val.get<bool>() ? "true" : "false";
+bool InfluxdbClient::appendJsonMessageToLineProtocol(LineProtocolEncoder& encoder, const json& msg, long long timestamp_offset_us) {
+    // Validate each message
+    if (!msg.contains("fields") || !msg["fields"].is_object()) {
+        std::cerr << "Message missing 'fields' object.\n";
+        return false;
     }
-    else if (val.is_number_float()) {
-        double d = val.get<double>();
-        std::ostringstream oss;
-        oss << std::fixed << std::setprecision(9) << d;
-        return oss.str();
+    if (!msg.contains("measure") || !msg["measure"].is_string()) {
+        std::cerr << "Message missing 'measure' string.\n";
+        return false;
     }
-    else if (val.is_number_integer() || val.is_number_unsigned()) {
-        return std::to_string(val.get<long long>());
+    if (!msg.contains("timestamp") || !msg["timestamp"].is_number()) {
+        std::cerr << "Message missing 'timestamp' field.\n";
+        return false;
+    }
+
+    const std::string& measurement = msg["measure"].get_ref<const std::string&>();
+    long long json_timestamp_us = msg["timestamp"].get<long long>();
+    
+    // Combine the JSON timestamp with the current system timestamp
+    long long combined_timestamp_us = json_timestamp_us + timestamp_offset_us;
+
+    // Format:
+    // measurement field1=val1,field2=val2 <combined_timestamp_us>
+    // The measure is a single word from vcu_reflection.hpp, so it is written as its own series key
+    const size_t line_start = encoder.Size();
+    encoder.BeginLine(measurement);
+
+    // Serialize fields. Integers are written without a suffix, i.e. as floats, as they always have been,
+    // so existing buckets keep their field types.
+    const auto& fields = msg["fields"];
+    for (auto it = fields.begin(); it != fields.end(); ++it) {
+        const std::string& field_name = it.key();
+        const auto& field_value = it.value();
+        if (field_value.is_boolean()) {
+            encoder.AddFieldEscaping(field_name, field_value.get<bool>());
+        } else if (field_value.is_number()) {
+            encoder.AddFieldEscaping(field_name, field_value.get<double>());
+        } else {
+            // Unsupported field type, skip
+            std::cerr << "Unsupported field type for field '" << field_name << "'. Skipping.\n";
+        }
     }
-    else {
-        // Unsupported type
-        return "";
+    if (!encoder.HasFields()) {
+        encoder.DiscardLine(line_start);
+        return false;
     }
+
+    // precision=us
+    encoder.EndLine(combined_timestamp_us);
+    return true;
 }
-bool InfluxdbClient::writeJsonToInfluxdb(const json& j, size_t batch_size = 1000) {
+bool InfluxdbClient::writeJsonToInfluxdb(const json& j) {
     // Validate JSON structure
     if (!j.contains("messages") || !j["messages"].is_array()) {
         std::cerr << "JSON does not contain a 'messages' array.\n";
@@ -120,80 +154,48 @@ bool InfluxdbClient::writeJsonToInfluxdb(const json& j, size_t batch_size = 1000
     auto now = std::chrono::system_clock::now().time_since_epoch();
     long long current_timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
 
-    std::ostringstream batch_stream;
-    size_t count = 0;
-
-    for (const auto& msg : messages) {
-        // Validate each message
-        if (!msg.contains("fields") || !msg["fields"].is_object()) {
-            std::cerr << "Message missing 'fields' object.\n";
-            continue;
-        }
-        if (!msg.contains("measure") || !msg["measure"].is_string()) {
-            std::cerr << "Message missing 'measure' string.\n";
-            continue;
-        }
-        if (!msg.contains("timestamp") || !msg["timestamp"].is_number()) {
-            std::cerr << "Message missing 'timestamp' field.\n";
-            continue;
-        }
-
-        const std::string measurement = msg["measure"].get<std::string>();
-        long long json_timestamp_us = msg["timestamp"].get<long long>();
-        
-        // Combine the JSON timestamp with the current system timestamp
-        long long combined_timestamp_us = json_timestamp_us + current_timestamp_us;
-
-        // Format:
-        // measurement field1=val1,field2=val2 <combined_timestamp_us>u
-        batch_stream << measurement << " ";
-
-        // Serialize fields
-        const auto& fields = msg["fields"];
-        bool first_field = true;
-        for (auto it = fields.begin(); it != fields.end(); ++it) {
-            const std::string& field_name = it.key();
-            const auto& field_value = it.value();
-            std::string val_str = FormatJsonValue(field_value);
-            if (val_str.empty()) {
-                // Unsupported field type, skip
-                std::cerr << "Unsupported field type for field '" << field_name << "'. Skipping.\n";
-                continue;
-            }
-            if (!first_field) {
-                batch_stream << ",";
-            }
-            batch_stream << field_name << "=" << val_str;
-            first_field = false;
-        }
-
-        // Add the InfluxDB timestamp in microseconds with precision indicator 'u'
-        batch_stream << " " << combined_timestamp_us << "\n"; // 'u' indicates microseconds
-
-        // If we've reached the batch size, send this batch to InfluxDB
-        if (++count >= batch_size) {
-            std::string batch_data = batch_stream.str();
-            if (!batch_data.empty()) {
-                bool success = this->postToInfluxdb("test_2", batch_data, "us");
-                if (!success) {
-                    std::cerr << "Failed to post batch data to InfluxDB.\n";
-                    return false;
-                }
+    return this->writeLinesToInfluxdb([&](LineProtocolBatcher& batcher) {
+        for (const auto& msg : messages) {
+            if (appendJsonMessageToLineProtocol(batcher.Encoder(), msg, current_timestamp_us)) {
+                batcher.LineDone();
             }
-            batch_stream.str("");  // Clear the stream for the next batch
-            count = 0;  // Reset counter
         }
-    }
+    });
+}
+bool InfluxdbClient::writeUdpToInfluxdb(Converter& converter, const uint8_t* udp_msg, size_t udp_msg_size) {
+    // the transfer timestamps are offset by the current system time, like writeJsonToInfluxdb does
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    long long current_timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
 
-    // Send any remaining data if there's any left after the loop
-    std::string remaining_data = batch_stream.str();
-    if (!remaining_data.empty()) {
-        bool success = this->postToInfluxdb("test_2", remaining_data, "us");
-        if (!success) {
-            std::cerr << "Failed to post remaining data to InfluxDB.\n";
-            return false;
-        }
-    }
+    return this->writeLinesToInfluxdb([&](LineProtocolBatcher& batcher) {
+        converter.udpToLineProtocol(udp_msg, udp_msg_size, batcher, current_timestamp_us);
+    });
+}
+bool InfluxdbClient::writeLinesToInfluxdb(const std::function<void(LineProtocolBatcher& batcher)>& encode) {
+    // Batches are sent from LineDone() as they fill up, the encoder keeps its buffer between them
+    std::lock_guard<std::mutex> lock(this->batch_mutex);
+    encode(this->batcher);
+    this->batcher.FlushIfDue();
 
-    return true;
+    const bool ok = !this->batch_failed;
+    this->batch_failed = false;
+    return ok;
+}
+bool InfluxdbClient::flushDueToInfluxdb() {
+    std::lock_guard<std::mutex> lock(this->batch_mutex);
+    this->batcher.FlushIfDue();
+    const bool ok = !this->batch_failed;
+    this->batch_failed = false;
+    return ok;
+}
+bool InfluxdbClient::flushToInfluxdb() {
+    std::lock_guard<std::mutex> lock(this->batch_mutex);
+    this->batcher.Flush();
+    const bool ok = !this->batch_failed;
+    this->batch_failed = false;
+    return ok;
+}
+void InfluxdbClient::setBatchPolicy(const LineBatchPolicy& policy) {
+    std::lock_guard<std::mutex> lock(this->batch_mutex);
+    this->batcher.SetPolicy(policy);
 }
@@ -0,0 +1,76 @@
+#include "live_telemetry.hpp"
+
+#include <algorithm>
+
+LiveTelemetry::LiveTelemetry(const UdpReceiverConfig& config, size_t max_readers)
+    : m_snapshots(max_readers),
+      m_receiver(config, [this](const UdpDatagram* datagrams, size_t count) { onBatch(datagrams, count); })
+{
+}
+
+LiveTelemetry::~LiveTelemetry() {
+    stop();
+}
+
+bool LiveTelemetry::start() {
+    return m_receiver.start();
+}
+
+void LiveTelemetry::stop() {
+    m_receiver.stop();
+}
+
+bool LiveTelemetry::isRunning() const {
+    return m_receiver.isRunning();
+}
+
+unsigned short LiveTelemetry::port() const {
+    return m_receiver.port();
+}
+
+LiveTelemetry::Snapshot LiveTelemetry::latest() {
+    return m_snapshots.Acquire();
+}
+
+UdpReceiverStats LiveTelemetry::receiverStats() const {
+    return m_receiver.stats();
+}
+
+void LiveTelemetry::onBatch(const UdpDatagram* datagrams, size_t count) {
+    const uint64_t batch = ++m_batches;
+    bool changed = false;
+    for (size_t i = 0; i < count; ++i) {
+        m_converter.udpToJsonMessages(datagrams[i].data, datagrams[i].size, [&](uint32_t can_id, uint64_t timestamp_us, std::string_view message) {
+            m_timestamp_us = std::max(m_timestamp_us, timestamp_us);
+            const auto known = m_state_index.find(can_id);
+            if (known == m_state_index.end()) {
+                m_state_index[can_id] = m_state.size();
+                m_state.emplace_back(message);
+                m_state_versions.push_back(batch);
+            } else {
+                // reuses the capacity of the previous message of the CAN id
+                m_state[known->second].assign(message);
+                m_state_versions[known->second] = batch;
+            }
+            changed = true;
+        });
+    }
+    m_datagrams += count;
+    if (!changed) {
+        return;
+    }
+
+    // the buffer to write holds the state of an earlier batch, only what changed since is copied
+    LiveSnapshot& snapshot = m_snapshots.Write();
+    snapshot.messages.resize(m_state.size());
+    snapshot.versions.resize(m_state.size(), 0);
+    for (size_t i = 0; i < m_state.size(); ++i) {
+        if (snapshot.versions[i] != m_state_versions[i]) {
+            snapshot.messages[i].assign(m_state[i]);
+            snapshot.versions[i] = m_state_versions[i];
+        }
+    }
+    snapshot.datagrams = m_datagrams;
+    snapshot.timestamp_us = m_timestamp_us;
+    m_snapshots.Publish();
+}
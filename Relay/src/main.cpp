@@ -1,8 +1,13 @@
 #include "influxdb_client.hpp"
 #include "websocket_server.hpp"
 #include "converter.hpp"
+#include "live_telemetry.hpp"
+#include <algorithm>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
 #include <time.h>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
@@ -12,9 +17,67 @@ using json = nlohmann::json;
 //      you have to think about managing transfer_id 
 // 		
 
-int main() {
+// ./bin/main live [udp_port]: the car's datagrams instead of the capture. The receive thread decodes
+// and publishes the newest message of every CAN id, the broadcast loop takes the newest snapshot when
+// it is ready for it and sends the messages that changed since its last broadcast, so a client that
+// connects later gets each CAN id with its next change (delta clients get a keyframe). Snapshots skip
+// values, InfluxDB needs every datagram (writeUdpToInfluxdb).
+int runLive(unsigned short udp_port) {
+    UdpReceiverConfig udp_config;
+    udp_config.port = udp_port;
+    LiveTelemetry live(udp_config, 2);
+    if (!live.start()) {
+        return 1;
+    }
+
+    WebSocketServer server;
+    Converter c;
+    server.setPackedEncoder([&c](const json& message, std::string& out) { return c.jsonToPacked(message, out); }, Converter::packedSchema());
+    server.startServer(8080);
+
+    uint64_t broadcast = 0;
+    uint64_t broadcast_version = 0;     // newest batch already sent, see LiveSnapshot::versions
+    std::vector<std::string> changed;
+    while (server.isRunning()) {
+        LiveTelemetry::Snapshot snapshot = live.latest();
+        if (!snapshot || snapshot.Sequence() == broadcast) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        broadcast = snapshot.Sequence();
+        changed.clear();
+        uint64_t newest = broadcast_version;
+        for (size_t i = 0; i < snapshot->messages.size(); ++i) {
+            if (snapshot->versions[i] > broadcast_version) {
+                changed.push_back(snapshot->messages[i]);
+                newest = std::max(newest, snapshot->versions[i]);
+            }
+        }
+        broadcast_version = newest;
+        if (changed.empty()) {
+            continue;
+        }
+        if (!server.broadcastMessages(changed, 1000000, 10)) {
+            server.stopServer();
+            break;
+        }
+    }
+
+    live.stop();
+    const UdpReceiverStats stats = live.receiverStats();
+    std::cout << stats.datagrams << " datagrams, " << stats.kernel_drops << " dropped by the kernel\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc >= 2 && std::string(argv[1]) == "live") {
+        return runLive(argc >= 3 ? static_cast<unsigned short>(std::stoul(argv[2])) : 5000);
+    }
 
 	Converter c;
+    // The document, not pcapFileToJsonText: jsonToUdp and broadcastJson below both work on it, and
+    // broadcastJson encodes the binary formats from it without parsing the text again
     json j = c.pcapFileToJson("2024-09-03-13-13-09.pcap");
     //std::cout << j.dump(4) << std::endl;
     sleep(2);
@@ -25,9 +88,12 @@ int main() {
     std::cout << i.dump(4) << std::endl;
 
 	//InfluxdbClient client("localhost", "8086", "30ffd1384cc64fb7", "MyInitialAdminToken0==");
-	//client.writeJsonToInfluxdb(j, 5000);
+	//client.startSpool("influx_spool", 4ULL * 1024 * 1024 * 1024);
+	//client.writeJsonToInfluxdb(j);
+	//client.flushToInfluxdb();
 
     WebSocketServer server;
+    server.setPackedEncoder([&c](const json& message, std::string& out) { return c.jsonToPacked(message, out); }, Converter::packedSchema());
     server.startServer(8080);
     server.startHotspot("hotspot_name", "hotspot_password");
 
@@ -46,6 +112,7 @@ int main() {
 // 		car sends data on port XXXX.
 // 		Relay recieves one message at a time and parses each message and stores it in a json objects. 
 // 		There are three of these json objects so that while the parser writes to the json object, an other thread can read from one of the other two.
+// 		(LiveTelemetry, with a SnapshotBuffer from triple_buffer.hpp: one per reader plus two)
 // 		One thread broadcasts the json object over websocket.
 // 		Another thread parses the json file and stores it in PSN local influxdb.
 
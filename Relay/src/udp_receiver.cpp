@@ -0,0 +1,381 @@
+#include "udp_receiver.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#endif
+
+namespace {
+
+// room for a timestamp and the drop counter, a multiple of the cmsghdr alignment
+constexpr size_t kControlBytes = 128;
+
+uint64_t wallClockNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Kernel receive time and drop counter from the control messages of one datagram
+void readControl(msghdr& header, uint64_t& timestamp_ns, uint64_t& kernel_drops) {
+    for (cmsghdr* control = CMSG_FIRSTHDR(&header); control != nullptr; control = CMSG_NXTHDR(&header, control)) {
+        if (control->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+#ifdef __linux__
+        if (control->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec time;
+            std::memcpy(&time, CMSG_DATA(control), sizeof(time));
+            timestamp_ns = static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_nsec);
+        } else if (control->cmsg_type == SO_RXQ_OVFL) {
+            // the count of the socket since it was opened, not since the last datagram
+            uint32_t drops = 0;
+            std::memcpy(&drops, CMSG_DATA(control), sizeof(drops));
+            kernel_drops = std::max<uint64_t>(kernel_drops, drops);
+        }
+#elif defined(SCM_TIMESTAMP)
+        if (control->cmsg_type == SCM_TIMESTAMP) {
+            timeval time;
+            std::memcpy(&time, CMSG_DATA(control), sizeof(time));
+            timestamp_ns = static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_usec) * 1000ULL;
+        }
+#endif
+    }
+}
+
+bool makeAddress(const std::string& address, unsigned short port, sockaddr_in& out) {
+    std::memset(&out, 0, sizeof(out));
+    out.sin_family = AF_INET;
+    out.sin_port = htons(port);
+    return inet_pton(AF_INET, address.c_str(), &out.sin_addr) == 1;
+}
+
+} // namespace
+
+UdpReceiver::UdpReceiver(const UdpReceiverConfig& config, BatchFn on_batch)
+    : m_config(config), m_on_batch(std::move(on_batch)), m_running(false),
+      m_datagram_count(0), m_byte_count(0), m_batch_count(0), m_full_batch_count(0),
+      m_kernel_drop_count(0), m_truncated_count(0), m_error_count(0)
+{
+    m_config.batch_size = std::max<size_t>(m_config.batch_size, 1);
+    m_config.max_datagram_bytes = std::max<size_t>(m_config.max_datagram_bytes, 1);
+    const size_t slots = m_config.batch_size;
+    m_buffers.resize(slots * m_config.max_datagram_bytes);
+    m_controls.resize(slots * kControlBytes);
+    m_datagrams.resize(slots);
+    m_iovecs.resize(slots);
+    m_messages.resize(slots);
+    for (size_t slot = 0; slot < slots; ++slot) {
+        m_iovecs[slot].iov_base = m_buffers.data() + slot * m_config.max_datagram_bytes;
+        m_iovecs[slot].iov_len = m_config.max_datagram_bytes;
+#ifdef __linux__
+        msghdr& header = m_messages[slot].msg_hdr;
+#else
+        msghdr& header = m_messages[slot];
+#endif
+        std::memset(&header, 0, sizeof(header));
+        header.msg_iov = &m_iovecs[slot];
+        header.msg_iovlen = 1;
+        header.msg_control = m_controls.data() + slot * kControlBytes;
+        m_datagrams[slot].data = m_buffers.data() + slot * m_config.max_datagram_bytes;
+    }
+}
+
+UdpReceiver::~UdpReceiver() {
+    stop();
+}
+
+bool UdpReceiver::start() {
+    if (m_running.load()) {
+        std::cerr << "UDP receiver is already running.\n";
+        return false;
+    }
+    if (!openSocket()) {
+        return false;
+    }
+    m_running = true;
+    m_thread = std::thread(&UdpReceiver::receiveLoop, this);
+    return true;
+}
+
+void UdpReceiver::stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_fd >= 0) {
+        readKernelDrops();
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool UdpReceiver::isRunning() const {
+    return m_running.load();
+}
+
+unsigned short UdpReceiver::port() const {
+    return m_port;
+}
+
+int UdpReceiver::receiveBufferBytes() const {
+    return m_receive_buffer_bytes;
+}
+
+UdpReceiverStats UdpReceiver::stats() const {
+    UdpReceiverStats stats;
+    stats.datagrams = m_datagram_count.load(std::memory_order_relaxed);
+    stats.bytes = m_byte_count.load(std::memory_order_relaxed);
+    stats.batches = m_batch_count.load(std::memory_order_relaxed);
+    stats.full_batches = m_full_batch_count.load(std::memory_order_relaxed);
+    stats.kernel_drops = m_kernel_drop_count.load(std::memory_order_relaxed);
+    stats.truncated = m_truncated_count.load(std::memory_order_relaxed);
+    stats.errors = m_error_count.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool UdpReceiver::openSocket() {
+    sockaddr_in address;
+    if (!makeAddress(m_config.bind_address, m_config.port, address)) {
+        std::cerr << "Invalid UDP bind address: " << m_config.bind_address << "\n";
+        return false;
+    }
+
+    m_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_fd < 0) {
+        std::cerr << "Failed to open UDP socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    const int flags = fcntl(m_fd, F_GETFL, 0);
+    fcntl(m_fd, F_SETFL, flags | O_NONBLOCK);
+
+    const int on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    int buffer_bytes = m_config.receive_buffer_bytes;
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &buffer_bytes, sizeof(buffer_bytes));
+#ifdef __linux__
+    // beyond net.core.rmem_max, only works with CAP_NET_ADMIN
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_bytes, sizeof(buffer_bytes));
+    if (setsockopt(m_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+        std::cerr << "SO_TIMESTAMPNS not available, using the read time: " << std::strerror(errno) << "\n";
+    }
+    setsockopt(m_fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#elif defined(SO_TIMESTAMP)
+    setsockopt(m_fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#endif
+    socklen_t length = sizeof(m_receive_buffer_bytes);
+    getsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &m_receive_buffer_bytes, &length);
+#ifdef __linux__
+    // Linux reports twice the size it was given, half of it is bookkeeping
+    m_receive_buffer_bytes /= 2;
+#endif
+    if (m_receive_buffer_bytes < m_config.receive_buffer_bytes) {
+        std::cerr << "UDP receive buffer is " << m_receive_buffer_bytes << " bytes instead of "
+                  << m_config.receive_buffer_bytes << ", raise net.core.rmem_max to avoid drops\n";
+    }
+
+    if (::bind(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Failed to bind UDP port " << m_config.port << ": " << std::strerror(errno) << "\n";
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    sockaddr_in bound;
+    socklen_t bound_length = sizeof(bound);
+    getsockname(m_fd, reinterpret_cast<sockaddr*>(&bound), &bound_length);
+    m_port = ntohs(bound.sin_port);
+    return true;
+}
+
+void UdpReceiver::receiveLoop() {
+    pollfd descriptor;
+    descriptor.fd = m_fd;
+    descriptor.events = POLLIN;
+    while (m_running.load()) {
+        descriptor.revents = 0;
+        const int ready = poll(&descriptor, 1, m_config.poll_timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            m_error_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (ready == 0) {
+            readKernelDrops();
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        // drain the socket before sleeping in poll again
+        while (m_running.load()) {
+            const size_t count = receiveBatch();
+            if (count == 0) {
+                break;
+            }
+            m_on_batch(m_datagrams.data(), count);
+            if (count < m_config.batch_size) {
+                break;
+            }
+        }
+    }
+}
+
+size_t UdpReceiver::receiveBatch() {
+    const size_t slots = m_config.batch_size;
+    const uint64_t read_time_ns = wallClockNs();
+    uint64_t kernel_drops = m_kernel_drop_count.load(std::memory_order_relaxed);
+    auto accept = [&](size_t slot, msghdr& header, size_t size) {
+        UdpDatagram& datagram = m_datagrams[slot];
+        datagram.size = size;
+        if (header.msg_flags & MSG_TRUNC) {
+            m_truncated_count.fetch_add(1, std::memory_order_relaxed);
+            datagram.size = std::min(size, m_config.max_datagram_bytes);
+        }
+        datagram.timestamp_ns = read_time_ns;
+        readControl(header, datagram.timestamp_ns, kernel_drops);
+        m_byte_count.fetch_add(datagram.size, std::memory_order_relaxed);
+    };
+
+    size_t count = 0;
+#ifdef __linux__
+    for (size_t slot = 0; slot < slots; ++slot) {
+        // the kernel shrinks these to what it wrote
+        m_messages[slot].msg_hdr.msg_controllen = kControlBytes;
+        m_messages[slot].msg_hdr.msg_flags = 0;
+    }
+    const int received = recvmmsg(m_fd, m_messages.data(), static_cast<unsigned int>(slots), MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            m_error_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+    count = static_cast<size_t>(received);
+    for (size_t slot = 0; slot < count; ++slot) {
+        accept(slot, m_messages[slot].msg_hdr, m_messages[slot].msg_len);
+    }
+#else
+    for (; count < slots; ++count) {
+        msghdr& header = m_messages[count];
+        header.msg_controllen = kControlBytes;
+        header.msg_flags = 0;
+        const ssize_t received = recvmsg(m_fd, &header, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                m_error_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+        }
+        accept(count, header, static_cast<size_t>(received));
+    }
+#endif
+
+    if (count > 0) {
+        m_datagram_count.fetch_add(count, std::memory_order_relaxed);
+        m_batch_count.fetch_add(1, std::memory_order_relaxed);
+        if (count == slots) {
+            m_full_batch_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_kernel_drop_count.store(kernel_drops, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+// The drop counter only comes with the datagrams that make it, so after a burst that ended in drops
+// it is read from the socket directly once the socket is idle
+void UdpReceiver::readKernelDrops() {
+#if defined(__linux__) && defined(SO_MEMINFO)
+    uint32_t meminfo[SK_MEMINFO_VARS] = {};
+    socklen_t length = sizeof(meminfo);
+    if (getsockopt(m_fd, SOL_SOCKET, SO_MEMINFO, meminfo, &length) == 0 && length > SK_MEMINFO_DROPS * sizeof(uint32_t)) {
+        const uint64_t drops = meminfo[SK_MEMINFO_DROPS];
+        if (drops > m_kernel_drop_count.load(std::memory_order_relaxed)) {
+            m_kernel_drop_count.store(drops, std::memory_order_relaxed);
+        }
+    }
+#endif
+}
+
+UdpSender::UdpSender() {}
+
+UdpSender::~UdpSender() {
+    close();
+}
+
+bool UdpSender::open(const std::string& address, unsigned short port) {
+    close();
+    sockaddr_in destination;
+    if (!makeAddress(address, port, destination)) {
+        std::cerr << "Invalid UDP address: " << address << "\n";
+        return false;
+    }
+    m_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_fd < 0) {
+        std::cerr << "Failed to open UDP socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    // connected, so every datagram goes to the same place without an address of its own
+    if (::connect(m_fd, reinterpret_cast<const sockaddr*>(&destination), sizeof(destination)) != 0) {
+        std::cerr << "Failed to connect UDP socket: " << std::strerror(errno) << "\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool UdpSender::send(const std::vector<std::vector<uint8_t>>& datagrams, size_t batch_size) {
+    if (m_fd < 0) {
+        return false;
+    }
+#ifdef __linux__
+    batch_size = std::max<size_t>(batch_size, 1);
+    std::vector<iovec> iovecs(batch_size);
+    std::vector<mmsghdr> messages(batch_size);
+    size_t next = 0;
+    while (next < datagrams.size()) {
+        const size_t count = std::min(batch_size, datagrams.size() - next);
+        for (size_t i = 0; i < count; ++i) {
+            iovecs[i].iov_base = const_cast<uint8_t*>(datagrams[next + i].data());
+            iovecs[i].iov_len = datagrams[next + i].size();
+            std::memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int sent = sendmmsg(m_fd, messages.data(), static_cast<unsigned int>(count), 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to send UDP datagrams: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        next += static_cast<size_t>(sent);
+    }
+#else
+    (void)batch_size;
+    for (const std::vector<uint8_t>& datagram : datagrams) {
+        if (::send(m_fd, datagram.data(), datagram.size(), 0) < 0) {
+            std::cerr << "Failed to send UDP datagram: " << std::strerror(errno) << "\n";
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void UdpSender::close() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
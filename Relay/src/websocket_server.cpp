@@ -82,15 +82,7 @@ void WebSocketServer::startServer(unsigned short port) {
             while (m_running.load()) {
                 auto socket = std::make_shared<tcp::socket>(m_io_context);
                 m_acceptor->accept(*socket);
-                auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(*socket));
-                ws->accept();
-
-                {
-                    std::lock_guard<std::mutex> lock(m_clients_mutex);
-                    m_clients.push_back(ws);
-                }
-
-                std::thread(&WebSocketServer::handleClient, this, ws).detach();
+                acceptClient(socket);
             }
         } catch (const std::exception& e) {
             if (m_running.load()) {
@@ -123,9 +115,9 @@ void WebSocketServer::stopServer() {
     // Close all client connections
     {
         std::lock_guard<std::mutex> lock(m_clients_mutex);
-        for (auto& ws : m_clients) {
+        for (auto& client : m_clients) {
             try {
-                ws->close(websocket::close_code::normal);
+                client.ws->close(websocket::close_code::normal);
             } catch (const std::exception& e) {
                 std::cerr << "Error closing client connection: " << e.what() << "\n";
             }
@@ -175,6 +167,140 @@ void WebSocketServer::stopHotspot() {
     }
 }
 
+void WebSocketServer::acceptClient(std::shared_ptr<tcp::socket> socket) {
+    namespace http = boost::beast::http;
+    try {
+        // the upgrade request is read first to see which format the client asks for
+        boost::beast::flat_buffer buffer;
+        http::request<http::string_body> request;
+        http::read(*socket, buffer, request);
+        if (!websocket::is_upgrade(request)) {
+            std::cerr << "Connection without websocket upgrade rejected.\n";
+            return;
+        }
+
+        // a subprotocol is only answered if the client offered it
+        bool echo_subprotocol = false;
+        const WireFormat format = negotiateFormat(request, echo_subprotocol);
+        auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(*socket));
+        ws->set_option(websocket::stream_base::decorator([format, echo_subprotocol](websocket::response_type& response) {
+            if (echo_subprotocol) {
+                response.set(http::field::sec_websocket_protocol, wire::subprotocol(format));
+            }
+        }));
+        ws->accept(request);
+
+        if (format == WireFormat::Packed || format == WireFormat::Delta) {
+            std::string schema;
+            {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                schema = (format == WireFormat::Packed) ? m_packed_schema : m_delta_schema;
+            }
+            ws->text(true);
+            ws->write(asio::buffer(schema));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            m_clients.push_back({ws, format, format == WireFormat::Delta});
+        }
+        std::cout << "Client connected with " << wire::subprotocol(format) << ".\n";
+
+        std::thread(&WebSocketServer::handleClient, this, ws).detach();
+    } catch (const std::exception& e) {
+        std::cerr << "Websocket handshake failed: " << e.what() << "\n";
+    }
+}
+
+// The first offered subprotocol that is available (echo_subprotocol is set then), else "?format=" in
+// the target, else JSON
+WireFormat WebSocketServer::negotiateFormat(const boost::beast::http::request<boost::beast::http::string_body>& request, bool& echo_subprotocol) {
+    namespace http = boost::beast::http;
+    bool packed_available = false;
+    {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        packed_available = static_cast<bool>(m_packed_encode);
+    }
+    auto available = [&](const std::string& name, WireFormat& format) {
+        return wire::parseFormat(name, format) && ((format != WireFormat::Packed && format != WireFormat::Delta) || packed_available);
+    };
+
+    WireFormat format = WireFormat::Json;
+    echo_subprotocol = false;
+    const auto offered = request.find(http::field::sec_websocket_protocol);
+    if (offered != request.end()) {
+        std::istringstream protocols(std::string(offered->value()));
+        std::string protocol;
+        while (std::getline(protocols, protocol, ',')) {
+            protocol.erase(0, protocol.find_first_not_of(" \t"));
+            protocol.erase(protocol.find_last_not_of(" \t") + 1);
+            if (available(protocol, format)) {
+                echo_subprotocol = true;
+                return format;
+            }
+        }
+    }
+
+    const std::string target(request.target());
+    const size_t query = target.find('?');
+    if (query != std::string::npos) {
+        const size_t key = target.find("format=", query);
+        if (key != std::string::npos) {
+            const size_t value_start = key + 7;
+            const std::string value = target.substr(value_start, target.find('&', value_start) - value_start);
+            if (available(value, format)) {
+                return format;
+            }
+        }
+    }
+    return WireFormat::Json;
+}
+
+void WebSocketServer::setPackedEncoder(PackedEncodeFn encode, const json& schema, const DeltaStreamConfig& delta_config) {
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    m_packed_encode = std::move(encode);
+    m_packed_schema = schema.dump();
+    m_delta = std::make_unique<DeltaStreamEncoder>(schema, delta_config);
+    m_delta_schema = m_delta->Schema().dump();
+}
+
+// Formats of the connected clients, JSON if there are none so a broadcast still paces the same way.
+// Delta frames are built from the packed records, so delta clients need those too.
+std::array<bool, kWireFormatCount> WebSocketServer::formatsInUse() {
+    std::array<bool, kWireFormatCount> used = {};
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    for (const Client& client : m_clients) {
+        used[static_cast<size_t>(client.format)] = true;
+    }
+    if (m_clients.empty()) {
+        used[static_cast<size_t>(WireFormat::Json)] = true;
+    }
+    if (used[static_cast<size_t>(WireFormat::Delta)]) {
+        used[static_cast<size_t>(WireFormat::Packed)] = true;
+    }
+    return used;
+}
+
+bool WebSocketServer::encodeMessage(const json& message, WireFormat format, std::string& out) {
+    out.clear();
+    switch (format) {
+        case WireFormat::Json:
+            out = message.dump();
+            return true;
+        case WireFormat::Cbor:
+            json::to_cbor(message, out);
+            return true;
+        case WireFormat::MsgPack:
+            json::to_msgpack(message, out);
+            return true;
+        case WireFormat::Packed:
+            return m_packed_encode && m_packed_encode(message, out);
+        case WireFormat::Delta:
+            return false;   // per send, see broadcastEncoded
+    }
+    return false;
+}
+
 bool WebSocketServer::broadcastJson(const json& j, const size_t bytes_per_second, const size_t time_ms_between_sends) {
     if (!m_running.load()) return false;
 
@@ -184,13 +310,77 @@ bool WebSocketServer::broadcastJson(const json& j, const size_t bytes_per_second
         return false;
     }
 
+    // every message is encoded once per format, not once per client
+    EncodedMessages encoded;
+    encoded.used = formatsInUse();
     const auto& messages = j["messages"];
+    for (size_t f = 0; f < kWireFormatCount; ++f) {
+        if (!encoded.used[f] || static_cast<WireFormat>(f) == WireFormat::Delta) {
+            continue;
+        }
+        std::vector<std::string>& out = encoded.messages[f];
+        out.resize(messages.size());
+        for (size_t i = 0; i < messages.size(); ++i) {
+            if (!encodeMessage(messages[i], static_cast<WireFormat>(f), out[i])) {
+                out[i].clear();     // sent as nothing to the clients of this format
+            }
+        }
+    }
+    return broadcastEncoded(encoded, bytes_per_second, time_ms_between_sends);
+}
+
+bool WebSocketServer::broadcastMessages(const std::vector<std::string>& messages, const size_t bytes_per_second, const size_t time_ms_between_sends) {
+    if (!m_running.load()) return false;
+
+    EncodedMessages encoded;
+    encoded.used = formatsInUse();
+    encoded.used[static_cast<size_t>(WireFormat::Json)] = true;
+    encoded.messages[static_cast<size_t>(WireFormat::Json)] = messages;
+    bool binary_in_use = false;
+    for (size_t f = 0; f < kWireFormatCount; ++f) {
+        if (encoded.used[f] && wire::isBinary(static_cast<WireFormat>(f)) && static_cast<WireFormat>(f) != WireFormat::Delta) {
+            binary_in_use = true;
+            encoded.messages[f].resize(messages.size());
+        }
+    }
+    if (binary_in_use) {
+        for (size_t i = 0; i < messages.size(); ++i) {
+            const json message = json::parse(messages[i], nullptr, false);
+            for (size_t f = 0; f < kWireFormatCount; ++f) {
+                if (!encoded.used[f] || !wire::isBinary(static_cast<WireFormat>(f)) || static_cast<WireFormat>(f) == WireFormat::Delta) {
+                    continue;
+                }
+                if (message.is_discarded() || !encodeMessage(message, static_cast<WireFormat>(f), encoded.messages[f][i])) {
+                    encoded.messages[f][i].clear();
+                }
+            }
+        }
+    }
+    return broadcastEncoded(encoded, bytes_per_second, time_ms_between_sends);
+}
+
+// Sends the messages paced to bytes_per_second, counted in the largest encoding in use. Every send
+// is one websocket message per format with the messages of that format back to back. Clients that
+// connect during the broadcast with a format that is not encoded get the next broadcast.
+// The delta frame of a send is built from its packed records, once for all delta clients. A delta
+// client that just connected gets a keyframe of the state before the send first.
+bool WebSocketServer::broadcastEncoded(const EncodedMessages& encoded, const size_t bytes_per_second, const size_t time_ms_between_sends) {
+    if (!m_running.load()) return false;
+
+    size_t message_count = 0;
+    for (size_t f = 0; f < kWireFormatCount; ++f) {
+        if (encoded.used[f]) {
+            message_count = std::max(message_count, encoded.messages[f].size());
+        }
+    }
+
     size_t total_bytes_sent = 0;
     auto start_time = std::chrono::steady_clock::now();
     size_t prev_time_sent_ms = 0;
     size_t hit_data_size_zero_count = 0;
+    std::array<std::string, kWireFormatCount> data;
 
-    for (unsigned int i = 0; i < messages.size(); /*empty*/) {
+    for (size_t i = 0; i < message_count; /*empty*/) {
 
         // if the server is signaled to close this is necessary to escape this function
         if (!m_running.load()) {
@@ -220,16 +410,24 @@ bool WebSocketServer::broadcastJson(const json& j, const size_t bytes_per_second
             now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
         }
 
-        std::string data = "";
-        while (total_bytes_sent + data.size() < now_ms * bytes_per_second / 1000) {
-            if (i == messages.size()) {
+        for (std::string& payload : data) {
+            payload.clear();
+        }
+        size_t data_size = 0;
+        while (total_bytes_sent + data_size < now_ms * bytes_per_second / 1000) {
+            if (i == message_count) {
                 break; // no more messages
             }
-            data += messages[i].dump();
+            for (size_t f = 0; f < kWireFormatCount; ++f) {
+                if (encoded.used[f] && i < encoded.messages[f].size()) {
+                    data[f] += encoded.messages[f][i];
+                    data_size = std::max(data_size, data[f].size());
+                }
+            }
             ++i;
         }
 
-        if (data.size() == 0) {
+        if (data_size == 0) {
             ++hit_data_size_zero_count;
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
             continue;
@@ -237,13 +435,45 @@ bool WebSocketServer::broadcastJson(const json& j, const size_t bytes_per_second
             hit_data_size_zero_count = 0;
         }
 
-        std::cout << data << std::endl << std::endl;;
+        // the state before this send for delta clients that joined since the last one
+        std::string delta_keyframe;
+        if (encoded.used[static_cast<size_t>(WireFormat::Delta)] && m_delta) {
+            bool joined = false;
+            {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                for (const Client& client : m_clients) {
+                    joined = joined || client.needs_keyframe;
+                }
+            }
+            if (joined) {
+                delta_keyframe = m_delta->Keyframe();
+            }
+            m_delta->AddRecords(data[static_cast<size_t>(WireFormat::Packed)]);
+            data[static_cast<size_t>(WireFormat::Delta)] = m_delta->TakeFrame();
+        }
+
+        if (!data[static_cast<size_t>(WireFormat::Json)].empty()) {
+            std::cout << data[static_cast<size_t>(WireFormat::Json)] << std::endl << std::endl;;
+        }
 
         {
             std::lock_guard<std::mutex> lock(m_clients_mutex);
             for (auto it = m_clients.begin(); it != m_clients.end();) {
+                const std::string& payload = data[static_cast<size_t>(it->format)];
+                // a delta client that connected after the keyframe was taken waits for the next send
+                if (!encoded.used[static_cast<size_t>(it->format)] || (it->needs_keyframe && delta_keyframe.empty())) {
+                    ++it;
+                    continue;
+                }
                 try {
-                    (*it)->write(asio::buffer(data));
+                    it->ws->binary(wire::isBinary(it->format));
+                    if (it->needs_keyframe) {
+                        it->ws->write(asio::buffer(delta_keyframe));
+                        it->needs_keyframe = false;
+                    }
+                    if (!payload.empty()) {
+                        it->ws->write(asio::buffer(payload));
+                    }
                     ++it;
                 } catch (const std::exception& e) {
                     std::cerr << "Client disconnected during broadcast: " << e.what() << "\n";
@@ -254,7 +484,7 @@ bool WebSocketServer::broadcastJson(const json& j, const size_t bytes_per_second
                 }
             }
         }
-        total_bytes_sent += data.size();
+        total_bytes_sent += data_size;
 
         prev_time_sent_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
     }
@@ -298,7 +528,7 @@ void WebSocketServer::handleClient(std::shared_ptr<websocket::stream<tcp::socket
     } catch (const std::exception& e) {
         std::cerr << "Client connection error: " << e.what() << "\n";
         std::lock_guard<std::mutex> lock(m_clients_mutex);
-        m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), ws), m_clients.end());
+        m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [&](const Client& client) { return client.ws == ws; }), m_clients.end());
     }
 }
 
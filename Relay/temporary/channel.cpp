@@ -4,6 +4,7 @@
 #include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <stdexcept>
 
@@ -37,8 +38,7 @@ Channel::Channel(const Channel& other) {
     std::lock_guard<std::mutex> lock(other.m_mutex);
     m_time = other.m_time;
     m_value = other.m_value;
-    m_exists_in_local_influxdb = other.m_exists_in_local_influxdb;
-    m_exists_in_global_influxdb = other.m_exists_in_global_influxdb;
+    m_upload_watermarks = other.m_upload_watermarks;
     m_is_sorted = other.m_is_sorted;
     m_updated = other.m_updated;
     m_log_id = other.m_log_id;
@@ -224,6 +224,68 @@ std::vector<ChannelValue_t> Channel::getValues() const {
     return m_value;
 }
 
+size_t Channel::getUploadStartIndex(const std::string& destination) {
+    sortData();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_upload_watermarks.find(destination);
+    if (it == m_upload_watermarks.end()) {
+        return 0;
+    }
+    return uploadResumeIndex(m_time, it->second, [this](size_t i) {
+        return std::visit([](auto&& arg) -> double { return static_cast<double>(arg); }, m_value[i]);
+    });
+}
+
+void Channel::setUploaded(const std::string& destination, size_t points) {
+    sortData();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_upload_watermarks[destination] = makeUploadWatermark(m_time, points, [this](size_t i) {
+        return std::visit([](auto&& arg) -> double { return static_cast<double>(arg); }, m_value[i]);
+    });
+}
+
+std::optional<UploadWatermark> Channel::getUploadWatermark(const std::string& destination) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_upload_watermarks.find(destination);
+    if (it == m_upload_watermarks.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void Channel::setUploadWatermark(const std::string& destination, const UploadWatermark& watermark) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_upload_watermarks[destination] = watermark;
+}
+
+std::string Channel::getUploadKey() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // the tags in a fixed order, the map's own order differs between runs
+    std::map<std::string, std::string> tags(m_tags.begin(), m_tags.end());
+    std::string key = m_log_id;
+    for (const auto& [name, value] : tags) {
+        key += " " + name + "=" + value;
+    }
+    return key;
+}
+
+void Channel::loadUploadWatermarks(const UploadWatermarkStore& store) {
+    const std::string key = getUploadKey();
+    for (const std::string& destination : store.Destinations()) {
+        if (auto watermark = store.Get(destination, key)) {
+            setUploadWatermark(destination, *watermark);
+        }
+    }
+}
+
+void Channel::storeUploadWatermarks(UploadWatermarkStore& store) const {
+    const std::string key = getUploadKey();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& [destination, watermark] : m_upload_watermarks) {
+        store.Set(destination, key, watermark);
+    }
+}
+
 bool Channel::isDataSorted() const {
     std::lock_guard<std::mutex> loc(m_mutex);
     return m_is_sorted;
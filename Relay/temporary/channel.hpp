@@ -6,6 +6,9 @@
 #include <unordered_map>
 #include <variant>
 #include <cstdint>
+#include <optional>
+
+#include "upload_watermarks.hpp"
 
 using ChannelValue_t = std::variant<double, float, uint32_t, uint16_t, uint8_t, bool>;
 
@@ -13,8 +16,7 @@ class Channel {
 private:
     std::vector<double> m_time;
     std::vector<ChannelValue_t> m_value;
-    std::vector<bool> m_exists_in_local_influxdb;
-    std::vector<bool> m_exists_in_global_influxdb;
+    std::unordered_map<std::string, UploadWatermark> m_upload_watermarks; // per destination, e.g. "local" and "global" InfluxDB
     mutable std::mutex m_mutex;
     bool m_is_sorted;
     bool m_updated;
@@ -65,5 +67,16 @@ public:
 
     bool                                            isDataSorted() const;
 
+    // Incremental uploads: the first point not yet uploaded to destination (0 if the uploaded range
+    // has changed since), and marking the first `points` points as uploaded. Sorts the data first.
+    size_t                                          getUploadStartIndex(const std::string& destination);
+    void                                            setUploaded(const std::string& destination, size_t points);
+    std::optional<UploadWatermark>                  getUploadWatermark(const std::string& destination) const;
+    void                                            setUploadWatermark(const std::string& destination, const UploadWatermark& watermark);
+    // Kept between sessions through an UploadWatermarkStore, under getUploadKey()
+    std::string                                     getUploadKey() const;
+    void                                            loadUploadWatermarks(const UploadWatermarkStore& store);
+    void                                            storeUploadWatermarks(UploadWatermarkStore& store) const;
+
     void                                            sortData();
 };
@@ -128,6 +128,22 @@ Channel* ChannelsManager::getChannelReference(const std::unordered_map<std::stri
     return nullptr;
 }
 
+// Takes the watermarks of every channel from the store, e.g. after reading a session
+void ChannelsManager::loadUploadWatermarks(const UploadWatermarkStore& store) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& channel_ptr : channels) {
+        channel_ptr->loadUploadWatermarks(store);
+    }
+}
+
+// Puts the watermarks of every channel into the store
+void ChannelsManager::storeUploadWatermarks(UploadWatermarkStore& store) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& channel_ptr : channels) {
+        channel_ptr->storeUploadWatermarks(store);
+    }
+}
+
 // Sorts data in all channels
 void ChannelsManager::sortData() {
     std::lock_guard<std::mutex> lock(m_mutex);
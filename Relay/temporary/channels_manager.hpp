@@ -41,6 +41,11 @@ public:
     // Returns a pointer to the channel or nullptr if not found
     Channel* getChannelReference(const std::unordered_map<std::string, std::string>& tags);
 
+    // The upload watermarks of every channel from and to a session's store, save the store after
+    // storeUploadWatermarks()
+    void loadUploadWatermarks(const UploadWatermarkStore& store);
+    void storeUploadWatermarks(UploadWatermarkStore& store) const;
+
 private:
     void sortData();
     Channel* createChannel(const std::string& log_id, const std::unordered_map<std::string, std::string>& tags);